@@ -0,0 +1,147 @@
+// Measures block validation cost with and without assumevalid on a synthetic
+// regtest-style chain of fully signed spends.
+//
+//   bench_assumevalid [blocks=50] [spends_per_block=200]
+#include "../layer1-core/crypto/schnorr.h"
+#include "../layer1-core/merkle/merkle.h"
+#include "../layer1-core/pow/difficulty.h"
+#include "../layer1-core/validation/validation.h"
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// BIP-340 test vector 1 key pair.
+const std::array<uint8_t, 32> kSeckey = {
+    0xB7,0xE1,0x51,0x62,0x8A,0xED,0x2A,0x6A,0xBF,0x71,0x58,0x80,0x9C,0xF4,0xF3,0xC7,
+    0x62,0xE7,0x16,0x0F,0x38,0xB4,0xDA,0x56,0xA7,0x84,0xD9,0x04,0x51,0x90,0xCF,0xEF};
+const std::array<uint8_t, 32> kPubkey = {
+    0xDF,0xF1,0xD7,0x7F,0x2A,0x67,0x1C,0x5F,0x36,0x18,0x37,0x26,0xDB,0x23,0x41,0xBE,
+    0x58,0xFE,0xAE,0x1D,0xA2,0xDE,0xCE,0xD8,0x43,0x24,0x0F,0x7B,0x50,0x2B,0xA6,0x59};
+
+struct OutPointHasher {
+    std::size_t operator()(const OutPoint& o) const noexcept
+    {
+        size_t h = 0;
+        for (auto b : o.hash) h = (h * 131) ^ b;
+        return h ^ o.index;
+    }
+};
+
+struct OutPointEq {
+    bool operator()(const OutPoint& a, const OutPoint& b) const noexcept
+    {
+        return a.index == b.index && a.hash == b.hash;
+    }
+};
+
+Transaction MakeCoinbase(uint64_t value, uint32_t height)
+{
+    Transaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash.fill(0);
+    tx.vin[0].prevout.index = std::numeric_limits<uint32_t>::max();
+    tx.vin[0].scriptSig = {static_cast<uint8_t>(height), static_cast<uint8_t>(height >> 8)};
+    tx.vin[0].assetId = static_cast<uint8_t>(AssetId::TALANTON);
+    TxOut out{};
+    out.value = value;
+    out.assetId = static_cast<uint8_t>(AssetId::TALANTON);
+    out.scriptPubKey.assign(kPubkey.begin(), kPubkey.end());
+    tx.vout.push_back(out);
+    return tx;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    const int blocks = argc > 1 ? std::atoi(argv[1]) : 50;
+    const int spends = argc > 2 ? std::atoi(argv[2]) : 200;
+
+    consensus::Params params = consensus::Testnet();
+    params.nGenesisBits = 0x207fffff;
+    params.fPowAllowMinDifficultyBlocks = true;
+    const uint8_t drm = static_cast<uint8_t>(AssetId::DRACHMA);
+
+    std::unordered_map<OutPoint, TxOut, OutPointHasher, OutPointEq> utxos;
+    std::vector<Block> chain;
+    chain.reserve(blocks);
+
+    std::cout << "building " << blocks << " blocks x " << spends << " signed spends...\n";
+    for (int b = 0; b < blocks; ++b) {
+        const uint32_t height = static_cast<uint32_t>(b + 1);
+        Block block{};
+        block.header.version = 1;
+        block.header.bits = params.nGenesisBits;
+        block.header.time = params.nGenesisTime + height * params.nPowTargetSpacing;
+        block.transactions.push_back(MakeCoinbase(consensus::GetBlockSubsidy(height, params, static_cast<uint8_t>(AssetId::TALANTON)), height));
+        for (int s = 0; s < spends; ++s) {
+            OutPoint prev{};
+            prev.hash.fill(0);
+            prev.hash[0] = static_cast<uint8_t>(b);
+            prev.hash[1] = static_cast<uint8_t>(b >> 8);
+            prev.hash[2] = static_cast<uint8_t>(s);
+            prev.hash[3] = static_cast<uint8_t>(s >> 8);
+            TxOut coin{};
+            coin.value = 100000;
+            coin.assetId = drm;
+            coin.scriptPubKey.assign(kPubkey.begin(), kPubkey.end());
+            utxos[prev] = coin;
+
+            Transaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = prev;
+            tx.vin[0].assetId = drm;
+            TxOut out = coin;
+            out.value = coin.value - 1000;
+            tx.vout.push_back(out);
+            auto digest = ComputeInputDigest(tx, 0);
+            std::array<uint8_t, 64> sig{};
+            if (!schnorr_sign_with_aux(kSeckey.data(), digest.data(), nullptr, sig.data())) {
+                std::cerr << "signing failed\n";
+                return 1;
+            }
+            tx.vin[0].scriptSig.assign(sig.begin(), sig.end());
+            block.transactions.push_back(std::move(tx));
+        }
+        block.header.merkleRoot = ComputeMerkleRoot(block.transactions);
+        while (!powalgo::CheckProofOfWork(BlockHash(block.header), block.header.bits, params))
+            ++block.header.nonce;
+        chain.push_back(std::move(block));
+    }
+
+    auto lookup = [&utxos](const OutPoint& op) -> std::optional<TxOut> {
+        auto it = utxos.find(op);
+        if (it == utxos.end()) return std::nullopt;
+        return it->second;
+    };
+
+    auto run = [&](bool skipScripts) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < chain.size(); ++i) {
+            BlockValidationOptions opts;
+            opts.medianTimePast = chain[i].header.time - 1;
+            opts.now = chain[i].header.time;
+            opts.skipScriptChecks = skipScripts;
+            if (!ValidateBlock(chain[i], params, static_cast<int>(i + 1), lookup, opts)) {
+                std::cerr << "block " << i + 1 << " failed validation\n";
+                std::exit(1);
+            }
+        }
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    const double full = run(false);
+    const double assumed = run(true);
+    const double inputs = static_cast<double>(blocks) * spends;
+    std::cout << std::fixed << std::setprecision(1)
+              << "full validation:   " << full << " ms (" << (full * 1000.0 / inputs) << " us/input)\n"
+              << "assumevalid:       " << assumed << " ms (" << (assumed * 1000.0 / inputs) << " us/input)\n"
+              << "speedup:           " << (assumed > 0 ? full / assumed : 0.0) << "x\n";
+    return 0;
+}
@@ -0,0 +1,649 @@
+// Discrete-event simulation of block and transaction relay over a few
+// hundred nodes. It is a model, not the node: it re-implements simplified
+// versions of the relay rules of net::P2PNetwork and net::CompactBlockRelay
+// (trickled inv / getdata / tx for transactions, and blocks sent as full
+// blocks, as compact blocks on request, or pushed to high bandwidth peers
+// before validation) and only borrows their constants, without running
+// their code. Its numbers compare relay strategies; they say nothing about
+// bugs in the real components, which have their own tests. Blocks are
+// mined every minute on average by a random node on top of its own tip,
+// so slow propagation shows up as stale blocks.
+//
+// Links have a one-way latency drawn from [0.5, 1.5] times the configured
+// one, every node has one uplink shared by its peers, and a lost segment
+// costs a retransmission timeout. Delivery on a link stays in order, as on
+// TCP. Runs are deterministic: the topology, the workload and the relay
+// randomness each have their own fixed seed, so the relay variants see the
+// same network, transactions and mining schedule.
+//
+//   bench_netsim [nodes=200] [minutes=30] [tx_per_second=5] [latency_ms=100]
+//                [upload_KiB/s=1024] [loss_percent=0.5]
+#include "../layer2-services/net/compact_block.h"
+#include "../layer2-services/net/compact_relay.h"
+#include "../layer2-services/net/p2p.h"
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr size_t k_header_bytes = 24;
+constexpr size_t k_inv_bytes = 33;
+constexpr size_t k_block_header_bytes = 80;
+constexpr size_t k_tx_bytes = 300;
+constexpr size_t k_coinbase_bytes = 120;
+constexpr size_t k_segment_bytes = 1460;
+constexpr double k_min_rto = 0.2;           // s
+constexpr double k_block_interval = 60.0;   // s
+constexpr double k_block_validation = 0.05; // s
+constexpr double k_drain = 120.0;           // s, after the last transaction
+constexpr int k_outbound = 8;
+constexpr int k_max_peers = 64;
+// Node defaults.
+constexpr double k_inbound_trickle = 5.0;
+constexpr double k_outbound_trickle = 2.0;
+
+enum class BlockRelay { Full, Compact, HighBandwidth };
+
+struct Config {
+    int nodes{200};
+    double seconds{1800};
+    double txRate{5};
+    double latency{0.1};      // s, one way
+    double upload{1 << 20};   // bytes per second
+    double loss{0.005};       // per segment
+    BlockRelay relay{BlockRelay::HighBandwidth};
+};
+
+enum class Kind : uint8_t { NewTx, Mine, InboundTrickle, OutboundTrickle, Validated, Deliver };
+
+enum class Msg : uint8_t { Inv, GetData, Tx, BlockInv, GetBlock, GetCompact, CmpctBlock, GetBlockTxn, BlockTxn, Block, SendCmpct };
+
+struct Event {
+    double time{0};
+    uint64_t seq{0};
+    Kind kind{Kind::Deliver};
+    Msg msg{Msg::Inv};
+    int node{0};
+    size_t edge{0}; // at `node`; for deliveries the edge back to the sender
+    int item{0};    // transaction or block
+    std::vector<int> txs;
+
+    bool operator>(const Event& o) const { return time != o.time ? time > o.time : seq > o.seq; }
+};
+
+struct Edge {
+    int to{0};
+    size_t back{0}; // index of the reverse edge in the peer's list
+    bool outbound{false};
+    double latency{0};
+    double delivered{0}; // last arrival on the link
+    bool pushBlocks{false}; // the peer picked us as a high bandwidth peer
+    std::vector<char> knownTx;
+    std::vector<char> knownBlock;
+    std::vector<int> queue; // transactions to announce
+};
+
+struct Node {
+    std::vector<Edge> edges;
+    std::vector<double> tx;    // arrival time, < 0 if not yet
+    std::vector<char> txRequested;
+    std::vector<double> block; // connected at, < 0 if not yet
+    std::vector<char> blockRequested;
+    std::vector<char> building; // received, being reconstructed or validated
+    std::vector<int> orphans;   // blocks waiting for their parent
+    std::deque<size_t> highBandwidth; // oldest first
+    int tip{0};
+    double uplinkFree{0};
+    uint64_t sent{0};
+};
+
+struct Block {
+    int parent{-1};
+    int height{0};
+    double mined{0};
+    std::vector<int> txs;
+};
+
+// Seconds until a share of the nodes has an item, one entry per item.
+struct Reach {
+    std::vector<double> half;
+    std::vector<double> most; // 90%
+    std::vector<double> all;
+};
+
+struct Result {
+    Reach blocks;
+    Reach txs;
+    std::vector<double> upload; // KiB/s per node
+    size_t mined{0};
+    size_t stale{0};
+    uint64_t roundTrips{0}; // getblocktxn
+    uint64_t redundant{0};  // compact or full blocks that arrived once more
+};
+
+class Simulation {
+public:
+    explicit Simulation(const Config& cfg)
+        : m_cfg(cfg), m_topologyRng(42), m_workloadRng(43), m_relayRng(44), m_nodeState(cfg.nodes)
+    {
+        std::uniform_real_distribution<double> spread(0.5, 1.5);
+        for (int n = 0; n < cfg.nodes; ++n) {
+            int opened = 0;
+            for (int attempts = 0; opened < k_outbound && attempts < 100 * k_outbound; ++attempts) {
+                const int to = static_cast<int>(m_topologyRng() % cfg.nodes);
+                if (to == n || Connected(n, to) || m_nodeState[to].edges.size() >= k_max_peers) continue;
+                Link(n, to, cfg.latency * spread(m_topologyRng));
+                ++opened;
+            }
+        }
+
+        m_blocks.push_back(Block{}); // genesis
+        for (int n = 0; n < cfg.nodes; ++n) {
+            auto& node = m_nodeState[n];
+            node.block.assign(1, 0.0);
+            node.blockRequested.assign(1, 1);
+            node.building.assign(1, 1);
+            for (auto& e : node.edges) e.knownBlock.assign(1, 1);
+            Push(Delay(m_relayRng, k_inbound_trickle), Kind::InboundTrickle, n);
+            for (size_t e = 0; e < node.edges.size(); ++e)
+                if (node.edges[e].outbound) Push(Delay(m_relayRng, k_outbound_trickle), Kind::OutboundTrickle, n, e);
+        }
+        if (cfg.txRate > 0) Push(Delay(m_workloadRng, 1.0 / cfg.txRate), Kind::NewTx, 0);
+        Push(Delay(m_workloadRng, k_block_interval), Kind::Mine, 0);
+    }
+
+    Result Run()
+    {
+        while (!m_events.empty()) {
+            std::pop_heap(m_events.begin(), m_events.end(), std::greater<Event>());
+            Event ev = std::move(m_events.back());
+            m_events.pop_back();
+            if (ev.time > m_cfg.seconds + k_drain) break;
+            m_now = ev.time;
+            switch (ev.kind) {
+            case Kind::NewTx:
+                NewTx();
+                break;
+            case Kind::Mine:
+                Mine();
+                break;
+            case Kind::InboundTrickle: {
+                auto& node = m_nodeState[ev.node];
+                for (size_t e = 0; e < node.edges.size(); ++e)
+                    if (!node.edges[e].outbound) Flush(ev.node, e);
+                Push(m_now + Delay(m_relayRng, k_inbound_trickle), Kind::InboundTrickle, ev.node);
+                break;
+            }
+            case Kind::OutboundTrickle:
+                Flush(ev.node, ev.edge);
+                Push(m_now + Delay(m_relayRng, k_outbound_trickle), Kind::OutboundTrickle, ev.node, ev.edge);
+                break;
+            case Kind::Validated:
+                Connect(ev.node, ev.item, ev.edge);
+                break;
+            case Kind::Deliver:
+                Deliver(ev);
+                break;
+            }
+        }
+        Summarize();
+        return m_result;
+    }
+
+private:
+    static constexpr size_t k_no_edge = static_cast<size_t>(-1);
+
+    bool Connected(int a, int b) const
+    {
+        for (const auto& e : m_nodeState[a].edges)
+            if (e.to == b) return true;
+        return false;
+    }
+
+    void Link(int from, int to, double latency)
+    {
+        auto& a = m_nodeState[from].edges;
+        auto& b = m_nodeState[to].edges;
+        a.push_back(Edge{to, b.size(), true, latency, 0, false, {}, {}, {}});
+        b.push_back(Edge{from, a.size() - 1, false, latency, 0, false, {}, {}, {}});
+    }
+
+    static double Delay(std::mt19937_64& rng, double mean)
+    {
+        return std::exponential_distribution<double>(1.0 / mean)(rng);
+    }
+
+    void Push(double time, Kind kind, int node, size_t edge = 0, int item = 0)
+    {
+        Event ev;
+        ev.time = time;
+        ev.kind = kind;
+        ev.node = node;
+        ev.edge = edge;
+        ev.item = item;
+        Push(std::move(ev));
+    }
+
+    void Push(Event ev)
+    {
+        ev.seq = m_seq++;
+        m_events.push_back(std::move(ev));
+        std::push_heap(m_events.begin(), m_events.end(), std::greater<Event>());
+    }
+
+    // Queues a message on the sender's uplink. Every lost segment holds the
+    // link up for a retransmission timeout, which doubles while the resent
+    // segment keeps getting lost.
+    void Send(int from, size_t e, Msg msg, int item, std::vector<int> txs, size_t bytes)
+    {
+        auto& node = m_nodeState[from];
+        auto& edge = node.edges[e];
+        const double size = static_cast<double>(k_header_bytes + bytes);
+        node.uplinkFree = std::max(m_now, node.uplinkFree) + size / m_cfg.upload;
+        node.sent += static_cast<uint64_t>(size);
+
+        double arrival = node.uplinkFree + edge.latency;
+        const int segments = static_cast<int>((k_header_bytes + bytes + k_segment_bytes - 1) / k_segment_bytes);
+        std::uniform_real_distribution<double> draw(0.0, 1.0);
+        for (int lost = std::binomial_distribution<int>(segments, m_cfg.loss)(m_relayRng); lost > 0; --lost) {
+            double rto = std::max(k_min_rto, 4 * edge.latency);
+            do {
+                arrival += rto;
+                rto *= 2;
+            } while (draw(m_relayRng) < m_cfg.loss);
+        }
+        arrival = std::max(arrival, edge.delivered);
+        edge.delivered = arrival;
+
+        Event ev;
+        ev.time = arrival;
+        ev.kind = Kind::Deliver;
+        ev.msg = msg;
+        ev.node = edge.to;
+        ev.edge = edge.back;
+        ev.item = item;
+        ev.txs = std::move(txs);
+        Push(std::move(ev));
+    }
+
+    size_t CompactBytes(int b) const
+    {
+        return k_block_header_bytes + 8 + 4 + net::k_short_id_bytes * m_blocks[b].txs.size() + 4 + 8 + k_coinbase_bytes;
+    }
+
+    size_t FullBytes(int b) const { return k_block_header_bytes + 4 + k_coinbase_bytes + k_tx_bytes * m_blocks[b].txs.size(); }
+
+    void NewTx()
+    {
+        const int tx = static_cast<int>(m_created.size());
+        m_created.push_back(m_now);
+        m_confirmed.push_back(0);
+        for (auto& node : m_nodeState) {
+            node.tx.push_back(-1.0);
+            node.txRequested.push_back(0);
+            for (auto& e : node.edges) e.knownTx.push_back(0);
+        }
+        std::uniform_int_distribution<int> origin(0, m_cfg.nodes - 1);
+        AcceptTx(origin(m_workloadRng), tx);
+        const double next = m_now + Delay(m_workloadRng, 1.0 / m_cfg.txRate);
+        if (next < m_cfg.seconds) Push(next, Kind::NewTx, 0);
+    }
+
+    void AcceptTx(int n, int tx)
+    {
+        auto& node = m_nodeState[n];
+        if (node.tx[tx] >= 0) return;
+        node.tx[tx] = m_now;
+        for (auto& e : node.edges)
+            if (!e.knownTx[tx]) e.queue.push_back(tx);
+    }
+
+    void Flush(int n, size_t e)
+    {
+        auto& edge = m_nodeState[n].edges[e];
+        std::vector<int> batch;
+        size_t taken = 0;
+        for (; taken < edge.queue.size() && batch.size() < net::P2PNetwork::k_max_inv_per_trickle; ++taken) {
+            const int tx = edge.queue[taken];
+            if (edge.knownTx[tx]) continue;
+            edge.knownTx[tx] = 1;
+            batch.push_back(tx);
+        }
+        edge.queue.erase(edge.queue.begin(), edge.queue.begin() + static_cast<std::ptrdiff_t>(taken));
+        if (batch.empty()) return;
+        const size_t bytes = k_inv_bytes * batch.size();
+        Send(n, e, Msg::Inv, 0, std::move(batch), bytes);
+    }
+
+    void Mine()
+    {
+        std::uniform_int_distribution<int> pick(0, m_cfg.nodes - 1);
+        const int miner = pick(m_workloadRng);
+        auto& node = m_nodeState[miner];
+        Block block;
+        block.parent = node.tip;
+        block.height = m_blocks[node.tip].height + 1;
+        block.mined = m_now;
+        for (size_t tx = 0; tx < m_created.size(); ++tx) {
+            if (node.tx[tx] < 0 || m_confirmed[tx]) continue;
+            m_confirmed[tx] = 1;
+            block.txs.push_back(static_cast<int>(tx));
+        }
+        const int b = static_cast<int>(m_blocks.size());
+        m_blocks.push_back(std::move(block));
+        for (auto& n : m_nodeState) {
+            n.block.push_back(-1.0);
+            n.blockRequested.push_back(0);
+            n.building.push_back(0);
+            for (auto& e : n.edges) e.knownBlock.push_back(0);
+        }
+        node.blockRequested[b] = 1;
+        node.building[b] = 1;
+        Connect(miner, b, k_no_edge);
+
+        const double next = m_now + Delay(m_workloadRng, k_block_interval);
+        if (next < m_cfg.seconds) Push(next, Kind::Mine, 0);
+    }
+
+    void Deliver(Event& ev)
+    {
+        const int n = ev.node;
+        auto& node = m_nodeState[n];
+        auto& edge = node.edges[ev.edge];
+        const int b = ev.item;
+        switch (ev.msg) {
+        case Msg::Inv: {
+            std::vector<int> wanted;
+            for (int tx : ev.txs) {
+                edge.knownTx[tx] = 1;
+                if (node.tx[tx] >= 0 || node.txRequested[tx]) continue;
+                node.txRequested[tx] = 1;
+                wanted.push_back(tx);
+            }
+            if (wanted.empty()) return;
+            const size_t bytes = k_inv_bytes * wanted.size();
+            Send(n, ev.edge, Msg::GetData, 0, std::move(wanted), bytes);
+            return;
+        }
+        case Msg::GetData:
+            for (int tx : ev.txs) Send(n, ev.edge, Msg::Tx, tx, {}, k_tx_bytes);
+            return;
+        case Msg::Tx:
+            edge.knownTx[ev.item] = 1;
+            AcceptTx(n, ev.item);
+            return;
+        case Msg::BlockInv:
+            edge.knownBlock[b] = 1;
+            if (node.blockRequested[b] || node.building[b]) return;
+            node.blockRequested[b] = 1;
+            Send(n, ev.edge, m_cfg.relay == BlockRelay::Full ? Msg::GetBlock : Msg::GetCompact, b, {}, k_inv_bytes);
+            return;
+        case Msg::GetBlock:
+            Send(n, ev.edge, Msg::Block, b, {}, FullBytes(b));
+            return;
+        case Msg::GetCompact:
+            Send(n, ev.edge, Msg::CmpctBlock, b, {}, CompactBytes(b));
+            return;
+        case Msg::CmpctBlock:
+            edge.knownBlock[b] = 1;
+            ReceiveCompact(n, ev.edge, b);
+            return;
+        case Msg::GetBlockTxn: {
+            const size_t bytes = 32 + 4 + k_tx_bytes * ev.txs.size();
+            Send(n, ev.edge, Msg::BlockTxn, b, std::move(ev.txs), bytes);
+            return;
+        }
+        case Msg::BlockTxn:
+            for (int tx : ev.txs) Fill(node, edge, tx);
+            Built(n, ev.edge, b);
+            return;
+        case Msg::Block:
+            edge.knownBlock[b] = 1;
+            if (node.block[b] >= 0 || node.building[b]) {
+                ++m_result.redundant;
+                return;
+            }
+            for (int tx : m_blocks[b].txs) Fill(node, edge, tx);
+            node.building[b] = 1;
+            Built(n, ev.edge, b);
+            return;
+        case Msg::SendCmpct:
+            edge.pushBlocks = ev.item != 0;
+            return;
+        }
+    }
+
+    // A transaction that came inside a block; it is not relayed on.
+    void Fill(Node& node, Edge& edge, int tx)
+    {
+        edge.knownTx[tx] = 1;
+        if (node.tx[tx] < 0) node.tx[tx] = m_now;
+    }
+
+    void ReceiveCompact(int n, size_t e, int b)
+    {
+        auto& node = m_nodeState[n];
+        if (node.block[b] >= 0 || node.building[b]) {
+            ++m_result.redundant;
+            return;
+        }
+        node.building[b] = 1;
+        // The header checks out: high bandwidth peers get it before it is
+        // validated.
+        if (m_cfg.relay == BlockRelay::HighBandwidth) {
+            for (size_t i = 0; i < node.edges.size(); ++i) {
+                auto& peer = node.edges[i];
+                if (!peer.pushBlocks || peer.knownBlock[b]) continue;
+                peer.knownBlock[b] = 1;
+                Send(n, i, Msg::CmpctBlock, b, {}, CompactBytes(b));
+            }
+        }
+        std::vector<int> missing;
+        for (int tx : m_blocks[b].txs)
+            if (node.tx[tx] < 0) missing.push_back(tx);
+        if (missing.empty()) {
+            Built(n, e, b);
+            return;
+        }
+        ++m_result.roundTrips;
+        const size_t bytes = 32 + 4 + 4 * missing.size();
+        Send(n, e, Msg::GetBlockTxn, b, std::move(missing), bytes);
+    }
+
+    void Built(int n, size_t e, int b) { Push(m_now + k_block_validation, Kind::Validated, n, e, b); }
+
+    void Connect(int n, int b, size_t from)
+    {
+        auto& node = m_nodeState[n];
+        const Block& block = m_blocks[b];
+        if (node.block[b] >= 0) return;
+        if (node.block[block.parent] < 0) {
+            node.orphans.push_back(b);
+            if (from != k_no_edge && !node.blockRequested[block.parent]) {
+                node.blockRequested[block.parent] = 1;
+                Send(n, from, Msg::GetBlock, block.parent, {}, k_inv_bytes);
+            }
+            return;
+        }
+        node.block[b] = m_now;
+        for (int tx : block.txs)
+            if (node.tx[tx] < 0) node.tx[tx] = m_now;
+        if (block.height > m_blocks[node.tip].height) {
+            node.tip = b;
+            if (from != k_no_edge && m_cfg.relay == BlockRelay::HighBandwidth) Promote(n, from);
+            Announce(n, b);
+        }
+        std::vector<int> children;
+        for (int child : node.orphans)
+            if (m_blocks[child].parent == b) children.push_back(child);
+        if (children.empty()) return;
+        node.orphans.erase(std::remove_if(node.orphans.begin(), node.orphans.end(),
+                                          [&](int child) { return m_blocks[child].parent == b; }),
+                           node.orphans.end());
+        for (int child : children) Connect(n, child, k_no_edge);
+    }
+
+    // The peer that gave us a new tip first becomes a high bandwidth peer,
+    // pushing out the one that has gone longest without doing so.
+    void Promote(int n, size_t e)
+    {
+        auto& hb = m_nodeState[n].highBandwidth;
+        auto it = std::find(hb.begin(), hb.end(), e);
+        if (it != hb.end()) {
+            hb.erase(it);
+            hb.push_back(e);
+            return;
+        }
+        hb.push_back(e);
+        Send(n, e, Msg::SendCmpct, 1, {}, 9);
+        if (hb.size() > net::CompactBlockRelay::k_high_bandwidth_peers) {
+            Send(n, hb.front(), Msg::SendCmpct, 0, {}, 9);
+            hb.pop_front();
+        }
+    }
+
+    void Announce(int n, int b)
+    {
+        auto& node = m_nodeState[n];
+        for (size_t i = 0; i < node.edges.size(); ++i) {
+            auto& peer = node.edges[i];
+            if (peer.knownBlock[b]) continue;
+            peer.knownBlock[b] = 1;
+            if (m_cfg.relay == BlockRelay::HighBandwidth && peer.pushBlocks)
+                Send(n, i, Msg::CmpctBlock, b, {}, CompactBytes(b));
+            else
+                Send(n, i, Msg::BlockInv, b, {}, k_inv_bytes);
+        }
+    }
+
+    void Measure(std::vector<double> times, double start, Reach& reach) const
+    {
+        times.erase(std::remove_if(times.begin(), times.end(), [](double t) { return t < 0; }), times.end());
+        std::sort(times.begin(), times.end());
+        const size_t nodes = m_nodeState.size();
+        const size_t half = (nodes + 1) / 2;
+        const size_t most = (nodes * 9 + 9) / 10;
+        if (times.size() >= half) reach.half.push_back(times[half - 1] - start);
+        if (times.size() >= most) reach.most.push_back(times[most - 1] - start);
+        if (times.size() == nodes) reach.all.push_back(times.back() - start);
+    }
+
+    void Summarize()
+    {
+        // The best chain ends at the highest block, the first mined on a tie.
+        int best = 0;
+        for (size_t b = 1; b < m_blocks.size(); ++b)
+            if (m_blocks[b].height > m_blocks[best].height) best = static_cast<int>(b);
+        std::vector<char> main(m_blocks.size(), 0);
+        for (int b = best; b >= 0; b = m_blocks[b].parent) main[b] = 1;
+        m_result.mined = m_blocks.size() - 1;
+        for (size_t b = 1; b < m_blocks.size(); ++b) {
+            if (!main[b]) {
+                ++m_result.stale;
+                continue;
+            }
+            std::vector<double> times;
+            for (const auto& node : m_nodeState) times.push_back(node.block[b]);
+            Measure(std::move(times), m_blocks[b].mined, m_result.blocks);
+        }
+        for (size_t tx = 0; tx < m_created.size(); ++tx) {
+            std::vector<double> times;
+            for (const auto& node : m_nodeState) times.push_back(node.tx[tx]);
+            Measure(std::move(times), m_created[tx], m_result.txs);
+        }
+        for (const auto& node : m_nodeState) m_result.upload.push_back(node.sent / 1024.0 / m_now);
+    }
+
+    const Config m_cfg;
+    std::mt19937_64 m_topologyRng;
+    std::mt19937_64 m_workloadRng;
+    std::mt19937_64 m_relayRng;
+    std::vector<Node> m_nodeState;
+    std::vector<Block> m_blocks;
+    std::vector<double> m_created;
+    std::vector<char> m_confirmed;
+    std::vector<Event> m_events; // heap, earliest first
+    uint64_t m_seq{0};
+    double m_now{0};
+    Result m_result;
+};
+
+double Percentile(std::vector<double> values, double p)
+{
+    if (values.empty()) return -1;
+    std::sort(values.begin(), values.end());
+    return values[static_cast<size_t>(p * static_cast<double>(values.size() - 1) + 0.5)];
+}
+
+void PrintCell(double value)
+{
+    if (value < 0)
+        std::cout << std::setw(8) << "-";
+    else
+        std::cout << std::setw(8) << value;
+}
+
+void PrintReach(const char* what, const Reach& reach)
+{
+    std::cout << "  " << std::left << std::setw(14) << what << std::right << std::fixed << std::setprecision(2);
+    for (const auto* column : {&reach.half, &reach.most, &reach.all}) {
+        PrintCell(Percentile(*column, 0.5));
+        PrintCell(Percentile(*column, 0.9));
+    }
+    std::cout << "\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Config cfg;
+    cfg.nodes = argc > 1 ? std::atoi(argv[1]) : 200;
+    cfg.seconds = 60.0 * (argc > 2 ? std::atof(argv[2]) : 30.0);
+    cfg.txRate = argc > 3 ? std::atof(argv[3]) : 5.0;
+    cfg.latency = (argc > 4 ? std::atof(argv[4]) : 100.0) / 1000.0;
+    cfg.upload = (argc > 5 ? std::atof(argv[5]) : 1024.0) * 1024.0;
+    cfg.loss = (argc > 6 ? std::atof(argv[6]) : 0.5) / 100.0;
+    if (cfg.nodes <= k_outbound || cfg.upload <= 0 || cfg.loss < 0 || cfg.loss >= 1) {
+        std::cerr << "need more than " << k_outbound << " nodes, a positive upload and a loss below 100%\n";
+        return 1;
+    }
+
+    std::cout << "model of the relay rules (see the top of netsim_bench.cpp), not the node's code\n";
+    std::cout << cfg.nodes << " nodes, " << k_outbound << " outbound each, " << cfg.seconds / 60 << " minutes, "
+              << cfg.txRate << " tx/s, " << cfg.latency * 1000 << " ms latency, " << cfg.upload / 1024
+              << " KiB/s upload, " << cfg.loss * 100 << "% loss\n";
+    std::cout << "seconds until 50%, 90% and all nodes have an item, median and p90 over items\n";
+
+    const std::pair<BlockRelay, const char*> variants[] = {
+        {BlockRelay::Full, "full blocks"},
+        {BlockRelay::Compact, "compact blocks"},
+        {BlockRelay::HighBandwidth, "compact blocks, high bandwidth"},
+    };
+    for (const auto& [relay, name] : variants) {
+        cfg.relay = relay;
+        Simulation sim(cfg);
+        const Result r = sim.Run();
+        std::cout << "\n" << name << "\n";
+        std::cout << "  " << std::left << std::setw(14) << "" << std::right << std::setw(16) << "to 50%"
+                  << std::setw(16) << "to 90%" << std::setw(16) << "to all" << "\n";
+        PrintReach("blocks", r.blocks);
+        PrintReach("transactions", r.txs);
+        std::cout << std::setprecision(1) << "  upload KiB/s per node: mean "
+                  << (r.upload.empty() ? 0.0
+                                       : std::accumulate(r.upload.begin(), r.upload.end(), 0.0) / r.upload.size())
+                  << ", p90 " << Percentile(r.upload, 0.9) << ", max " << Percentile(r.upload, 1.0) << "\n";
+        std::cout << "  stale blocks: " << r.stale << " of " << r.mined;
+        if (r.mined) std::cout << " (" << 100.0 * r.stale / r.mined << "%)";
+        std::cout << ", getblocktxn round trips: " << r.roundTrips << ", redundant blocks: " << r.redundant << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,316 @@
+// Simulates transaction announcement traffic on a random network, once with
+// trickled inv flooding and once with reconciliation (reqrecon / sketch /
+// reconcildiff, as net::P2PNetwork does it), at 8, 32 and 64 peers per node.
+// Only announcement traffic is counted: inv, getdata and the reconciliation
+// messages. Transaction bodies are fetched once per node either way.
+//
+// A sketch is taken to decode exactly when the set difference is smaller
+// than its capacity, which is what Minisketch::Decode(capacity - 1) does
+// short of a 2^-32 accident; the sketches themselves are not computed.
+//
+//   bench_txrelay [nodes=150] [transactions=1000] [tx_per_second=10]
+#include "../layer2-services/net/minisketch.h"
+#include "../layer2-services/net/p2p.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+constexpr double k_tick = 0.05;    // s
+constexpr double k_latency = 0.05; // s, one way
+constexpr size_t k_header_bytes = 24;
+constexpr size_t k_inv_bytes = 33;
+// Node defaults.
+constexpr double k_inbound_trickle = 5.0;
+constexpr double k_outbound_trickle = 2.0;
+constexpr double k_recon_interval = 2.0;
+
+struct Edge {
+    int to{0};
+    size_t back{0}; // index of the reverse edge in the peer's list
+    bool outbound{false};
+    double nextTrickle{0};
+    double nextRecon{0};
+    uint64_t salt{0};
+    std::vector<char> known; // the peer is known to have the transaction
+    std::vector<int> queue;  // to announce (flooding) or to reconcile
+};
+
+struct Node {
+    std::vector<Edge> edges;
+    std::vector<double> has; // arrival time, < 0 if not yet
+    std::vector<char> requested;
+    double nextInbound{0};
+};
+
+struct Result {
+    uint64_t invBytes{0};
+    uint64_t getdataBytes{0};
+    uint64_t reconBytes{0};
+    uint64_t rounds{0};
+    uint64_t failures{0};
+    double meanReach{0}; // until every node has a transaction, s
+};
+
+uint32_t ShortId(uint64_t salt, int tx)
+{
+    uint64_t z = salt + static_cast<uint64_t>(tx) * 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    const auto id = static_cast<uint32_t>(z ^ (z >> 31));
+    return id ? id : 1;
+}
+
+class Simulation {
+public:
+    Simulation(int nodes, int peers, int txs, double rate, bool reconcile)
+        : m_nodes(nodes), m_txs(txs), m_rate(rate), m_reconcile(reconcile), m_rng(42), m_nodeState(nodes)
+    {
+        std::uniform_real_distribution<double> phase(0.0, k_recon_interval);
+        // Every node opens peers / 2 connections, so the average is `peers`.
+        for (int n = 0; n < nodes; ++n) {
+            int opened = 0;
+            for (int attempts = 0; opened < peers / 2 && attempts < 100 * peers; ++attempts) {
+                const int to = static_cast<int>(m_rng() % nodes);
+                if (to == n || Connected(n, to)) continue;
+                Link(n, to, phase(m_rng));
+                ++opened;
+            }
+        }
+        for (auto& node : m_nodeState) {
+            node.has.assign(txs, -1.0);
+            node.requested.assign(txs, 0);
+            node.nextInbound = Delay(k_inbound_trickle);
+            for (auto& e : node.edges) {
+                e.known.assign(txs, 0);
+                e.nextTrickle = Delay(k_outbound_trickle);
+            }
+        }
+    }
+
+    Result Run()
+    {
+        std::uniform_int_distribution<int> origin(0, m_nodes - 1);
+        const double end = m_txs / m_rate + 120.0;
+        int created = 0;
+        for (double now = 0; now < end; now += k_tick) {
+            while (created < m_txs && created / m_rate <= now) {
+                Arrive(origin(m_rng), created, now);
+                ++created;
+            }
+            while (!m_arrivals.empty() && m_arrivals.top().time <= now) {
+                const auto a = m_arrivals.top();
+                m_arrivals.pop();
+                Arrive(a.node, a.tx, a.time);
+            }
+            if (m_reconcile)
+                Reconcile(now);
+            else
+                Trickle(now);
+            if (created == m_txs && m_arrivals.empty() && Settled()) break;
+        }
+        double total = 0;
+        for (int tx = 0; tx < m_txs; ++tx) {
+            double last = 0;
+            for (const auto& node : m_nodeState) last = std::max(last, node.has[tx]);
+            total += last - tx / m_rate;
+        }
+        m_result.meanReach = total / m_txs;
+        return m_result;
+    }
+
+private:
+    struct Arrival {
+        double time;
+        int node;
+        int tx;
+        bool operator>(const Arrival& o) const { return time > o.time; }
+    };
+
+    bool Connected(int a, int b) const
+    {
+        for (const auto& e : m_nodeState[a].edges)
+            if (e.to == b) return true;
+        return false;
+    }
+
+    void Link(int from, int to, double phase)
+    {
+        auto& a = m_nodeState[from].edges;
+        auto& b = m_nodeState[to].edges;
+        const uint64_t salt = m_rng();
+        a.push_back(Edge{to, b.size(), true, 0, phase, salt, {}, {}});
+        b.push_back(Edge{from, a.size() - 1, false, 0, phase, salt, {}, {}});
+    }
+
+    double Delay(double mean)
+    {
+        return std::exponential_distribution<double>(1.0 / mean)(m_rng);
+    }
+
+    bool Settled() const
+    {
+        for (const auto& node : m_nodeState)
+            for (const auto& e : node.edges)
+                if (!e.queue.empty()) return false;
+        return true;
+    }
+
+    void Arrive(int n, int tx, double now)
+    {
+        auto& node = m_nodeState[n];
+        if (node.has[tx] >= 0) return;
+        node.has[tx] = now;
+        for (auto& e : node.edges)
+            if (!e.known[tx]) e.queue.push_back(tx);
+    }
+
+    // Announces `txs` over `e`; the peer fetches what it lacks.
+    void Announce(Edge& e, const std::vector<int>& txs, double now)
+    {
+        std::vector<int> fresh;
+        for (int tx : txs)
+            if (!e.known[tx]) fresh.push_back(tx);
+        if (fresh.empty()) return;
+        m_result.invBytes += k_header_bytes + k_inv_bytes * fresh.size();
+        auto& peer = m_nodeState[e.to];
+        auto& reverse = peer.edges[e.back];
+        size_t wanted = 0;
+        for (int tx : fresh) {
+            e.known[tx] = 1;
+            reverse.known[tx] = 1;
+            if (peer.has[tx] >= 0 || peer.requested[tx]) continue;
+            peer.requested[tx] = 1;
+            ++wanted;
+            m_arrivals.push(Arrival{now + 3 * k_latency, e.to, tx});
+        }
+        if (wanted) m_result.getdataBytes += k_header_bytes + k_inv_bytes * wanted;
+    }
+
+    void Flush(Edge& e, double now)
+    {
+        std::vector<int> txs;
+        txs.swap(e.queue);
+        Announce(e, txs, now);
+    }
+
+    void Trickle(double now)
+    {
+        for (auto& node : m_nodeState) {
+            const bool inboundDue = now >= node.nextInbound;
+            if (inboundDue) node.nextInbound = now + Delay(k_inbound_trickle);
+            for (auto& e : node.edges) {
+                if (!e.outbound) {
+                    if (inboundDue) Flush(e, now);
+                } else if (now >= e.nextTrickle) {
+                    e.nextTrickle = now + Delay(k_outbound_trickle);
+                    Flush(e, now);
+                }
+            }
+        }
+    }
+
+    void Reconcile(double now)
+    {
+        for (auto& node : m_nodeState) {
+            for (auto& e : node.edges) {
+                if (!e.outbound || now < e.nextRecon) continue;
+                e.nextRecon = now + k_recon_interval;
+                Round(e, now);
+            }
+        }
+    }
+
+    void Round(Edge& e, double now)
+    {
+        Edge& reverse = m_nodeState[e.to].edges[e.back];
+        std::vector<int> mine;
+        std::vector<int> theirs;
+        mine.swap(e.queue);
+        theirs.swap(reverse.queue);
+        ++m_result.rounds;
+
+        const size_t small = std::min(mine.size(), theirs.size());
+        const size_t large = std::max(mine.size(), theirs.size());
+        size_t capacity = large == 0 ? 0 : (large - small) + small / 4 + 2;
+        capacity = std::min(capacity, net::P2PNetwork::k_max_sketch_capacity);
+        m_result.reconBytes += 2 * k_header_bytes + sizeof(uint32_t) + capacity * net::Minisketch::k_element_bytes;
+
+        std::unordered_set<uint32_t> mineIds;
+        std::unordered_set<uint32_t> theirIds;
+        for (int tx : mine) mineIds.insert(ShortId(e.salt, tx));
+        for (int tx : theirs) theirIds.insert(ShortId(e.salt, tx));
+        std::vector<int> onlyMine;
+        std::vector<int> onlyTheirs;
+        for (int tx : mine)
+            if (!theirIds.count(ShortId(e.salt, tx))) onlyMine.push_back(tx);
+        for (int tx : theirs)
+            if (!mineIds.count(ShortId(e.salt, tx))) onlyTheirs.push_back(tx);
+
+        const bool decoded = capacity == 0 || onlyMine.size() + onlyTheirs.size() < capacity;
+        m_result.reconBytes += k_header_bytes + 1;
+        if (decoded) {
+            m_result.reconBytes += sizeof(uint32_t) * onlyTheirs.size();
+            // Transactions both sides have are settled by the sketch alone.
+            for (int tx : mine) {
+                if (theirIds.count(ShortId(e.salt, tx))) {
+                    e.known[tx] = 1;
+                    reverse.known[tx] = 1;
+                }
+            }
+            Announce(e, onlyMine, now);
+            Announce(reverse, onlyTheirs, now);
+        } else {
+            ++m_result.failures;
+            Announce(e, mine, now);
+            Announce(reverse, theirs, now);
+        }
+    }
+
+    const int m_nodes;
+    const int m_txs;
+    const double m_rate;
+    const bool m_reconcile;
+    std::mt19937_64 m_rng;
+    std::vector<Node> m_nodeState;
+    std::priority_queue<Arrival, std::vector<Arrival>, std::greater<Arrival>> m_arrivals;
+    Result m_result;
+};
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    const int nodes = argc > 1 ? std::atoi(argv[1]) : 150;
+    const int txs = argc > 2 ? std::atoi(argv[2]) : 1000;
+    const double rate = argc > 3 ? std::atof(argv[3]) : 10.0;
+
+    std::cout << nodes << " nodes, " << txs << " transactions at " << rate << "/s\n\n";
+    std::cout << std::left << std::setw(7) << "peers" << std::setw(11) << "relay" << std::right << std::setw(14)
+              << "announce KiB" << std::setw(16) << "bytes/tx/node" << std::setw(10) << "reach s" << std::setw(10)
+              << "rounds" << std::setw(10) << "failed" << "\n";
+    for (int peers : {8, 32, 64}) {
+        if (peers >= nodes) continue;
+        uint64_t flooded = 0;
+        for (bool reconcile : {false, true}) {
+            Simulation sim(nodes, peers, txs, rate, reconcile);
+            const Result r = sim.Run();
+            const uint64_t bytes = r.invBytes + r.getdataBytes + r.reconBytes;
+            if (!reconcile) flooded = bytes;
+            std::cout << std::left << std::setw(7) << peers << std::setw(11) << (reconcile ? "reconcile" : "flood")
+                      << std::right << std::fixed << std::setprecision(1) << std::setw(14) << bytes / 1024.0
+                      << std::setw(16) << static_cast<double>(bytes) / (static_cast<double>(txs) * nodes)
+                      << std::setw(10) << r.meanReach << std::setw(10) << r.rounds << std::setw(10) << r.failures;
+            if (reconcile && flooded)
+                std::cout << "   (" << std::setprecision(0) << 100.0 * bytes / flooded << "% of flooding)";
+            std::cout << "\n";
+        }
+    }
+    return 0;
+}
@@ -1,8 +1,59 @@
 #include "block.h"
 
 #include "../crypto/tagged_hash.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+constexpr uint32_t kMaxTxSize = 10 * 1024 * 1024;
+constexpr uint32_t kMaxTxCount = 100000;
+
+} // namespace
 
 uint256 BlockHash(const BlockHeader& header) {
     return tagged_hash("BLOCK", reinterpret_cast<const uint8_t*>(&header), sizeof(BlockHeader));
 }
 
+
+std::vector<uint8_t> SerializeBlock(const Block& block)
+{
+    std::vector<uint8_t> data(sizeof(BlockHeader) + sizeof(uint32_t));
+    std::memcpy(data.data(), &block.header, sizeof(BlockHeader));
+    const uint32_t txCount = static_cast<uint32_t>(block.transactions.size());
+    std::memcpy(data.data() + sizeof(BlockHeader), &txCount, sizeof(txCount));
+    for (const auto& tx : block.transactions) {
+        const auto raw = Serialize(tx);
+        const uint32_t len = static_cast<uint32_t>(raw.size());
+        const auto* p = reinterpret_cast<const uint8_t*>(&len);
+        data.insert(data.end(), p, p + sizeof(len));
+        data.insert(data.end(), raw.begin(), raw.end());
+    }
+    return data;
+}
+
+Block DeserializeBlock(const std::vector<uint8_t>& data)
+{
+    if (data.size() < sizeof(BlockHeader) + sizeof(uint32_t)) throw std::runtime_error("block too small");
+    Block block{};
+    std::memcpy(&block.header, data.data(), sizeof(BlockHeader));
+    std::size_t off = sizeof(BlockHeader);
+    uint32_t txCount = 0;
+    std::memcpy(&txCount, data.data() + off, sizeof(txCount));
+    off += sizeof(txCount);
+    if (txCount > kMaxTxCount) throw std::runtime_error("transaction count exceeds maximum");
+    block.transactions.reserve(txCount);
+    for (uint32_t i = 0; i < txCount; ++i) {
+        uint32_t txSize = 0;
+        if (off + sizeof(txSize) > data.size()) throw std::runtime_error("truncated transaction size");
+        std::memcpy(&txSize, data.data() + off, sizeof(txSize));
+        off += sizeof(txSize);
+        if (txSize == 0 || txSize > kMaxTxSize || txSize > data.size() - off)
+            throw std::runtime_error("invalid transaction size");
+        block.transactions.push_back(
+            DeserializeTransaction(std::vector<uint8_t>(data.begin() + off, data.begin() + off + txSize)));
+        off += txSize;
+    }
+    if (off != data.size()) throw std::runtime_error("trailing block data");
+    return block;
+}
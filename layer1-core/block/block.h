@@ -20,3 +20,11 @@ struct Block {
 
 // Compute the tagged hash of a block header (double-tagged SHA-256 per DRACHMA rules).
 uint256 BlockHash(const BlockHeader& header);
+
+// Self-contained block encoding used for bootstrap files and for "block"
+// messages between peers: [header(80)][txCount(4)]([length(4)][tx])... with
+// the raw header struct and little-endian counts (the layout of the oldest
+// block store records). DeserializeBlock throws std::runtime_error on
+// malformed input; it does not check the block beyond that.
+std::vector<uint8_t> SerializeBlock(const Block& block);
+Block DeserializeBlock(const std::vector<uint8_t>& data);
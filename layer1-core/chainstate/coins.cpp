@@ -1,4 +1,5 @@
 #include "coins.h"
+#include <filesystem>
 #include <fstream>
 #include <stdexcept>
 #include <algorithm>
@@ -12,7 +13,63 @@
 namespace {
 constexpr size_t ASSET_FIELD_SIZE = sizeof(uint8_t);
 constexpr size_t MIN_VALUE_SIZE = ASSET_FIELD_SIZE + sizeof(uint64_t);
+
+// Metadata keys are shorter than the 36-byte outpoint keys so Load() skips
+// them when rebuilding the coin map.
+const std::string kBestBlockKey{"\0" "B", 2};
+const std::string kStatsKey{"\0" "S", 2};
+
+std::string CoinKey(const OutPoint& out)
+{
+    std::string key;
+    key.reserve(out.hash.size() + sizeof(out.index));
+    key.append(reinterpret_cast<const char*>(out.hash.data()), out.hash.size());
+    key.append(reinterpret_cast<const char*>(&out.index), sizeof(out.index));
+    return key;
+}
+
+// value layout: [asset(1)][value(8)][scriptPubKey]
+std::string CoinValue(const TxOut& txout)
+{
+    std::string value;
+    value.resize(ASSET_FIELD_SIZE + sizeof(txout.value));
+    value[0] = static_cast<char>(txout.assetId);
+    std::memcpy(value.data() + ASSET_FIELD_SIZE, &txout.value, sizeof(txout.value));
+    value.append(reinterpret_cast<const char*>(txout.scriptPubKey.data()), txout.scriptPubKey.size());
+    return value;
+}
+
+std::string BestBlockValue(const BestBlockMarker& marker)
+{
+    std::string value(reinterpret_cast<const char*>(marker.hash.data()), marker.hash.size());
+    value.append(reinterpret_cast<const char*>(&marker.height), sizeof(marker.height));
+    return value;
+}
+
+// stats layout: [coins(8)][size(8)][assetCount(1)][(asset(1), amount(8))...]
+//               [muhash numerator(384)][muhash denominator(384)]
+std::string StatsValue(uint64_t coins, uint64_t size, const std::map<uint8_t, uint64_t>& amounts, const MuHash3072& muhash)
+{
+    std::string value;
+    value.append(reinterpret_cast<const char*>(&coins), sizeof(coins));
+    value.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    value.push_back(static_cast<char>(amounts.size()));
+    for (const auto& [asset, amount] : amounts) {
+        value.push_back(static_cast<char>(asset));
+        value.append(reinterpret_cast<const char*>(&amount), sizeof(amount));
+    }
+    value.append(reinterpret_cast<const char*>(muhash.Numerator().data()), MuHash3072::BYTE_SIZE);
+    value.append(reinterpret_cast<const char*>(muhash.Denominator().data()), MuHash3072::BYTE_SIZE);
+    return value;
+}
+
+bool OutPointLess(const OutPoint& a, const OutPoint& b)
+{
+    int cmp = std::memcmp(a.hash.data(), b.hash.data(), a.hash.size());
+    if (cmp != 0) return cmp < 0;
+    return a.index < b.index;
 }
+} // namespace
 
 std::size_t OutPointHash::operator()(const OutPoint& o) const noexcept
 {
@@ -27,6 +84,28 @@ bool OutPointEq::operator()(const OutPoint& a, const OutPoint& b) const noexcept
     return a.index == b.index && std::equal(a.hash.begin(), a.hash.end(), b.hash.begin());
 }
 
+void Chainstate::StatsAccumulator::Add(const OutPoint& out, const TxOut& txout)
+{
+    const std::string element = CoinKey(out) + CoinValue(txout);
+    ++coins;
+    serializedSize += element.size();
+    totalAmount[txout.assetId] += txout.value;
+    muhash.Insert(reinterpret_cast<const uint8_t*>(element.data()), element.size());
+}
+
+void Chainstate::StatsAccumulator::Remove(const OutPoint& out, const TxOut& txout)
+{
+    const std::string element = CoinKey(out) + CoinValue(txout);
+    --coins;
+    serializedSize -= element.size();
+    auto it = totalAmount.find(txout.assetId);
+    if (it != totalAmount.end()) {
+        it->second -= txout.value;
+        if (it->second == 0) totalAmount.erase(it);
+    }
+    muhash.Remove(reinterpret_cast<const uint8_t*>(element.data()), element.size());
+}
+
 Chainstate::Chainstate(const std::string& path, std::size_t cacheCapacity)
     : storagePath(path), maxCacheEntries(cacheCapacity)
 {
@@ -89,23 +168,15 @@ void Chainstate::AddUTXO(const OutPoint& out, const TxOut& txout)
         pending.push_back(change);
     }
 
+    if (itExisting != utxos.end()) stats.Remove(out, itExisting->second);
+    stats.Add(out, txout);
     utxos[out] = txout;
     cache[out] = txout;
 #ifdef DRACHMA_HAVE_LEVELDB
     if (useDb && !inTransaction) {
         leveldb::WriteBatch batch;
-        // value layout: [asset(1)][value(8)][scriptPubKey]
-        std::string value;
-        value.resize(ASSET_FIELD_SIZE + sizeof(txout.value));
-        value[0] = static_cast<char>(txout.assetId);
-        std::memcpy(value.data() + ASSET_FIELD_SIZE, &txout.value, sizeof(txout.value));
-        value.append(reinterpret_cast<const char*>(txout.scriptPubKey.data()), txout.scriptPubKey.size());
-
-        std::string key;
-        key.reserve(out.hash.size() + sizeof(out.index));
-        key.append(reinterpret_cast<const char*>(out.hash.data()), out.hash.size());
-        key.append(reinterpret_cast<const char*>(&out.index), sizeof(out.index));
-        batch.Put(key, value);
+        batch.Put(CoinKey(out), CoinValue(txout));
+        StageStats(batch);
         PersistBatch(batch);
     }
 #endif
@@ -125,16 +196,14 @@ void Chainstate::SpendUTXO(const OutPoint& out)
         change.hadNew = false;
         pending.push_back(change);
     }
+    stats.Remove(out, it->second);
     utxos.erase(it);
     cache.erase(out);
 #ifdef DRACHMA_HAVE_LEVELDB
     if (useDb && !inTransaction) {
         leveldb::WriteBatch batch;
-        std::string key;
-        key.reserve(out.hash.size() + sizeof(out.index));
-        key.append(reinterpret_cast<const char*>(out.hash.data()), out.hash.size());
-        key.append(reinterpret_cast<const char*>(&out.index), sizeof(out.index));
-        batch.Delete(key);
+        batch.Delete(CoinKey(out));
+        StageStats(batch);
         PersistBatch(batch);
     }
 #endif
@@ -148,15 +217,170 @@ std::size_t Chainstate::CachedEntries() const
     return cache.size();
 }
 
+bool Chainstate::Empty() const
+{
+    std::lock_guard<std::mutex> l(mu);
+    return utxos.empty();
+}
+
+std::optional<BestBlockMarker> Chainstate::BestBlock() const
+{
+    std::lock_guard<std::mutex> l(mu);
+    return bestBlock;
+}
+
+void Chainstate::SetBestBlock(const BestBlockMarker& marker)
+{
+    {
+        std::lock_guard<std::mutex> l(mu);
+        bestBlock = marker;
+#ifdef DRACHMA_HAVE_LEVELDB
+        if (useDb) {
+            leveldb::WriteBatch batch;
+            batch.Put(kBestBlockKey, BestBlockValue(marker));
+            StageStats(batch);
+            PersistBatch(batch);
+            return;
+        }
+#endif
+    }
+    Persist();
+}
+
+std::vector<std::pair<OutPoint, TxOut>> Chainstate::SortedUTXOs() const
+{
+    std::vector<std::pair<OutPoint, TxOut>> out;
+    {
+        std::lock_guard<std::mutex> l(mu);
+        out.reserve(utxos.size());
+        for (const auto& entry : utxos)
+            out.emplace_back(entry.first, entry.second);
+    }
+    std::sort(out.begin(), out.end(), [](const auto& a, const auto& b) { return OutPointLess(a.first, b.first); });
+    return out;
+}
+
+void Chainstate::ImportUTXOs(const std::vector<std::pair<OutPoint, TxOut>>& coins)
+{
+    // Hash outside the lock so decoding threads don't serialize on MuHash.
+    StatsAccumulator added;
+    for (const auto& coin : coins)
+        added.Add(coin.first, coin.second);
+#ifdef DRACHMA_HAVE_LEVELDB
+    leveldb::WriteBatch batch;
+#endif
+    {
+        std::lock_guard<std::mutex> l(mu);
+        for (const auto& coin : coins) {
+            cache.erase(coin.first);
+            auto existing = utxos.find(coin.first);
+            if (existing != utxos.end()) {
+                stats.Remove(existing->first, existing->second);
+                existing->second = coin.second;
+            } else {
+                utxos.emplace(coin.first, coin.second);
+            }
+#ifdef DRACHMA_HAVE_LEVELDB
+            if (useDb) batch.Put(CoinKey(coin.first), CoinValue(coin.second));
+#endif
+        }
+        stats.coins += added.coins;
+        stats.serializedSize += added.serializedSize;
+        for (const auto& [asset, amount] : added.totalAmount)
+            stats.totalAmount[asset] += amount;
+        stats.muhash *= added.muhash;
+    }
+#ifdef DRACHMA_HAVE_LEVELDB
+    // The stats record is left to the next synced write (SetBestBlock/Flush);
+    // Load() cross-checks it against the coins it reads. LevelDB serializes concurrent writers internally; keeping the write
+    // outside our mutex lets decoding threads overlap with ingestion.
+    PersistBatch(batch, /*sync=*/false);
+#endif
+}
+
+void Chainstate::Clear()
+{
+    {
+        std::lock_guard<std::mutex> l(mu);
+#ifdef DRACHMA_HAVE_LEVELDB
+        if (useDb) {
+            leveldb::WriteBatch batch;
+            std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+            for (it->SeekToFirst(); it->Valid(); it->Next())
+                batch.Delete(it->key());
+            PersistBatch(batch);
+        }
+#endif
+        utxos.clear();
+        cache.clear();
+        pending.clear();
+        bestBlock.reset();
+        stats = StatsAccumulator{};
+    }
+    Persist();
+}
+
+UTXOSetStats Chainstate::Stats() const
+{
+    UTXOSetStats out;
+    MuHash3072 muhash;
+    {
+        std::lock_guard<std::mutex> l(mu);
+        out.coins = stats.coins;
+        out.serializedSize = stats.serializedSize;
+        out.totalAmount = stats.totalAmount;
+        muhash = stats.muhash;
+    }
+    out.muhash = muhash.Finalize();
+    return out;
+}
+
 void Chainstate::Load()
 {
     std::lock_guard<std::mutex> l(mu);
+    std::string persistedStats;
+    // Totals are cheap to recount while the coins stream in; the set hash is
+    // only recomputed if the persisted record disagrees with them.
+    auto finishStats = [&]() {
+        StatsAccumulator totals;
+        for (const auto& entry : utxos) {
+            ++totals.coins;
+            totals.serializedSize += sizeof(entry.first.hash) + sizeof(entry.first.index) + MIN_VALUE_SIZE + entry.second.scriptPubKey.size();
+            totals.totalAmount[entry.second.assetId] += entry.second.value;
+        }
+        std::string expected = StatsValue(totals.coins, totals.serializedSize, totals.totalAmount, MuHash3072{});
+        expected.resize(expected.size() - 2 * MuHash3072::BYTE_SIZE);
+        if (persistedStats.size() == expected.size() + 2 * MuHash3072::BYTE_SIZE &&
+            persistedStats.compare(0, expected.size(), expected) == 0) {
+            MuHash3072::Num3072 num{}, den{};
+            std::memcpy(num.data(), persistedStats.data() + expected.size(), num.size());
+            std::memcpy(den.data(), persistedStats.data() + expected.size() + num.size(), den.size());
+            totals.muhash = MuHash3072::FromParts(num, den);
+        } else {
+            for (const auto& entry : utxos) {
+                const std::string element = CoinKey(entry.first) + CoinValue(entry.second);
+                totals.muhash.Insert(reinterpret_cast<const uint8_t*>(element.data()), element.size());
+            }
+        }
+        stats = std::move(totals);
+    };
 #ifdef DRACHMA_HAVE_LEVELDB
     if (useDb) {
         std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
         for (it->SeekToFirst(); it->Valid(); it->Next()) {
             const auto& key = it->key();
             const auto& val = it->value();
+            if (key == kBestBlockKey && val.size() == sizeof(BestBlockMarker::hash) + sizeof(uint32_t)) {
+                BestBlockMarker marker;
+                std::memcpy(marker.hash.data(), val.data(), marker.hash.size());
+                std::memcpy(&marker.height, val.data() + marker.hash.size(), sizeof(marker.height));
+                bestBlock = marker;
+                continue;
+            }
+            if (key == kStatsKey) {
+                persistedStats = val.ToString();
+                continue;
+            }
             OutPoint op{};
             if (key.size() != op.hash.size() + sizeof(uint32_t) || val.size() < MIN_VALUE_SIZE)
                 continue;
@@ -168,6 +392,7 @@ void Chainstate::Load()
             txo.scriptPubKey.assign(val.data() + ASSET_FIELD_SIZE + sizeof(txo.value), val.data() + val.size());
             utxos.emplace(op, txo);
         }
+        finishStats();
         return;
     }
 #endif
@@ -189,28 +414,58 @@ void Chainstate::Load()
         if (!in) throw std::runtime_error("corrupt utxo set");
         utxos.emplace(op, txo);
     }
+    // Optional trailer written by newer versions: [hash(32)][height(4)].
+    BestBlockMarker marker;
+    in.read(reinterpret_cast<char*>(marker.hash.data()), marker.hash.size());
+    in.read(reinterpret_cast<char*>(&marker.height), sizeof(marker.height));
+    if (in) bestBlock = marker;
+    finishStats();
 }
 
 void Chainstate::Persist() const
 {
     std::lock_guard<std::mutex> l(mu);
+    PersistLocked();
+}
+
+void Chainstate::PersistLocked() const
+{
 #ifdef DRACHMA_HAVE_LEVELDB
     if (useDb) {
-        return; // LevelDB writes are handled incrementally in Add/Spend/Commit
+        // Coin writes are handled incrementally in Add/Spend/Commit; an empty
+        // synced batch forces any unsynced bulk imports onto disk.
+        leveldb::WriteBatch batch;
+        StageStats(batch);
+        PersistBatch(batch);
+        return;
     }
 #endif
-    std::ofstream out(storagePath, std::ios::binary | std::ios::trunc);
-    uint32_t count = static_cast<uint32_t>(utxos.size());
-    out.write(reinterpret_cast<const char*>(&count), sizeof(count));
-    for (const auto& entry : utxos) {
-        out.write(reinterpret_cast<const char*>(entry.first.hash.data()), entry.first.hash.size());
-        out.write(reinterpret_cast<const char*>(&entry.first.index), sizeof(entry.first.index));
-        out.write(reinterpret_cast<const char*>(&entry.second.assetId), sizeof(entry.second.assetId));
-        out.write(reinterpret_cast<const char*>(&entry.second.value), sizeof(entry.second.value));
-        uint32_t scriptSize = static_cast<uint32_t>(entry.second.scriptPubKey.size());
-        out.write(reinterpret_cast<const char*>(&scriptSize), sizeof(scriptSize));
-        out.write(reinterpret_cast<const char*>(entry.second.scriptPubKey.data()), scriptSize);
+    // Written beside the live file and renamed over it, so a crash mid-write
+    // leaves the previous snapshot intact.
+    const std::string tmpPath = storagePath + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        uint32_t count = static_cast<uint32_t>(utxos.size());
+        out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        for (const auto& entry : utxos) {
+            out.write(reinterpret_cast<const char*>(entry.first.hash.data()), entry.first.hash.size());
+            out.write(reinterpret_cast<const char*>(&entry.first.index), sizeof(entry.first.index));
+            out.write(reinterpret_cast<const char*>(&entry.second.assetId), sizeof(entry.second.assetId));
+            out.write(reinterpret_cast<const char*>(&entry.second.value), sizeof(entry.second.value));
+            uint32_t scriptSize = static_cast<uint32_t>(entry.second.scriptPubKey.size());
+            out.write(reinterpret_cast<const char*>(&scriptSize), sizeof(scriptSize));
+            out.write(reinterpret_cast<const char*>(entry.second.scriptPubKey.data()), scriptSize);
+        }
+        if (bestBlock) {
+            out.write(reinterpret_cast<const char*>(bestBlock->hash.data()), bestBlock->hash.size());
+            out.write(reinterpret_cast<const char*>(&bestBlock->height), sizeof(bestBlock->height));
+        }
+        out.flush();
+        if (!out) throw std::runtime_error("chainstate write failed");
     }
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, storagePath, ec);
+    if (ec) throw std::runtime_error("chainstate rename failed: " + ec.message());
 }
 
 void Chainstate::MaybeEvict() const
@@ -234,30 +489,26 @@ void Chainstate::BeginTransaction()
     inTransaction = true;
 }
 
-void Chainstate::Commit()
+void Chainstate::Commit(std::optional<BestBlockMarker> tip)
 {
     std::lock_guard<std::mutex> l(mu);
     if (!inTransaction) return;
+    if (tip) bestBlock = tip;
 
 #ifdef DRACHMA_HAVE_LEVELDB
-    if (useDb && !pending.empty()) {
+    if (useDb && (!pending.empty() || tip)) {
         leveldb::WriteBatch batch;
         for (const auto& change : pending) {
-            std::string key;
-            key.reserve(change.out.hash.size() + sizeof(change.out.index));
-            key.append(reinterpret_cast<const char*>(change.out.hash.data()), change.out.hash.size());
-            key.append(reinterpret_cast<const char*>(&change.out.index), sizeof(change.out.index));
             if (change.hadNew) {
-                std::string value;
-                value.resize(ASSET_FIELD_SIZE + sizeof(change.newValue.value));
-                value[0] = static_cast<char>(change.newValue.assetId);
-                std::memcpy(value.data() + ASSET_FIELD_SIZE, &change.newValue.value, sizeof(change.newValue.value));
-                value.append(reinterpret_cast<const char*>(change.newValue.scriptPubKey.data()), change.newValue.scriptPubKey.size());
-                batch.Put(key, value);
+                batch.Put(CoinKey(change.out), CoinValue(change.newValue));
             } else {
-                batch.Delete(key);
+                batch.Delete(CoinKey(change.out));
             }
         }
+        // The marker rides in the same batch as the coins, so after a crash
+        // the best block always names exactly the state on disk.
+        if (tip) batch.Put(kBestBlockKey, BestBlockValue(*tip));
+        StageStats(batch);
         PersistBatch(batch);
     }
     const bool use_db = useDb;
@@ -267,7 +518,7 @@ void Chainstate::Commit()
 #endif
 
     if (!use_db) {
-        Persist();
+        PersistLocked();
     }
 
     pending.clear();
@@ -280,6 +531,8 @@ void Chainstate::Rollback()
     if (!inTransaction) return;
 
     for (auto it = pending.rbegin(); it != pending.rend(); ++it) {
+        if (it->hadNew) stats.Remove(it->out, it->newValue);
+        if (it->hadOld) stats.Add(it->out, it->oldValue);
         if (it->hadOld) {
             utxos[it->out] = it->oldValue;
             cache[it->out] = it->oldValue;
@@ -293,14 +546,19 @@ void Chainstate::Rollback()
 }
 
 #ifdef DRACHMA_HAVE_LEVELDB
-void Chainstate::PersistBatch(leveldb::WriteBatch& batch) const
+void Chainstate::PersistBatch(leveldb::WriteBatch& batch, bool sync) const
 {
     if (!useDb)
         return;
     leveldb::WriteOptions opts;
-    opts.sync = true; // durability for mainnet safety
+    opts.sync = sync; // durability for mainnet safety; only bulk imports opt out
     auto status = db->Write(opts, &batch);
     if (!status.ok())
         throw std::runtime_error("leveldb write failed: " + status.ToString());
 }
+
+void Chainstate::StageStats(leveldb::WriteBatch& batch) const
+{
+    batch.Put(kStatsKey, StatsValue(stats.coins, stats.serializedSize, stats.totalAmount, stats.muhash));
+}
 #endif
@@ -1,7 +1,9 @@
 #pragma once
 
 #include "../tx/transaction.h"
+#include "../crypto/muhash.h"
 #include <cstddef>
+#include <map>
 #include <mutex>
 #include <optional>
 #include <string>
@@ -22,6 +24,21 @@ struct OutPointEq {
     bool operator()(const OutPoint& a, const OutPoint& b) const noexcept;
 };
 
+// Identifies the block whose outputs the persisted UTXO set reflects.
+struct BestBlockMarker {
+    uint256 hash{};
+    uint32_t height{0};
+};
+
+// Running aggregates over the whole UTXO set. Maintained incrementally on
+// every add/spend so callers never need to walk the coin database.
+struct UTXOSetStats {
+    uint64_t coins{0};
+    uint64_t serializedSize{0};               // key + value bytes as stored
+    std::map<uint8_t, uint64_t> totalAmount;  // per asset id
+    uint256 muhash{};                         // MuHash3072 over serialized coins
+};
+
 // Persistent chainstate with a bounded UTXO cache for fast lookups during
 // block/transaction validation.
 class Chainstate {
@@ -38,12 +55,33 @@ public:
 
     // Simple transactional API used by block validation to stage updates before
     // finalizing a new tip. Rollback restores the in-memory view without
-    // touching persistent storage.
+    // touching persistent storage. Passing `tip` to Commit records the new
+    // best block in the same write as the coin changes.
     void BeginTransaction();
-    void Commit();
+    void Commit(std::optional<BestBlockMarker> tip = std::nullopt);
     void Rollback();
 
     std::size_t CachedEntries() const;
+    bool Empty() const;
+
+    std::optional<BestBlockMarker> BestBlock() const;
+    void SetBestBlock(const BestBlockMarker& marker);
+
+    // Copy of the full UTXO set ordered by (txid, index), used to produce
+    // deterministic snapshots.
+    std::vector<std::pair<OutPoint, TxOut>> SortedUTXOs() const;
+
+    // Bulk ingestion used by snapshot loading. Safe to call concurrently from
+    // several threads; each call is persisted as one unsynced batch and the
+    // caller is expected to Flush() once the import completes. Cached
+    // entries for the imported outpoints are dropped.
+    void ImportUTXOs(const std::vector<std::pair<OutPoint, TxOut>>& coins);
+
+    // Drops every coin and the best-block marker (memory and disk).
+    void Clear();
+
+    // O(1) apart from one modular inversion to finalize the set hash.
+    UTXOSetStats Stats() const;
 
 private:
     std::string storagePath;
@@ -60,6 +98,18 @@ private:
         TxOut newValue{};
     };
     std::vector<ChangeLog> pending;
+    std::optional<BestBlockMarker> bestBlock;
+
+    struct StatsAccumulator {
+        uint64_t coins{0};
+        uint64_t serializedSize{0};
+        std::map<uint8_t, uint64_t> totalAmount;
+        MuHash3072 muhash;
+
+        void Add(const OutPoint& out, const TxOut& txout);
+        void Remove(const OutPoint& out, const TxOut& txout);
+    };
+    StatsAccumulator stats;
 
 #ifdef DRACHMA_HAVE_LEVELDB
     std::unique_ptr<leveldb::DB> db;
@@ -68,9 +118,12 @@ private:
 
     void Load();
     void Persist() const;
+    void PersistLocked() const; // caller holds `mu`
     void MaybeEvict() const;
 #ifdef DRACHMA_HAVE_LEVELDB
-    void PersistBatch(leveldb::WriteBatch& batch) const;
+    void PersistBatch(leveldb::WriteBatch& batch, bool sync = true) const;
+    // Adds the current stats record to `batch`; caller holds `mu`.
+    void StageStats(leveldb::WriteBatch& batch) const;
 #endif
 };
 
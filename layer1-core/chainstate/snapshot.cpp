@@ -0,0 +1,401 @@
+#include "snapshot.h"
+#include "../crypto/tagged_hash.h"
+#include "../tx/serialization.h"
+
+#include <openssl/sha.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr char kMagic[4] = {'D', 'R', 'U', 'S'};
+constexpr uint8_t kVersion = 1;
+constexpr size_t kHeaderSize = sizeof(kMagic) + 1 + 4 + 32 + 8 + 4 + 32;
+constexpr uint32_t kMaxChunkPayload = 256 * 1024 * 1024;
+constexpr uint64_t kMaxScriptSize = 10000;
+
+struct Chunk {
+    std::vector<uint8_t> payload;
+    uint32_t coins{0};
+};
+
+// Bounded hand-off between the reader and the decode workers so a fast disk
+// cannot buffer the whole snapshot in memory.
+class ChunkQueue {
+public:
+    explicit ChunkQueue(size_t capacity) : m_capacity(capacity) {}
+
+    void Push(Chunk chunk)
+    {
+        std::unique_lock<std::mutex> l(m_mu);
+        m_notFull.wait(l, [this] { return m_items.size() < m_capacity || m_closed; });
+        if (m_closed) return;
+        m_items.push_back(std::move(chunk));
+        m_notEmpty.notify_one();
+    }
+
+    bool Pop(Chunk& out)
+    {
+        std::unique_lock<std::mutex> l(m_mu);
+        m_notEmpty.wait(l, [this] { return !m_items.empty() || m_closed; });
+        if (m_items.empty()) return false;
+        out = std::move(m_items.front());
+        m_items.pop_front();
+        m_notFull.notify_one();
+        return true;
+    }
+
+    void Close()
+    {
+        std::lock_guard<std::mutex> l(m_mu);
+        m_closed = true;
+        m_notEmpty.notify_all();
+        m_notFull.notify_all();
+    }
+
+private:
+    size_t m_capacity;
+    std::deque<Chunk> m_items;
+    bool m_closed{false};
+    std::mutex m_mu;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+};
+
+void PutLE32(uint8_t* out, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i) out[i] = static_cast<uint8_t>(v >> (8 * i));
+}
+
+void PutLE64(uint8_t* out, uint64_t v)
+{
+    for (int i = 0; i < 8; ++i) out[i] = static_cast<uint8_t>(v >> (8 * i));
+}
+
+uint32_t GetLE32(const uint8_t* in)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= static_cast<uint32_t>(in[i]) << (8 * i);
+    return v;
+}
+
+uint64_t GetLE64(const uint8_t* in)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v |= static_cast<uint64_t>(in[i]) << (8 * i);
+    return v;
+}
+
+std::array<uint8_t, kHeaderSize> EncodeHeader(const UTXOSnapshotMetadata& meta, uint32_t chunkCount)
+{
+    std::array<uint8_t, kHeaderSize> h{};
+    size_t off = 0;
+    std::memcpy(h.data(), kMagic, sizeof(kMagic));
+    off += sizeof(kMagic);
+    h[off++] = kVersion;
+    PutLE32(h.data() + off, meta.height);
+    off += 4;
+    std::memcpy(h.data() + off, meta.blockHash.data(), meta.blockHash.size());
+    off += meta.blockHash.size();
+    PutLE64(h.data() + off, meta.coinCount);
+    off += 8;
+    PutLE32(h.data() + off, chunkCount);
+    off += 4;
+    std::memcpy(h.data() + off, meta.commitment.data(), meta.commitment.size());
+    return h;
+}
+
+UTXOSnapshotMetadata DecodeHeader(const std::array<uint8_t, kHeaderSize>& h, uint32_t& chunkCount)
+{
+    if (std::memcmp(h.data(), kMagic, sizeof(kMagic)) != 0)
+        throw std::runtime_error("not a utxo snapshot");
+    size_t off = sizeof(kMagic);
+    if (h[off++] != kVersion)
+        throw std::runtime_error("unsupported utxo snapshot version");
+    UTXOSnapshotMetadata meta;
+    meta.height = GetLE32(h.data() + off);
+    off += 4;
+    std::memcpy(meta.blockHash.data(), h.data() + off, meta.blockHash.size());
+    off += meta.blockHash.size();
+    meta.coinCount = GetLE64(h.data() + off);
+    off += 8;
+    chunkCount = GetLE32(h.data() + off);
+    off += 4;
+    std::memcpy(meta.commitment.data(), h.data() + off, meta.commitment.size());
+    return meta;
+}
+
+// The commitment binds the snapshot base and the canonical coin stream, but
+// not the chunking.
+class CommitmentHasher {
+public:
+    CommitmentHasher(uint32_t height, const uint256& blockHash)
+    {
+        SHA256_Init(&m_ctx);
+        uint8_t h[4];
+        PutLE32(h, height);
+        SHA256_Update(&m_ctx, h, sizeof(h));
+        SHA256_Update(&m_ctx, blockHash.data(), blockHash.size());
+    }
+
+    void Update(const std::vector<uint8_t>& payload)
+    {
+        if (!payload.empty()) SHA256_Update(&m_ctx, payload.data(), payload.size());
+    }
+
+    uint256 Final()
+    {
+        uint256 digest{};
+        SHA256_Final(digest.data(), &m_ctx);
+        return tagged_hash("UTXOSNAPSHOT", digest.data(), digest.size());
+    }
+
+private:
+    SHA256_CTX m_ctx{};
+};
+
+void EncodeGroup(std::vector<uint8_t>& out, const std::vector<std::pair<OutPoint, TxOut>>& coins, size_t begin, size_t end)
+{
+    const auto& txid = coins[begin].first.hash;
+    out.insert(out.end(), txid.begin(), txid.end());
+    Serializer::writeVarInt(out, end - begin);
+    for (size_t i = begin; i < end; ++i) {
+        const auto& txout = coins[i].second;
+        Serializer::writeVarInt(out, coins[i].first.index);
+        out.push_back(txout.assetId);
+        Serializer::writeVarInt(out, txout.value);
+        Serializer::writeVarInt(out, txout.scriptPubKey.size());
+        out.insert(out.end(), txout.scriptPubKey.begin(), txout.scriptPubKey.end());
+    }
+}
+
+std::vector<std::pair<OutPoint, TxOut>> DecodeChunk(const Chunk& chunk)
+{
+    std::vector<std::pair<OutPoint, TxOut>> coins;
+    coins.reserve(chunk.coins);
+    const auto& p = chunk.payload;
+    size_t off = 0;
+    while (off < p.size()) {
+        OutPoint op{};
+        if (off + op.hash.size() > p.size()) throw std::runtime_error("truncated snapshot txid");
+        std::memcpy(op.hash.data(), p.data() + off, op.hash.size());
+        off += op.hash.size();
+        uint64_t outputs = Serializer::readVarInt(p, off);
+        if (outputs == 0 || outputs > chunk.coins - coins.size())
+            throw std::runtime_error("bad snapshot output count");
+        uint64_t lastIndex = 0;
+        for (uint64_t i = 0; i < outputs; ++i) {
+            uint64_t index = Serializer::readVarInt(p, off);
+            if (index > UINT32_MAX || (i > 0 && index <= lastIndex))
+                throw std::runtime_error("bad snapshot output index");
+            lastIndex = index;
+            op.index = static_cast<uint32_t>(index);
+            TxOut txout{};
+            if (off >= p.size()) throw std::runtime_error("truncated snapshot coin");
+            txout.assetId = p[off++];
+            if (!IsValidAssetId(txout.assetId)) throw std::runtime_error("bad snapshot asset");
+            txout.value = Serializer::readVarInt(p, off);
+            uint64_t scriptLen = Serializer::readVarInt(p, off);
+            if (scriptLen > kMaxScriptSize || off + scriptLen > p.size())
+                throw std::runtime_error("bad snapshot script");
+            txout.scriptPubKey.assign(p.begin() + off, p.begin() + off + scriptLen);
+            off += scriptLen;
+            coins.emplace_back(op, std::move(txout));
+        }
+    }
+    if (coins.size() != chunk.coins) throw std::runtime_error("snapshot chunk coin count mismatch");
+    return coins;
+}
+
+void WriteChunk(std::ofstream& out, const std::vector<uint8_t>& payload, uint32_t coins)
+{
+    uint8_t prefix[8];
+    PutLE32(prefix, static_cast<uint32_t>(payload.size()));
+    PutLE32(prefix + 4, coins);
+    out.write(reinterpret_cast<const char*>(prefix), sizeof(prefix));
+    out.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+}
+
+} // namespace
+
+UTXOSnapshotMetadata DumpUTXOSnapshot(const Chainstate& chainstate, const std::string& path, std::size_t coinsPerChunk)
+{
+    auto best = chainstate.BestBlock();
+    if (!best) throw std::runtime_error("chainstate has no best block");
+    if (coinsPerChunk == 0) coinsPerChunk = 1;
+
+    UTXOSnapshotMetadata meta;
+    meta.height = best->height;
+    meta.blockHash = best->hash;
+
+    const auto coins = chainstate.SortedUTXOs();
+    meta.coinCount = coins.size();
+
+    const std::string tmpPath = path + ".tmp";
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!out) throw std::runtime_error("cannot open snapshot file");
+    auto placeholder = EncodeHeader(meta, 0);
+    out.write(reinterpret_cast<const char*>(placeholder.data()), placeholder.size());
+
+    CommitmentHasher hasher(meta.height, meta.blockHash);
+    std::vector<uint8_t> payload;
+    uint32_t chunkCoins = 0;
+    uint32_t chunkCount = 0;
+    auto flush = [&]() {
+        if (chunkCoins == 0) return;
+        hasher.Update(payload);
+        WriteChunk(out, payload, chunkCoins);
+        payload.clear();
+        chunkCoins = 0;
+        ++chunkCount;
+    };
+
+    size_t i = 0;
+    while (i < coins.size()) {
+        size_t end = i + 1;
+        while (end < coins.size() && coins[end].first.hash == coins[i].first.hash) ++end;
+        EncodeGroup(payload, coins, i, end);
+        chunkCoins += static_cast<uint32_t>(end - i);
+        i = end;
+        if (chunkCoins >= coinsPerChunk) flush();
+    }
+    flush();
+
+    meta.commitment = hasher.Final();
+    auto header = EncodeHeader(meta, chunkCount);
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(header.data()), header.size());
+    out.flush();
+    if (!out) throw std::runtime_error("failed writing snapshot file");
+    out.close();
+
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec) throw std::runtime_error("cannot finalize snapshot file: " + ec.message());
+    return meta;
+}
+
+UTXOSnapshotMetadata ReadUTXOSnapshotMetadata(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("cannot open snapshot file");
+    std::array<uint8_t, kHeaderSize> header{};
+    in.read(reinterpret_cast<char*>(header.data()), header.size());
+    if (!in) throw std::runtime_error("truncated snapshot header");
+    uint32_t chunkCount = 0;
+    return DecodeHeader(header, chunkCount);
+}
+
+UTXOSnapshotMetadata LoadUTXOSnapshot(Chainstate& chainstate,
+                                      const std::string& path,
+                                      const consensus::Params& params,
+                                      const std::optional<uint256>& expectedCommitment,
+                                      std::size_t workers)
+{
+    if (!chainstate.Empty() || chainstate.BestBlock())
+        throw std::runtime_error("chainstate must be empty to load a snapshot");
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("cannot open snapshot file");
+    std::array<uint8_t, kHeaderSize> header{};
+    in.read(reinterpret_cast<char*>(header.data()), header.size());
+    if (!in) throw std::runtime_error("truncated snapshot header");
+    uint32_t chunkCount = 0;
+    const auto meta = DecodeHeader(header, chunkCount);
+
+    // Refuse before touching the chainstate if the claimed commitment is not
+    // one we trust.
+    uint256 trusted{};
+    if (expectedCommitment) {
+        trusted = *expectedCommitment;
+    } else {
+        auto it = params.assumeutxo.find(meta.height);
+        if (it == params.assumeutxo.end())
+            throw std::runtime_error("no trusted commitment for snapshot height " + std::to_string(meta.height));
+        trusted = it->second;
+    }
+    if (meta.commitment != trusted)
+        throw std::runtime_error("snapshot commitment does not match trusted value");
+
+    if (workers == 0) workers = std::max(1u, std::thread::hardware_concurrency());
+    ChunkQueue queue(workers * 2);
+    std::atomic<uint64_t> imported{0};
+    std::mutex errMu;
+    std::exception_ptr workerError;
+
+    std::vector<std::thread> pool;
+    pool.reserve(workers);
+    for (size_t i = 0; i < workers; ++i) {
+        pool.emplace_back([&]() {
+            Chunk chunk;
+            while (queue.Pop(chunk)) {
+                try {
+                    auto coins = DecodeChunk(chunk);
+                    chainstate.ImportUTXOs(coins);
+                    imported.fetch_add(coins.size(), std::memory_order_relaxed);
+                } catch (...) {
+                    std::lock_guard<std::mutex> l(errMu);
+                    if (!workerError) workerError = std::current_exception();
+                    queue.Close();
+                }
+            }
+        });
+    }
+
+    std::exception_ptr readerError;
+    CommitmentHasher hasher(meta.height, meta.blockHash);
+    try {
+        for (uint32_t c = 0; c < chunkCount; ++c) {
+            uint8_t prefix[8];
+            in.read(reinterpret_cast<char*>(prefix), sizeof(prefix));
+            if (!in) throw std::runtime_error("truncated snapshot chunk header");
+            Chunk chunk;
+            const uint32_t size = GetLE32(prefix);
+            chunk.coins = GetLE32(prefix + 4);
+            if (size == 0 || size > kMaxChunkPayload || chunk.coins == 0)
+                throw std::runtime_error("invalid snapshot chunk size");
+            chunk.payload.resize(size);
+            in.read(reinterpret_cast<char*>(chunk.payload.data()), size);
+            if (!in) throw std::runtime_error("truncated snapshot chunk");
+            hasher.Update(chunk.payload);
+            queue.Push(std::move(chunk));
+            {
+                std::lock_guard<std::mutex> l(errMu);
+                if (workerError) break;
+            }
+        }
+        if (in.peek() != std::char_traits<char>::eof())
+            throw std::runtime_error("trailing data after snapshot");
+    } catch (...) {
+        readerError = std::current_exception();
+    }
+    queue.Close();
+    for (auto& t : pool) t.join();
+
+    try {
+        if (workerError) std::rethrow_exception(workerError);
+        if (readerError) std::rethrow_exception(readerError);
+        if (hasher.Final() != meta.commitment)
+            throw std::runtime_error("snapshot content does not match its commitment");
+        if (imported.load() != meta.coinCount)
+            throw std::runtime_error("snapshot coin count mismatch");
+    } catch (...) {
+        chainstate.Clear();
+        throw;
+    }
+
+    // The marker write is synced, which also makes the unsynced bulk batches durable.
+    chainstate.SetBestBlock(BestBlockMarker{meta.blockHash, meta.height});
+    return meta;
+}
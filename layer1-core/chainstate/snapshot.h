@@ -0,0 +1,46 @@
+#pragma once
+
+#include "coins.h"
+#include "../consensus/params.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+// UTXO set snapshots let a fresh node seed its chainstate from a file instead
+// of replaying every block through ConnectBlock.
+//
+// File layout (all integers little-endian):
+//   header: magic "DRUS" | version(1) | height(4) | blockHash(32) |
+//           coinCount(8) | chunkCount(4) | commitment(32)
+//   chunk:  payloadSize(4) | coinCount(4) | payload
+//   payload: repeated groups of
+//           txid(32) | varint outputs | outputs × (varint index | asset(1) |
+//                                                 varint value | varint scriptLen | script)
+//
+// Coins are sorted by (txid, index) and a txid group never spans two chunks,
+// so the commitment is independent of the chunk size.
+struct UTXOSnapshotMetadata {
+    uint32_t height{0};
+    uint256 blockHash{};
+    uint64_t coinCount{0};
+    uint256 commitment{};
+};
+
+// Writes the chainstate to `path` (via a temporary file and rename). The
+// chainstate must have a best-block marker.
+UTXOSnapshotMetadata DumpUTXOSnapshot(const Chainstate& chainstate, const std::string& path, std::size_t coinsPerChunk = 64 * 1024);
+
+// Reads only the header of a snapshot file.
+UTXOSnapshotMetadata ReadUTXOSnapshotMetadata(const std::string& path);
+
+// Loads a snapshot into an empty chainstate. Chunks are decoded and written to
+// LevelDB on `workers` threads (0 = hardware concurrency). The commitment is
+// checked against `expectedCommitment` when supplied, otherwise against
+// params.assumeutxo; if neither knows the height the load is refused. On any
+// failure the chainstate is cleared and std::runtime_error is thrown.
+UTXOSnapshotMetadata LoadUTXOSnapshot(Chainstate& chainstate,
+                                      const std::string& path,
+                                      const consensus::Params& params,
+                                      const std::optional<uint256>& expectedCommitment = std::nullopt,
+                                      std::size_t workers = 0);
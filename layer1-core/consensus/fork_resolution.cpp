@@ -52,6 +52,27 @@ std::vector<uint256> ForkResolver::ReorgPath(const uint256& newTip) const
     return path;
 }
 
+std::optional<BlockMeta> ForkResolver::Lookup(const uint256& hash) const
+{
+    std::lock_guard<std::mutex> l(m_mu);
+    auto it = m_index.find(hash);
+    if (it == m_index.end())
+        return std::nullopt;
+    return it->second;
+}
+
+bool ForkResolver::IsAncestor(const uint256& ancestor, const uint256& descendant) const
+{
+    std::lock_guard<std::mutex> l(m_mu);
+    auto anc = m_index.find(ancestor);
+    if (anc == m_index.end())
+        return false;
+    auto it = m_index.find(descendant);
+    while (it != m_index.end() && it->second.height > anc->second.height)
+        it = m_index.find(it->second.parent);
+    return it != m_index.end() && it->second.hash == ancestor;
+}
+
 bool ForkResolver::IsBetterChain(const BlockMeta& candidate) const
 {
     if (!m_bestTip)
@@ -119,7 +140,7 @@ bool ForkResolver::AttachAndUpdateTip(const BlockHeader& header, const uint256&
         return false;
     }
 
-    BlockMeta meta{hash, parentHash, height, header.time, header.bits, cumulative};
+    BlockMeta meta{hash, parentHash, height, header.time, header.bits, cumulative, header};
     m_index[hash] = meta;
 
     if (!m_bestTip) {
@@ -33,6 +33,7 @@ struct BlockMeta {
     uint32_t time{0};
     uint32_t bits{0};
     ChainWork chainWork{};
+    BlockHeader header{};
 };
 
 struct OrphanBlock {
@@ -78,6 +79,10 @@ public:
     const BlockMeta* Tip() const { return m_bestTip ? &(*m_bestTip) : nullptr; }
     std::vector<uint256> ReorgPath(const uint256& newTip) const;
 
+    std::optional<BlockMeta> Lookup(const uint256& hash) const;
+    // True if `ancestor` equals `descendant` or lies on its parent chain.
+    bool IsAncestor(const uint256& ancestor, const uint256& descendant) const;
+
 private:
     uint32_t m_finalizationDepth;
     uint32_t m_reorgMarginBps; // 10_000 = 100%
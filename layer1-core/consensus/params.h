@@ -50,6 +50,11 @@ struct Params {
 
     // Multi-asset activation height (regenesis/fork point).
     uint32_t nMultiAssetActivationHeight{0};
+
+    // Known-good UTXO snapshot commitments keyed by snapshot height. A
+    // snapshot at one of these heights must match the listed commitment
+    // before it can seed a chainstate.
+    std::map<uint32_t, uint256> assumeutxo{};
 };
 
 const Params& Main();
@@ -0,0 +1,120 @@
+#include "crc32c.h"
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define DRACHMA_CRC32C_SSE42 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define DRACHMA_CRC32C_ARM 1
+#endif
+
+namespace {
+
+constexpr uint32_t kPolynomial = 0x82F63B78;
+
+struct Tables {
+    std::array<std::array<uint32_t, 256>, 8> t{};
+    Tables()
+    {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int k = 0; k < 8; ++k) crc = (crc >> 1) ^ (kPolynomial & (0u - (crc & 1)));
+            t[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (size_t k = 1; k < 8; ++k) t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+        }
+    }
+};
+
+const Tables& SoftwareTables()
+{
+    static const Tables tables;
+    return tables;
+}
+
+// `crc` is the raw register (already inverted) in all the kernels below.
+uint32_t Software(const uint8_t* p, std::size_t len, uint32_t crc)
+{
+    const auto& t = SoftwareTables().t;
+    while (len >= 8) {
+        uint32_t lo = 0;
+        uint32_t hi = 0;
+        std::memcpy(&lo, p, 4);
+        std::memcpy(&hi, p + 4, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        lo = __builtin_bswap32(lo);
+        hi = __builtin_bswap32(hi);
+#endif
+        lo ^= crc;
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+#if defined(DRACHMA_CRC32C_SSE42)
+__attribute__((target("sse4.2"))) uint32_t Hardware(const uint8_t* p, std::size_t len, uint32_t crc)
+{
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t v = 0;
+        std::memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+        p += 8;
+        len -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (len--) crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+
+bool DetectHardware()
+{
+    return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(DRACHMA_CRC32C_ARM)
+uint32_t Hardware(const uint8_t* p, std::size_t len, uint32_t crc)
+{
+    while (len >= 8) {
+        uint64_t v = 0;
+        std::memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) crc = __crc32cb(crc, *p++);
+    return crc;
+}
+
+bool DetectHardware()
+{
+    return true;
+}
+#endif
+
+} // namespace
+
+bool Crc32cAccelerated()
+{
+#if defined(DRACHMA_CRC32C_SSE42) || defined(DRACHMA_CRC32C_ARM)
+    static const bool accelerated = DetectHardware();
+    return accelerated;
+#else
+    return false;
+#endif
+}
+
+uint32_t Crc32c(const uint8_t* data, std::size_t len, uint32_t crc)
+{
+    crc = ~crc;
+#if defined(DRACHMA_CRC32C_SSE42) || defined(DRACHMA_CRC32C_ARM)
+    if (Crc32cAccelerated()) return ~Hardware(data, len, crc);
+#endif
+    return ~Software(data, len, crc);
+}
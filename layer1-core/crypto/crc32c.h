@@ -0,0 +1,15 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32C (Castagnoli), as used by iSCSI and ext4: reflected polynomial
+// 0x82F63B78 with the usual initial and final inversion. Chaining is
+// supported: Crc32c(b, n, Crc32c(a, m)) equals the CRC of a followed by b.
+//
+// Uses the SSE4.2 crc32 instruction on x86-64 (detected at runtime) or the
+// ARMv8 CRC extension when compiled in; otherwise slicing-by-8 tables.
+// Meant for detecting accidental corruption only.
+uint32_t Crc32c(const uint8_t* data, std::size_t len, uint32_t crc = 0);
+
+// Whether Crc32c() runs on a hardware instruction on this machine.
+bool Crc32cAccelerated();
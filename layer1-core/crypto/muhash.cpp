@@ -0,0 +1,138 @@
+#include "muhash.h"
+
+#include <openssl/bn.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#include <memory>
+#include <stdexcept>
+
+namespace {
+
+using bn_ptr = std::unique_ptr<BIGNUM, decltype(&BN_free)>;
+using bn_ctx_ptr = std::unique_ptr<BN_CTX, decltype(&BN_CTX_free)>;
+
+bn_ptr NewBn() { return bn_ptr(BN_new(), &BN_free); }
+
+bn_ptr FromNum(const MuHash3072::Num3072& num)
+{
+    return bn_ptr(BN_bin2bn(num.data(), static_cast<int>(num.size()), nullptr), &BN_free);
+}
+
+void ToNum(const BIGNUM* bn, MuHash3072::Num3072& out)
+{
+    if (BN_bn2binpad(bn, out.data(), static_cast<int>(out.size())) != static_cast<int>(out.size()))
+        throw std::runtime_error("muhash: value does not fit 3072 bits");
+}
+
+// p = 2^3072 - 1103717, the largest 3072-bit safe prime.
+const BIGNUM* Modulus()
+{
+    static const bn_ptr p = [] {
+        bn_ptr two_pow = NewBn();
+        bn_ptr offset = NewBn();
+        if (!two_pow || !offset || BN_set_bit(two_pow.get(), 3072) != 1 || BN_set_word(offset.get(), 1103717) != 1 ||
+            BN_sub(two_pow.get(), two_pow.get(), offset.get()) != 1)
+            throw std::runtime_error("muhash: modulus setup failed");
+        return two_pow;
+    }();
+    return p.get();
+}
+
+MuHash3072::Num3072 One()
+{
+    MuHash3072::Num3072 one{};
+    one.back() = 1;
+    return one;
+}
+
+// ChaCha20 keystream keyed by SHA256(data), reduced into the group.
+MuHash3072::Num3072 ToElement(const uint8_t* data, std::size_t size)
+{
+    uint8_t key[SHA256_DIGEST_LENGTH];
+    SHA256(data, size, key);
+
+    MuHash3072::Num3072 stream{};
+    const uint8_t iv[16] = {0};
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) throw std::runtime_error("EVP_CIPHER_CTX_new failed");
+    int len = 0;
+    const bool ok = EVP_EncryptInit_ex(ctx, EVP_chacha20(), nullptr, key, iv) == 1 &&
+                    EVP_EncryptUpdate(ctx, stream.data(), &len, stream.data(), static_cast<int>(stream.size())) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    if (!ok) throw std::runtime_error("muhash: chacha20 failed");
+
+    // Values >= p occur with probability ~2^-3052; reduce for canonicity.
+    bn_ptr bn = FromNum(stream);
+    if (BN_cmp(bn.get(), Modulus()) >= 0) {
+        BN_sub(bn.get(), bn.get(), Modulus());
+        ToNum(bn.get(), stream);
+    }
+    return stream;
+}
+
+void MulMod(MuHash3072::Num3072& acc, const MuHash3072::Num3072& factor)
+{
+    bn_ctx_ptr ctx(BN_CTX_new(), &BN_CTX_free);
+    bn_ptr a = FromNum(acc);
+    bn_ptr b = FromNum(factor);
+    bn_ptr r = NewBn();
+    if (!ctx || !a || !b || !r || BN_mod_mul(r.get(), a.get(), b.get(), Modulus(), ctx.get()) != 1)
+        throw std::runtime_error("muhash: multiplication failed");
+    ToNum(r.get(), acc);
+}
+
+} // namespace
+
+MuHash3072::MuHash3072() : numerator(One()), denominator(One()) {}
+
+void MuHash3072::Insert(const uint8_t* data, std::size_t size)
+{
+    MulMod(numerator, ToElement(data, size));
+}
+
+void MuHash3072::Remove(const uint8_t* data, std::size_t size)
+{
+    MulMod(denominator, ToElement(data, size));
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& other)
+{
+    MulMod(numerator, other.numerator);
+    MulMod(denominator, other.denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& other)
+{
+    MulMod(numerator, other.denominator);
+    MulMod(denominator, other.numerator);
+    return *this;
+}
+
+uint256 MuHash3072::Finalize() const
+{
+    bn_ctx_ptr ctx(BN_CTX_new(), &BN_CTX_free);
+    bn_ptr num = FromNum(numerator);
+    bn_ptr den = FromNum(denominator);
+    bn_ptr inv = NewBn();
+    bn_ptr result = NewBn();
+    if (!ctx || !num || !den || !inv || !result ||
+        !BN_mod_inverse(inv.get(), den.get(), Modulus(), ctx.get()) ||
+        BN_mod_mul(result.get(), num.get(), inv.get(), Modulus(), ctx.get()) != 1)
+        throw std::runtime_error("muhash: finalize failed");
+
+    Num3072 normalized{};
+    ToNum(result.get(), normalized);
+    uint256 out{};
+    SHA256(normalized.data(), normalized.size(), out.data());
+    return out;
+}
+
+MuHash3072 MuHash3072::FromParts(const Num3072& numerator, const Num3072& denominator)
+{
+    MuHash3072 h;
+    h.numerator = numerator;
+    h.denominator = denominator;
+    return h;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+using uint256 = std::array<uint8_t, 32>;
+
+// Rolling multiset hash over the group of integers modulo 2^3072 - 1103717.
+// Each element is expanded to a 3072-bit number with ChaCha20 keyed by
+// SHA256(element); the set hash is the product of all inserted numbers divided
+// by the product of all removed ones. Insert and Remove commute, so two nodes
+// holding the same set agree on Finalize() regardless of update order, and any
+// update can be undone by applying the opposite operation.
+//
+// Numerator and denominator are tracked separately so that Remove costs a
+// single multiplication; the modular inverse is only taken in Finalize().
+class MuHash3072 {
+public:
+    static constexpr std::size_t BYTE_SIZE = 384;
+    using Num3072 = std::array<uint8_t, BYTE_SIZE>; // big-endian
+
+    MuHash3072();
+
+    void Insert(const uint8_t* data, std::size_t size);
+    void Remove(const uint8_t* data, std::size_t size);
+
+    // Combine whole sets: *this becomes (this ∪ other) or (this \ other).
+    MuHash3072& operator*=(const MuHash3072& other);
+    MuHash3072& operator/=(const MuHash3072& other);
+
+    // SHA256 of the normalized 3072-bit value.
+    uint256 Finalize() const;
+
+    const Num3072& Numerator() const { return numerator; }
+    const Num3072& Denominator() const { return denominator; }
+    static MuHash3072 FromParts(const Num3072& numerator, const Num3072& denominator);
+
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+};
@@ -0,0 +1,54 @@
+#include "siphash.h"
+
+namespace {
+
+inline uint64_t Rotl(uint64_t x, int b)
+{
+    return (x << b) | (x >> (64 - b));
+}
+
+inline void Round(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3)
+{
+    v0 += v1; v1 = Rotl(v1, 13); v1 ^= v0; v0 = Rotl(v0, 32);
+    v2 += v3; v3 = Rotl(v3, 16); v3 ^= v2;
+    v0 += v3; v3 = Rotl(v3, 21); v3 ^= v0;
+    v2 += v1; v1 = Rotl(v1, 17); v1 ^= v2; v2 = Rotl(v2, 32);
+}
+
+inline uint64_t ReadLE64(const uint8_t* p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+}
+
+} // namespace
+
+uint64_t SipHash24(uint64_t k0, uint64_t k1, const uint8_t* data, std::size_t len)
+{
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ k1;
+
+    const std::size_t whole = len - (len % 8);
+    for (std::size_t i = 0; i < whole; i += 8) {
+        const uint64_t m = ReadLE64(data + i);
+        v3 ^= m;
+        Round(v0, v1, v2, v3);
+        Round(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+
+    uint64_t last = static_cast<uint64_t>(len) << 56;
+    for (std::size_t i = 0; i < len % 8; ++i)
+        last |= static_cast<uint64_t>(data[whole + i]) << (8 * i);
+    v3 ^= last;
+    Round(v0, v1, v2, v3);
+    Round(v0, v1, v2, v3);
+    v0 ^= last;
+
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; ++i) Round(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// SipHash-2-4 with a 128-bit key given as two little-endian 64-bit words.
+// Used where short, keyed, non-cryptographic-strength hashes are needed
+// (compact filter elements, short transaction ids).
+uint64_t SipHash24(uint64_t k0, uint64_t k1, const uint8_t* data, std::size_t len);
+
+// Same, for a 32-byte value.
+inline uint64_t SipHash24(uint64_t k0, uint64_t k1, const std::array<uint8_t, 32>& value)
+{
+    return SipHash24(k0, k1, value.data(), value.size());
+}
@@ -1,20 +1,37 @@
 #include <boost/asio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <csignal>
 #include <filesystem>
 #include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
 #include <iostream>
 #include <optional>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <type_traits>
 #include <vector>
 
+#include "chainstate/coins.h"
 #include "consensus/params.h"
 #include "validation/validation.h"
+#include "validation/assumevalid.h"
+#include "validation/replay.h"
+#include "validation/import.h"
+#include "storage/blockstore.h"
+#include "storage/scrubber.h"
 #include "../layer2-services/policy/policy.h"
 #include "../layer2-services/mempool/mempool.h"
 #include "../layer2-services/net/p2p.h"
+#include "../layer2-services/net/block_sync.h"
+#include "../layer2-services/net/compact_relay.h"
 #include "../layer2-services/rpc/rpcserver.h"
+#include "../layer2-services/index/addressindex.h"
+#include "../layer2-services/index/blockfilterindex.h"
 #include "../layer2-services/index/txindex.h"
 #include "../layer2-services/wallet/wallet.h"
 #include "../sidechain/wasm/runtime/engine.h"
@@ -44,7 +61,38 @@ void PrintHelp()
     std::cout << "  --rpcpassword=<pass>  RPC password (default: pass)\n";
     std::cout << "  --rpcport=<port>      RPC port (default: 8332)\n";
     std::cout << "  --port=<port>         P2P port (default: 9333)\n";
-    std::cout << "  --nolisten            Disable P2P listening\n\n";
+    std::cout << "  --nolisten            Disable P2P listening\n";
+    std::cout << "  --maxoutbound=<n>     Outbound peer connections to keep (default: 8)\n";
+    std::cout << "  --maxupload=<KiB/s>   Upload cap across all peers; transaction relay waits\n";
+    std::cout << "                        for blocks (default: 0, none)\n";
+    std::cout << "  --maxpeerupload=<KiB/s>\n";
+    std::cout << "                        Upload cap for each peer (default: 0, none)\n";
+    std::cout << "  --assumevalid=<hash>  Skip signature checks for ancestors of this block\n";
+    std::cout << "                        (default: latest checkpoint, 0 to disable)\n";
+    std::cout << "  --addrindex           Maintain an address index for getaddresshistory and\n";
+    std::cout << "                        getaddressutxos (default: off)\n";
+    std::cout << "  --blockfilterindex    Maintain compact block filters and serve them to\n";
+    std::cout << "                        light clients (default: off)\n";
+    std::cout << "  --compressblocks      Compress newly stored blocks; saves disk at the cost\n";
+    std::cout << "                        of direct transaction reads (default: off)\n";
+    std::cout << "  --wireblocks          Store new blocks in their network encoding so peers\n";
+    std::cout << "                        are served without re-encoding (default: off)\n";
+    std::cout << "  --prune=<MiB>         Delete old block files to stay within this budget;\n";
+    std::cout << "                        0 disables, otherwise at least 550 (default: 0)\n";
+    std::cout << "  --scrubrate=<MiB/s>   Disk rate of the background block file check;\n";
+    std::cout << "                        0 disables it (default: 8)\n";
+    std::cout << "  --txreconciliation    Reconcile transaction announcements with peers that\n";
+    std::cout << "                        support it instead of flooding them (default: off)\n";
+    std::cout << "  --v2transport         Encrypt connections with peers that support it\n";
+    std::cout << "                        (default: off)\n";
+    std::cout << "  --netthreads=<n>      Threads for network and RPC I/O (default: 2)\n";
+    std::cout << "  --msgthreads=<n>      Threads handling P2P messages (default: 2)\n";
+    std::cout << "  --valthreads=<n>      Threads validating transactions from peers\n";
+    std::cout << "                        (default: 2)\n";
+    std::cout << "  --reindex             Rebuild the block index, chainstate and indexes from\n";
+    std::cout << "                        the stored block files\n";
+    std::cout << "  --loadblock=<file>    Import blocks from a bootstrap file on startup (may be\n";
+    std::cout << "                        given more than once)\n\n";
     std::cout << "For more information, visit: https://github.com/Tsoympet/PARTHENON-CHAIN\n";
 }
 
@@ -72,6 +120,23 @@ struct Config {
     uint16_t rpcport{8332};
     uint16_t p2pport{9333};
     bool listen{true};
+    unsigned maxOutbound{8};
+    uint64_t maxUploadKiBps{0};     // 0 = no cap
+    uint64_t maxPeerUploadKiBps{0};
+    std::optional<std::string> assumeValid; // unset = network default
+    bool addrIndex{false};
+    bool blockFilterIndex{false};
+    bool compressBlocks{false};
+    bool wireBlocks{false};
+    uint64_t pruneMiB{0}; // 0 = keep every block
+    uint64_t scrubMiBps{8}; // 0 = no background scrubbing
+    bool reindex{false};
+    std::vector<std::string> loadBlocks;
+    bool txReconciliation{false};
+    bool v2Transport{false};
+    unsigned netThreads{2};
+    unsigned msgThreads{2};
+    unsigned valThreads{2};
 };
 
 Config ParseArgs(int argc, char* argv[])
@@ -98,6 +163,23 @@ Config ParseArgs(int argc, char* argv[])
         else if (takeValue("--rpcport=", cfg.rpcport)) {}
         else if (takeValue("--port=", cfg.p2pport)) {}
         else if (arg == "--nolisten") cfg.listen = false;
+        else if (takeValue("--maxoutbound=", cfg.maxOutbound)) {}
+        else if (takeValue("--maxupload=", cfg.maxUploadKiBps)) {}
+        else if (takeValue("--maxpeerupload=", cfg.maxPeerUploadKiBps)) {}
+        else if (arg.rfind("--assumevalid=", 0) == 0) cfg.assumeValid = arg.substr(14);
+        else if (arg == "--addrindex") cfg.addrIndex = true;
+        else if (arg == "--blockfilterindex") cfg.blockFilterIndex = true;
+        else if (arg == "--compressblocks") cfg.compressBlocks = true;
+        else if (arg == "--wireblocks") cfg.wireBlocks = true;
+        else if (takeValue("--prune=", cfg.pruneMiB)) {}
+        else if (takeValue("--scrubrate=", cfg.scrubMiBps)) {}
+        else if (arg == "--reindex") cfg.reindex = true;
+        else if (arg == "--txreconciliation") cfg.txReconciliation = true;
+        else if (arg == "--v2transport") cfg.v2Transport = true;
+        else if (takeValue("--netthreads=", cfg.netThreads)) {}
+        else if (takeValue("--msgthreads=", cfg.msgThreads)) {}
+        else if (takeValue("--valthreads=", cfg.valThreads)) {}
+        else if (arg.rfind("--loadblock=", 0) == 0) cfg.loadBlocks.push_back(arg.substr(12));
     }
     return cfg;
 }
@@ -116,6 +198,38 @@ void EnsureDatadir(const std::string& path)
     (void)ec;
 }
 
+constexpr uint64_t kMinPruneMiB = 550;
+
+// Highest height pruning may remove. The last k_limited_blocks stay for
+// peers and reorgs, and so does every block an index has yet to read.
+std::optional<uint32_t> PruneLimit(std::optional<uint32_t> tip, const std::vector<const indexer::BaseIndex*>& indexes)
+{
+    if (!tip || *tip < net::P2PNode::k_limited_blocks) return std::nullopt;
+    uint32_t limit = *tip - net::P2PNode::k_limited_blocks;
+    for (const auto* idx : indexes) {
+        const auto indexed = idx->IndexedHeight();
+        if (!indexed) return std::nullopt;
+        limit = std::min(limit, *indexed);
+    }
+    return limit;
+}
+
+ImportOptions ImportProgress(const std::string& what)
+{
+    ImportOptions opts;
+    opts.progressInterval = 10000;
+    opts.progress = [what](const ImportStats& s) {
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(1) << what << ": " << s.blocks << " block(s)";
+        if (s.height) line << " to height " << *s.height;
+        line << ", " << (s.elapsedSeconds > 0 ? s.blocks / s.elapsedSeconds : 0.0) << " blocks/s; reading "
+             << s.readSeconds << "s, waited " << s.waitReadSeconds << "s for disk and " << s.waitValidateSeconds
+             << "s for validation\n";
+        std::cout << line.str();
+    };
+    return opts;
+}
+
 std::vector<uint8_t> SeedFromPath(const std::string& path)
 {
     std::vector<uint8_t> seed;
@@ -143,9 +257,24 @@ int main(int argc, char* argv[])
     }
     
     Config cfg = ParseArgs(argc, argv);
+    if (cfg.pruneMiB != 0 && cfg.pruneMiB < kMinPruneMiB) {
+        std::cerr << "Error: --prune must be 0 or at least " << kMinPruneMiB << " MiB\n";
+        return 1;
+    }
+    if (cfg.compressBlocks && cfg.wireBlocks) {
+        std::cerr << "Error: --compressblocks and --wireblocks cannot be combined\n";
+        return 1;
+    }
     EnsureDatadir(cfg.datadir);
 
     const auto& params = ParamsFor(cfg.network);
+    std::optional<uint256> assumeValid;
+    try {
+        assumeValid = cfg.assumeValid ? ParseAssumeValid(*cfg.assumeValid) : DefaultAssumeValid(params);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
 
     boost::asio::io_context io;
     policy::FeePolicy feePolicy(1, 100000, 100);
@@ -160,32 +289,303 @@ int main(int argc, char* argv[])
         // best effort; wallet will still function for watching balances
     }
 
+    Chainstate chainstate(cfg.datadir + "/chainstate");
+    BlockStore blocks(cfg.datadir + "/blocks.dat", BlockStoreOptions{BlockStore::kDefaultSegmentSize, cfg.compressBlocks, cfg.wireBlocks});
+
+    if (cfg.reindex) {
+        // The optional indexes rebuild themselves from the store once started.
+        std::error_code ec;
+        for (const char* dir : {"/txindex", "/addrindex", "/blockfilter"})
+            std::filesystem::remove_all(cfg.datadir + dir, ec);
+    }
     txindex::TxIndex index;
     index.Open(cfg.datadir + "/txindex");
+    addrindex::AddressIndex addrIndex;
+    if (cfg.addrIndex) addrIndex.Open(cfg.datadir + "/addrindex");
+    blockfilter::BlockFilterIndex filterIndex;
+    if (cfg.blockFilterIndex) filterIndex.Open(cfg.datadir + "/blockfilter");
+
+    // Bring the chainstate back in line with the block store after an
+    // unclean shutdown.
+    try {
+        if (blocks.RecoveredOnOpen() > 0)
+            std::cout << "Recovered " << blocks.RecoveredOnOpen() << " unindexed block(s) from blocks.dat\n";
+        if (cfg.reindex) {
+            std::cout << "Reindexing: " << RebuildBlockIndex(blocks, params) << " block(s) found in the block files\n";
+            const auto result = ReindexChainstate(chainstate, blocks, params, ImportProgress("Reindex"));
+            if (result.failedHeight)
+                std::cerr << "Warning: stored block " << *result.failedHeight << " rejected during reindex: " << result.error << "\n";
+        } else {
+            const auto replay = ReplayBlocks(chainstate, blocks, params);
+            if (replay.replayed > 0)
+                std::cout << "Replayed " << replay.replayed << " block(s) into the chainstate\n";
+            if (replay.failedHeight)
+                std::cerr << "Warning: stored block " << *replay.failedHeight << " rejected during replay: " << replay.error << "\n";
+        }
+        for (const auto& file : cfg.loadBlocks) {
+            const auto result = ImportBootstrap(file, chainstate, blocks, params, ImportProgress("Importing " + file));
+            if (result.failedHeight)
+                std::cerr << "Warning: block " << *result.failedHeight << " from " << file << " rejected: " << result.error << "\n";
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
+    // The indexes catch up with the chainstate on their own threads.
+    const auto tip = chainstate.BestBlock();
+    const auto tipHeight = tip ? std::optional<uint32_t>(tip->height) : std::nullopt;
+    std::vector<const indexer::BaseIndex*> activeIndexes{&index};
+    if (cfg.addrIndex) activeIndexes.push_back(&addrIndex);
+    if (cfg.blockFilterIndex) activeIndexes.push_back(&filterIndex);
+    if (const auto pruned = blocks.PrunedHeight()) {
+        // An index can only be built from blocks that are still on disk.
+        for (const auto* idx : activeIndexes) {
+            const auto indexed = idx->IndexedHeight();
+            if (!indexed || *indexed < *pruned) {
+                std::cerr << "Error: " << idx->Name() << " needs blocks that were pruned (up to height " << *pruned
+                          << "); disable it or resync from scratch\n";
+                return 1;
+            }
+        }
+    }
+    index.Start(blocks, tipHeight);
+    if (cfg.addrIndex) addrIndex.Start(blocks, tipHeight);
+    if (cfg.blockFilterIndex) filterIndex.Start(blocks, tipHeight);
+
+    // Pruning runs at startup and then periodically, as the indexes catch up.
+    const uint64_t pruneTarget = cfg.pruneMiB * 1024 * 1024;
+    auto pruneBlocks = [&]() {
+        const auto best = chainstate.BestBlock();
+        const auto limit = PruneLimit(best ? std::optional<uint32_t>(best->height) : std::nullopt, activeIndexes);
+        if (!limit) return;
+        try {
+            if (const size_t removed = blocks.Prune(pruneTarget, *limit))
+                std::cout << "Pruned " << removed << " block(s) up to height " << *blocks.PrunedHeight() << "\n";
+        } catch (const std::exception& e) {
+            std::cerr << "Warning: pruning failed: " << e.what() << "\n";
+        }
+    };
+    boost::asio::steady_timer pruneTimer(io);
+    std::function<void()> schedulePrune = [&]() {
+        pruneTimer.expires_after(std::chrono::minutes(10));
+        pruneTimer.async_wait([&](const boost::system::error_code& ec) {
+            if (ec) return;
+            pruneBlocks();
+            schedulePrune();
+        });
+    };
+    if (cfg.pruneMiB != 0) {
+        pruneBlocks();
+        schedulePrune();
+    }
 
+    // Network I/O runs on the io_context threads, P2P messages are handled
+    // on `processing` and transactions from peers validated on `validation`,
+    // so neither a slow handler nor a backlog of transactions delays reads,
+    // writes or pings.
+    boost::asio::thread_pool processing(std::max(1u, cfg.msgThreads));
+    boost::asio::thread_pool validation(std::max(1u, cfg.valThreads));
     net::P2PNode p2p(io, cfg.p2pport);
-    p2p.SetLocalHeight(static_cast<uint32_t>(index.BlockCount()));
+    p2p.SetProcessingExecutor(processing.get_executor());
+    p2p.SetLocalHeight(tip ? tip->height : 0);
+    p2p.SetMaxOutbound(cfg.maxOutbound);
+    p2p.SetUploadLimits(cfg.maxPeerUploadKiBps * 1024, cfg.maxUploadKiBps * 1024);
+    p2p.SetAddressFile(cfg.datadir + "/peers.dat");
+    // A pruned node can only serve recent blocks.
+    if (cfg.pruneMiB != 0) p2p.SetLocalServices(net::P2PNode::k_node_network_limited);
+    if (cfg.txReconciliation) p2p.EnableTxReconciliation();
+    if (cfg.v2Transport) p2p.EnableV2Transport();
+    if (cfg.blockFilterIndex) {
+        p2p.SetFilterProvider([&filterIndex](uint32_t height) -> std::optional<net::FilterRecord> {
+            auto entry = filterIndex.Entry(height);
+            if (!entry) return std::nullopt;
+            return net::FilterRecord{entry->blockHash, entry->filterHash, entry->header, std::move(entry->filter)};
+        });
+    }
+
+    // Damaged blocks found by the scrubber are fetched again from a full
+    // node, a different one on each attempt.
+    ScrubOptions scrubOptions;
+    scrubOptions.bytesPerSecond = cfg.scrubMiBps * 1024 * 1024;
+    std::atomic<size_t> repairTurn{0};
+    BlockScrubber scrubber(blocks, scrubOptions, [&p2p, &repairTurn](uint32_t height, const uint256& hash) {
+        std::vector<net::PeerInfo> full;
+        for (auto& peer : p2p.Peers()) {
+            if (peer.services & net::P2PNode::k_node_network) full.push_back(std::move(peer));
+        }
+        if (!full.empty()) {
+            const auto& peer = full[repairTurn++ % full.size()];
+            if (p2p.RequestBlocks(peer.id, {hash})) return peer.id;
+        }
+        std::cerr << "Warning: stored block " << height << " is damaged and no peer can serve it\n";
+        return std::string();
+    });
+
+    // Headers-first sync. The header index starts out with the stored
+    // chain; blocks downloaded from peers go through the same pipeline as
+    // imports and are announced once they reach the best header.
+    std::vector<BlockHeader> storedHeaders;
+    bool canSync = cfg.listen;
+    try {
+        for (uint32_t h = 0; canSync && tipHeight && h <= *tipHeight; ++h)
+            storedHeaders.push_back(blocks.ReadHeader(h));
+    } catch (const std::exception& e) {
+        const auto pruned = blocks.PrunedHeight();
+        if (!pruned || storedHeaders.size() > *pruned) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        // Pruned before the store kept their headers: such a node keeps
+        // serving recent blocks but cannot download.
+        std::cerr << "Warning: headers of pruned blocks are missing; block download is disabled until a resync\n";
+        canSync = false;
+        storedHeaders.clear();
+    }
+    consensus::ForkResolver headers;
+    PipelineOptions syncOptions;
+    for (size_t i = storedHeaders.size() > 11 ? storedHeaders.size() - 11 : 0; i < storedHeaders.size(); ++i)
+        syncOptions.previousTimes.push_back(storedHeaders[i].time);
+    syncOptions.skipScripts = [&](uint32_t, const uint256& hash) { return CanSkipScriptChecks(headers, assumeValid, hash); };
+    // Set once the compact block relay exists, before any block can arrive.
+    std::function<void(const Block&)> announceBlock;
+    syncOptions.onConnected = [&](uint32_t height, const uint256& hash, const Block& block) {
+        index.ChainTipChanged(height);
+        if (cfg.addrIndex) addrIndex.ChainTipChanged(height);
+        if (cfg.blockFilterIndex) filterIndex.ChainTipChanged(height);
+        p2p.SetLocalHeight(height);
+        pool.RemoveForBlock(block.transactions);
+        pool.SetChainHeight(static_cast<int>(height));
+        const auto* best = headers.Tip();
+        if (best && best->hash == hash && announceBlock) announceBlock(block);
+    };
+    // An invalid download is dropped and fetched from another peer.
+    std::function<void(uint32_t, const uint256&)> rejectBlock;
+    syncOptions.onRejected = [&](uint32_t height, const uint256& hash, const std::string& error) {
+        std::cerr << "Warning: downloaded block " << height << " rejected: " << error << "\n";
+        if (rejectBlock) rejectBlock(height, hash);
+    };
+    BlockPipeline pipeline(chainstate, params, [&blocks](uint32_t height, const Block& block) { blocks.WriteBlock(height, block); },
+                           syncOptions);
+    net::BlockSync sync(io, p2p, headers, params, [&pipeline](uint32_t height, const Block& block) {
+        return pipeline.Submit(height, block);
+    });
+    rejectBlock = [&sync](uint32_t height, const uint256& hash) { sync.BlockRejected(height, hash); };
+    for (size_t h = 0; h < storedHeaders.size(); ++h) {
+        if (!sync.AcceptHeader(storedHeaders[h])) {
+            std::cerr << "Error: stored block " << h << " does not extend the header index\n";
+            return 1;
+        }
+    }
+    // New blocks travel as compact blocks rebuilt from the mempool.
+    net::CompactBlockRelay compactRelay(
+        p2p, pool, [&sync](const BlockHeader& header) { return sync.CheckHeader(header); },
+        [&sync](const net::PeerInfo& peer, const Block& block) { sync.ProcessBlock(peer, block); });
+    announceBlock = [&compactRelay](const Block& block) { compactRelay.Announce(block); };
+    sync.SetBlockFallback([&scrubber](const net::PeerInfo& peer, const Block& block) {
+        if (scrubber.Repair(block, peer.id))
+            std::cout << "Repaired a damaged stored block with data from " << peer.address << "\n";
+    });
+    p2p.SetBlockProvider([&headers, &blocks](const uint256& hash) -> std::optional<std::vector<uint8_t>> {
+        const auto meta = headers.Lookup(hash);
+        if (!meta || !blocks.HasBlock(meta->height)) return std::nullopt;
+        try {
+            auto data = blocks.ReadSerializedBlock(meta->height);
+            BlockHeader header{};
+            if (data.size() < sizeof(header)) return std::nullopt;
+            std::memcpy(&header, data.data(), sizeof(header));
+            if (BlockHash(header) != hash) return std::nullopt;
+            return data;
+        } catch (const std::exception&) {
+            return std::nullopt;
+        }
+    });
+
+    // Transactions from peers are relayed only once the mempool takes them;
+    // the fee comes from the confirmed coins they spend.
+    pool.SetValidationContext(params, tipHeight ? static_cast<int>(*tipHeight) : 0,
+                              [&chainstate](const OutPoint& out) { return chainstate.TryGetUTXO(out); });
+    p2p.SetTxProvider([&pool](const uint256& txid) -> std::optional<std::vector<uint8_t>> {
+        auto tx = pool.Get(txid);
+        if (!tx) return std::nullopt;
+        return Serialize(*tx);
+    });
+    p2p.RegisterHandler("tx", [&chainstate, &pool, &validation](const net::PeerInfo&, const net::Message& msg) {
+        Transaction tx;
+        try {
+            tx = DeserializeTransaction(msg.payload);
+        } catch (const std::exception&) {
+            return;
+        }
+        boost::asio::post(validation, [&chainstate, &pool, tx = std::move(tx)] {
+            uint64_t in = 0;
+            uint64_t out = 0;
+            for (const auto& input : tx.vin) {
+                const auto coin = chainstate.TryGetUTXO(input.prevout);
+                if (!coin) return; // spends an unknown or unconfirmed output
+                in += coin->value;
+            }
+            for (const auto& output : tx.vout) out += output.value;
+            if (out <= in) pool.Accept(tx, in - out);
+        });
+    });
 
     sidechain::wasm::ExecutionEngine wasmEngine;
     sidechain::state::StateStore sidechainState;
     sidechain::rpc::WasmRpcService wasmService(wasmEngine, sidechainState);
 
     rpc::RPCServer rpc(io, cfg.rpcuser, cfg.rpcpassword, cfg.rpcport);
-    rpc.SetBlockStorePath(cfg.datadir + "/blocks.dat");
+    rpc.SetBlockStore(&blocks);
     rpc.AttachCoreHandlers(pool, wallet, index, p2p);
+    rpc.AttachChainstateHandlers(chainstate, params);
+    if (cfg.addrIndex) rpc.AttachAddressIndexHandlers(addrIndex);
+    if (cfg.blockFilterIndex) rpc.AttachBlockFilterHandlers(filterIndex);
+    rpc.AttachScrubberHandlers(scrubber);
+    if (canSync) rpc.AttachSyncHandlers(sync);
     rpc.AttachSidechainHandlers(wasmService);
 
     if (cfg.listen) {
         p2p.Start();
+        if (canSync) {
+            compactRelay.Start();
+            sync.Start(tipHeight);
+        }
     }
     rpc.Start();
+    if (cfg.scrubMiBps != 0) scrubber.Start();
 
     std::cout << "drachmad started (" << cfg.network << ")\n";
     std::cout << "RPC listening on port " << cfg.rpcport << " user=" << cfg.rpcuser << "\n";
     std::cout << "P2P listening on port " << cfg.p2pport << (cfg.listen ? "" : " (disabled)") << "\n";
+    std::cout << "assumevalid: " << (assumeValid ? "enabled" : "disabled") << "\n";
+    if (cfg.pruneMiB != 0) std::cout << "Pruning block files to " << cfg.pruneMiB << " MiB\n";
 
-    std::signal(SIGINT, [](int) { std::exit(0); });
-    std::signal(SIGTERM, [](int) { std::exit(0); });
+    // Stop the event loop rather than exiting from the handler, so every
+    // store is flushed below.
+    boost::asio::signal_set signals(io, SIGINT, SIGTERM);
+    signals.async_wait([&](const boost::system::error_code&, int) { io.stop(); });
+    std::vector<std::thread> ioThreads;
+    for (unsigned i = 1; i < cfg.netThreads; ++i) ioThreads.emplace_back([&io] { io.run(); });
     io.run();
+    for (auto& t : ioThreads) t.join();
+
+    std::cout << "Shutting down\n";
+    rpc.Stop();
+    scrubber.Stop();
+    sync.Stop();
+    p2p.Stop();
+    // Queued messages and transactions are dropped.
+    processing.stop();
+    validation.stop();
+    processing.join();
+    validation.join();
+    if (!pipeline.Finish() && pipeline.FailedHeight())
+        std::cerr << "Warning: storing downloaded block " << *pipeline.FailedHeight() << " failed: " << pipeline.Error() << "\n";
+    index.Stop();
+    addrIndex.Stop();
+    filterIndex.Stop();
+    blocks.Sync();
+    chainstate.Flush();
+    index.Flush();
     return 0;
 }
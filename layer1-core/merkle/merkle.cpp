@@ -7,6 +7,13 @@
 
 uint256 ComputeMerkleRoot(const std::vector<Transaction>& txs)
 {
+    bool mutated;
+    return ComputeMerkleRoot(txs, mutated);
+}
+
+uint256 ComputeMerkleRoot(const std::vector<Transaction>& txs, bool& mutated)
+{
+    mutated = false;
     // Compute the Merkle root of transactions using tagged hashing (BIP-340 style).
     // The tree is built bottom-up by pairing transaction hashes and hashing pairs
     // until a single root hash remains. Odd-sized layers duplicate the last element
@@ -44,6 +51,10 @@ uint256 ComputeMerkleRoot(const std::vector<Transaction>& txs)
             // Handle odd-sized layer by duplicating last element
             // This follows Bitcoin's merkle tree construction algorithm
             const size_t rightIdx = (i + 1 < layerSize) ? i + 1 : i;
+            // A real pair of equal hashes is what padding an odd layer
+            // produces, so a shorter list has the same root.
+            if (rightIdx != i && layer[i] == layer[rightIdx])
+                mutated = true;
             std::memcpy(concat + 32, layer[rightIdx].data(), 32);
             
             // Use tagged hash for domain separation and protection against length extension
@@ -4,3 +4,7 @@
 #include "../tx/transaction.h"
 
 uint256 ComputeMerkleRoot(const std::vector<Transaction>& txs);
+// Also tells whether some level pairs two equal hashes: the list is then
+// one of several with this root (CVE-2012-2459), e.g. the last transactions
+// repeated.
+uint256 ComputeMerkleRoot(const std::vector<Transaction>& txs, bool& mutated);
@@ -0,0 +1,272 @@
+#include "blockcodec.h"
+#include "../tx/serialization.h"
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace blockcodec {
+
+namespace {
+
+// Input flags
+constexpr uint8_t kScriptEmpty = 0;
+constexpr uint8_t kScriptImplicit = 1; // 64-byte signature (inputs) / 32-byte key (outputs)
+constexpr uint8_t kScriptSized = 2;
+constexpr uint8_t kScriptMask = 0x03;
+constexpr uint8_t kAssetShift = 2;
+constexpr uint8_t kAssetMask = 0x03 << kAssetShift; // 0-2 inline, 3 = raw byte follows
+constexpr uint8_t kAssetRaw = 3;
+constexpr uint8_t kFinalSequence = 0x10;
+constexpr uint8_t kNullIndex = 0x20;
+// Output flags
+constexpr uint8_t kRawAmount = 0x10;
+
+constexpr size_t kInputScriptSize = 64;
+constexpr size_t kOutputScriptSize = 32;
+constexpr size_t kMaxScriptSize = 10 * 1024 * 1024;
+constexpr size_t kMaxCount = 1000000;
+
+class Reader {
+public:
+    Reader(const uint8_t* data, size_t len) : m_data(data), m_len(len) {}
+
+    uint64_t VarInt() { return Serializer::readVarInt(m_data, m_len, m_off); }
+    uint32_t VarInt32()
+    {
+        const uint64_t v = VarInt();
+        if (v > std::numeric_limits<uint32_t>::max()) throw std::runtime_error("compact tx: value out of range");
+        return static_cast<uint32_t>(v);
+    }
+    uint8_t Byte()
+    {
+        Need(1);
+        return m_data[m_off++];
+    }
+    void Bytes(uint8_t* out, size_t n)
+    {
+        Need(n);
+        std::memcpy(out, m_data + m_off, n);
+        m_off += n;
+    }
+    std::vector<uint8_t> Bytes(size_t n)
+    {
+        Need(n);
+        std::vector<uint8_t> out(m_data + m_off, m_data + m_off + n);
+        m_off += n;
+        return out;
+    }
+    bool AtEnd() const { return m_off == m_len; }
+
+private:
+    void Need(size_t n) const
+    {
+        if (n > m_len - m_off) throw std::runtime_error("compact tx: truncated");
+    }
+
+    const uint8_t* m_data;
+    size_t m_len;
+    size_t m_off{0};
+};
+
+uint8_t AssetFlags(uint8_t assetId)
+{
+    return static_cast<uint8_t>((assetId < kAssetRaw ? assetId : kAssetRaw) << kAssetShift);
+}
+
+uint8_t ReadAsset(Reader& in, uint8_t flags)
+{
+    const uint8_t asset = (flags & kAssetMask) >> kAssetShift;
+    return asset == kAssetRaw ? in.Byte() : asset;
+}
+
+uint8_t ScriptFlags(const std::vector<uint8_t>& script, size_t implicitSize)
+{
+    if (script.empty()) return kScriptEmpty;
+    return script.size() == implicitSize ? kScriptImplicit : kScriptSized;
+}
+
+void WriteScript(std::vector<uint8_t>& out, const std::vector<uint8_t>& script, uint8_t flags)
+{
+    if ((flags & kScriptMask) == kScriptSized) Serializer::writeVarInt(out, script.size());
+    out.insert(out.end(), script.begin(), script.end());
+}
+
+std::vector<uint8_t> ReadScript(Reader& in, uint8_t flags, size_t implicitSize)
+{
+    switch (flags & kScriptMask) {
+    case kScriptEmpty:
+        return {};
+    case kScriptImplicit:
+        return in.Bytes(implicitSize);
+    case kScriptSized: {
+        const uint64_t len = in.VarInt();
+        if (len > kMaxScriptSize) throw std::runtime_error("compact tx: script too large");
+        return in.Bytes(static_cast<size_t>(len));
+    }
+    default:
+        throw std::runtime_error("compact tx: bad script flags");
+    }
+}
+
+size_t ReadCount(Reader& in)
+{
+    const uint64_t n = in.VarInt();
+    if (n > kMaxCount) throw std::runtime_error("compact tx: count too large");
+    return static_cast<size_t>(n);
+}
+
+uint32_t ReadLE32(const uint8_t* p)
+{
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 | static_cast<uint32_t>(p[2]) << 16 |
+           static_cast<uint32_t>(p[3]) << 24;
+}
+
+} // namespace
+
+uint64_t CompressAmount(uint64_t n)
+{
+    if (n == 0) return 0;
+    int e = 0;
+    while ((n % 10) == 0 && e < 9) {
+        n /= 10;
+        ++e;
+    }
+    if (e < 9) {
+        const uint64_t d = n % 10;
+        n /= 10;
+        return 1 + (n * 9 + d - 1) * 10 + e;
+    }
+    return 1 + (n - 1) * 10 + 9;
+}
+
+uint64_t DecompressAmount(uint64_t x)
+{
+    if (x == 0) return 0;
+    --x;
+    int e = static_cast<int>(x % 10);
+    x /= 10;
+    uint64_t n = 0;
+    if (e < 9) {
+        const uint64_t d = (x % 9) + 1;
+        x /= 9;
+        n = x * 10 + d;
+    } else {
+        n = x + 1;
+    }
+    while (e-- > 0) n *= 10;
+    return n;
+}
+
+void EncodeTransaction(const Transaction& tx, std::vector<uint8_t>& out)
+{
+    Serializer::writeVarInt(out, tx.version);
+    Serializer::writeVarInt(out, tx.vin.size());
+    for (const auto& in : tx.vin) {
+        uint8_t flags = ScriptFlags(in.scriptSig, kInputScriptSize) | AssetFlags(in.assetId);
+        if (in.sequence == std::numeric_limits<uint32_t>::max()) flags |= kFinalSequence;
+        if (in.prevout.index == std::numeric_limits<uint32_t>::max()) flags |= kNullIndex;
+        out.push_back(flags);
+        out.insert(out.end(), in.prevout.hash.begin(), in.prevout.hash.end());
+        if (!(flags & kNullIndex)) Serializer::writeVarInt(out, in.prevout.index);
+        if (in.assetId >= kAssetRaw) out.push_back(in.assetId);
+        WriteScript(out, in.scriptSig, flags);
+        if (!(flags & kFinalSequence)) Serializer::writeVarInt(out, in.sequence);
+    }
+    Serializer::writeVarInt(out, tx.vout.size());
+    for (const auto& o : tx.vout) {
+        uint8_t flags = ScriptFlags(o.scriptPubKey, kOutputScriptSize) | AssetFlags(o.assetId);
+        if (o.value > kMaxPackedAmount) flags |= kRawAmount;
+        out.push_back(flags);
+        Serializer::writeVarInt(out, (flags & kRawAmount) ? o.value : CompressAmount(o.value));
+        if (o.assetId >= kAssetRaw) out.push_back(o.assetId);
+        WriteScript(out, o.scriptPubKey, flags);
+    }
+    Serializer::writeVarInt(out, tx.lockTime);
+}
+
+Transaction DecodeTransaction(const uint8_t* data, size_t len)
+{
+    Reader in(data, len);
+    Transaction tx;
+    tx.version = in.VarInt32();
+    tx.vin.resize(ReadCount(in));
+    for (auto& txin : tx.vin) {
+        const uint8_t flags = in.Byte();
+        in.Bytes(txin.prevout.hash.data(), txin.prevout.hash.size());
+        txin.prevout.index = (flags & kNullIndex) ? std::numeric_limits<uint32_t>::max() : in.VarInt32();
+        txin.assetId = ReadAsset(in, flags);
+        txin.scriptSig = ReadScript(in, flags, kInputScriptSize);
+        txin.sequence = (flags & kFinalSequence) ? std::numeric_limits<uint32_t>::max() : in.VarInt32();
+    }
+    tx.vout.resize(ReadCount(in));
+    for (auto& o : tx.vout) {
+        const uint8_t flags = in.Byte();
+        const uint64_t amount = in.VarInt();
+        o.value = (flags & kRawAmount) ? amount : DecompressAmount(amount);
+        o.assetId = ReadAsset(in, flags);
+        o.scriptPubKey = ReadScript(in, flags, kOutputScriptSize);
+    }
+    tx.lockTime = in.VarInt32();
+    if (!in.AtEnd()) throw std::runtime_error("compact tx: trailing data");
+    return tx;
+}
+
+std::vector<uint8_t> Compress(const uint8_t* data, size_t len)
+{
+    constexpr size_t kMinMatch = 4;
+    constexpr size_t kWindow = 64 * 1024;
+    constexpr int kHashBits = 14;
+    std::vector<int64_t> table(size_t{1} << kHashBits, -1);
+    std::vector<uint8_t> out;
+    out.reserve(len / 2 + 16);
+
+    size_t literalStart = 0;
+    size_t i = 0;
+    while (i + kMinMatch <= len) {
+        const uint32_t h = (ReadLE32(data + i) * 2654435761u) >> (32 - kHashBits);
+        const int64_t candidate = table[h];
+        table[h] = static_cast<int64_t>(i);
+        if (candidate < 0 || i - static_cast<size_t>(candidate) > kWindow ||
+            std::memcmp(data + candidate, data + i, kMinMatch) != 0) {
+            ++i;
+            continue;
+        }
+        size_t match = kMinMatch;
+        while (i + match < len && data[candidate + match] == data[i + match]) ++match;
+
+        Serializer::writeVarInt(out, i - literalStart);
+        out.insert(out.end(), data + literalStart, data + i);
+        Serializer::writeVarInt(out, match - kMinMatch);
+        Serializer::writeVarInt(out, i - static_cast<size_t>(candidate));
+        i += match;
+        literalStart = i;
+    }
+    Serializer::writeVarInt(out, len - literalStart);
+    out.insert(out.end(), data + literalStart, data + len);
+    return out;
+}
+
+std::vector<uint8_t> Decompress(const uint8_t* data, size_t len, size_t rawSize)
+{
+    std::vector<uint8_t> out;
+    out.reserve(rawSize);
+    size_t off = 0;
+    while (true) {
+        const uint64_t literals = Serializer::readVarInt(data, len, off);
+        if (literals > len - off || literals > rawSize - out.size()) throw std::runtime_error("decompress: bad literal run");
+        out.insert(out.end(), data + off, data + off + literals);
+        off += literals;
+        if (out.size() == rawSize) break;
+        const uint64_t match = Serializer::readVarInt(data, len, off) + 4;
+        const uint64_t distance = Serializer::readVarInt(data, len, off);
+        if (distance == 0 || distance > out.size() || match > rawSize - out.size())
+            throw std::runtime_error("decompress: bad match");
+        // Byte by byte: matches may overlap their own output.
+        size_t from = out.size() - static_cast<size_t>(distance);
+        for (uint64_t k = 0; k < match; ++k) out.push_back(out[from++]);
+    }
+    if (off != len) throw std::runtime_error("decompress: trailing data");
+    return out;
+}
+
+} // namespace blockcodec
@@ -0,0 +1,39 @@
+#pragma once
+#include "../block/block.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Storage-only encodings used by BlockStore. None of this is consensus: the
+// decoders reproduce the exact transactions (and so the wire serialization
+// and txids) that were encoded.
+namespace blockcodec {
+
+// Compact transaction encoding:
+//   varint version, varint #inputs, then per input
+//     flags(1) prevout hash(32) [varint index] [asset(1)] [script] [varint sequence]
+//   varint #outputs, then per output
+//     flags(1) varint amount [asset(1)] [script]
+//   varint lockTime
+// Flags carry the common cases implicitly: a 64-byte signature / 32-byte key
+// script needs no length, assets 0-2 need no byte, a final sequence and a
+// null (coinbase) prevout index need no varint. Amounts are stored with
+// CompressAmount unless they are too large to pack.
+void EncodeTransaction(const Transaction& tx, std::vector<uint8_t>& out);
+// Decodes exactly `len` bytes; throws std::runtime_error on malformed input.
+Transaction DecodeTransaction(const uint8_t* data, size_t len);
+
+// Drops trailing decimal zeros into a small exponent so round amounts
+// become short varints. Only valid for amounts up to kMaxPackedAmount.
+constexpr uint64_t kMaxPackedAmount = 100000000000000000ULL;
+uint64_t CompressAmount(uint64_t amount);
+uint64_t DecompressAmount(uint64_t packed);
+
+// Byte-oriented LZ77 with a 64 KiB window and no shared dictionary, so every
+// record decompresses on its own. Stream: ([varint literals][bytes]
+// [varint matchLength - 4][varint distance])... and always ends with a
+// literal run (possibly empty) that completes `rawSize` bytes.
+std::vector<uint8_t> Compress(const uint8_t* data, size_t len);
+std::vector<uint8_t> Decompress(const uint8_t* data, size_t len, size_t rawSize);
+
+} // namespace blockcodec
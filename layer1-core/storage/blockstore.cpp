@@ -1,184 +1,804 @@
-#include "../block/block.h"
+#include "blockstore.h"
+#include "blockcodec.h"
+#include "../crypto/crc32c.h"
+#include "../tx/serialization.h"
+#include "../validation/validation.h"
+#include <algorithm>
+#include <array>
+#include <filesystem>
 #include <fstream>
-#include <unordered_map>
-#include <mutex>
 #include <stdexcept>
 #include <vector>
 #include <cstring>
 #include <openssl/evp.h>
 
-class BlockStore {
-public:
-    explicit BlockStore(const std::string& path): path(path) { LoadIndex(); }
-    
-    ~BlockStore() {
-        std::lock_guard<std::mutex> l(mu);
-        FlushIndex();
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const uint32_t MAX_BLOCK_SIZE = 100 * 1024 * 1024; // 100MB max
+const uint32_t MAX_TX_SIZE = 10 * 1024 * 1024;     // 10MB max per tx
+constexpr size_t kRecordPrefix = sizeof(uint32_t) + 32;
+constexpr uint32_t kIndexMagic = 0xffffffff;
+constexpr uint32_t kIndexVersion = 2;
+constexpr size_t kHeaderSize = 80;
+static_assert(sizeof(BlockHeader) == kHeaderSize, "legacy records store the raw header struct");
+
+// High bits of a record's size field. Records written before the compact
+// codec existed have none of them set.
+constexpr uint32_t kRecordCompact = 0x80000000;
+constexpr uint32_t kRecordCompressed = 0x40000000;
+constexpr uint32_t kRecordCrc = 0x20000000;
+constexpr uint32_t kRecordSizeMask = 0x1fffffff;
+static_assert(MAX_BLOCK_SIZE <= kRecordSizeMask, "record size must fit below the flag bits");
+
+std::array<uint8_t, 32> Checksum(const std::vector<uint8_t>& data)
+{
+    // SHA-256 via the EVP API for integrity verification.
+    std::array<uint8_t, 32> checksum{};
+    unsigned int checksumLen = 0;
+    EVP_MD_CTX* mdctx = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(mdctx, EVP_sha256(), nullptr);
+    EVP_DigestUpdate(mdctx, data.data(), data.size());
+    EVP_DigestFinal_ex(mdctx, checksum.data(), &checksumLen);
+    EVP_MD_CTX_free(mdctx);
+    return checksum;
+}
+
+// Checksum slot of a kRecordCrc record: [crc32c(4)][first 28 bytes of sha256].
+std::array<uint8_t, 32> RecordChecksum(const std::vector<uint8_t>& data)
+{
+    auto checksum = Checksum(data);
+    std::memmove(checksum.data() + 4, checksum.data(), checksum.size() - 4);
+    const uint32_t crc = Crc32c(data.data(), data.size());
+    std::memcpy(checksum.data(), &crc, sizeof(crc));
+    return checksum;
+}
+
+// Reads check only the CRC of records that have one; `full` also checks the
+// SHA-256 part, which is what the scrubber does.
+bool ChecksumMatches(const std::vector<uint8_t>& data, uint32_t flags, const std::array<uint8_t, 32>& stored,
+                     bool full = false)
+{
+    if (!(flags & kRecordCrc)) return Checksum(data) == stored;
+    uint32_t crc = 0;
+    std::memcpy(&crc, stored.data(), sizeof(crc));
+    if (Crc32c(data.data(), data.size()) != crc) return false;
+    if (!full) return true;
+    const auto sha = Checksum(data);
+    return std::equal(stored.begin() + 4, stored.end(), sha.begin());
+}
+
+void EncodeHeader(const BlockHeader& header, std::vector<uint8_t>& out)
+{
+    Serializer::writeUint32(out, header.version);
+    out.insert(out.end(), header.prevBlockHash.begin(), header.prevBlockHash.end());
+    out.insert(out.end(), header.merkleRoot.begin(), header.merkleRoot.end());
+    Serializer::writeUint32(out, header.time);
+    Serializer::writeUint32(out, header.bits);
+    Serializer::writeUint32(out, header.nonce);
+}
+
+// Both record formats start with the 80-byte header (the legacy one as the
+// raw struct, which has the same layout).
+BlockHeader DecodeHeader(const std::vector<uint8_t>& data, uint32_t flags)
+{
+    if (data.size() < kHeaderSize) throw std::runtime_error("block too small");
+    BlockHeader header{};
+    if (!(flags & kRecordCompact)) {
+        std::memcpy(&header, data.data(), sizeof(BlockHeader));
+        return header;
     }
+    size_t off = 0;
+    header.version = Serializer::readUint32(data, off);
+    std::memcpy(header.prevBlockHash.data(), data.data() + off, 32);
+    off += 32;
+    std::memcpy(header.merkleRoot.data(), data.data() + off, 32);
+    off += 32;
+    header.time = Serializer::readUint32(data, off);
+    header.bits = Serializer::readUint32(data, off);
+    header.nonce = Serializer::readUint32(data, off);
+    return header;
+}
 
-    void WriteBlock(uint32_t height, const Block& block)
-    {
-        std::lock_guard<std::mutex> l(mu);
-        std::ofstream out(path, std::ios::binary | std::ios::app);
-        if (!out) throw std::runtime_error("cannot open blockstore");
-        auto pos = out.tellp();
-
-        std::vector<uint8_t> buffer;
-        buffer.reserve(sizeof(BlockHeader) + sizeof(uint32_t) + 4096);
-        buffer.insert(buffer.end(), reinterpret_cast<const uint8_t*>(&block.header), reinterpret_cast<const uint8_t*>(&block.header) + sizeof(BlockHeader));
-        uint32_t txCount = static_cast<uint32_t>(block.transactions.size());
-        buffer.insert(buffer.end(), reinterpret_cast<uint8_t*>(&txCount), reinterpret_cast<uint8_t*>(&txCount) + sizeof(txCount));
-        for (const auto& tx : block.transactions) {
-            auto ser = Serialize(tx);
-            uint32_t txSize = static_cast<uint32_t>(ser.size());
-            buffer.insert(buffer.end(), reinterpret_cast<uint8_t*>(&txSize), reinterpret_cast<uint8_t*>(&txSize) + sizeof(txSize));
-            buffer.insert(buffer.end(), ser.begin(), ser.end());
+// Location of each transaction within a record payload (or within the
+// decompressed body, for compressed records).
+struct TxSpan {
+    uint64_t offset;
+    uint32_t length;
+};
+
+std::vector<TxSpan> LegacySpans(const std::vector<uint8_t>& data)
+{
+    std::vector<TxSpan> spans;
+    if (data.size() < sizeof(BlockHeader) + sizeof(uint32_t)) throw std::runtime_error("block too small");
+    uint64_t offset = sizeof(BlockHeader);
+    uint32_t txCount = 0;
+    std::memcpy(&txCount, data.data() + offset, sizeof(txCount));
+    offset += sizeof(txCount);
+
+    // Validate transaction count to prevent memory exhaustion
+    const uint32_t MAX_TX_COUNT = 100000;
+    if (txCount > MAX_TX_COUNT) {
+        throw std::runtime_error("transaction count exceeds maximum");
+    }
+
+    for (uint32_t i = 0; i < txCount; ++i) {
+        if (offset + sizeof(uint32_t) > data.size()) throw std::runtime_error("truncated transaction size");
+        uint32_t txSize = 0;
+        std::memcpy(&txSize, data.data() + offset, sizeof(txSize));
+        offset += sizeof(txSize);
+
+        // Validate transaction size
+        if (txSize == 0 || txSize > MAX_TX_SIZE) {
+            throw std::runtime_error("invalid transaction size");
         }
 
-        uint32_t totalSize = static_cast<uint32_t>(buffer.size());
-        
-        // Calculate SHA-256 checksum for integrity verification using modern EVP API
-        std::array<uint8_t, 32> checksum;
-        unsigned int checksumLen = 0;
-        EVP_MD_CTX* mdctx = EVP_MD_CTX_new();
-        EVP_DigestInit_ex(mdctx, EVP_sha256(), nullptr);
-        EVP_DigestUpdate(mdctx, buffer.data(), buffer.size());
-        EVP_DigestFinal_ex(mdctx, checksum.data(), &checksumLen);
-        EVP_MD_CTX_free(mdctx);
-        
-        // Write: [size][checksum][data]
-        out.write(reinterpret_cast<const char*>(&totalSize), sizeof(totalSize));
-        out.write(reinterpret_cast<const char*>(checksum.data()), checksum.size());
-        out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
-        
-        index[height] = static_cast<uint64_t>(pos);
-        ++dirtyCount;
-        if (dirtyCount >= kFlushThreshold) {
-            FlushIndex();
-            dirtyCount = 0;
+        if (offset + txSize > data.size()) throw std::runtime_error("truncated transaction data");
+        spans.push_back(TxSpan{offset, txSize});
+        offset += txSize;
+    }
+    return spans;
+}
+
+// Compact body: [varint txCount]([varint length][compact tx])...
+std::vector<TxSpan> CompactSpans(const uint8_t* data, size_t len, uint64_t base)
+{
+    std::vector<TxSpan> spans;
+    size_t off = 0;
+    const uint64_t txCount = Serializer::readVarInt(data, len, off);
+    if (txCount > 100000) throw std::runtime_error("transaction count exceeds maximum");
+    for (uint64_t i = 0; i < txCount; ++i) {
+        const uint64_t txSize = Serializer::readVarInt(data, len, off);
+        if (txSize == 0 || txSize > MAX_TX_SIZE) throw std::runtime_error("invalid transaction size");
+        if (txSize > len - off) throw std::runtime_error("truncated transaction data");
+        spans.push_back(TxSpan{base + off, static_cast<uint32_t>(txSize)});
+        off += txSize;
+    }
+    if (off != len) throw std::runtime_error("trailing block data");
+    return spans;
+}
+
+// Compressed body: [varint rawSize][compressed compact body]
+std::vector<uint8_t> DecompressBody(const std::vector<uint8_t>& data)
+{
+    size_t off = kHeaderSize;
+    const uint64_t rawSize = Serializer::readVarInt(data, off);
+    if (rawSize > MAX_BLOCK_SIZE) throw std::runtime_error("invalid block size");
+    return blockcodec::Decompress(data.data() + off, data.size() - off, static_cast<size_t>(rawSize));
+}
+
+Block DecodeBlock(const std::vector<uint8_t>& data, uint32_t flags)
+{
+    Block block{};
+    block.header = DecodeHeader(data, flags);
+    if (!(flags & kRecordCompact)) {
+        for (const auto& span : LegacySpans(data)) {
+            std::vector<uint8_t> txdata(data.begin() + span.offset, data.begin() + span.offset + span.length);
+            block.transactions.push_back(DeserializeTransaction(txdata));
         }
+        return block;
     }
-    
-    void Sync() {
-        std::lock_guard<std::mutex> l(mu);
-        if (dirtyCount > 0) {
-            FlushIndex();
-            dirtyCount = 0;
+    std::vector<uint8_t> body;
+    const uint8_t* bodyData = data.data() + kHeaderSize;
+    size_t bodySize = data.size() - kHeaderSize;
+    if (flags & kRecordCompressed) {
+        body = DecompressBody(data);
+        bodyData = body.data();
+        bodySize = body.size();
+    }
+    for (const auto& span : CompactSpans(bodyData, bodySize, 0))
+        block.transactions.push_back(blockcodec::DecodeTransaction(bodyData + span.offset, span.length));
+    return block;
+}
+
+// Directly readable transaction spans within a record payload. Compressed
+// records have none: their transactions are only reachable via the block.
+std::vector<TxSpan> TransactionSpans(const std::vector<uint8_t>& data, uint32_t flags)
+{
+    if (!(flags & kRecordCompact)) return LegacySpans(data);
+    if (flags & kRecordCompressed) return {};
+    if (data.size() < kHeaderSize) throw std::runtime_error("block too small");
+    return CompactSpans(data.data() + kHeaderSize, data.size() - kHeaderSize, kHeaderSize);
+}
+
+// Reads the record at `offset`. Returns false if it is torn or corrupt.
+bool ReadRecord(std::ifstream& in, uint64_t offset, std::vector<uint8_t>& data, uint32_t& flags)
+{
+    in.clear();
+    in.seekg(static_cast<std::streamoff>(offset));
+    uint32_t size = 0;
+    std::array<uint8_t, 32> storedChecksum{};
+    in.read(reinterpret_cast<char*>(&size), sizeof(size));
+    in.read(reinterpret_cast<char*>(storedChecksum.data()), storedChecksum.size());
+    flags = size & ~kRecordSizeMask;
+    size &= kRecordSizeMask;
+    if (!in || size == 0 || size > MAX_BLOCK_SIZE) return false;
+    data.resize(size);
+    in.read(reinterpret_cast<char*>(data.data()), size);
+    if (!in) return false;
+    return ChecksumMatches(data, flags, storedChecksum);
+}
+
+void SyncPath(const std::string& path)
+{
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    ::fsync(fd);
+    ::close(fd);
+#else
+    (void)path;
+#endif
+}
+
+} // namespace
+
+BlockStore::BlockStore(const std::string& path, uint64_t maxSegmentSize)
+    : BlockStore(path, BlockStoreOptions{maxSegmentSize, false, false})
+{
+}
+
+BlockStore::BlockStore(const std::string& path, const BlockStoreOptions& options)
+    : path(path), maxSegmentSize(options.maxSegmentSize), compress(options.compress), wire(options.wire)
+{
+    if (compress && wire) throw std::runtime_error("wire block records cannot be compressed");
+    LoadIndex();
+    RecoverTail();
+}
+
+BlockStore::~BlockStore()
+{
+    try {
+        Sync();
+    } catch (...) {
+    }
+}
+
+std::string BlockStore::SegmentPath(uint32_t segment) const
+{
+    return segment == 0 ? path : path + "." + std::to_string(segment);
+}
+
+std::vector<DiskTxPos> BlockStore::WriteBlock(uint32_t height, const Block& block)
+{
+    std::lock_guard<std::mutex> l(mu);
+
+    std::vector<uint8_t> buffer;
+    std::vector<TxSpan> spans;
+    uint32_t flags = kRecordCrc;
+    if (wire) {
+        buffer = SerializeBlock(block);
+        spans = LegacySpans(buffer);
+    } else {
+        // [header(80)][varint txCount]([varint length][compact tx])...
+        std::vector<uint8_t> body;
+        body.reserve(4096);
+        Serializer::writeVarInt(body, block.transactions.size());
+        spans.reserve(block.transactions.size());
+        std::vector<uint8_t> txdata;
+        for (const auto& tx : block.transactions) {
+            txdata.clear();
+            blockcodec::EncodeTransaction(tx, txdata);
+            Serializer::writeVarInt(body, txdata.size());
+            spans.push_back(TxSpan{kHeaderSize + body.size(), static_cast<uint32_t>(txdata.size())});
+            body.insert(body.end(), txdata.begin(), txdata.end());
         }
+
+        buffer.reserve(kHeaderSize + body.size());
+        EncodeHeader(block.header, buffer);
+        flags |= kRecordCompact;
+        if (compress) {
+            auto packed = blockcodec::Compress(body.data(), body.size());
+            std::vector<uint8_t> rawSize;
+            Serializer::writeVarInt(rawSize, body.size());
+            if (rawSize.size() + packed.size() < body.size()) {
+                flags |= kRecordCompressed;
+                buffer.insert(buffer.end(), rawSize.begin(), rawSize.end());
+                buffer.insert(buffer.end(), packed.begin(), packed.end());
+                spans.clear();
+            }
+        }
+        if (!(flags & kRecordCompressed)) buffer.insert(buffer.end(), body.begin(), body.end());
     }
+    if (buffer.size() > MAX_BLOCK_SIZE) throw std::runtime_error("block too large for blockstore");
+
+    uint32_t sizeField = static_cast<uint32_t>(buffer.size()) | flags;
+    auto checksum = RecordChecksum(buffer);
+
+    // Start a new segment rather than grow the current one past its cap, or
+    // mix compact and legacy-layout records in one.
+    std::error_code ec;
+    uint64_t pos = std::filesystem::file_size(SegmentPath(writeSegment), ec);
+    if (ec) pos = 0;
+    if (pos > 0 && (pos + kRecordPrefix + buffer.size() > maxSegmentSize || SegmentIsCompact(writeSegment) == wire)) {
+        SyncPath(SegmentPath(writeSegment));
+        ++writeSegment;
+        pos = 0;
+    }
+
+    std::ofstream out(SegmentPath(writeSegment), std::ios::binary | std::ios::app);
+    if (!out) throw std::runtime_error("cannot open blockstore");
+
+    // Write: [size | flags][checksum][data]
+    out.write(reinterpret_cast<const char*>(&sizeField), sizeof(sizeField));
+    out.write(reinterpret_cast<const char*>(checksum.data()), checksum.size());
+    out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    out.flush();
+    if (!out) throw std::runtime_error("blockstore write failed");
+    segmentCompact[writeSegment] = !wire;
+
+    index[height] = BlockPos{writeSegment, pos};
+    ++dirtyCount;
+    if (dirtyCount >= kFlushThreshold) {
+        SyncPath(SegmentPath(writeSegment));
+        FlushIndex();
+        dirtyCount = 0;
+    }
+
+    std::vector<DiskTxPos> positions;
+    positions.reserve(spans.size());
+    for (const auto& span : spans)
+        positions.push_back(DiskTxPos{writeSegment, pos + kRecordPrefix + span.offset, span.length});
+    return positions;
+}
+
+bool BlockStore::SegmentIsCompact(uint32_t segment) const
+{
+    auto it = segmentCompact.find(segment);
+    if (it != segmentCompact.end()) return it->second;
+    std::ifstream in(SegmentPath(segment), std::ios::binary);
+    uint32_t sizeField = 0;
+    if (!in.read(reinterpret_cast<char*>(&sizeField), sizeof(sizeField))) return true; // empty: nothing to mix with
+    const bool compact = (sizeField & kRecordCompact) != 0;
+    segmentCompact[segment] = compact;
+    return compact;
+}
+
+void BlockStore::Sync()
+{
+    std::lock_guard<std::mutex> l(mu);
+    SyncPath(SegmentPath(writeSegment));
+    if (dirtyCount > 0) {
+        FlushIndex();
+        dirtyCount = 0;
+    }
+}
+
+bool BlockStore::HasBlock(uint32_t height) const
+{
+    std::lock_guard<std::mutex> l(mu);
+    return index.count(height) != 0;
+}
+
+std::optional<uint32_t> BlockStore::TipHeight() const
+{
+    std::lock_guard<std::mutex> l(mu);
+    if (index.empty()) return std::nullopt;
+    return index.rbegin()->first;
+}
 
-    Block ReadBlock(uint32_t height)
+BlockStore::BlockPos BlockStore::Locate(uint32_t height) const
+{
+    std::lock_guard<std::mutex> l(mu);
+    auto it = index.find(height);
+    if (it == index.end()) {
+        if (!index.empty() && height < index.begin()->first) throw std::runtime_error("block pruned");
+        throw std::runtime_error("unknown height");
+    }
+    return it->second;
+}
+
+std::vector<uint8_t> BlockStore::ReadRecordData(const BlockPos& pos, uint32_t& flags, bool full) const
+{
+    // Records are never rewritten in place, so this needs no lock and
+    // concurrent readers only contend on the disk.
+    std::ifstream in(SegmentPath(pos.segment), std::ios::binary);
+    if (!in) throw std::runtime_error("missing block segment");
+    in.seekg(static_cast<std::streamoff>(pos.offset));
+    uint32_t size = 0;
+    in.read(reinterpret_cast<char*>(&size), sizeof(size));
+    flags = size & ~kRecordSizeMask;
+    size &= kRecordSizeMask;
+
+    // Validate block size to prevent allocation attacks
+    if (size == 0 || size > MAX_BLOCK_SIZE) {
+        throw std::runtime_error("invalid block size");
+    }
+
+    // Read checksum
+    std::array<uint8_t, 32> storedChecksum;
+    in.read(reinterpret_cast<char*>(storedChecksum.data()), storedChecksum.size());
+
+    // Read block data
+    std::vector<uint8_t> data(size);
+    in.read(reinterpret_cast<char*>(data.data()), size);
+    if (!in) throw std::runtime_error("corrupt blockstore");
+
+    if (!ChecksumMatches(data, flags, storedChecksum, full)) {
+        throw std::runtime_error("block checksum mismatch - data corruption detected");
+    }
+    return data;
+}
+
+Block BlockStore::ReadBlock(uint32_t height, std::vector<DiskTxPos>* positions)
+{
+    const BlockPos pos = Locate(height);
+    uint32_t flags = 0;
+    const auto data = ReadRecordData(pos, flags);
+    if (positions) {
+        positions->clear();
+        for (const auto& span : TransactionSpans(data, flags))
+            positions->push_back(DiskTxPos{pos.segment, pos.offset + kRecordPrefix + span.offset, span.length});
+    }
+    return DecodeBlock(data, flags);
+}
+
+std::vector<uint8_t> BlockStore::ReadSerializedBlock(uint32_t height) const
+{
+    uint32_t flags = 0;
+    auto data = ReadRecordData(Locate(height), flags);
+    if (!(flags & kRecordCompact)) return data;
+    return SerializeBlock(DecodeBlock(data, flags));
+}
+
+BlockHeader BlockStore::ReadHeader(uint32_t height) const
+{
     {
         std::lock_guard<std::mutex> l(mu);
-        auto it = index.find(height);
-        if (it == index.end()) throw std::runtime_error("unknown height");
-        std::ifstream in(path, std::ios::binary);
-        in.seekg(it->second);
-        uint32_t size = 0;
-        in.read(reinterpret_cast<char*>(&size), sizeof(size));
-        
-        // Validate block size to prevent allocation attacks
-        const uint32_t MAX_BLOCK_SIZE = 100 * 1024 * 1024; // 100MB max
-        if (size == 0 || size > MAX_BLOCK_SIZE) {
-            throw std::runtime_error("invalid block size");
-        }
-        
-        // Read checksum
-        std::array<uint8_t, 32> storedChecksum;
-        in.read(reinterpret_cast<char*>(storedChecksum.data()), storedChecksum.size());
-        
-        // Read block data
-        std::vector<uint8_t> data(size);
-        in.read(reinterpret_cast<char*>(data.data()), size);
-        if (!in) throw std::runtime_error("corrupt blockstore");
-        
-        // Verify checksum for integrity using modern EVP API
-        std::array<uint8_t, 32> computedChecksum;
-        unsigned int checksumLen = 0;
-        EVP_MD_CTX* mdctx = EVP_MD_CTX_new();
-        EVP_DigestInit_ex(mdctx, EVP_sha256(), nullptr);
-        EVP_DigestUpdate(mdctx, data.data(), data.size());
-        EVP_DigestFinal_ex(mdctx, computedChecksum.data(), &checksumLen);
-        EVP_MD_CTX_free(mdctx);
-        
-        if (storedChecksum != computedChecksum) {
-            throw std::runtime_error("block checksum mismatch - data corruption detected");
+        if (!index.empty() && height < index.begin()->first) {
+            std::ifstream in(path + ".hdr", std::ios::binary);
+            in.seekg(static_cast<std::streamoff>(uint64_t{height} * kHeaderSize));
+            BlockHeader header{};
+            in.read(reinterpret_cast<char*>(&header), sizeof(header));
+            if (!in) throw std::runtime_error("block pruned");
+            return header;
         }
+    }
+    // Every record format starts its payload with the header.
+    const BlockPos pos = Locate(height);
+    std::ifstream in(SegmentPath(pos.segment), std::ios::binary);
+    if (!in) throw std::runtime_error("missing block segment");
+    in.seekg(static_cast<std::streamoff>(pos.offset));
+    uint32_t size = 0;
+    in.read(reinterpret_cast<char*>(&size), sizeof(size));
+    if ((size & kRecordSizeMask) < sizeof(BlockHeader)) throw std::runtime_error("invalid block size");
+    in.seekg(static_cast<std::streamoff>(pos.offset + kRecordPrefix));
+    BlockHeader header{};
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in) throw std::runtime_error("corrupt blockstore");
+    return header;
+}
 
-        Block block{};
-        if (size < sizeof(BlockHeader) + sizeof(uint32_t)) throw std::runtime_error("block too small");
-        size_t offset = 0;
-        std::memcpy(&block.header, data.data() + offset, sizeof(BlockHeader));
-        offset += sizeof(BlockHeader);
-        uint32_t txCount = 0;
-        std::memcpy(&txCount, data.data() + offset, sizeof(txCount));
-        offset += sizeof(txCount);
-        
-        // Validate transaction count to prevent memory exhaustion
-        const uint32_t MAX_TX_COUNT = 100000;
-        if (txCount > MAX_TX_COUNT) {
-            throw std::runtime_error("transaction count exceeds maximum");
+BlockCheck BlockStore::VerifyBlock(uint32_t height) const
+{
+    const BlockPos pos = Locate(height);
+    BlockCheck check;
+    try {
+        uint32_t flags = 0;
+        const auto data = ReadRecordData(pos, flags, true);
+        check.bytes = kRecordPrefix + data.size();
+        const Block block = DecodeBlock(data, flags);
+        if (!CheckMerkleRoot(block)) throw std::runtime_error("merkle root mismatch");
+        check.ok = true;
+    } catch (const std::exception& e) {
+        check.error = e.what();
+    }
+    return check;
+}
+
+std::vector<DiskTxPos> BlockStore::TransactionPositions(uint32_t height)
+{
+    std::vector<DiskTxPos> positions;
+    ReadBlock(height, &positions);
+    return positions;
+}
+
+Transaction BlockStore::ReadTransaction(const DiskTxPos& pos) const
+{
+    if (pos.length == 0 || pos.length > MAX_TX_SIZE) throw std::runtime_error("invalid transaction size");
+    std::lock_guard<std::mutex> l(mu);
+    std::ifstream in(SegmentPath(pos.segment), std::ios::binary);
+    if (!in) throw std::runtime_error("missing block segment");
+    in.seekg(static_cast<std::streamoff>(pos.offset));
+    std::vector<uint8_t> data(pos.length);
+    in.read(reinterpret_cast<char*>(data.data()), data.size());
+    if (!in) throw std::runtime_error("truncated transaction data");
+    if (SegmentIsCompact(pos.segment)) return blockcodec::DecodeTransaction(data.data(), data.size());
+    return DeserializeTransaction(data);
+}
+
+uint64_t BlockStore::SegmentSize(uint32_t segment) const
+{
+    std::error_code ec;
+    const auto size = std::filesystem::file_size(SegmentPath(segment), ec);
+    return ec ? 0 : size;
+}
+
+uint64_t BlockStore::DiskUsage() const
+{
+    std::lock_guard<std::mutex> l(mu);
+    uint64_t total = 0;
+    for (uint32_t s = 0; s <= writeSegment; ++s) total += SegmentSize(s);
+    return total;
+}
+
+std::optional<uint32_t> BlockStore::PrunedHeight() const
+{
+    std::lock_guard<std::mutex> l(mu);
+    if (index.empty() || index.begin()->first == 0) return std::nullopt;
+    return index.begin()->first - 1;
+}
+
+size_t BlockStore::Prune(uint64_t targetBytes, uint32_t maxHeight)
+{
+    std::lock_guard<std::mutex> l(mu);
+    std::map<uint32_t, uint32_t> segmentTop; // segment -> highest height it holds
+    for (const auto& [height, pos] : index) {
+        auto& top = segmentTop[pos.segment];
+        top = std::max(top, height);
+    }
+
+    uint64_t usage = 0;
+    for (uint32_t s = 0; s <= writeSegment; ++s) usage += SegmentSize(s);
+
+    // Segments no index entry points at any more (their blocks were
+    // replaced by a reorg, or a previous prune stopped before deleting)
+    // go first, then whole segments in order.
+    std::vector<uint32_t> victims;
+    const uint32_t firstUsed = segmentTop.empty() ? writeSegment : segmentTop.begin()->first;
+    for (uint32_t s = 0; s < firstUsed; ++s) {
+        const uint64_t size = SegmentSize(s);
+        if (size == 0 && !std::filesystem::exists(SegmentPath(s))) continue;
+        victims.push_back(s);
+        usage -= size;
+    }
+    for (const auto& [segment, top] : segmentTop) {
+        if (usage <= targetBytes || segment >= writeSegment || top > maxHeight) break;
+        victims.push_back(segment);
+        usage -= SegmentSize(segment);
+    }
+    if (victims.empty()) return 0;
+
+    uint32_t below = 0;
+    for (const auto& [height, pos] : index) {
+        if (std::find(victims.begin(), victims.end(), pos.segment) == victims.end()) break;
+        below = height + 1;
+    }
+    KeepHeaders(below);
+
+    size_t removed = 0;
+    for (auto it = index.begin(); it != index.end();) {
+        if (std::find(victims.begin(), victims.end(), it->second.segment) != victims.end()) {
+            it = index.erase(it);
+            ++removed;
+        } else {
+            ++it;
         }
-        
-        for (uint32_t i = 0; i < txCount; ++i) {
-            if (offset + sizeof(uint32_t) > data.size()) throw std::runtime_error("truncated transaction size");
-            uint32_t txSize = 0;
-            std::memcpy(&txSize, data.data() + offset, sizeof(txSize));
-            offset += sizeof(txSize);
-            
-            // Validate transaction size
-            const uint32_t MAX_TX_SIZE = 10 * 1024 * 1024; // 10MB max per tx
-            if (txSize == 0 || txSize > MAX_TX_SIZE) {
-                throw std::runtime_error("invalid transaction size");
-            }
-            
-            if (offset + txSize > data.size()) throw std::runtime_error("truncated transaction data");
-            std::vector<uint8_t> txdata(data.begin() + offset, data.begin() + offset + txSize);
-            offset += txSize;
-            block.transactions.push_back(DeserializeTransaction(txdata));
+    }
+    SyncPath(SegmentPath(writeSegment));
+    FlushIndex();
+    dirtyCount = 0;
+    for (uint32_t segment : victims) {
+        std::error_code ec;
+        std::filesystem::remove(SegmentPath(segment), ec);
+        segmentCompact.erase(segment);
+    }
+    return removed;
+}
+
+std::vector<uint32_t> BlockStore::Segments() const
+{
+    // List the directory rather than probe numbers: pruning leaves a gap at
+    // the front and a lost index leaves no upper bound.
+    const std::filesystem::path base(path);
+    const std::string name = base.filename().string();
+    auto dir = base.parent_path();
+    if (dir.empty()) dir = ".";
+    std::vector<uint32_t> segments;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        const std::string file = entry.path().filename().string();
+        if (file == name) {
+            segments.push_back(0);
+            continue;
         }
-        return block;
+        if (file.size() <= name.size() + 1 || file.compare(0, name.size() + 1, name + ".") != 0) continue;
+        const std::string suffix = file.substr(name.size() + 1);
+        if (suffix.size() > 9 || !std::all_of(suffix.begin(), suffix.end(), [](char c) { return c >= '0' && c <= '9'; }))
+            continue;
+        const auto segment = static_cast<uint32_t>(std::stoul(suffix));
+        if (segment > 0) segments.push_back(segment);
     }
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
 
-private:
-    std::string path;
-    std::unordered_map<uint32_t, uint64_t> index;
-    std::mutex mu;
-    size_t dirtyCount{0};
-    static constexpr size_t kFlushThreshold = 100;
+std::vector<StoredBlock> BlockStore::ScanSegment(uint32_t segment) const
+{
+    std::vector<StoredBlock> found;
+    std::error_code ec;
+    const auto fileSize = std::filesystem::file_size(SegmentPath(segment), ec);
+    if (ec) return found;
+    std::ifstream in(SegmentPath(segment), std::ios::binary);
+    std::vector<uint8_t> data;
+    uint32_t flags = 0;
+    uint64_t next = 0;
+    while (next < fileSize && ReadRecord(in, next, data, flags) && data.size() >= kHeaderSize) {
+        found.push_back(StoredBlock{segment, next, DecodeHeader(data, flags)});
+        next += kRecordPrefix + data.size();
+    }
+    return found;
+}
 
-    void LoadIndex()
-    {
-        std::ifstream in(path + ".idx", std::ios::binary);
-        if (!in.good()) return;
-        uint32_t count = 0;
+void BlockStore::ResetIndex(const std::vector<StoredBlock>& chain)
+{
+    std::lock_guard<std::mutex> l(mu);
+    index.clear();
+    for (uint32_t height = 0; height < chain.size(); ++height)
+        index[height] = BlockPos{chain[height].segment, chain[height].offset};
+    segmentCompact.clear();
+    writeSegment = 0;
+    for (const auto& [height, pos] : index) writeSegment = std::max(writeSegment, pos.segment);
+    FlushIndex();
+    dirtyCount = 0;
+}
+
+void BlockStore::LoadIndex()
+{
+    std::ifstream in(path + ".idx", std::ios::binary);
+    if (!in.good()) return;
+    uint32_t count = 0;
+    in.read(reinterpret_cast<char*>(&count), sizeof(count));
+    uint32_t version = 1;
+    if (count == kIndexMagic) {
+        in.read(reinterpret_cast<char*>(&version), sizeof(version));
         in.read(reinterpret_cast<char*>(&count), sizeof(count));
-        
-        // Validate index count to prevent memory exhaustion
-        const uint32_t MAX_INDEX_ENTRIES = 10000000; // 10 million blocks max
-        if (count > MAX_INDEX_ENTRIES) {
-            throw std::runtime_error("index count exceeds maximum");
+        if (!in.good() || version != kIndexVersion) throw std::runtime_error("unsupported block index version");
+    }
+
+    // Validate index count to prevent memory exhaustion
+    const uint32_t MAX_INDEX_ENTRIES = 10000000; // 10 million blocks max
+    if (count > MAX_INDEX_ENTRIES) {
+        throw std::runtime_error("index count exceeds maximum");
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t height; BlockPos pos;
+        in.read(reinterpret_cast<char*>(&height), sizeof(height));
+        if (version >= 2) in.read(reinterpret_cast<char*>(&pos.segment), sizeof(pos.segment));
+        in.read(reinterpret_cast<char*>(&pos.offset), sizeof(pos.offset));
+        if (!in.good()) {
+            throw std::runtime_error("corrupt index file");
         }
-        
-        for (uint32_t i = 0; i < count; ++i) {
-            uint32_t height; uint64_t off;
-            in.read(reinterpret_cast<char*>(&height), sizeof(height));
-            in.read(reinterpret_cast<char*>(&off), sizeof(off));
-            if (!in.good()) {
-                throw std::runtime_error("corrupt index file");
+        index[height] = pos;
+        writeSegment = std::max(writeSegment, pos.segment);
+    }
+}
+
+void BlockStore::RecoverTail()
+{
+    // Resume after the last indexed record; the block at the highest indexed
+    // height is the one the next record has to link to.
+    uint32_t segment = writeSegment;
+    uint64_t next = 0;
+    std::optional<uint32_t> prevHeight;
+    std::optional<uint256> prevHash;
+    std::vector<uint8_t> data;
+    uint32_t flags = 0;
+    if (!index.empty()) {
+        const BlockPos* last = nullptr;
+        for (const auto& entry : index) {
+            const auto& pos = entry.second;
+            if (!last || pos.segment > last->segment || (pos.segment == last->segment && pos.offset > last->offset))
+                last = &pos;
+        }
+        std::ifstream in(SegmentPath(last->segment), std::ios::binary);
+        if (!ReadRecord(in, last->offset, data, flags)) return; // ReadBlock reports it
+        segment = last->segment;
+        next = last->offset + kRecordPrefix + data.size();
+
+        const auto& tip = *index.rbegin();
+        std::ifstream tipIn(SegmentPath(tip.second.segment), std::ios::binary);
+        if (ReadRecord(tipIn, tip.second.offset, data, flags) && data.size() >= kHeaderSize) {
+            prevHeight = tip.first;
+            prevHash = BlockHash(DecodeHeader(data, flags));
+        }
+    }
+
+    bool done = false;
+    while (!done) {
+        std::error_code ec;
+        const auto fileSize = std::filesystem::file_size(SegmentPath(segment), ec);
+        if (ec) break;
+        writeSegment = segment;
+        std::ifstream in(SegmentPath(segment), std::ios::binary);
+        while (next < fileSize) {
+            if (!ReadRecord(in, next, data, flags) || data.size() < kHeaderSize) {
+                // Torn append: drop it so later writes don't land behind garbage.
+                in.close();
+                std::filesystem::resize_file(SegmentPath(segment), next, ec);
+                done = true;
+                break;
             }
-            index[height] = off;
+            const BlockHeader header = DecodeHeader(data, flags);
+            uint32_t height = 0;
+            if (prevHash) {
+                if (header.prevBlockHash != *prevHash) { done = true; break; }
+                height = *prevHeight + 1;
+            } else {
+                // Index lost entirely: only a genesis record can anchor heights.
+                if (header.prevBlockHash != uint256{}) { done = true; break; }
+                height = 0;
+            }
+            index[height] = BlockPos{segment, next};
+            ++recovered;
+            ++dirtyCount;
+            prevHeight = height;
+            prevHash = BlockHash(header);
+            next += kRecordPrefix + data.size();
         }
+        ++segment;
+        next = 0;
+    }
+    if (recovered > 0) {
+        FlushIndex();
+        dirtyCount = 0;
     }
+}
 
-    void FlushIndex()
+void BlockStore::FlushIndex()
+{
+    // Write-then-rename so a crash leaves either the old or the new index.
+    const std::string tmp = path + ".idx.tmp";
     {
-        std::ofstream out(path + ".idx", std::ios::binary | std::ios::trunc);
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
         uint32_t count = static_cast<uint32_t>(index.size());
+        out.write(reinterpret_cast<const char*>(&kIndexMagic), sizeof(kIndexMagic));
+        out.write(reinterpret_cast<const char*>(&kIndexVersion), sizeof(kIndexVersion));
         out.write(reinterpret_cast<const char*>(&count), sizeof(count));
         for (const auto& e : index) {
             out.write(reinterpret_cast<const char*>(&e.first), sizeof(e.first));
-            out.write(reinterpret_cast<const char*>(&e.second), sizeof(e.second));
+            out.write(reinterpret_cast<const char*>(&e.second.segment), sizeof(e.second.segment));
+            out.write(reinterpret_cast<const char*>(&e.second.offset), sizeof(e.second.offset));
         }
+        out.flush();
+        if (!out) throw std::runtime_error("blockstore index write failed");
     }
-};
+    SyncPath(tmp);
+    std::error_code ec;
+    std::filesystem::rename(tmp, path + ".idx", ec);
+    if (ec) throw std::runtime_error("blockstore index rename failed: " + ec.message());
+}
+
+void BlockStore::KeepHeaders(uint32_t below)
+{
+    const std::string file = path + ".hdr";
+    std::error_code ec;
+    const uint64_t size = std::filesystem::file_size(file, ec);
+    uint32_t kept = ec ? 0 : static_cast<uint32_t>(size / kHeaderSize);
+    // A crash mid-append leaves a partial header at the end.
+    if (!ec && size % kHeaderSize != 0) std::filesystem::resize_file(file, uint64_t{kept} * kHeaderSize, ec);
+    // Headers pruned before this file existed are gone; the file only ever
+    // holds a gap-free run from height 0.
+    if (kept >= below || index.empty() || kept < index.begin()->first) return;
+    std::ofstream out(file, std::ios::binary | std::ios::app);
+    std::vector<uint8_t> data;
+    uint32_t flags = 0;
+    for (; kept < below; ++kept) {
+        const auto it = index.find(kept);
+        if (it == index.end()) throw std::runtime_error("unknown height");
+        std::ifstream in(SegmentPath(it->second.segment), std::ios::binary);
+        if (!ReadRecord(in, it->second.offset, data, flags) || data.size() < kHeaderSize)
+            throw std::runtime_error("corrupt blockstore");
+        const BlockHeader header = DecodeHeader(data, flags);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+    out.flush();
+    if (!out) throw std::runtime_error("pruned header write failed");
+    out.close();
+    SyncPath(file);
+}
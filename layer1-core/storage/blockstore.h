@@ -0,0 +1,179 @@
+#pragma once
+#include "../block/block.h"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Location of one serialized transaction inside the block files.
+struct DiskTxPos {
+    uint32_t segment{0};
+    uint64_t offset{0};
+    uint32_t length{0};
+};
+
+// A record found by scanning a segment file directly.
+struct StoredBlock {
+    uint32_t segment{0};
+    uint64_t offset{0};
+    BlockHeader header{};
+};
+
+// Outcome of BlockStore::VerifyBlock().
+struct BlockCheck {
+    bool ok{false};
+    uint64_t bytes{0};  // record size on disk, if it could be read
+    std::string error;
+};
+
+struct BlockStoreOptions {
+    uint64_t maxSegmentSize{128ull * 1024 * 1024};
+    // Also LZ-compress each block's body when that makes it smaller. Such
+    // records have no per-transaction positions, so transaction lookups fall
+    // back to reading the whole block.
+    bool compress{false};
+    // Store new blocks in their wire encoding (SerializeBlock) instead, so
+    // ReadSerializedBlock() returns them as stored, e.g. for an archive node
+    // serving blocks to syncing peers. Larger on disk; cannot be combined
+    // with `compress`.
+    bool wire{false};
+};
+
+// Append-only block files with a height -> (segment, offset) index.
+//
+// Blocks are appended to numbered segment files: segment 0 is `path`, later
+// ones are `path.1`, `path.2`, ... and a new segment is started once the
+// current one would grow past `maxSegmentSize`.
+//
+// Segment records: [size(4)][checksum(32)][payload]. The top bits of the
+// size field give the payload format:
+//   compact:    [header(80)][varint txCount]([varint len][compact tx])...
+//   compressed: [header(80)][varint rawSize][Compress(compact body)]
+//   neither:    [header | txCount(4) | (len(4), wire tx)...]  (older files,
+//               and `wire` stores)
+// Transactions are stored with blockcodec::EncodeTransaction and decode to
+// the exact consensus serialization. The checksum is the payload's SHA-256,
+// or for records with the CRC bit (all new ones) [crc32c(4)][first 28
+// bytes of the SHA-256]: reads and recovery check only the CRC, and
+// VerifyBlock() checks both. A segment holds only one of legacy-layout or
+// compact records, so a DiskTxPos can be decoded from its segment alone.
+// Index file (path + ".idx"): [0xffffffff][version(4)][count(4)] then
+// (height(4), segment(4), offset(8)) in ascending height order, replaced
+// atomically on every flush. Version 1 files ([count] then (height, offset)
+// pairs, single segment) are still read.
+//
+// Records appended after the last index flush are recovered on open by
+// walking the newest segments: each record must pass its checksum and link
+// to the previous block by prevBlockHash. A torn record at the tail (crash
+// during append) is truncated away.
+//
+// Pruning deletes whole segments from the front. Their heights are dropped
+// from the index (which is flushed first, so a crash never leaves the index
+// pointing into a deleted file); reads below the lowest remaining height
+// then fail with "block pruned". The headers of pruned blocks are first
+// appended to `path + ".hdr"` (raw 80-byte headers from height 0), so
+// ReadHeader() keeps working for them and the header chain can still be
+// rebuilt after a restart.
+class BlockStore {
+public:
+    static constexpr uint64_t kDefaultSegmentSize = 128ull * 1024 * 1024;
+
+    explicit BlockStore(const std::string& path, uint64_t maxSegmentSize = kDefaultSegmentSize);
+    BlockStore(const std::string& path, const BlockStoreOptions& options);
+    ~BlockStore();
+
+    BlockStore(const BlockStore&) = delete;
+    BlockStore& operator=(const BlockStore&) = delete;
+
+    // Appends the block; returns where each of its transactions was written
+    // (nothing for a compressed record).
+    std::vector<DiskTxPos> WriteBlock(uint32_t height, const Block& block);
+    // Optionally also reports where each transaction of the block is stored.
+    // The file read and decoding happen outside the store lock, so several
+    // threads can read blocks in parallel.
+    Block ReadBlock(uint32_t height, std::vector<DiskTxPos>* positions = nullptr);
+    // The block's wire encoding (SerializeBlock). Legacy-layout records are
+    // that already and are returned as read, after the checksum; others are
+    // decoded and serialized.
+    std::vector<uint8_t> ReadSerializedBlock(uint32_t height) const;
+
+    // Only the header of a stored block, without reading the rest of the
+    // record or checking its checksum (e.g. to rebuild a header index).
+    // Also works for pruned blocks.
+    BlockHeader ReadHeader(uint32_t height) const;
+
+    // Transaction positions of a stored block, for indexing existing data.
+    std::vector<DiskTxPos> TransactionPositions(uint32_t height);
+
+    // Reads a single transaction without loading its block. Only the block
+    // record as a whole is checksummed, so callers should compare the txid.
+    Transaction ReadTransaction(const DiskTxPos& pos) const;
+
+    // Full integrity check of a stored block: the whole checksum, the
+    // decoding and the merkle root (CheckMerkleRoot). Never throws for
+    // damaged data; throws std::runtime_error only if the height is not
+    // stored.
+    BlockCheck VerifyBlock(uint32_t height) const;
+
+    bool HasBlock(uint32_t height) const;
+    std::optional<uint32_t> TipHeight() const;
+
+    // fsyncs the segment being written, then rewrites and fsyncs the index.
+    void Sync();
+
+    // Number of records recovered from the data file during open.
+    std::size_t RecoveredOnOpen() const { return recovered; }
+
+    std::string SegmentPath(uint32_t segment) const;
+
+    // Deletes the oldest segments while the block files take more than
+    // `targetBytes`. Only segments whose blocks are all at or below
+    // `maxHeight` are removed, and never the one being written, so the
+    // caller decides what must stay. Returns the number of blocks removed.
+    size_t Prune(uint64_t targetBytes, uint32_t maxHeight);
+    // Size of all segment files.
+    uint64_t DiskUsage() const;
+    // Highest height whose block has been pruned, if any.
+    std::optional<uint32_t> PrunedHeight() const;
+
+    // Reindexing. Segments() lists the segment files present on disk and
+    // ScanSegment() returns every intact record of one of them in file
+    // order, without consulting the index; both are safe to call from
+    // several threads. ResetIndex() replaces the height index with `chain`,
+    // where chain[h] is the block at height h.
+    std::vector<uint32_t> Segments() const;
+    std::vector<StoredBlock> ScanSegment(uint32_t segment) const;
+    void ResetIndex(const std::vector<StoredBlock>& chain);
+
+private:
+    struct BlockPos {
+        uint32_t segment{0};
+        uint64_t offset{0};
+    };
+
+    std::string path;
+    uint64_t maxSegmentSize;
+    bool compress{false};
+    bool wire{false};
+    std::map<uint32_t, BlockPos> index;
+    uint32_t writeSegment{0};
+    mutable std::mutex mu;
+    size_t dirtyCount{0};
+    size_t recovered{0};
+    mutable std::map<uint32_t, bool> segmentCompact;
+    static constexpr size_t kFlushThreshold = 100;
+
+    BlockPos Locate(uint32_t height) const;
+    std::vector<uint8_t> ReadRecordData(const BlockPos& pos, uint32_t& flags, bool full = false) const;
+    // Whether the segment holds compact records (true for a new segment).
+    bool SegmentIsCompact(uint32_t segment) const;
+    uint64_t SegmentSize(uint32_t segment) const;
+    void LoadIndex();
+    void RecoverTail();
+    void FlushIndex();
+    // Appends the headers of heights [kept, below) to the pruned-header file.
+    void KeepHeaders(uint32_t below);
+};
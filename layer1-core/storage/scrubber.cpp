@@ -0,0 +1,195 @@
+#include "scrubber.h"
+#include "../validation/validation.h"
+#include <stdexcept>
+
+BlockScrubber::BlockScrubber(BlockStore& blocks, ScrubOptions options, RepairRequest request)
+    : m_blocks(blocks), m_options(options), m_request(std::move(request))
+{
+}
+
+BlockScrubber::~BlockScrubber()
+{
+    Stop();
+}
+
+void BlockScrubber::Start()
+{
+    if (m_thread.joinable()) throw std::runtime_error("scrubber already started");
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        m_stop = false;
+    }
+    m_thread = std::thread([this] { ThreadLoop(); });
+}
+
+void BlockScrubber::Stop()
+{
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    if (m_thread.joinable()) m_thread.join();
+}
+
+void BlockScrubber::ThreadLoop()
+{
+    while (true) {
+        RunPass();
+        std::unique_lock<std::mutex> l(m_mutex);
+        if (m_wake.wait_for(l, m_options.passInterval, [this] { return m_stop; })) return;
+    }
+}
+
+bool BlockScrubber::Throttle(std::chrono::steady_clock::time_point started, uint64_t bytes)
+{
+    std::unique_lock<std::mutex> l(m_mutex);
+    if (m_options.bytesPerSecond > 0) {
+        const auto due = started + std::chrono::microseconds(bytes * 1000000 / m_options.bytesPerSecond);
+        m_wake.wait_until(l, due, [this] { return m_stop; });
+    }
+    return !m_stop;
+}
+
+std::size_t BlockScrubber::RunPass()
+{
+    const auto tip = m_blocks.TipHeight();
+    const auto pruned = m_blocks.PrunedHeight();
+    const auto started = std::chrono::steady_clock::now();
+    uint64_t bytes = 0;
+    std::size_t found = 0;
+    bool complete = true;
+    if (tip) {
+        for (uint32_t height = pruned ? *pruned + 1 : 0; height <= *tip; ++height) {
+            if (!Throttle(started, bytes)) {
+                complete = false;
+                break;
+            }
+            {
+                std::lock_guard<std::mutex> l(m_mutex);
+                m_status.position = height;
+            }
+            BlockCheck check;
+            try {
+                check = m_blocks.VerifyBlock(height);
+            } catch (const std::runtime_error&) {
+                continue; // pruned or reorganized away meanwhile
+            }
+            if (!check.ok && !m_blocks.HasBlock(height)) continue;
+            bytes += check.bytes;
+            std::lock_guard<std::mutex> l(m_mutex);
+            ++m_status.blocksVerified;
+            m_status.bytesVerified += check.bytes;
+            if (check.ok) {
+                m_damaged.erase(height);
+                continue;
+            }
+            ++found;
+            auto& damage = m_damaged[height];
+            damage.error = check.error;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        m_status.position.reset();
+        if (complete) ++m_status.passes;
+        // Heights that are gone (pruned) cannot be repaired any more.
+        const auto lowest = m_blocks.PrunedHeight();
+        if (lowest) m_damaged.erase(m_damaged.begin(), m_damaged.upper_bound(*lowest));
+    }
+    RequestRepairs();
+    return found;
+}
+
+void BlockScrubber::RequestRepairs()
+{
+    // Only an intact block above names a damaged one.
+    std::vector<uint32_t> heights;
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        for (const auto& [height, damage] : m_damaged) {
+            if (!m_damaged.count(height + 1)) heights.push_back(height);
+        }
+    }
+    std::vector<std::pair<uint32_t, uint256>> requests;
+    for (uint32_t height : heights) {
+        std::optional<uint256> expected;
+        try {
+            expected = m_blocks.ReadBlock(height + 1).header.prevBlockHash;
+        } catch (const std::runtime_error&) {
+        }
+        std::lock_guard<std::mutex> l(m_mutex);
+        auto it = m_damaged.find(height);
+        if (it == m_damaged.end()) continue;
+        if (expected) it->second.expected = expected;
+        if (it->second.expected) requests.emplace_back(height, *it->second.expected);
+    }
+    // Damaged runs are named from the top down as Repair() fills them in;
+    // ask again for the parts already named.
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        for (const auto& [height, damage] : m_damaged) {
+            if (damage.expected && m_damaged.count(height + 1)) requests.emplace_back(height, *damage.expected);
+        }
+    }
+    for (const auto& [height, hash] : requests) Request(height, hash);
+}
+
+void BlockScrubber::Request(uint32_t height, const uint256& hash)
+{
+    if (!m_request) return;
+    std::string source = m_request(height, hash);
+    std::lock_guard<std::mutex> l(m_mutex);
+    auto it = m_damaged.find(height);
+    if (it != m_damaged.end() && it->second.expected == hash) it->second.source = std::move(source);
+}
+
+bool BlockScrubber::Repair(const Block& block, const std::string& source)
+{
+    const uint256 hash = BlockHash(block.header);
+    std::optional<uint32_t> height;
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        for (const auto& [h, damage] : m_damaged) {
+            if (damage.expected && *damage.expected == hash && !source.empty() && damage.source == source) {
+                height = h;
+                break;
+            }
+        }
+    }
+    if (!height) return false;
+    if (!CheckMerkleRoot(block)) return false;
+    m_blocks.WriteBlock(*height, block);
+    m_blocks.Sync();
+
+    // The repaired block names its parent, which may be damaged too.
+    std::optional<std::pair<uint32_t, uint256>> next;
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        m_damaged.erase(*height);
+        ++m_status.repaired;
+        if (*height > 0) {
+            auto it = m_damaged.find(*height - 1);
+            if (it != m_damaged.end() && !it->second.expected) {
+                it->second.expected = block.header.prevBlockHash;
+                next.emplace(*height - 1, block.header.prevBlockHash);
+            }
+        }
+    }
+    if (next) Request(next->first, next->second);
+    return true;
+}
+
+ScrubStatus BlockScrubber::Status() const
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    ScrubStatus status = m_status;
+    for (const auto& [height, damage] : m_damaged) {
+        if (!status.damaged.empty() && status.damaged.back().last + 1 == height) {
+            status.damaged.back().last = height;
+            continue;
+        }
+        status.damaged.push_back(DamagedRange{height, height, damage.error});
+    }
+    return status;
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include "blockstore.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct ScrubOptions {
+    // Disk read budget of the scrub thread; 0 = unthrottled. Keeps it from
+    // competing with block validation and peers for the disk.
+    uint64_t bytesPerSecond{8ull * 1024 * 1024};
+    // Pause between the end of one pass and the start of the next.
+    std::chrono::seconds passInterval{std::chrono::hours(24)};
+};
+
+// Consecutive damaged heights sharing the first one's error.
+struct DamagedRange {
+    uint32_t first{0};
+    uint32_t last{0};
+    std::string error;
+};
+
+struct ScrubStatus {
+    uint64_t passes{0};          // completed
+    uint64_t blocksVerified{0};  // over all passes
+    uint64_t bytesVerified{0};
+    std::optional<uint32_t> position;  // height being checked by the current pass
+    uint64_t repaired{0};
+    std::vector<DamagedRange> damaged;
+};
+
+// Background integrity scrubber for the block store.
+//
+// Normal reads only check the cheap CRC of each record. The scrubber walks
+// every stored block from the lowest unpruned height to the tip, checks it
+// end to end with BlockStore::VerifyBlock() (SHA-256, decoding and merkle
+// root) and remembers the heights that fail. The hash a damaged block must
+// have is taken from the prevBlockHash of the block above it, and is handed
+// to the repair callback so the node can fetch that block from a peer; a
+// block from that peer passed to Repair() that matches is written back to
+// the store. A damaged tip cannot be named that way and is only reported.
+class BlockScrubber {
+public:
+    // Called without the scrubber lock held, from the scrub thread or from
+    // Repair(). Returns the peer asked for the block, empty if none.
+    using RepairRequest = std::function<std::string(uint32_t height, const uint256& hash)>;
+
+    BlockScrubber(BlockStore& blocks, ScrubOptions options = {}, RepairRequest request = {});
+    ~BlockScrubber();
+
+    BlockScrubber(const BlockScrubber&) = delete;
+    BlockScrubber& operator=(const BlockScrubber&) = delete;
+
+    // Runs passes on a background thread until Stop().
+    void Start();
+    void Stop();
+
+    // One full pass on the calling thread (throttled the same way). Returns
+    // the number of damaged blocks found.
+    std::size_t RunPass();
+
+    // Accepts a block that replaces a damaged one: it must come from the
+    // peer it was requested from, have the requested hash and pass
+    // CheckMerkleRoot(). Returns false for any other block.
+    bool Repair(const Block& block, const std::string& source);
+
+    ScrubStatus Status() const;
+
+private:
+    struct Damage {
+        std::string error;
+        std::optional<uint256> expected;
+        std::string source; // peer asked for the block
+    };
+
+    void ThreadLoop();
+    // Sleeps off the read budget; false if stopped meanwhile.
+    bool Throttle(std::chrono::steady_clock::time_point started, uint64_t bytes);
+    void RequestRepairs();
+    // Asks for one block and remembers the peer asked.
+    void Request(uint32_t height, const uint256& hash);
+
+    BlockStore& m_blocks;
+    ScrubOptions m_options;
+    RepairRequest m_request;
+    std::thread m_thread;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stop{false};
+    ScrubStatus m_status;
+    std::map<uint32_t, Damage> m_damaged;
+};
@@ -44,4 +44,38 @@ public:
         off += size;
         return out;
     }
+
+    // MSB base-128 varint with the "+1 per continuation byte" offset so every
+    // value has exactly one encoding. Used by storage formats, never on the
+    // consensus wire encoding.
+    static void writeVarInt(std::vector<uint8_t>& buf, uint64_t v) {
+        uint8_t tmp[10];
+        int len = 0;
+        while (true) {
+            tmp[len] = static_cast<uint8_t>((v & 0x7F) | (len ? 0x80 : 0x00));
+            if (v <= 0x7F) break;
+            v = (v >> 7) - 1;
+            ++len;
+        }
+        do {
+            buf.push_back(tmp[len]);
+        } while (len--);
+    }
+
+    static uint64_t readVarInt(const uint8_t* data, size_t size, size_t& off) {
+        uint64_t v = 0;
+        while (true) {
+            if (off >= size) throw std::runtime_error("readVarInt OOB");
+            if (v > (UINT64_MAX >> 7)) throw std::runtime_error("readVarInt overflow");
+            uint8_t b = data[off++];
+            v = (v << 7) | (b & 0x7F);
+            if (!(b & 0x80)) return v;
+            if (v == UINT64_MAX) throw std::runtime_error("readVarInt overflow");
+            ++v;
+        }
+    }
+
+    static uint64_t readVarInt(const std::vector<uint8_t>& buf, size_t& off) {
+        return readVarInt(buf.data(), buf.size(), off);
+    }
 };
@@ -0,0 +1,48 @@
+#include "assumevalid.h"
+#include <stdexcept>
+
+std::optional<uint256> DefaultAssumeValid(const consensus::Params& params)
+{
+    if (params.checkpoints.empty())
+        return std::nullopt;
+    return params.checkpoints.rbegin()->second;
+}
+
+std::optional<uint256> ParseAssumeValid(const std::string& arg)
+{
+    if (arg == "0")
+        return std::nullopt;
+    if (arg.size() != 64)
+        throw std::runtime_error("assumevalid must be a 64 character block hash or 0");
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    uint256 hash{};
+    for (size_t i = 0; i < hash.size(); ++i) {
+        int hi = nibble(arg[2 * i]);
+        int lo = nibble(arg[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            throw std::runtime_error("assumevalid must be hex");
+        hash[i] = static_cast<uint8_t>((hi << 4) | lo);
+    }
+    return hash;
+}
+
+bool CanSkipScriptChecks(const consensus::ForkResolver& headers,
+                         const std::optional<uint256>& assumeValid,
+                         const uint256& blockHash)
+{
+    if (!assumeValid)
+        return false;
+    const auto* tip = headers.Tip();
+    if (!tip)
+        return false;
+    // An attacker feeding us a side chain that happens to contain the
+    // assumed-valid block does not help: it must be on the best header chain.
+    if (!headers.IsAncestor(*assumeValid, tip->hash))
+        return false;
+    return headers.IsAncestor(blockHash, *assumeValid);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "../consensus/fork_resolution.h"
+#include "../consensus/params.h"
+#include <optional>
+#include <string>
+
+// assumevalid: blocks buried under a known-good block are assumed to carry
+// valid signatures, so initial sync may skip VerifyScript for them. Every
+// other consensus rule (amounts, UTXO existence, assets, merkle root) is still
+// checked, and the shortcut only applies when the assumed-valid block is part
+// of the best header chain we know about.
+
+// Default assumed-valid block: the highest hardened checkpoint, if any.
+std::optional<uint256> DefaultAssumeValid(const consensus::Params& params);
+
+// Parses the -assumevalid argument. "0" disables the optimisation; anything
+// else must be a 64 character hex block hash in the byte order the RPC
+// interface prints hashes. Throws std::runtime_error on malformed input.
+std::optional<uint256> ParseAssumeValid(const std::string& arg);
+
+// True when scripts for `blockHash` may be skipped: `assumeValid` is known,
+// lies on the chain of the best header, and `blockHash` is one of its
+// ancestors (or the block itself).
+bool CanSkipScriptChecks(const consensus::ForkResolver& headers,
+                         const std::optional<uint256>& assumeValid,
+                         const uint256& blockHash);
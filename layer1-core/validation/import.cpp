@@ -0,0 +1,349 @@
+#include "import.h"
+#include "../consensus/fork_resolution.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t kMaxBootstrapBlock = 100 * 1024 * 1024;
+constexpr std::size_t kMedianTimeSpan = 11;
+
+double Seconds(Clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+std::size_t ThreadCount(std::size_t requested)
+{
+    return requested ? requested : std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Indexes into `headers` that form the best chain from genesis, in height
+// order. Records may appear in any order and more than once; heights follow
+// from the parent links and records that do not lead back to genesis are
+// ignored. The header index then picks the tip exactly as it would for
+// headers from the network.
+std::vector<std::size_t> BestChain(const std::vector<BlockHeader>& headers, const consensus::Params& params)
+{
+    constexpr uint32_t kUnknown = std::numeric_limits<uint32_t>::max();
+    constexpr uint32_t kDetached = kUnknown - 1;
+
+    std::vector<uint256> hashes(headers.size());
+    std::unordered_map<uint256, std::size_t, consensus::Uint256Hasher, consensus::Uint256Eq> byHash;
+    byHash.reserve(headers.size());
+    for (std::size_t i = 0; i < headers.size(); ++i) {
+        hashes[i] = BlockHash(headers[i]);
+        byHash.emplace(hashes[i], i); // first copy wins
+    }
+
+    std::vector<uint32_t> height(headers.size(), kUnknown);
+    std::vector<std::size_t> walk;
+    for (std::size_t i = 0; i < headers.size(); ++i) {
+        walk.clear();
+        std::size_t cur = i;
+        uint32_t next = kDetached; // height of walk.back()
+        while (true) {
+            if (height[cur] != kUnknown) {
+                if (height[cur] != kDetached) next = height[cur] + 1;
+                break;
+            }
+            walk.push_back(cur);
+            if (headers[cur].prevBlockHash == uint256{}) {
+                next = 0;
+                break;
+            }
+            auto parent = byHash.find(headers[cur].prevBlockHash);
+            if (parent == byHash.end()) break;
+            cur = parent->second;
+        }
+        for (auto it = walk.rbegin(); it != walk.rend(); ++it)
+            height[*it] = next == kDetached ? kDetached : next++;
+    }
+
+    std::vector<std::size_t> order;
+    for (std::size_t i = 0; i < headers.size(); ++i) {
+        if (height[i] != kDetached && byHash[hashes[i]] == i) order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return height[a] < height[b]; });
+
+    consensus::ForkResolver resolver;
+    for (std::size_t i : order)
+        resolver.ConsiderHeader(headers[i], hashes[i], headers[i].prevBlockHash, height[i], params);
+    const auto* tip = resolver.Tip();
+    if (!tip) return {};
+    std::vector<std::size_t> chain;
+    for (const auto& hash : resolver.ReorgPath(tip->hash)) chain.push_back(byHash.at(hash));
+    return chain;
+}
+
+// Loads items 0..count-1 on worker threads, never more than `window` ahead
+// of the consumer, and hands them out in order. A failed load is rethrown
+// by Take() for that item.
+class OrderedReader {
+public:
+    using Load = std::function<Block(std::size_t)>;
+
+    OrderedReader(std::size_t count, std::size_t threads, std::size_t window, Load load)
+        : m_count(count), m_window(std::max<std::size_t>(1, window)), m_load(std::move(load))
+    {
+        threads = std::min(threads, std::max<std::size_t>(1, count));
+        for (std::size_t i = 0; i < threads; ++i) m_threads.emplace_back([this] { Run(); });
+    }
+
+    ~OrderedReader()
+    {
+        {
+            std::lock_guard<std::mutex> l(m_mu);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        for (auto& t : m_threads) t.join();
+    }
+
+    OrderedReader(const OrderedReader&) = delete;
+    OrderedReader& operator=(const OrderedReader&) = delete;
+
+    Block Take(std::size_t item, double& waited)
+    {
+        std::unique_lock<std::mutex> l(m_mu);
+        const auto start = Clock::now();
+        m_cv.wait(l, [&] { return m_ready.count(item) || m_errors.count(item); });
+        waited += Seconds(Clock::now() - start);
+        m_taken = item + 1;
+        m_cv.notify_all();
+        if (auto err = m_errors.find(item); err != m_errors.end()) std::rethrow_exception(err->second);
+        auto node = m_ready.extract(item);
+        return std::move(node.mapped());
+    }
+
+    double ReadSeconds() const
+    {
+        std::lock_guard<std::mutex> l(m_mu);
+        return m_readSeconds;
+    }
+
+private:
+    void Run()
+    {
+        while (true) {
+            std::size_t item = 0;
+            {
+                std::unique_lock<std::mutex> l(m_mu);
+                m_cv.wait(l, [&] { return m_stop || (m_next < m_count && m_next < m_taken + m_window); });
+                if (m_stop) return;
+                item = m_next++;
+            }
+            const auto start = Clock::now();
+            std::optional<Block> block;
+            std::exception_ptr error;
+            try {
+                block = m_load(item);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            {
+                std::lock_guard<std::mutex> l(m_mu);
+                m_readSeconds += Seconds(Clock::now() - start);
+                if (error) m_errors[item] = error;
+                else m_ready[item] = std::move(*block);
+            }
+            m_cv.notify_all();
+        }
+    }
+
+    const std::size_t m_count;
+    const std::size_t m_window;
+    Load m_load;
+    mutable std::mutex m_mu;
+    std::condition_variable m_cv;
+    std::map<std::size_t, Block> m_ready;
+    std::map<std::size_t, std::exception_ptr> m_errors;
+    std::size_t m_next{0};
+    std::size_t m_taken{0};
+    double m_readSeconds{0};
+    bool m_stop{false};
+    std::vector<std::thread> m_threads;
+};
+
+// Feeds `count` blocks starting at `first` through a pipeline.
+ImportResult Feed(Chainstate& chainstate, const consensus::Params& params, BlockPipeline::BlockSink sink,
+                  ImportOptions& opts, uint32_t first, std::size_t count, OrderedReader::Load load)
+{
+    ImportResult result;
+    const auto started = Clock::now();
+    {
+        BlockPipeline pipeline(chainstate, params, std::move(sink), opts.pipeline);
+        OrderedReader reader(count, ThreadCount(opts.readers), opts.readAhead, std::move(load));
+        for (std::size_t i = 0; i < count; ++i) {
+            const uint32_t height = first + static_cast<uint32_t>(i);
+            Block block;
+            try {
+                block = reader.Take(i, result.stats.waitReadSeconds);
+            } catch (const std::exception& e) {
+                result.failedHeight = height;
+                result.error = std::string("read failed: ") + e.what();
+                break;
+            }
+            const auto submitStart = Clock::now();
+            const bool accepted = pipeline.Submit(height, std::move(block));
+            result.stats.waitValidateSeconds += Seconds(Clock::now() - submitStart);
+            if (!accepted) break;
+            ++result.stats.blocks;
+            result.stats.height = height;
+            if (opts.progress && opts.progressInterval && result.stats.blocks % opts.progressInterval == 0) {
+                result.stats.elapsedSeconds = Seconds(Clock::now() - started);
+                result.stats.readSeconds = reader.ReadSeconds();
+                opts.progress(result.stats);
+            }
+        }
+        const auto finishStart = Clock::now();
+        pipeline.Finish();
+        result.stats.waitValidateSeconds += Seconds(Clock::now() - finishStart);
+        result.stats.readSeconds = reader.ReadSeconds();
+        if (pipeline.FailedHeight()) {
+            result.failedHeight = pipeline.FailedHeight();
+            result.error = pipeline.Error();
+        }
+        if (auto connected = pipeline.ConnectedHeight()) result.connected = *connected - first + 1;
+    }
+    if (auto best = chainstate.BestBlock()) result.tip = best->height;
+    result.stats.elapsedSeconds = Seconds(Clock::now() - started);
+    if (opts.progress) opts.progress(result.stats);
+    return result;
+}
+
+} // namespace
+
+std::size_t RebuildBlockIndex(BlockStore& blocks, const consensus::Params& params, std::size_t threads)
+{
+    if (blocks.PrunedHeight()) throw std::runtime_error("cannot reindex: old blocks have been pruned");
+
+    // Scan segments in parallel; keep them in file order so that of two
+    // copies of a block the older one is used.
+    const auto segments = blocks.Segments();
+    std::vector<std::vector<StoredBlock>> scanned(segments.size());
+    std::atomic<std::size_t> next{0};
+    std::vector<std::thread> workers;
+    const std::size_t count = std::min(ThreadCount(threads), std::max<std::size_t>(1, segments.size()));
+    for (std::size_t t = 0; t < count; ++t) {
+        workers.emplace_back([&] {
+            for (std::size_t i = next++; i < segments.size(); i = next++) scanned[i] = blocks.ScanSegment(segments[i]);
+        });
+    }
+    for (auto& w : workers) w.join();
+
+    std::vector<StoredBlock> records;
+    for (auto& segment : scanned) records.insert(records.end(), segment.begin(), segment.end());
+    std::vector<BlockHeader> headers;
+    headers.reserve(records.size());
+    for (const auto& r : records) headers.push_back(r.header);
+
+    const auto best = BestChain(headers, params);
+    if (best.empty()) throw std::runtime_error("no genesis block found in the block files");
+    std::vector<StoredBlock> chain;
+    chain.reserve(best.size());
+    for (std::size_t i : best) chain.push_back(records[i]);
+    blocks.ResetIndex(chain);
+    return chain.size();
+}
+
+ImportResult ReindexChainstate(Chainstate& chainstate, BlockStore& blocks, const consensus::Params& params,
+                               ImportOptions opts)
+{
+    if (blocks.PrunedHeight()) throw std::runtime_error("cannot reindex: old blocks have been pruned");
+    chainstate.Clear();
+    const auto tip = blocks.TipHeight();
+    if (!tip) return {};
+    // The chain starts at its root, so there are no earlier timestamps.
+    opts.pipeline.previousTimes.clear();
+    // The blocks are already stored.
+    return Feed(chainstate, params, {}, opts, 0, static_cast<std::size_t>(*tip) + 1,
+                [&blocks](std::size_t height) { return blocks.ReadBlock(static_cast<uint32_t>(height)); });
+}
+
+ImportResult ImportBootstrap(const std::string& path, Chainstate& chainstate, BlockStore& blocks,
+                             const consensus::Params& params, ImportOptions opts)
+{
+    // First pass: where each record is, and its header.
+    struct Record {
+        uint64_t offset{0}; // of the block data
+        uint32_t size{0};
+    };
+    std::vector<Record> records;
+    std::vector<BlockHeader> headers;
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) throw std::runtime_error("cannot open bootstrap file " + path);
+        in.seekg(0, std::ios::end);
+        const uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+        uint64_t pos = 0;
+        while (pos + 8 + sizeof(BlockHeader) <= fileSize) {
+            uint32_t magic = 0;
+            uint32_t size = 0;
+            in.seekg(static_cast<std::streamoff>(pos));
+            in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+            in.read(reinterpret_cast<char*>(&size), sizeof(size));
+            if (!in || magic != kBootstrapMagic || size < sizeof(BlockHeader) || size > kMaxBootstrapBlock)
+                throw std::runtime_error("corrupt bootstrap record at offset " + std::to_string(pos));
+            if (pos + 8 + size > fileSize) break; // truncated download: use what is complete
+            BlockHeader header{};
+            in.read(reinterpret_cast<char*>(&header), sizeof(header));
+            records.push_back(Record{pos + 8, size});
+            headers.push_back(header);
+            pos += 8 + size;
+        }
+    }
+
+    const auto chain = BestChain(headers, params);
+    if (chain.empty()) throw std::runtime_error("bootstrap file has no genesis block");
+
+    uint32_t start = 0;
+    if (const auto best = chainstate.BestBlock()) {
+        if (best->height >= chain.size() || BlockHash(headers[chain[best->height]]) != best->hash)
+            throw std::runtime_error("bootstrap file does not contain the current chain tip");
+        start = best->height + 1;
+    }
+    ImportResult result;
+    if (start >= chain.size()) {
+        result.tip = start - 1;
+        return result;
+    }
+
+    opts.pipeline.previousTimes.clear();
+    for (uint32_t h = start > kMedianTimeSpan ? start - kMedianTimeSpan : 0; h < start; ++h)
+        opts.pipeline.previousTimes.push_back(headers[chain[h]].time);
+
+    auto load = [&](std::size_t i) {
+        const Record& r = records[chain[start + i]];
+        std::ifstream in(path, std::ios::binary);
+        in.seekg(static_cast<std::streamoff>(r.offset));
+        std::vector<uint8_t> data(r.size);
+        in.read(reinterpret_cast<char*>(data.data()), data.size());
+        if (!in) throw std::runtime_error("truncated bootstrap record");
+        return DeserializeBlock(data);
+    };
+    return Feed(chainstate, params, [&blocks](uint32_t height, const Block& block) { blocks.WriteBlock(height, block); },
+                opts, start, chain.size() - start, load);
+}
+
+void AppendBootstrapBlock(std::ostream& out, const Block& block)
+{
+    const auto data = SerializeBlock(block);
+    const uint32_t size = static_cast<uint32_t>(data.size());
+    out.write(reinterpret_cast<const char*>(&kBootstrapMagic), sizeof(kBootstrapMagic));
+    out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    out.write(reinterpret_cast<const char*>(data.data()), data.size());
+}
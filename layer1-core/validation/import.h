@@ -0,0 +1,71 @@
+#pragma once
+#include "pipeline.h"
+#include "../storage/blockstore.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <ostream>
+#include <string>
+
+// Rebuilding the chain from local block data instead of the network.
+//
+//   -reindex     RebuildBlockIndex() scans every block segment and lets the
+//                header index (consensus::ForkResolver) pick the most-work
+//                chain from genesis, so records written out of order or for
+//                stale forks land at the right height; ReindexChainstate()
+//                then reconnects that chain into an empty chainstate.
+//   -loadblock   ImportBootstrap() orders the blocks of a bootstrap file the
+//                same way and connects (and stores) the ones above the
+//                chainstate tip.
+//
+// Blocks are loaded by several reader threads, up to `readAhead` blocks in
+// front of the validation pipeline, and handed to it in height order. The
+// stats separate the time the feeding thread spent waiting for readers (the
+// import is IO-bound) from the time it spent blocked on a full pipeline (it
+// is CPU-bound).
+
+struct ImportStats {
+    std::size_t blocks{0};           // handed to the pipeline
+    std::optional<uint32_t> height;  // last block handed to the pipeline
+    double elapsedSeconds{0};
+    double readSeconds{0};           // summed over reader threads
+    double waitReadSeconds{0};       // pipeline starved: waiting for reads
+    double waitValidateSeconds{0};   // readers ahead: waiting for validation
+};
+
+struct ImportOptions {
+    std::size_t readers{0};     // 0 = hardware concurrency
+    std::size_t readAhead{64};  // blocks loaded but not yet submitted
+    PipelineOptions pipeline;   // previousTimes is filled in
+    // Called on the importing thread every `progressInterval` blocks and
+    // once at the end.
+    std::function<void(const ImportStats&)> progress;
+    std::size_t progressInterval{1000};
+};
+
+struct ImportResult {
+    std::size_t connected{0};
+    std::optional<uint32_t> tip;  // chainstate best height afterwards
+    std::optional<uint32_t> failedHeight;
+    std::string error;
+    ImportStats stats;
+};
+
+// Replaces the block store's height index with the best chain found in its
+// segment files; returns the number of blocks on it. Throws
+// std::runtime_error for a pruned store or when no genesis record exists.
+std::size_t RebuildBlockIndex(BlockStore& blocks, const consensus::Params& params, std::size_t threads = 0);
+
+// Clears the chainstate and connects every stored block from height 0.
+ImportResult ReindexChainstate(Chainstate& chainstate, BlockStore& blocks, const consensus::Params& params,
+                               ImportOptions opts = {});
+
+// Bootstrap file: [magic(4)][size(4)][SerializeBlock(block)] records. The
+// file must hold the chain from genesis; blocks up to the chainstate tip are
+// skipped after checking the file agrees with it. Throws std::runtime_error if it cannot be read or does
+// not contain the current tip.
+constexpr uint32_t kBootstrapMagic = 0xd1a0c0de;
+ImportResult ImportBootstrap(const std::string& path, Chainstate& chainstate, BlockStore& blocks,
+                             const consensus::Params& params, ImportOptions opts = {});
+void AppendBootstrapBlock(std::ostream& out, const Block& block);
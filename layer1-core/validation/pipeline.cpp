@@ -0,0 +1,359 @@
+#include "pipeline.h"
+#include "../script/interpreter.h"
+#include <algorithm>
+#include <ctime>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+using CoinMap = std::unordered_map<OutPoint, TxOut, OutPointHash, OutPointEq>;
+
+constexpr std::size_t kMedianTimeSpan = 11;
+
+uint32_t MedianTime(const std::deque<uint32_t>& times)
+{
+    if (times.empty())
+        return 1; // no history supplied: only require a non-zero timestamp
+    // Older entries are only kept for rewinds.
+    std::vector<uint32_t> sorted(times.end() - std::min(kMedianTimeSpan, times.size()), times.end());
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[sorted.size() / 2];
+}
+
+void AddOutputs(CoinMap& coins, const Transaction& tx)
+{
+    const auto txid = tx.GetHash();
+    for (size_t i = 0; i < tx.vout.size(); ++i)
+        coins[OutPoint{txid, static_cast<uint32_t>(i)}] = tx.vout[i];
+}
+
+} // namespace
+
+BlockPipeline::BlockPipeline(Chainstate& chainstate, const consensus::Params& params, BlockSink sink, PipelineOptions opts)
+    : m_chainstate(chainstate), m_params(params), m_sink(std::move(sink)), m_opts(std::move(opts))
+{
+    if (m_opts.workers == 0)
+        m_opts.workers = std::max(1u, std::thread::hardware_concurrency());
+    m_opts.lookahead = std::max<std::size_t>(1, m_opts.lookahead);
+    for (auto t : m_opts.previousTimes) {
+        m_recentTimes.push_back(t);
+        if (m_recentTimes.size() > kMedianTimeSpan) m_recentTimes.pop_front();
+    }
+
+    m_workers.reserve(m_opts.workers);
+    for (std::size_t i = 0; i < m_opts.workers; ++i)
+        m_workers.emplace_back([this] { WorkerLoop(); });
+    m_connector = std::thread([this] { ConnectLoop(); });
+}
+
+BlockPipeline::~BlockPipeline()
+{
+    try {
+        Finish();
+    } catch (...) {
+    }
+}
+
+bool BlockPipeline::Submit(uint32_t height, Block block)
+{
+    std::unique_lock<std::mutex> l(m_mu);
+    if (m_closing)
+        throw std::runtime_error("pipeline already finished");
+    if (m_failedHeight)
+        return false;
+    if (m_nextSubmit && height != *m_nextSubmit) {
+        if (m_rewound)
+            return false;
+        throw std::runtime_error("pipeline heights must be consecutive");
+    }
+    if (!m_nextConnect)
+        m_nextConnect = height;
+
+    const uint64_t epoch = m_epoch;
+    m_spaceFreed.wait(l, [&] { return m_inFlight < m_opts.lookahead || m_failedHeight || m_epoch != epoch; });
+    if (m_failedHeight || m_epoch != epoch)
+        return false;
+
+    Job job;
+    job.epoch = epoch;
+    job.height = height;
+    job.medianTimePast = MedianTime(m_recentTimes);
+    m_recentTimes.push_back(block.header.time);
+    if (m_recentTimes.size() > kMedianTimeSpan + m_opts.lookahead) m_recentTimes.pop_front();
+    job.block = std::move(block);
+
+    ++m_inFlight;
+    m_rewound = false;
+    m_nextSubmit = height + 1;
+    m_jobs.push_back(std::move(job));
+    m_jobReady.notify_one();
+    return true;
+}
+
+bool BlockPipeline::Finish()
+{
+    {
+        std::lock_guard<std::mutex> l(m_mu);
+        if (m_finished)
+            return !m_failedHeight;
+        m_closing = true;
+        m_jobReady.notify_all();
+        m_checkedReady.notify_all();
+    }
+    for (auto& t : m_workers) t.join();
+    m_connector.join();
+    std::lock_guard<std::mutex> l(m_mu);
+    m_finished = true;
+    return !m_failedHeight;
+}
+
+std::optional<uint32_t> BlockPipeline::FailedHeight() const
+{
+    std::lock_guard<std::mutex> l(m_mu);
+    return m_failedHeight;
+}
+
+std::string BlockPipeline::Error() const
+{
+    std::lock_guard<std::mutex> l(m_mu);
+    return m_error;
+}
+
+std::optional<uint32_t> BlockPipeline::ConnectedHeight() const
+{
+    std::lock_guard<std::mutex> l(m_mu);
+    return m_connected;
+}
+
+void BlockPipeline::Fail(uint32_t height, const std::string& error)
+{
+    std::lock_guard<std::mutex> l(m_mu);
+    if (!m_failedHeight || height < *m_failedHeight) {
+        m_failedHeight = height;
+        m_error = error;
+    }
+    m_jobReady.notify_all();
+    m_checkedReady.notify_all();
+    m_spaceFreed.notify_all();
+}
+
+void BlockPipeline::WorkerLoop()
+{
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> l(m_mu);
+            m_jobReady.wait(l, [this] { return !m_jobs.empty() || m_closing || m_failedHeight; });
+            if (m_failedHeight || m_jobs.empty())
+                return;
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        Checked checked = Check(std::move(job));
+        std::lock_guard<std::mutex> l(m_mu);
+        if (checked.job.epoch != m_epoch)
+            continue; // submitted before a rewind
+        const uint32_t height = checked.job.height;
+        m_checked.emplace(height, std::move(checked));
+        if (m_nextConnect && height == *m_nextConnect)
+            m_checkedReady.notify_one();
+    }
+}
+
+BlockPipeline::Checked BlockPipeline::Check(Job job) const
+{
+    Checked out;
+    const Block& block = job.block;
+    out.hash = BlockHash(block.header);
+    out.skipScripts = m_opts.skipScripts && m_opts.skipScripts(job.height, out.hash);
+
+    auto reject = [&](const std::string& why) {
+        out.error = why;
+        out.job = std::move(job);
+        return std::move(out);
+    };
+
+    BlockValidationOptions opts;
+    opts.medianTimePast = job.medianTimePast;
+    opts.now = static_cast<uint32_t>(std::time(nullptr));
+    opts.maxFutureDrift = m_opts.maxFutureDrift;
+    if (!ValidateBlockHeader(block.header, m_params, opts))
+        return reject("bad-header");
+    if (block.transactions.empty())
+        return reject("bad-blk-length");
+    if (!CheckMerkleRoot(block))
+        return reject("bad-txnmrklroot");
+
+    std::size_t inputs = 0;
+    for (const auto& tx : block.transactions) inputs += tx.vin.size();
+    out.verified.assign(inputs, false);
+
+    // Verify what we can without the connect stage: coins created earlier in
+    // this block or already in the chainstate. A chainstate coin can only be
+    // spent, never changed, so a signature checked against it stays valid;
+    // anything created by a block still in flight is left for Connect().
+    if (!out.skipScripts) {
+        CoinMap inBlock;
+        std::size_t slot = block.transactions.front().vin.size();
+        AddOutputs(inBlock, block.transactions.front());
+        for (std::size_t t = 1; t < block.transactions.size(); ++t) {
+            const auto& tx = block.transactions[t];
+            for (std::size_t i = 0; i < tx.vin.size(); ++i, ++slot) {
+                std::optional<TxOut> coin;
+                auto it = inBlock.find(tx.vin[i].prevout);
+                if (it != inBlock.end()) coin = it->second;
+                else coin = m_chainstate.TryGetUTXO(tx.vin[i].prevout);
+                if (!coin) continue;
+                if (!VerifyScript(tx, i, *coin))
+                    return reject("bad-signature");
+                out.verified[slot] = true;
+            }
+            AddOutputs(inBlock, tx);
+        }
+    }
+
+    out.ok = true;
+    out.job = std::move(job);
+    return out;
+}
+
+void BlockPipeline::Validate(const Checked& checked) const
+{
+    const Block& block = checked.job.block;
+    const uint32_t height = checked.job.height;
+
+    // The coin each input spends, resolved in block order: an output can
+    // only be spent by the transactions after the one creating it.
+    CoinMap spent;
+    CoinMap inBlock;
+    AddOutputs(inBlock, block.transactions.front());
+    for (std::size_t t = 1; t < block.transactions.size(); ++t) {
+        const auto& tx = block.transactions[t];
+        for (const auto& in : tx.vin) {
+            auto it = inBlock.find(in.prevout);
+            auto coin = it != inBlock.end() ? std::optional<TxOut>(it->second) : m_chainstate.TryGetUTXO(in.prevout);
+            if (coin) spent.emplace(in.prevout, *coin);
+        }
+        AddOutputs(inBlock, tx);
+    }
+    UTXOLookup lookup = [&spent](const OutPoint& out) -> std::optional<TxOut> {
+        auto it = spent.find(out);
+        if (it == spent.end()) return std::nullopt;
+        return it->second;
+    };
+
+    // Signatures were handled above or in Check(); this pass covers amounts,
+    // assets, coin existence and intra-block double spends.
+    if (!ValidateTransactions(block.transactions, m_params, static_cast<int>(height), lookup, /*skipScriptChecks=*/true))
+        throw std::runtime_error("bad-txns");
+
+    if (!checked.skipScripts) {
+        std::size_t slot = block.transactions.front().vin.size();
+        for (std::size_t t = 1; t < block.transactions.size(); ++t) {
+            const auto& tx = block.transactions[t];
+            for (std::size_t i = 0; i < tx.vin.size(); ++i, ++slot) {
+                if (checked.verified[slot]) continue;
+                auto coin = lookup(tx.vin[i].prevout);
+                if (!coin || !VerifyScript(tx, i, *coin))
+                    throw std::runtime_error("bad-signature");
+            }
+        }
+    }
+}
+
+void BlockPipeline::Connect(const Checked& checked)
+{
+    const Block& block = checked.job.block;
+    m_chainstate.BeginTransaction();
+    try {
+        for (std::size_t t = 0; t < block.transactions.size(); ++t) {
+            const auto& tx = block.transactions[t];
+            if (t > 0) {
+                for (const auto& in : tx.vin)
+                    m_chainstate.SpendUTXO(in.prevout);
+            }
+            const auto txid = tx.GetHash();
+            for (std::size_t i = 0; i < tx.vout.size(); ++i)
+                m_chainstate.AddUTXO(OutPoint{txid, static_cast<uint32_t>(i)}, tx.vout[i]);
+        }
+        m_chainstate.Commit(BestBlockMarker{checked.hash, checked.job.height});
+    } catch (...) {
+        m_chainstate.Rollback();
+        throw;
+    }
+}
+
+void BlockPipeline::Reject(const Checked& checked)
+{
+    const uint32_t height = checked.job.height;
+    if (!m_opts.onRejected) {
+        Fail(height, checked.error);
+        return;
+    }
+    std::lock_guard<std::mutex> l(m_mu);
+    // Everything before it is connected; everything after it is dropped.
+    const std::size_t dropped = *m_nextSubmit - height;
+    m_recentTimes.erase(m_recentTimes.end() - std::min(dropped, m_recentTimes.size()), m_recentTimes.end());
+    m_jobs.clear();
+    m_checked.clear();
+    m_inFlight = 0;
+    m_nextSubmit = height;
+    m_nextConnect = height;
+    ++m_epoch;
+    m_rewound = true;
+    m_opts.onRejected(height, checked.hash, checked.error);
+    m_spaceFreed.notify_all();
+}
+
+void BlockPipeline::ConnectLoop()
+{
+    while (true) {
+        Checked checked;
+        {
+            std::unique_lock<std::mutex> l(m_mu);
+            m_checkedReady.wait(l, [this] {
+                return m_failedHeight || (m_closing && m_nextConnect == m_nextSubmit) ||
+                       (m_nextConnect && m_checked.count(*m_nextConnect));
+            });
+            if (m_failedHeight || !m_nextConnect || !m_checked.count(*m_nextConnect))
+                break;
+            auto node = m_checked.extract(*m_nextConnect);
+            checked = std::move(node.mapped());
+        }
+
+        const uint32_t height = checked.job.height;
+        if (checked.ok) {
+            try {
+                Validate(checked);
+            } catch (const std::exception& e) {
+                checked.ok = false;
+                checked.error = e.what();
+            }
+        }
+        if (!checked.ok) {
+            Reject(checked);
+            continue;
+        }
+        try {
+            if (m_sink) m_sink(height, checked.job.block);
+        } catch (const std::exception& e) {
+            Fail(height, std::string("write failed: ") + e.what());
+            break;
+        }
+        try {
+            Connect(checked);
+        } catch (const std::exception& e) {
+            Fail(height, e.what());
+            break;
+        }
+        if (m_opts.onConnected)
+            m_opts.onConnected(height, checked.hash, checked.job.block);
+
+        std::lock_guard<std::mutex> l(m_mu);
+        m_connected = height;
+        m_nextConnect = height + 1;
+        --m_inFlight;
+        m_spaceFreed.notify_all();
+    }
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include "validation.h"
+#include "../chainstate/coins.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Staged block processing for initial sync. Blocks are submitted in height
+// order and flow through two stages:
+//
+//   check   (worker pool)  PoW, timestamps, merkle root, and signatures for
+//                          every input whose coin is already known (created
+//                          earlier in the same block or already in the
+//                          chainstate). Runs up to `lookahead` blocks ahead.
+//   connect (one thread)   in height order: amounts/UTXO rules, signatures
+//                          deferred by the check stage, then the block is
+//                          handed to the sink (normally BlockStore::WriteBlock)
+//                          and the chainstate update committed together with
+//                          the best-block marker.
+//
+// A block is only stored once it has passed every check, and always before
+// it is connected, so after a crash the block store is at or ahead of the
+// chainstate and the gap can be replayed from disk (see replay.h). Submit()
+// blocks once `lookahead` blocks are in flight. The first invalid block
+// stops the pipeline, nothing after it is connected, unless `onRejected`
+// asks for it to be skipped instead.
+struct PipelineOptions {
+    std::size_t workers{0};     // check threads; 0 = hardware concurrency
+    std::size_t lookahead{32};  // blocks submitted but not yet connected
+
+    // Timestamps of the blocks preceding the first submitted one (oldest
+    // first, at most 11 used) for the median-time-past rule.
+    std::vector<uint32_t> previousTimes;
+    uint32_t maxFutureDrift{2 * 60 * 60};
+
+    // Returns true when signature checks may be skipped for a block (see
+    // assumevalid.h). Unset means always verify.
+    std::function<bool(uint32_t height, const uint256& hash)> skipScripts;
+
+    // Called on the connect thread after each block's chainstate commit,
+    // e.g. to update the transaction index. Must not throw.
+    std::function<void(uint32_t height, const uint256& hash, const Block& block)> onConnected;
+
+    // Called on the connect thread when a block fails its checks (not when
+    // storing or committing it fails). If set, the pipeline drops that block
+    // and every one submitted after it and carries on from the connected
+    // tip: the next Submit() is for `height` again, and later heights
+    // submitted before that are refused. Runs with the pipeline locked, so
+    // no Submit() sees the rewind first; it must not call into the pipeline.
+    std::function<void(uint32_t height, const uint256& hash, const std::string& error)> onRejected;
+};
+
+class BlockPipeline {
+public:
+    using BlockSink = std::function<void(uint32_t height, const Block& block)>;
+
+    BlockPipeline(Chainstate& chainstate, const consensus::Params& params, BlockSink sink, PipelineOptions opts = {});
+    ~BlockPipeline();
+
+    BlockPipeline(const BlockPipeline&) = delete;
+    BlockPipeline& operator=(const BlockPipeline&) = delete;
+
+    // Queues the next block. Heights must be consecutive. Blocks while the
+    // pipeline is full; returns false once a block has been rejected, or
+    // after a rewind (see onRejected) for heights above the rejected one.
+    bool Submit(uint32_t height, Block block);
+
+    // Drains every stage and stops the threads. Returns false if any block
+    // was rejected (see FailedHeight()/Error()).
+    bool Finish();
+
+    std::optional<uint32_t> FailedHeight() const;
+    std::string Error() const;
+    std::optional<uint32_t> ConnectedHeight() const;
+
+private:
+    struct Job {
+        uint64_t epoch{0}; // rewinds before it was submitted
+        uint32_t height{0};
+        uint32_t medianTimePast{0};
+        Block block;
+    };
+    struct Checked {
+        Job job;
+        uint256 hash{};
+        bool ok{false};
+        std::string error;
+        bool skipScripts{false};
+        std::vector<bool> verified; // per input, flattened over the block
+    };
+
+    Chainstate& m_chainstate;
+    const consensus::Params& m_params;
+    BlockSink m_sink;
+    PipelineOptions m_opts;
+
+    // Submit -> check workers.
+    std::deque<Job> m_jobs;
+    // Check workers -> connector, reordered by height.
+    std::map<uint32_t, Checked> m_checked;
+
+    mutable std::mutex m_mu;
+    std::condition_variable m_jobReady;
+    std::condition_variable m_checkedReady;
+    std::condition_variable m_spaceFreed;
+
+    // Timestamps up to the last submitted block, enough of them to go back
+    // to the connected tip on a rewind.
+    std::deque<uint32_t> m_recentTimes;
+    std::optional<uint32_t> m_nextSubmit;
+    std::optional<uint32_t> m_nextConnect;
+    std::optional<uint32_t> m_connected;
+    std::size_t m_inFlight{0};
+    uint64_t m_epoch{0};
+    bool m_rewound{false}; // no block submitted since the last rewind
+    bool m_closing{false};
+    std::optional<uint32_t> m_failedHeight;
+    std::string m_error;
+
+    std::vector<std::thread> m_workers;
+    std::thread m_connector;
+    bool m_finished{false};
+
+    void WorkerLoop();
+    void ConnectLoop();
+    Checked Check(Job job) const;
+    // Throws the reject reason if the block breaks a rule Check() left out.
+    void Validate(const Checked& checked) const;
+    void Connect(const Checked& checked);
+    void Reject(const Checked& checked);
+    void Fail(uint32_t height, const std::string& error);
+};
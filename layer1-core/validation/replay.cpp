@@ -0,0 +1,46 @@
+#include "replay.h"
+#include <stdexcept>
+
+ReplayResult ReplayBlocks(Chainstate& chainstate, BlockStore& blocks, const consensus::Params& params,
+                          PipelineOptions opts)
+{
+    ReplayResult result;
+    const auto best = chainstate.BestBlock();
+    if (best) result.tip = best->height;
+
+    const auto storeTip = blocks.TipHeight();
+    uint32_t start = 0;
+    if (best) {
+        if (!blocks.HasBlock(best->height) || BlockHash(blocks.ReadBlock(best->height).header) != best->hash)
+            throw std::runtime_error("chainstate tip not found in block store; reindex required");
+        start = best->height + 1;
+    } else if (!chainstate.Empty()) {
+        throw std::runtime_error("chainstate has no best block; reindex required");
+    }
+    if (!storeTip || *storeTip < start)
+        return result;
+
+    // Median-time-past context for the first replayed block.
+    opts.previousTimes.clear();
+    const uint32_t first = start > 11 ? start - 11 : 0;
+    for (uint32_t h = first; h < start; ++h) {
+        if (blocks.HasBlock(h))
+            opts.previousTimes.push_back(blocks.ReadBlock(h).header.time);
+    }
+
+    // The blocks are already on disk, so there is nothing to write.
+    BlockPipeline pipeline(chainstate, params, {}, std::move(opts));
+    for (uint32_t h = start; h <= *storeTip; ++h) {
+        if (!blocks.HasBlock(h) || !pipeline.Submit(h, blocks.ReadBlock(h)))
+            break;
+    }
+    pipeline.Finish();
+
+    result.failedHeight = pipeline.FailedHeight();
+    result.error = pipeline.Error();
+    if (auto connected = pipeline.ConnectedHeight()) {
+        result.replayed = *connected - start + 1;
+        result.tip = connected;
+    }
+    return result;
+}
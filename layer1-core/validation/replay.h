@@ -0,0 +1,26 @@
+#pragma once
+#include "pipeline.h"
+#include "../storage/blockstore.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+// Startup recovery. The pipeline stores a block before connecting it and the
+// chainstate commits its best-block marker with every block, so after an
+// unclean shutdown the block store can only be ahead of the chainstate. This
+// replays exactly that gap from disk instead of rebuilding everything.
+struct ReplayResult {
+    std::size_t replayed{0};          // blocks connected by this call
+    std::optional<uint32_t> tip;      // chainstate best height afterwards
+    std::optional<uint32_t> failedHeight;
+    std::string error;
+};
+
+// Connects stored blocks above the chainstate's best block. Throws
+// std::runtime_error when the two cannot be reconciled without a reindex:
+// the chainstate has coins but no marker, or its best block is not in the
+// store. `opts` is passed to the pipeline (its previousTimes are filled in
+// from the stored headers).
+ReplayResult ReplayBlocks(Chainstate& chainstate, BlockStore& blocks, const consensus::Params& params,
+                          PipelineOptions opts = {});
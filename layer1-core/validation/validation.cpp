@@ -94,6 +94,8 @@ public:
     CachedLookup(const UTXOLookup& base, size_t capacity)
         : m_base(base), m_capacity(capacity) {}
 
+    bool HasBase() const { return static_cast<bool>(m_base); }
+
     std::optional<TxOut> operator()(const OutPoint& out)
     {
         auto it = m_cache.find(out);
@@ -117,31 +119,107 @@ private:
     std::unordered_map<OutPoint, TxOut, OutPointHasher, OutPointEq> m_cache;
 };
 
+constexpr size_t MAX_TX_SIZE = 1000000; // 1MB hard cap per tx
+constexpr uint64_t DUST_THRESHOLD = 546; // satoshi-equivalent dust floor
+
+using OutPointSet = std::unordered_set<OutPoint, OutPointHasher, OutPointEq>;
+
+bool CheckAsset(std::optional<uint8_t>& asset, uint8_t candidate)
+{
+    if (!IsValidAssetId(candidate))
+        return false;
+    if (asset && *asset != candidate)
+        return false;
+    asset = candidate;
+    return true;
+}
+
+// A non-coinbase transaction of `txSize` serialized bytes. Its inputs are
+// added to `spent`, which must not hold them yet; `fee` receives what it
+// leaves for the miner.
+bool CheckSpend(const Transaction& tx, size_t txSize, const consensus::Params& params, CachedLookup& lookup,
+                bool skipScriptChecks, OutPointSet& spent, uint64_t& fee)
+{
+    std::optional<uint8_t> txAsset;
+    if (txSize == 0 || txSize > MAX_TX_SIZE)
+        return false;
+
+    uint64_t totalOut = 0;
+    for (const auto& out : tx.vout) {
+        if (!CheckAsset(txAsset, out.assetId))
+            return false;
+        uint64_t next = 0;
+        if (!SafeAdd(totalOut, out.value, next))
+            return false;
+        totalOut = next;
+        const uint8_t assetForRange = txAsset.value_or(out.assetId);
+        if (!consensus::MoneyRange(out.value, params, assetForRange) || !consensus::MoneyRange(totalOut, params, assetForRange))
+            return false;
+        if (out.scriptPubKey.size() != 32)
+            return false; // enforce schnorr-only pubkeys
+        if (out.value < DUST_THRESHOLD)
+            return false;
+    }
+
+    if (IsCoinbase(tx))
+        return false; // only the first tx may be coinbase
+
+    if (!lookup.HasBase())
+        return false; // cannot validate spends without a UTXO provider
+
+    if (tx.vin.empty() || tx.vout.empty())
+        return false;
+
+    uint64_t totalIn = 0;
+    for (size_t inIdx = 0; inIdx < tx.vin.size(); ++inIdx) {
+        const auto& in = tx.vin[inIdx];
+        if (IsNullOutPoint(in.prevout))
+            return false;
+        if (in.scriptSig.empty())
+            return false;
+        if (in.scriptSig.size() > 1650)
+            return false; // oversized scripts risk DoS
+
+        if (!CheckAsset(txAsset, in.assetId))
+            return false;
+        if (!spent.insert(in.prevout).second)
+            return false; // duplicate spend within block
+
+        auto utxo = lookup(in.prevout);
+        if (!utxo || in.assetId != utxo->assetId || !CheckAsset(txAsset, utxo->assetId))
+            return false;
+
+        if (!skipScriptChecks && !VerifyScript(tx, inIdx, *utxo))
+            return false;
+
+        uint64_t next = 0;
+        if (!SafeAdd(totalIn, utxo->value, next))
+            return false;
+        totalIn = next;
+        if (!consensus::MoneyRange(totalIn, params, txAsset.value_or(in.assetId)))
+            return false;
+    }
+
+    if (totalOut > totalIn)
+        return false; // overspends
+    fee = totalIn - totalOut;
+    return true;
+}
+
 } // namespace
 
-bool ValidateTransactions(const std::vector<Transaction>& txs, const consensus::Params& params, int height, const UTXOLookup& lookup)
+bool ValidateTransactions(const std::vector<Transaction>& txs, const consensus::Params& params, int height, const UTXOLookup& lookup, bool skipScriptChecks)
 {
     if (txs.empty()) return false;
 
     const bool multiAssetActive = consensus::IsMultiAssetActive(params, height);
-    constexpr size_t MAX_TX_SIZE = 1000000; // 1MB hard cap per tx
     constexpr size_t MAX_BLOCK_WEIGHT = 4000000; // approximate weight limit
-    constexpr uint64_t DUST_THRESHOLD = 546; // satoshi-equivalent dust floor
 
-    std::unordered_set<OutPoint, OutPointHasher, OutPointEq> seenPrevouts;
+    OutPointSet seenPrevouts;
     seenPrevouts.reserve(txs.size() * 2);
     size_t runningWeight = 0;
     CachedLookup cachedLookup(lookup, 1024);
 
-    auto checkAsset = [](std::optional<uint8_t>& asset, uint8_t candidate) {
-        if (!IsValidAssetId(candidate))
-            return false;
-        if (asset && *asset != candidate)
-            return false;
-        asset = candidate;
-        return true;
-    };
-
     // Coinbase must be first and unique
     if (!IsCoinbase(txs.front()))
         return false;
@@ -157,7 +235,7 @@ bool ValidateTransactions(const std::vector<Transaction>& txs, const consensus::
     uint64_t coinbaseOutTotal = 0;
     std::optional<uint8_t> coinbaseAsset;
     for (const auto& out : txs.front().vout) {
-        if (!checkAsset(coinbaseAsset, out.assetId))
+        if (!CheckAsset(coinbaseAsset, out.assetId))
             return false;
         uint64_t next = 0;
         if (!SafeAdd(coinbaseOutTotal, out.value, next))
@@ -171,7 +249,7 @@ bool ValidateTransactions(const std::vector<Transaction>& txs, const consensus::
         if (out.value < DUST_THRESHOLD)
             return false;
     }
-    if (!coinbaseAsset || !checkAsset(coinbaseAsset, txs.front().vin.front().assetId))
+    if (!coinbaseAsset || !CheckAsset(coinbaseAsset, txs.front().vin.front().assetId))
         return false;
 
     if (multiAssetActive) {
@@ -186,82 +264,21 @@ bool ValidateTransactions(const std::vector<Transaction>& txs, const consensus::
 
     for (size_t i = 1; i < txs.size(); ++i) {
         const auto& tx = txs[i];
-        std::optional<uint8_t> txAsset;
-
         const size_t txSize = Serialize(tx).size();
-        if (txSize == 0 || txSize > MAX_TX_SIZE)
-            return false;
         runningWeight += txSize * 4; // legacy weight approximation
         if (runningWeight > MAX_BLOCK_WEIGHT)
             return false;
 
-        uint64_t totalOut = 0;
-        for (const auto& out : tx.vout) {
-            if (!checkAsset(txAsset, out.assetId))
-                return false;
-            uint64_t next = 0;
-            if (!SafeAdd(totalOut, out.value, next))
-                return false;
-            totalOut = next;
-            const uint8_t assetForRange = txAsset.value_or(out.assetId);
-            if (!consensus::MoneyRange(out.value, params, assetForRange) || !consensus::MoneyRange(totalOut, params, assetForRange))
-                return false;
-            if (out.scriptPubKey.size() != 32)
-                return false; // enforce schnorr-only pubkeys
-            if (out.value < DUST_THRESHOLD)
-                return false;
-        }
-
-        if (IsCoinbase(tx))
-            return false; // only the first tx may be coinbase
-
-        if (!lookup)
-            return false; // cannot validate spends without a UTXO provider
-
-        if (tx.vin.empty() || tx.vout.empty())
+        uint64_t fee = 0;
+        if (!CheckSpend(tx, txSize, params, cachedLookup, skipScriptChecks, seenPrevouts, fee))
             return false;
-
-            uint64_t totalIn = 0;
-            for (size_t inIdx = 0; inIdx < tx.vin.size(); ++inIdx) {
-                const auto& in = tx.vin[inIdx];
-                if (IsNullOutPoint(in.prevout))
-                    return false;
-                if (in.scriptSig.empty())
-                    return false;
-                if (in.scriptSig.size() > 1650)
-                    return false; // oversized scripts risk DoS
-
-                if (!checkAsset(txAsset, in.assetId))
-                    return false;
-                if (!seenPrevouts.insert(in.prevout).second)
-                    return false; // duplicate spend within block
-
-                auto utxo = cachedLookup(in.prevout);
-                if (!utxo || in.assetId != utxo->assetId || !checkAsset(txAsset, utxo->assetId))
-                    return false;
-
-                if (!VerifyScript(tx, inIdx, *utxo))
-                    return false;
-
-                uint64_t next = 0;
-                if (!SafeAdd(totalIn, utxo->value, next))
-                    return false;
-                totalIn = next;
-                if (!consensus::MoneyRange(totalIn, params, txAsset.value_or(in.assetId)))
-                    return false;
-            }
-
-            if (totalOut > totalIn)
-                return false; // overspends
-
-            uint64_t fee = totalIn - totalOut;
-            uint64_t nextFees = 0;
-            if (!SafeAdd(totalFees, fee, nextFees))
-                return false;
-            totalFees = nextFees;
-            if (!consensus::MoneyRange(totalFees, params))
-                return false;
-        }
+        uint64_t nextFees = 0;
+        if (!SafeAdd(totalFees, fee, nextFees))
+            return false;
+        totalFees = nextFees;
+        if (!consensus::MoneyRange(totalFees, params))
+            return false;
+    }
 
     uint64_t maxCoinbase = multiAssetActive && coinbaseAsset
         ? consensus::GetBlockSubsidy(height, params, *coinbaseAsset)
@@ -275,6 +292,28 @@ bool ValidateTransactions(const std::vector<Transaction>& txs, const consensus::
     return true;
 }
 
+bool ValidateTransaction(const Transaction& tx, const consensus::Params& params, int height, const UTXOLookup& lookup, bool skipScriptChecks)
+{
+    (void)height; // No per-transaction rule depends on it yet.
+    CachedLookup cachedLookup(lookup, tx.vin.size());
+    OutPointSet spent;
+    uint64_t fee = 0;
+    return CheckSpend(tx, Serialize(tx).size(), params, cachedLookup, skipScriptChecks, spent, fee);
+}
+
+bool CheckMerkleRoot(const Block& block)
+{
+    bool mutated = false;
+    const auto merkle = ComputeMerkleRoot(block.transactions, mutated);
+    if (mutated || CRYPTO_memcmp(merkle.data(), block.header.merkleRoot.data(), merkle.size()) != 0)
+        return false;
+    std::vector<uint256> txids;
+    txids.reserve(block.transactions.size());
+    for (const auto& tx : block.transactions) txids.push_back(tx.GetHash());
+    std::sort(txids.begin(), txids.end());
+    return std::adjacent_find(txids.begin(), txids.end()) == txids.end();
+}
+
 bool ValidateBlock(const Block& block, const consensus::Params& params, int height, const UTXOLookup& lookup, const BlockValidationOptions& opts)
 {
     if (!ValidateBlockHeader(block.header, params, opts, false))
@@ -287,10 +326,7 @@ bool ValidateBlock(const Block& block, const consensus::Params& params, int heig
             opts.nftStateRoot != opts.expectedNftStateRoot)
             return false;
     }
-    if (!ValidateTransactions(block.transactions, params, height, lookup))
+    if (!ValidateTransactions(block.transactions, params, height, lookup, opts.skipScriptChecks))
         return false;
-    const auto merkle = ComputeMerkleRoot(block.transactions);
-    if (CRYPTO_memcmp(merkle.data(), block.header.merkleRoot.data(), merkle.size()) != 0)
-        return false;
-    return true;
+    return CheckMerkleRoot(block);
 }
@@ -33,8 +33,20 @@ struct BlockValidationOptions {
     bool requireNftStateRoot = false;
     std::array<uint8_t, 32> nftStateRoot{};
     std::array<uint8_t, 32> expectedNftStateRoot{};
+
+    // Skip VerifyScript for every input (see assumevalid.h). Amounts, UTXO
+    // existence, asset rules and the merkle root are still enforced.
+    bool skipScriptChecks = false;
 };
 
 bool ValidateBlockHeader(const BlockHeader& header, const consensus::Params& params, const BlockValidationOptions& opts = {}, bool skipPowCheck = false);
-bool ValidateTransactions(const std::vector<Transaction>& txs, const consensus::Params& params, int height, const UTXOLookup& lookup = {});
+bool ValidateTransactions(const std::vector<Transaction>& txs, const consensus::Params& params, int height, const UTXOLookup& lookup = {}, bool skipScriptChecks = false);
+// One non-coinbase transaction on its own, as if mined at `height` on top of
+// the coins `lookup` sees, e.g. for the mempool; the block-level rules of
+// ValidateTransactions() do not apply.
+bool ValidateTransaction(const Transaction& tx, const consensus::Params& params, int height, const UTXOLookup& lookup, bool skipScriptChecks = false);
+// True if the transactions are exactly the ones the header commits to: the
+// merkle root matches, the tree is not mutated and no txid repeats. A block
+// failing this is a corrupt copy, which says nothing about the header.
+bool CheckMerkleRoot(const Block& block);
 bool ValidateBlock(const Block& block, const consensus::Params& params, int height, const UTXOLookup& lookup = {}, const BlockValidationOptions& opts = {});
@@ -0,0 +1,314 @@
+#include "addressindex.h"
+
+#include <leveldb/write_batch.h>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+
+namespace addrindex {
+
+namespace {
+
+const std::string kBestBlockKey = "B";
+
+// Undo data is kept this many blocks below the tip.
+constexpr uint32_t kUndoDepth = 1000;
+
+void AppendBE32(std::string& out, uint32_t v)
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.push_back(static_cast<char>((v >> shift) & 0xff));
+}
+
+uint32_t ReadBE32(const char* p)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i)
+        v = (v << 8) | static_cast<uint8_t>(p[i]);
+    return v;
+}
+
+template <typename T>
+void AppendLE(std::string& out, const T& v)
+{
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+template <typename T>
+T ReadLE(const char* p)
+{
+    T v{};
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+std::string Bytes(const uint8_t* data, size_t len)
+{
+    return std::string(reinterpret_cast<const char*>(data), len);
+}
+
+std::string OutPointBytes(const OutPoint& out)
+{
+    std::string s = Bytes(out.hash.data(), out.hash.size());
+    AppendBE32(s, out.index);
+    return s;
+}
+
+OutPoint ReadOutPoint(const char* p)
+{
+    OutPoint out{};
+    std::memcpy(out.hash.data(), p, out.hash.size());
+    out.index = ReadBE32(p + out.hash.size());
+    return out;
+}
+
+std::string ScriptPrefix(char prefix, const ScriptKey& script)
+{
+    return std::string(1, prefix) + Bytes(script.data(), script.size());
+}
+
+std::string UndoKey(uint32_t height)
+{
+    std::string key(1, 'z');
+    AppendBE32(key, height);
+    return key;
+}
+
+constexpr size_t kScriptSize = sizeof(ScriptKey);
+constexpr size_t kOutPointSize = sizeof(uint256) + sizeof(uint32_t);
+constexpr size_t kFundingSize = sizeof(uint64_t) + sizeof(uint8_t);
+constexpr size_t kSpenderSize = sizeof(uint256) + 2 * sizeof(uint32_t);
+
+} // namespace
+
+AddressIndex::AddressIndex() : BaseIndex("addrindex") {}
+
+AddressIndex::~AddressIndex()
+{
+    Stop();
+}
+
+void AddressIndex::Open(const std::string& path)
+{
+    leveldb::Options opts;
+    opts.create_if_missing = true;
+    leveldb::DB* raw{nullptr};
+    auto status = leveldb::DB::Open(opts, path, &raw);
+    if (!status.ok()) throw std::runtime_error(status.ToString());
+    m_db.reset(raw);
+}
+
+std::optional<indexer::IndexCheckpoint> AddressIndex::ReadCheckpoint() const
+{
+    if (!m_db) return std::nullopt;
+    std::string val;
+    indexer::IndexCheckpoint cp;
+    if (!m_db->Get(leveldb::ReadOptions{}, kBestBlockKey, &val).ok() || val.size() != cp.hash.size() + sizeof(uint32_t))
+        return std::nullopt;
+    std::memcpy(cp.hash.data(), val.data(), cp.hash.size());
+    cp.height = ReadLE<uint32_t>(val.data() + cp.hash.size());
+    return cp;
+}
+
+void AddressIndex::IndexBlock(uint32_t height, const uint256& hash, const Block& block,
+                              const std::vector<DiskTxPos>&)
+{
+    if (!m_db) return;
+
+    // Every change goes through `writes` so earlier transactions in the block
+    // are visible to later ones and the previous values can be recorded.
+    std::map<std::string, std::optional<std::string>> writes;
+    auto get = [&](const std::string& key) -> std::optional<std::string> {
+        auto it = writes.find(key);
+        if (it != writes.end()) return it->second;
+        std::string val;
+        if (m_db->Get(leveldb::ReadOptions{}, key, &val).ok()) return val;
+        return std::nullopt;
+    };
+
+    for (size_t t = 0; t < block.transactions.size(); ++t) {
+        const auto& tx = block.transactions[t];
+        const auto txid = tx.GetHash();
+        if (t > 0) {
+            for (size_t i = 0; i < tx.vin.size(); ++i) {
+                const auto prevKey = OutPointBytes(tx.vin[i].prevout);
+                auto funding = get("p" + prevKey);
+                if (!funding || funding->size() != kScriptSize + sizeof(uint32_t)) continue;
+                const std::string script = funding->substr(0, kScriptSize);
+                std::string fundingKey = "o" + script;
+                AppendBE32(fundingKey, ReadBE32(funding->data() + kScriptSize));
+                fundingKey += prevKey;
+                auto entry = get(fundingKey);
+                if (entry && entry->size() >= kFundingSize) {
+                    std::string spent = entry->substr(0, kFundingSize) + Bytes(txid.data(), txid.size());
+                    AppendLE(spent, static_cast<uint32_t>(i));
+                    AppendLE(spent, height);
+                    writes[fundingKey] = spent;
+                }
+                writes["u" + script + prevKey] = std::nullopt;
+                writes["p" + prevKey] = std::nullopt;
+            }
+        }
+        for (size_t v = 0; v < tx.vout.size(); ++v) {
+            const auto& out = tx.vout[v];
+            if (out.scriptPubKey.size() != kScriptSize) continue;
+            const std::string script = Bytes(out.scriptPubKey.data(), kScriptSize);
+            const auto outKey = OutPointBytes(OutPoint{txid, static_cast<uint32_t>(v)});
+            std::string funding;
+            AppendLE(funding, out.value);
+            AppendLE(funding, out.assetId);
+
+            std::string fundingKey = "o" + script;
+            AppendBE32(fundingKey, height);
+            writes[fundingKey + outKey] = funding;
+
+            std::string unspent;
+            AppendLE(unspent, height);
+            writes["u" + script + outKey] = unspent + funding;
+
+            std::string locator = script;
+            AppendBE32(locator, height);
+            writes["p" + outKey] = locator;
+        }
+    }
+    std::string best = Bytes(hash.data(), hash.size());
+    AppendLE(best, height);
+    writes[kBestBlockKey] = best;
+
+    // Undo: [keyLen(2) key hadOld(1) [valLen(4) val]]...
+    std::string undo;
+    leveldb::WriteBatch batch;
+    for (const auto& [key, value] : writes) {
+        std::string old;
+        const bool hadOld = m_db->Get(leveldb::ReadOptions{}, key, &old).ok();
+        AppendLE(undo, static_cast<uint16_t>(key.size()));
+        undo += key;
+        undo.push_back(hadOld ? 1 : 0);
+        if (hadOld) {
+            AppendLE(undo, static_cast<uint32_t>(old.size()));
+            undo += old;
+        }
+        if (value) batch.Put(key, *value);
+        else batch.Delete(key);
+    }
+    batch.Put(UndoKey(height), undo);
+    if (height >= kUndoDepth) batch.Delete(UndoKey(height - kUndoDepth));
+    auto status = m_db->Write(leveldb::WriteOptions{}, &batch);
+    if (!status.ok()) throw std::runtime_error("addrindex write failed: " + status.ToString());
+}
+
+void AddressIndex::RewindBlock(const indexer::IndexCheckpoint& tip)
+{
+    if (!m_db) return;
+    std::string undo;
+    if (!m_db->Get(leveldb::ReadOptions{}, UndoKey(tip.height), &undo).ok())
+        throw std::runtime_error("addrindex: no undo data for height " + std::to_string(tip.height) +
+                                 " (reorg deeper than the undo window); delete the addrindex directory to rebuild");
+
+    leveldb::WriteBatch batch;
+    size_t off = 0;
+    auto need = [&](size_t n) {
+        if (off + n > undo.size()) throw std::runtime_error("addrindex: corrupt undo data");
+    };
+    while (off < undo.size()) {
+        need(sizeof(uint16_t));
+        const auto keyLen = ReadLE<uint16_t>(undo.data() + off);
+        off += sizeof(uint16_t);
+        need(keyLen + 1);
+        const std::string key = undo.substr(off, keyLen);
+        off += keyLen;
+        const bool hadOld = undo[off++] != 0;
+        if (!hadOld) {
+            batch.Delete(key);
+            continue;
+        }
+        need(sizeof(uint32_t));
+        const auto valLen = ReadLE<uint32_t>(undo.data() + off);
+        off += sizeof(uint32_t);
+        need(valLen);
+        batch.Put(key, undo.substr(off, valLen));
+        off += valLen;
+    }
+    batch.Delete(UndoKey(tip.height));
+    auto status = m_db->Write(leveldb::WriteOptions{}, &batch);
+    if (!status.ok()) throw std::runtime_error("addrindex rewind failed: " + status.ToString());
+}
+
+AddressPage AddressIndex::History(const ScriptKey& script, uint32_t fromHeight, uint32_t toHeight, size_t limit,
+                                  const std::optional<std::string>& cursor) const
+{
+    AddressPage page;
+    if (!m_db || limit == 0) return page;
+    const std::string prefix = ScriptPrefix('o', script);
+    std::string start = prefix;
+    AppendBE32(start, fromHeight);
+    if (cursor && cursor->compare(0, prefix.size(), prefix) == 0 && *cursor > start) start = *cursor;
+
+    std::unique_ptr<leveldb::Iterator> it(m_db->NewIterator(leveldb::ReadOptions{}));
+    bool more = false;
+    for (it->Seek(start); it->Valid(); it->Next()) {
+        const std::string key = it->key().ToString();
+        if (key.size() != prefix.size() + sizeof(uint32_t) + kOutPointSize || key.compare(0, prefix.size(), prefix) != 0)
+            break;
+        if (cursor && key == *cursor) continue;
+        const uint32_t height = ReadBE32(key.data() + prefix.size());
+        if (height > toHeight) break;
+        if (page.entries.size() == limit) {
+            more = true;
+            break;
+        }
+        const std::string val = it->value().ToString();
+        if (val.size() < kFundingSize) continue;
+        AddressOutput out;
+        out.outpoint = ReadOutPoint(key.data() + prefix.size() + sizeof(uint32_t));
+        out.height = height;
+        out.value = ReadLE<uint64_t>(val.data());
+        out.assetId = static_cast<uint8_t>(val[sizeof(uint64_t)]);
+        if (val.size() == kFundingSize + kSpenderSize) {
+            SpentBy spent;
+            std::memcpy(spent.txid.data(), val.data() + kFundingSize, spent.txid.size());
+            spent.vin = ReadLE<uint32_t>(val.data() + kFundingSize + spent.txid.size());
+            spent.height = ReadLE<uint32_t>(val.data() + kFundingSize + spent.txid.size() + sizeof(uint32_t));
+            out.spentBy = spent;
+        }
+        page.entries.push_back(out);
+        page.next = key;
+    }
+    if (!more) page.next.reset();
+    return page;
+}
+
+AddressPage AddressIndex::Utxos(const ScriptKey& script, size_t limit, const std::optional<std::string>& cursor) const
+{
+    AddressPage page;
+    if (!m_db || limit == 0) return page;
+    const std::string prefix = ScriptPrefix('u', script);
+    std::string start = prefix;
+    if (cursor && cursor->compare(0, prefix.size(), prefix) == 0) start = *cursor;
+
+    std::unique_ptr<leveldb::Iterator> it(m_db->NewIterator(leveldb::ReadOptions{}));
+    bool more = false;
+    for (it->Seek(start); it->Valid(); it->Next()) {
+        const std::string key = it->key().ToString();
+        if (key.size() != prefix.size() + kOutPointSize || key.compare(0, prefix.size(), prefix) != 0)
+            break;
+        if (cursor && key == *cursor) continue;
+        if (page.entries.size() == limit) {
+            more = true;
+            break;
+        }
+        const std::string val = it->value().ToString();
+        if (val.size() != sizeof(uint32_t) + kFundingSize) continue;
+        AddressOutput out;
+        out.outpoint = ReadOutPoint(key.data() + prefix.size());
+        out.height = ReadLE<uint32_t>(val.data());
+        out.value = ReadLE<uint64_t>(val.data() + sizeof(uint32_t));
+        out.assetId = static_cast<uint8_t>(val[sizeof(uint32_t) + sizeof(uint64_t)]);
+        page.entries.push_back(out);
+        page.next = key;
+    }
+    if (!more) page.next.reset();
+    return page;
+}
+
+} // namespace addrindex
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "base_index.h"
+#include "../../layer1-core/tx/transaction.h"
+#include <leveldb/db.h>
+#include <array>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace addrindex {
+
+// 32-byte x-only key as it appears in scriptPubKey. Outputs with any other
+// script length are not indexed.
+using ScriptKey = std::array<uint8_t, 32>;
+
+struct SpentBy {
+    uint256 txid{};
+    uint32_t vin{0};
+    uint32_t height{0};
+};
+
+struct AddressOutput {
+    OutPoint outpoint{};
+    uint32_t height{0};
+    uint64_t value{0};
+    uint8_t assetId{0};
+    std::optional<SpentBy> spentBy; // history only; unset for utxos
+};
+
+// One page of results. `next` is an opaque cursor for the following page,
+// unset on the last one.
+struct AddressPage {
+    std::vector<AddressOutput> entries;
+    std::optional<std::string> next;
+};
+
+// Script-keyed index of every output paying a 32-byte key and the input that
+// later spent it, built in the background like the transaction index.
+//
+// Keys (heights big-endian so iteration is in height order):
+//   'o' + script + height(4) + txid + vout(4) -> value(8) asset(1) [spender txid vin(4) height(4)]
+//   'u' + script + txid + vout(4)             -> height(4) value(8) asset(1)
+//   'p' + txid + vout(4)                      -> script height(4)      (finds the 'o' key on spend)
+//   'z' + height(4)                           -> undo: (key, previous value or absent)...
+//   "B"                                       -> best block hash(32) height(4)
+class AddressIndex : public indexer::BaseIndex {
+public:
+    AddressIndex();
+    ~AddressIndex() override;
+
+    void Open(const std::string& path);
+
+    // Outputs paying `script` created at heights [fromHeight, toHeight], in
+    // height order, with the spending input where there is one.
+    AddressPage History(const ScriptKey& script, uint32_t fromHeight, uint32_t toHeight, size_t limit,
+                        const std::optional<std::string>& cursor = std::nullopt) const;
+    // Outputs paying `script` that are still unspent.
+    AddressPage Utxos(const ScriptKey& script, size_t limit,
+                      const std::optional<std::string>& cursor = std::nullopt) const;
+
+    std::optional<indexer::IndexCheckpoint> Checkpoint() const { return ReadCheckpoint(); }
+
+protected:
+    std::optional<indexer::IndexCheckpoint> ReadCheckpoint() const override;
+    void IndexBlock(uint32_t height, const uint256& hash, const Block& block,
+                    const std::vector<DiskTxPos>& positions) override;
+    void RewindBlock(const indexer::IndexCheckpoint& tip) override;
+
+private:
+    std::unique_ptr<leveldb::DB> m_db;
+};
+
+} // namespace addrindex
@@ -0,0 +1,142 @@
+#include "base_index.h"
+
+#include <iostream>
+#include <stdexcept>
+
+namespace indexer {
+
+BaseIndex::BaseIndex(std::string name) : m_name(std::move(name)) {}
+
+BaseIndex::~BaseIndex()
+{
+    Stop();
+}
+
+void BaseIndex::Start(BlockStore& blocks, std::optional<uint32_t> tip)
+{
+    if (m_thread.joinable())
+        throw std::runtime_error(m_name + " already started");
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        m_blocks = &blocks;
+        m_tip = tip;
+        m_stop = false;
+        m_dirty = true;
+        m_synced = false;
+    }
+    m_thread = std::thread([this] { ThreadLoop(); });
+}
+
+void BaseIndex::Stop()
+{
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void BaseIndex::ChainTipChanged(uint32_t height)
+{
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        m_tip = height;
+        m_dirty = true;
+        m_synced = false;
+    }
+    m_wake.notify_one();
+}
+
+bool BaseIndex::Synced() const
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    return m_synced;
+}
+
+bool BaseIndex::WaitUntilSynced(std::chrono::milliseconds timeout) const
+{
+    std::unique_lock<std::mutex> l(m_mutex);
+    return m_progress.wait_for(l, timeout, [this] { return m_synced; });
+}
+
+void BaseIndex::ThreadLoop()
+{
+    while (true) {
+        {
+            std::lock_guard<std::mutex> l(m_mutex);
+            if (m_stop) return;
+            m_dirty = false;
+        }
+        bool synced = false;
+        bool worked = false;
+        try {
+            worked = Step(synced);
+        } catch (const std::exception& e) {
+            // Leave the index where it is; the next start resumes from the
+            // last checkpoint.
+            std::cerr << m_name << ": stopped indexing: " << e.what() << "\n";
+            return;
+        }
+        if (worked) continue;
+
+        std::unique_lock<std::mutex> l(m_mutex);
+        if (!m_dirty) m_synced = synced;
+        m_progress.notify_all();
+        m_wake.wait(l, [this] { return m_stop || m_dirty; });
+    }
+}
+
+std::optional<uint32_t> BaseIndex::IndexedHeight() const
+{
+    const auto best = ReadCheckpoint();
+    if (!best) return std::nullopt;
+    return best->height;
+}
+
+bool BaseIndex::Step(bool& synced)
+{
+    std::optional<uint32_t> tip;
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        tip = m_tip;
+    }
+    const auto best = ReadCheckpoint();
+    if (!tip) {
+        synced = !best;
+        if (best) {
+            RewindBlock(*best);
+            return true;
+        }
+        return false;
+    }
+
+    if (best && best->height > *tip) {
+        RewindBlock(*best);
+        return true;
+    }
+    if (best && best->height == *tip) {
+        // At the tip: make sure it is still the block on the active chain.
+        if (!m_blocks->HasBlock(best->height) || BlockHash(m_blocks->ReadBlock(best->height).header) != best->hash) {
+            RewindBlock(*best);
+            return true;
+        }
+        synced = true;
+        return false;
+    }
+
+    const uint32_t next = best ? best->height + 1 : 0;
+    if (!m_blocks->HasBlock(next))
+        return false; // not stored yet; wait for the next tip notification
+    std::vector<DiskTxPos> positions;
+    const Block block = m_blocks->ReadBlock(next, &positions);
+    if (best && block.header.prevBlockHash != best->hash) {
+        RewindBlock(*best);
+        return true;
+    }
+    IndexBlock(next, BlockHash(block.header), block, positions);
+    return true;
+}
+
+} // namespace indexer
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "../../layer1-core/storage/blockstore.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace indexer {
+
+// Last block an index has fully written.
+struct IndexCheckpoint {
+    uint256 hash{};
+    uint32_t height{0};
+};
+
+// Optional block index built on its own thread by reading the BlockStore.
+//
+// The node only reports chain tip changes (ChainTipChanged), which never
+// blocks; the index thread walks stored blocks from its checkpoint up to that
+// tip. After a restart it resumes from the persisted checkpoint, and
+// enabling an index on an already synced node just means a longer catch-up
+// in the background.
+//
+// Reorgs: the store maps heights to the active chain, so when the block the
+// checkpoint names is no longer at its height (or the next block does not
+// link to it) the index rewinds its tip block using its own undo data and
+// tries again.
+//
+// Derived classes persist each block together with the new checkpoint and
+// the undo data needed to remove it again, in a single atomic write.
+class BaseIndex {
+public:
+    explicit BaseIndex(std::string name);
+    virtual ~BaseIndex();
+
+    BaseIndex(const BaseIndex&) = delete;
+    BaseIndex& operator=(const BaseIndex&) = delete;
+
+    // Starts following `blocks` up to `tip` (the height of the connected
+    // chain). Derived classes must already be open.
+    void Start(BlockStore& blocks, std::optional<uint32_t> tip);
+    // Stops the thread. Derived destructors must call this before their
+    // storage goes away.
+    void Stop();
+
+    // New connected tip. Cheap; safe to call from the validation thread.
+    void ChainTipChanged(uint32_t height);
+
+    // True once the index has caught up with the last reported tip.
+    bool Synced() const;
+    // Waits until Synced() or the timeout expires.
+    bool WaitUntilSynced(std::chrono::milliseconds timeout) const;
+
+    // Height of the last block written to the index. Blocks above it must
+    // stay in the store (pruning) until the index has read them.
+    std::optional<uint32_t> IndexedHeight() const;
+
+    const std::string& Name() const { return m_name; }
+
+protected:
+    virtual std::optional<IndexCheckpoint> ReadCheckpoint() const = 0;
+    // Writes `block` (stored at `positions`) and makes it the checkpoint.
+    virtual void IndexBlock(uint32_t height, const uint256& hash, const Block& block,
+                            const std::vector<DiskTxPos>& positions) = 0;
+    // Removes the checkpoint block using undo data; the checkpoint moves to
+    // its parent (or is cleared at height 0).
+    virtual void RewindBlock(const IndexCheckpoint& tip) = 0;
+
+private:
+    void ThreadLoop();
+    // One unit of work (index or rewind a block). Returns false when there
+    // is nothing to do; `synced` then tells whether the tip was reached.
+    bool Step(bool& synced);
+
+    std::string m_name;
+    BlockStore* m_blocks{nullptr};
+    std::thread m_thread;
+
+    mutable std::mutex m_mutex;
+    mutable std::condition_variable m_wake;
+    mutable std::condition_variable m_progress;
+    std::optional<uint32_t> m_tip;
+    bool m_stop{false};
+    bool m_dirty{false};
+    bool m_synced{false};
+};
+
+} // namespace indexer
@@ -0,0 +1,232 @@
+#include "blockfilter.h"
+
+#include "../../layer1-core/crypto/siphash.h"
+#include "../../layer1-core/pow/sha256d.h"
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+
+namespace blockfilter {
+
+namespace {
+
+uint64_t ReadLE64(const uint8_t* p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+}
+
+// High 64 bits of a 64x64-bit product.
+uint64_t MulHigh(uint64_t a, uint64_t b)
+{
+    const uint64_t aLo = a & 0xffffffff, aHi = a >> 32;
+    const uint64_t bLo = b & 0xffffffff, bHi = b >> 32;
+    const uint64_t lolo = aLo * bLo;
+    const uint64_t hilo = aHi * bLo;
+    const uint64_t lohi = aLo * bHi;
+    const uint64_t cross = (lolo >> 32) + (hilo & 0xffffffff) + lohi;
+    return aHi * bHi + (hilo >> 32) + (cross >> 32);
+}
+
+void WriteCompactSize(std::vector<uint8_t>& out, uint64_t n)
+{
+    auto put = [&](uint64_t v, int bytes) {
+        for (int i = 0; i < bytes; ++i) out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    };
+    if (n < 0xfd) {
+        out.push_back(static_cast<uint8_t>(n));
+    } else if (n <= 0xffff) {
+        out.push_back(0xfd);
+        put(n, 2);
+    } else if (n <= 0xffffffff) {
+        out.push_back(0xfe);
+        put(n, 4);
+    } else {
+        out.push_back(0xff);
+        put(n, 8);
+    }
+}
+
+uint64_t ReadCompactSize(const std::vector<uint8_t>& in, size_t& off)
+{
+    if (off >= in.size()) throw std::runtime_error("filter: truncated element count");
+    const uint8_t tag = in[off++];
+    int bytes = tag == 0xfd ? 2 : tag == 0xfe ? 4 : tag == 0xff ? 8 : 0;
+    if (bytes == 0) return tag;
+    if (off + bytes > in.size()) throw std::runtime_error("filter: truncated element count");
+    uint64_t v = 0;
+    for (int i = bytes - 1; i >= 0; --i) v = (v << 8) | in[off + i];
+    off += bytes;
+    return v;
+}
+
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t>& out) : m_out(out) {}
+
+    void Write(uint64_t value, int bits)
+    {
+        for (int i = bits - 1; i >= 0; --i) {
+            if (m_used == 0) m_out.push_back(0);
+            if ((value >> i) & 1) m_out.back() |= static_cast<uint8_t>(0x80 >> m_used);
+            m_used = (m_used + 1) % 8;
+        }
+    }
+
+private:
+    std::vector<uint8_t>& m_out;
+    int m_used{0};
+};
+
+class BitReader {
+public:
+    BitReader(const std::vector<uint8_t>& in, size_t offset) : m_in(in), m_pos(offset * 8) {}
+
+    bool Read(uint64_t& value, int bits)
+    {
+        value = 0;
+        for (int i = 0; i < bits; ++i) {
+            uint64_t bit{0};
+            if (!Bit(bit)) return false;
+            value = (value << 1) | bit;
+        }
+        return true;
+    }
+
+    bool Bit(uint64_t& bit)
+    {
+        if (m_pos >= m_in.size() * 8) return false;
+        bit = (m_in[m_pos / 8] >> (7 - m_pos % 8)) & 1;
+        ++m_pos;
+        return true;
+    }
+
+private:
+    const std::vector<uint8_t>& m_in;
+    size_t m_pos;
+};
+
+} // namespace
+
+GCSFilter::GCSFilter(const uint256& blockHash, const std::vector<Element>& elements)
+    : m_k0(ReadLE64(blockHash.data())), m_k1(ReadLE64(blockHash.data() + 8)), m_n(elements.size())
+{
+    std::vector<uint64_t> values;
+    values.reserve(elements.size());
+    for (const auto& e : elements) values.push_back(HashToRange(e));
+    std::sort(values.begin(), values.end());
+
+    WriteCompactSize(m_encoded, m_n);
+    m_dataOffset = m_encoded.size();
+    BitWriter writer(m_encoded);
+    uint64_t last = 0;
+    for (uint64_t v : values) {
+        const uint64_t delta = v - last;
+        for (uint64_t q = delta >> kFilterP; q > 0; --q) writer.Write(1, 1);
+        writer.Write(0, 1);
+        writer.Write(delta, kFilterP);
+        last = v;
+    }
+}
+
+GCSFilter::GCSFilter(const uint256& blockHash, std::vector<uint8_t> encoded)
+    : m_k0(ReadLE64(blockHash.data())), m_k1(ReadLE64(blockHash.data() + 8)), m_encoded(std::move(encoded))
+{
+    size_t off = 0;
+    m_n = ReadCompactSize(m_encoded, off);
+    m_dataOffset = off;
+}
+
+uint64_t GCSFilter::HashToRange(const Element& element) const
+{
+    return MulHigh(SipHash24(m_k0, m_k1, element.data(), element.size()), m_n * kFilterM);
+}
+
+template <typename Fn>
+void GCSFilter::ForEachValue(Fn&& fn) const
+{
+    BitReader reader(m_encoded, m_dataOffset);
+    uint64_t value = 0;
+    for (uint64_t i = 0; i < m_n; ++i) {
+        uint64_t q = 0, bit = 0;
+        while (true) {
+            if (!reader.Bit(bit)) return;
+            if (!bit) break;
+            ++q;
+        }
+        uint64_t r = 0;
+        if (!reader.Read(r, kFilterP)) return;
+        value += (q << kFilterP) + r;
+        if (!fn(value)) return;
+    }
+}
+
+bool GCSFilter::Match(const Element& element) const
+{
+    return MatchAny({element});
+}
+
+bool GCSFilter::MatchAny(const std::vector<Element>& elements) const
+{
+    if (m_n == 0 || elements.empty()) return false;
+    std::vector<uint64_t> queries;
+    queries.reserve(elements.size());
+    for (const auto& e : elements) queries.push_back(HashToRange(e));
+    std::sort(queries.begin(), queries.end());
+
+    // Merge the two sorted sequences; one pass over the filter.
+    bool found = false;
+    size_t qi = 0;
+    ForEachValue([&](uint64_t value) {
+        while (qi < queries.size() && queries[qi] < value) ++qi;
+        if (qi == queries.size()) return false;
+        if (queries[qi] == value) {
+            found = true;
+            return false;
+        }
+        return true;
+    });
+    return found;
+}
+
+Element OutPointElement(const OutPoint& out)
+{
+    Element e(out.hash.begin(), out.hash.end());
+    for (int i = 0; i < 4; ++i) e.push_back(static_cast<uint8_t>(out.index >> (8 * i)));
+    return e;
+}
+
+std::vector<Element> BlockFilterElements(const Block& block)
+{
+    std::set<Element> unique;
+    for (size_t t = 0; t < block.transactions.size(); ++t) {
+        const auto& tx = block.transactions[t];
+        for (const auto& out : tx.vout) {
+            if (!out.scriptPubKey.empty()) unique.insert(out.scriptPubKey);
+        }
+        if (t == 0) continue;
+        for (const auto& in : tx.vin) unique.insert(OutPointElement(in.prevout));
+    }
+    return std::vector<Element>(unique.begin(), unique.end());
+}
+
+GCSFilter BuildBlockFilter(const uint256& blockHash, const Block& block)
+{
+    return GCSFilter(blockHash, BlockFilterElements(block));
+}
+
+uint256 FilterHash(const std::vector<uint8_t>& encoded)
+{
+    return SHA256d(encoded.data(), encoded.size());
+}
+
+uint256 FilterHeader(const uint256& filterHash, const uint256& prevHeader)
+{
+    uint8_t buf[64];
+    std::copy(filterHash.begin(), filterHash.end(), buf);
+    std::copy(prevHeader.begin(), prevHeader.end(), buf + 32);
+    return SHA256d(buf, sizeof(buf));
+}
+
+} // namespace blockfilter
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "../../layer1-core/block/block.h"
+#include <cstdint>
+#include <vector>
+
+namespace blockfilter {
+
+// Golomb-Rice parameters of the basic filter (as in BIP158): false positive
+// rate about 1/784931 per queried element.
+constexpr uint8_t kFilterP = 19;
+constexpr uint32_t kFilterM = 784931;
+
+using Element = std::vector<uint8_t>;
+
+// Golomb-coded set: each element is hashed with SipHash (keyed by the first
+// 16 bytes of the block hash) into [0, N * M), the values are sorted and the
+// deltas Golomb-Rice coded with P remainder bits.
+//
+// Encoding: [N as CompactSize][bit stream, most significant bit first,
+// zero padded to a byte].
+class GCSFilter {
+public:
+    GCSFilter(const uint256& blockHash, const std::vector<Element>& elements);
+    // Wraps an encoded filter; throws std::runtime_error if the element count
+    // cannot be read.
+    GCSFilter(const uint256& blockHash, std::vector<uint8_t> encoded);
+
+    const std::vector<uint8_t>& Encoded() const { return m_encoded; }
+    uint64_t Size() const { return m_n; }
+
+    // False positives are possible, false negatives are not.
+    bool Match(const Element& element) const;
+    bool MatchAny(const std::vector<Element>& elements) const;
+
+private:
+    uint64_t HashToRange(const Element& element) const;
+    // Calls `fn` with each set value in ascending order until it returns false.
+    template <typename Fn>
+    void ForEachValue(Fn&& fn) const;
+
+    uint64_t m_k0{0};
+    uint64_t m_k1{0};
+    uint64_t m_n{0};
+    size_t m_dataOffset{0};
+    std::vector<uint8_t> m_encoded;
+};
+
+// Every non-empty output script and the outpoint (txid || index LE) of every
+// non-coinbase input, deduplicated. Wallets match their keys to find
+// payments and their outpoints to find spends.
+std::vector<Element> BlockFilterElements(const Block& block);
+GCSFilter BuildBlockFilter(const uint256& blockHash, const Block& block);
+
+// Serialized outpoint as used in filters.
+Element OutPointElement(const OutPoint& out);
+
+// SHA256d of an encoded filter, and the header chaining it to its parent:
+// SHA256d(filterHash || prevHeader). The genesis parent header is zero.
+uint256 FilterHash(const std::vector<uint8_t>& encoded);
+uint256 FilterHeader(const uint256& filterHash, const uint256& prevHeader);
+
+} // namespace blockfilter
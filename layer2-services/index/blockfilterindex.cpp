@@ -0,0 +1,117 @@
+#include "blockfilterindex.h"
+
+#include <leveldb/write_batch.h>
+#include <cstring>
+#include <stdexcept>
+
+namespace blockfilter {
+
+namespace {
+
+const std::string kBestBlockKey = "B";
+
+std::string EntryKey(uint32_t height)
+{
+    std::string key(1, 'f');
+    for (int shift = 24; shift >= 0; shift -= 8)
+        key.push_back(static_cast<char>((height >> shift) & 0xff));
+    return key;
+}
+
+std::string BestValue(const uint256& hash, uint32_t height)
+{
+    std::string val(reinterpret_cast<const char*>(hash.data()), hash.size());
+    val.append(reinterpret_cast<const char*>(&height), sizeof(height));
+    return val;
+}
+
+} // namespace
+
+BlockFilterIndex::BlockFilterIndex() : BaseIndex("blockfilterindex") {}
+
+BlockFilterIndex::~BlockFilterIndex()
+{
+    Stop();
+}
+
+void BlockFilterIndex::Open(const std::string& path)
+{
+    leveldb::Options opts;
+    opts.create_if_missing = true;
+    leveldb::DB* raw{nullptr};
+    auto status = leveldb::DB::Open(opts, path, &raw);
+    if (!status.ok()) throw std::runtime_error(status.ToString());
+    m_db.reset(raw);
+}
+
+std::optional<FilterEntry> BlockFilterIndex::Entry(uint32_t height) const
+{
+    if (!m_db) return std::nullopt;
+    std::string val;
+    FilterEntry entry;
+    const size_t fixed = entry.blockHash.size() + entry.filterHash.size() + entry.header.size();
+    if (!m_db->Get(leveldb::ReadOptions{}, EntryKey(height), &val).ok() || val.size() < fixed)
+        return std::nullopt;
+    const char* p = val.data();
+    std::memcpy(entry.blockHash.data(), p, 32);
+    std::memcpy(entry.filterHash.data(), p + 32, 32);
+    std::memcpy(entry.header.data(), p + 64, 32);
+    entry.filter.assign(val.begin() + fixed, val.end());
+    return entry;
+}
+
+std::optional<indexer::IndexCheckpoint> BlockFilterIndex::ReadCheckpoint() const
+{
+    if (!m_db) return std::nullopt;
+    std::string val;
+    indexer::IndexCheckpoint cp;
+    if (!m_db->Get(leveldb::ReadOptions{}, kBestBlockKey, &val).ok() || val.size() != cp.hash.size() + sizeof(uint32_t))
+        return std::nullopt;
+    std::memcpy(cp.hash.data(), val.data(), cp.hash.size());
+    std::memcpy(&cp.height, val.data() + cp.hash.size(), sizeof(cp.height));
+    return cp;
+}
+
+void BlockFilterIndex::IndexBlock(uint32_t height, const uint256& hash, const Block& block,
+                                  const std::vector<DiskTxPos>&)
+{
+    if (!m_db) return;
+    uint256 prevHeader{};
+    if (height > 0) {
+        auto prev = Entry(height - 1);
+        if (!prev) throw std::runtime_error("blockfilterindex: missing filter for height " + std::to_string(height - 1));
+        prevHeader = prev->header;
+    }
+    const auto filter = BuildBlockFilter(hash, block);
+    const auto filterHash = FilterHash(filter.Encoded());
+    const auto header = FilterHeader(filterHash, prevHeader);
+
+    std::string val(reinterpret_cast<const char*>(hash.data()), hash.size());
+    val.append(reinterpret_cast<const char*>(filterHash.data()), filterHash.size());
+    val.append(reinterpret_cast<const char*>(header.data()), header.size());
+    val.append(reinterpret_cast<const char*>(filter.Encoded().data()), filter.Encoded().size());
+
+    leveldb::WriteBatch batch;
+    batch.Put(EntryKey(height), val);
+    batch.Put(kBestBlockKey, BestValue(hash, height));
+    auto status = m_db->Write(leveldb::WriteOptions{}, &batch);
+    if (!status.ok()) throw std::runtime_error("blockfilterindex write failed: " + status.ToString());
+}
+
+void BlockFilterIndex::RewindBlock(const indexer::IndexCheckpoint& tip)
+{
+    if (!m_db) return;
+    leveldb::WriteBatch batch;
+    batch.Delete(EntryKey(tip.height));
+    if (tip.height == 0) {
+        batch.Delete(kBestBlockKey);
+    } else {
+        auto prev = Entry(tip.height - 1);
+        if (!prev) throw std::runtime_error("blockfilterindex: missing filter for height " + std::to_string(tip.height - 1));
+        batch.Put(kBestBlockKey, BestValue(prev->blockHash, tip.height - 1));
+    }
+    auto status = m_db->Write(leveldb::WriteOptions{}, &batch);
+    if (!status.ok()) throw std::runtime_error("blockfilterindex rewind failed: " + status.ToString());
+}
+
+} // namespace blockfilter
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "base_index.h"
+#include "blockfilter.h"
+#include <leveldb/db.h>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace blockfilter {
+
+struct FilterEntry {
+    uint256 blockHash{};
+    uint256 filterHash{};
+    uint256 header{};
+    std::vector<uint8_t> filter;
+};
+
+// Basic compact filter for every block, with the filter header chain,
+// built in the background like the other indexes. Serving a light client is
+// then a lookup per block instead of matching each transaction against a
+// per-peer bloom filter.
+//
+// Keys:
+//   'f' + height(4, big-endian) -> block hash(32) filter hash(32) header(32) filter
+//   "B"                         -> best block hash(32) height(4)
+// Entries are keyed by height, so rewinding a block is deleting its entry.
+class BlockFilterIndex : public indexer::BaseIndex {
+public:
+    BlockFilterIndex();
+    ~BlockFilterIndex() override;
+
+    void Open(const std::string& path);
+
+    std::optional<FilterEntry> Entry(uint32_t height) const;
+    std::optional<indexer::IndexCheckpoint> Checkpoint() const { return ReadCheckpoint(); }
+
+protected:
+    std::optional<indexer::IndexCheckpoint> ReadCheckpoint() const override;
+    void IndexBlock(uint32_t height, const uint256& hash, const Block& block,
+                    const std::vector<DiskTxPos>& positions) override;
+    void RewindBlock(const indexer::IndexCheckpoint& tip) override;
+
+private:
+    std::unique_ptr<leveldb::DB> m_db;
+};
+
+} // namespace blockfilter
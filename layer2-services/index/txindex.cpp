@@ -1,27 +1,58 @@
 #include "txindex.h"
 
+#include <leveldb/write_batch.h>
 #include <cstring>
-#include <iomanip>
-#include <sstream>
 #include <stdexcept>
 
 namespace txindex {
 
-TxIndex::TxIndex() = default;
+TxIndex::TxIndex() : BaseIndex("txindex") {}
 
-static std::string Hex(const uint256& h)
+TxIndex::~TxIndex()
 {
-    std::ostringstream ss;
-    for (auto b : h) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(b);
+    Stop();
+}
+
+namespace {
+
+// Shorter than any hash-keyed record, so it never collides with them.
+const std::string kBestBlockKey = "B";
+// Format marker; databases without it hold the old hex-keyed records.
+const std::string kVersionKey = "V";
+const std::string kVersion = "2";
+
+// Undo data is kept this many blocks below the tip; deeper reorgs need a
+// rebuild of the index.
+constexpr uint32_t kUndoDepth = 1000;
+
+constexpr size_t kPosSize = sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t);
+
+std::string EncodeLocation(uint32_t height, const DiskTxPos* pos)
+{
+    std::string val(reinterpret_cast<const char*>(&height), sizeof(height));
+    if (pos) {
+        val.append(reinterpret_cast<const char*>(&pos->segment), sizeof(pos->segment));
+        val.append(reinterpret_cast<const char*>(&pos->offset), sizeof(pos->offset));
+        val.append(reinterpret_cast<const char*>(&pos->length), sizeof(pos->length));
     }
-    return ss.str();
+    return val;
+}
+
+std::string UndoKey(uint32_t height)
+{
+    // Big-endian so undo records sort by height.
+    std::string key(1, 'u');
+    for (int shift = 24; shift >= 0; shift -= 8)
+        key.push_back(static_cast<char>((height >> shift) & 0xff));
+    return key;
 }
 
+} // namespace
+
 std::string TxIndex::KeyFor(const uint256& h, char prefix)
 {
     std::string key(1, prefix);
-    key += Hex(h);
+    key.append(reinterpret_cast<const char*>(h.data()), h.size());
     return key;
 }
 
@@ -33,50 +64,196 @@ void TxIndex::Open(const std::string& path)
     auto status = leveldb::DB::Open(opts, path, &raw);
     if (!status.ok()) throw std::runtime_error(status.ToString());
     m_db.reset(raw);
+
+    // The index can always be rebuilt from the block store, so an old
+    // hex-keyed database is simply emptied and re-indexed.
+    std::string version;
+    if (!m_db->Get(leveldb::ReadOptions{}, kVersionKey, &version).ok() || version != kVersion) {
+        leveldb::WriteBatch batch;
+        std::unique_ptr<leveldb::Iterator> it(m_db->NewIterator(leveldb::ReadOptions{}));
+        for (it->SeekToFirst(); it->Valid(); it->Next())
+            batch.Delete(it->key());
+        batch.Put(kVersionKey, kVersion);
+        status = m_db->Write(leveldb::WriteOptions{}, &batch);
+        if (!status.ok()) throw std::runtime_error("txindex upgrade failed: " + status.ToString());
+    }
+
+    // Reload the block cache so BlockCount() survives a restart.
+    std::lock_guard<std::mutex> l(m_cacheMutex);
+    m_blockCache.clear();
+    std::unique_ptr<leveldb::Iterator> it(m_db->NewIterator(leveldb::ReadOptions{}));
+    for (it->Seek("b"); it->Valid() && !it->key().empty() && it->key()[0] == 'b'; it->Next()) {
+        uint256 hash{};
+        if (it->key().size() != 1 + hash.size() || it->value().size() != sizeof(uint32_t)) continue;
+        std::memcpy(hash.data(), it->key().data() + 1, hash.size());
+        uint32_t height = 0;
+        std::memcpy(&height, it->value().data(), sizeof(height));
+        m_blockCache[hash] = height;
+    }
 }
 
 void TxIndex::Add(const uint256& hash, uint32_t height)
 {
     if (!m_db) return;
-    auto key = KeyFor(hash, 't');
-    leveldb::Slice val(reinterpret_cast<const char*>(&height), sizeof(height));
-    m_db->Put(leveldb::WriteOptions{}, key, val);
+    m_db->Put(leveldb::WriteOptions{}, KeyFor(hash, 't'), EncodeLocation(height, nullptr));
 }
 
 bool TxIndex::Lookup(const uint256& hash, uint32_t& heightOut) const
 {
-    if (!m_db) return false;
-    std::string val;
-    auto key = KeyFor(hash, 't');
-    auto status = m_db->Get(leveldb::ReadOptions{}, key, &val);
-    if (!status.ok()) return false;
-    if (val.size() != sizeof(uint32_t)) return false;
-    std::memcpy(&heightOut, val.data(), sizeof(uint32_t));
+    auto loc = Locate(hash);
+    if (!loc) return false;
+    heightOut = loc->height;
     return true;
 }
 
+std::optional<TxLocation> TxIndex::Locate(const uint256& hash) const
+{
+    if (!m_db) return std::nullopt;
+    std::string val;
+    auto status = m_db->Get(leveldb::ReadOptions{}, KeyFor(hash, 't'), &val);
+    if (!status.ok()) return std::nullopt;
+    if (val.size() != sizeof(uint32_t) && val.size() != sizeof(uint32_t) + kPosSize) return std::nullopt;
+    TxLocation loc;
+    std::memcpy(&loc.height, val.data(), sizeof(uint32_t));
+    if (val.size() > sizeof(uint32_t)) {
+        DiskTxPos pos;
+        const char* p = val.data() + sizeof(uint32_t);
+        std::memcpy(&pos.segment, p, sizeof(pos.segment));
+        std::memcpy(&pos.offset, p + sizeof(pos.segment), sizeof(pos.offset));
+        std::memcpy(&pos.length, p + sizeof(pos.segment) + sizeof(pos.offset), sizeof(pos.length));
+        loc.pos = pos;
+    }
+    return loc;
+}
+
+size_t TxIndex::BlockCount() const
+{
+    std::lock_guard<std::mutex> l(m_cacheMutex);
+    return m_blockCache.size();
+}
+
 void TxIndex::AddBlock(const uint256& blockHash, uint32_t height)
 {
-    m_blockCache[blockHash] = height;
+    {
+        std::lock_guard<std::mutex> l(m_cacheMutex);
+        m_blockCache[blockHash] = height;
+    }
     if (!m_db) return;
-    auto key = KeyFor(blockHash, 'b');
     leveldb::Slice val(reinterpret_cast<const char*>(&height), sizeof(height));
-    m_db->Put(leveldb::WriteOptions{}, key, val);
+    m_db->Put(leveldb::WriteOptions{}, KeyFor(blockHash, 'b'), val);
 }
 
 bool TxIndex::LookupBlock(const uint256& blockHash, uint32_t& heightOut) const
 {
-    auto it = m_blockCache.find(blockHash);
-    if (it != m_blockCache.end()) { heightOut = it->second; return true; }
+    {
+        std::lock_guard<std::mutex> l(m_cacheMutex);
+        auto it = m_blockCache.find(blockHash);
+        if (it != m_blockCache.end()) { heightOut = it->second; return true; }
+    }
     if (!m_db) return false;
     std::string val;
-    auto key = KeyFor(blockHash, 'b');
-    auto status = m_db->Get(leveldb::ReadOptions{}, key, &val);
+    auto status = m_db->Get(leveldb::ReadOptions{}, KeyFor(blockHash, 'b'), &val);
     if (!status.ok()) return false;
     if (val.size() != sizeof(uint32_t)) return false;
     std::memcpy(&heightOut, val.data(), sizeof(uint32_t));
     return true;
 }
 
-} // namespace txindex
+void TxIndex::AddBlockTransactions(const uint256& blockHash, uint32_t height, const std::vector<uint256>& txids,
+                                   const std::vector<DiskTxPos>& positions)
+{
+    if (!positions.empty() && positions.size() != txids.size())
+        throw std::runtime_error("txindex: one position per transaction required");
+    {
+        std::lock_guard<std::mutex> l(m_cacheMutex);
+        m_blockCache[blockHash] = height;
+    }
+    if (!m_db) return;
+    leveldb::WriteBatch batch;
+    std::string previous;
+    const bool hadBest = m_db->Get(leveldb::ReadOptions{}, kBestBlockKey, &previous).ok();
+    std::string undo(1, hadBest ? 1 : 0);
+    if (hadBest) undo += previous;
+    for (size_t i = 0; i < txids.size(); ++i) {
+        batch.Put(KeyFor(txids[i], 't'), EncodeLocation(height, positions.empty() ? nullptr : &positions[i]));
+        undo.append(reinterpret_cast<const char*>(txids[i].data()), txids[i].size());
+    }
+    batch.Put(KeyFor(blockHash, 'b'), EncodeLocation(height, nullptr));
+    std::string best(reinterpret_cast<const char*>(blockHash.data()), blockHash.size());
+    best.append(reinterpret_cast<const char*>(&height), sizeof(height));
+    batch.Put(kBestBlockKey, best);
+    batch.Put(UndoKey(height), undo);
+    if (height >= kUndoDepth) batch.Delete(UndoKey(height - kUndoDepth));
+    // Unsynced: a batch is applied all-or-nothing, and anything lost to a
+    // power failure is re-indexed from the block store on the next start.
+    auto status = m_db->Write(leveldb::WriteOptions{}, &batch);
+    if (!status.ok()) throw std::runtime_error("txindex write failed: " + status.ToString());
+}
+
+bool TxIndex::BestBlock(uint256& hashOut, uint32_t& heightOut) const
+{
+    if (!m_db) return false;
+    std::string val;
+    auto status = m_db->Get(leveldb::ReadOptions{}, kBestBlockKey, &val);
+    if (!status.ok() || val.size() != hashOut.size() + sizeof(uint32_t)) return false;
+    std::memcpy(hashOut.data(), val.data(), hashOut.size());
+    std::memcpy(&heightOut, val.data() + hashOut.size(), sizeof(uint32_t));
+    return true;
+}
+
+std::optional<indexer::IndexCheckpoint> TxIndex::ReadCheckpoint() const
+{
+    indexer::IndexCheckpoint cp;
+    if (!BestBlock(cp.hash, cp.height)) return std::nullopt;
+    return cp;
+}
 
+void TxIndex::IndexBlock(uint32_t height, const uint256& hash, const Block& block,
+                         const std::vector<DiskTxPos>& positions)
+{
+    std::vector<uint256> txids;
+    txids.reserve(block.transactions.size());
+    for (const auto& tx : block.transactions) txids.push_back(tx.GetHash());
+    AddBlockTransactions(hash, height, txids, positions);
+}
+
+void TxIndex::RewindBlock(const indexer::IndexCheckpoint& tip)
+{
+    if (!m_db) return;
+    std::string undo;
+    auto status = m_db->Get(leveldb::ReadOptions{}, UndoKey(tip.height), &undo);
+    if (!status.ok()) throw std::runtime_error("txindex: no undo data for height " + std::to_string(tip.height) +
+                                 " (reorg deeper than the undo window); delete the txindex directory to rebuild");
+
+    // [hadBest(1)][previous best marker if hadBest][txids...]
+    constexpr size_t kMarkerSize = sizeof(uint256) + sizeof(uint32_t);
+    if (undo.empty()) throw std::runtime_error("txindex: corrupt undo data");
+    const size_t markerSize = undo[0] ? kMarkerSize : 0;
+    leveldb::WriteBatch batch;
+    for (size_t off = 1 + markerSize; off + sizeof(uint256) <= undo.size(); off += sizeof(uint256)) {
+        uint256 txid{};
+        std::memcpy(txid.data(), undo.data() + off, txid.size());
+        batch.Delete(KeyFor(txid, 't'));
+    }
+    batch.Delete(KeyFor(tip.hash, 'b'));
+    batch.Delete(UndoKey(tip.height));
+    if (markerSize) batch.Put(kBestBlockKey, undo.substr(1, markerSize));
+    else batch.Delete(kBestBlockKey);
+    status = m_db->Write(leveldb::WriteOptions{}, &batch);
+    if (!status.ok()) throw std::runtime_error("txindex rewind failed: " + status.ToString());
+
+    std::lock_guard<std::mutex> l(m_cacheMutex);
+    m_blockCache.erase(tip.hash);
+}
+
+void TxIndex::Flush()
+{
+    if (!m_db) return;
+    leveldb::WriteOptions opts;
+    opts.sync = true;
+    leveldb::WriteBatch batch;
+    auto status = m_db->Write(opts, &batch);
+    if (!status.ok()) throw std::runtime_error("txindex flush failed: " + status.ToString());
+}
+
+} // namespace txindex
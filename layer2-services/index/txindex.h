@@ -1,22 +1,61 @@
 #pragma once
 
 #include "../../layer1-core/tx/transaction.h"
+#include "../../layer1-core/storage/blockstore.h"
+#include "base_index.h"
 #include <leveldb/db.h>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace txindex {
 
-class TxIndex {
+// Where a transaction lives: its block height and, when indexed from the
+// block store, the exact bytes to read with BlockStore::ReadTransaction().
+struct TxLocation {
+    uint32_t height{0};
+    std::optional<DiskTxPos> pos;
+};
+
+// Keys are a one byte prefix followed by the raw 32 byte hash:
+//   't' + txid       -> height(4) [segment(4) offset(8) length(4)]
+//   'b' + block hash -> height(4)
+//   "B"              -> best block hash(32) height(4)
+//   'u' + height(4)  -> undo: flag(1), previous "B" value if flag, txids
+//
+// Normally built in the background (BaseIndex::Start); the direct Add*
+// methods remain for callers that index by hand.
+class TxIndex : public indexer::BaseIndex {
 public:
     TxIndex();
+    ~TxIndex() override;
     void Open(const std::string& path);
     void Add(const uint256& hash, uint32_t height);
     bool Lookup(const uint256& hash, uint32_t& heightOut) const;
+    std::optional<TxLocation> Locate(const uint256& hash) const;
     void AddBlock(const uint256& blockHash, uint32_t height);
     bool LookupBlock(const uint256& blockHash, uint32_t& heightOut) const;
-    size_t BlockCount() const { return m_blockCache.size(); }
+    size_t BlockCount() const;
+
+    // Indexes a connected block: its transactions (txids[i] stored at
+    // positions[i]), the block itself and the index's best-block marker go
+    // to disk in one batch, so the index never records a block as done
+    // without its transactions.
+    void AddBlockTransactions(const uint256& blockHash, uint32_t height, const std::vector<uint256>& txids,
+                              const std::vector<DiskTxPos>& positions);
+    // Last block written by AddBlockTransactions(); false for a fresh index.
+    bool BestBlock(uint256& hashOut, uint32_t& heightOut) const;
+    // Forces batched writes onto disk (called on shutdown).
+    void Flush();
+
+protected:
+    std::optional<indexer::IndexCheckpoint> ReadCheckpoint() const override;
+    void IndexBlock(uint32_t height, const uint256& hash, const Block& block,
+                    const std::vector<DiskTxPos>& positions) override;
+    void RewindBlock(const indexer::IndexCheckpoint& tip) override;
 
 private:
     static std::string KeyFor(const uint256& h, char prefix);
@@ -27,6 +66,7 @@ private:
     };
 
     std::unique_ptr<leveldb::DB> m_db;
+    mutable std::mutex m_cacheMutex;
     std::unordered_map<uint256, uint32_t, ArrayHasher> m_blockCache;
 };
 
@@ -46,10 +46,7 @@ bool Mempool::Accept(const Transaction& tx, uint64_t fee)
         if (m_entries.count(hash)) return false;
         if (!m_policy.IsFeeAcceptable(tx, fee)) return false;
 
-        if (m_params) {
-            std::vector<Transaction> batch{tx};
-            if (!ValidateTransactions(batch, *m_params, m_chainHeight, m_lookup)) return false;
-        }
+        if (m_params && !ValidateTransaction(tx, *m_params, m_chainHeight + 1, m_lookup)) return false;
 
         bool replace = false;
         for (const auto& in : tx.vin) {
@@ -84,6 +81,14 @@ bool Mempool::Exists(const uint256& hash) const
     return m_entries.count(hash) != 0;
 }
 
+std::optional<Transaction> Mempool::Get(const uint256& hash) const
+{
+    std::lock_guard<std::mutex> g(m_mutex);
+    auto it = m_entries.find(hash);
+    if (it == m_entries.end()) return std::nullopt;
+    return it->second.tx;
+}
+
 bool Mempool::SpendsKnown(const OutPoint& op) const
 {
     std::lock_guard<std::mutex> g(m_mutex);
@@ -140,6 +145,12 @@ void Mempool::Remove(const std::vector<uint256>& hashes)
     m_arrival.swap(rebuilt);
 }
 
+void Mempool::ForEach(const std::function<void(const uint256&, const Transaction&)>& fn) const
+{
+    std::lock_guard<std::mutex> g(m_mutex);
+    for (const auto& kv : m_entries) fn(kv.first, kv.second.tx);
+}
+
 void Mempool::RemoveForBlock(const std::vector<Transaction>& blockTxs)
 {
     std::vector<uint256> hashes;
@@ -189,6 +200,12 @@ void Mempool::SetValidationContext(const consensus::Params& params, int height,
     m_lookup = std::move(lookup);
 }
 
+void Mempool::SetChainHeight(int height)
+{
+    std::lock_guard<std::mutex> g(m_mutex);
+    m_chainHeight = height;
+}
+
 void Mempool::SetOnAccept(std::function<void(const Transaction&)> cb)
 {
     std::lock_guard<std::mutex> g(m_mutex);
@@ -31,12 +31,17 @@ public:
 
     bool Accept(const Transaction& tx, uint64_t fee);
     bool Exists(const uint256& hash) const;
+    std::optional<Transaction> Get(const uint256& hash) const;
     bool SpendsKnown(const OutPoint& op) const;
     std::vector<Transaction> Snapshot() const;
+    // Visits every entry without copying it, under the pool lock: `fn` must
+    // not call back into the mempool.
+    void ForEach(const std::function<void(const uint256&, const Transaction&)>& fn) const;
     void Remove(const std::vector<uint256>& hashes);
     void RemoveForBlock(const std::vector<Transaction>& blockTxs);
     uint64_t EstimateFeeRate(size_t percentile) const; // sat/kB
     void SetValidationContext(const consensus::Params& params, int height, UTXOLookup lookup);
+    void SetChainHeight(int height);
     void SetOnAccept(std::function<void(const Transaction&)> cb);
 
 private:
@@ -0,0 +1,481 @@
+#include "addrman.h"
+
+#include <boost/asio/ip/address.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include "../../layer1-core/crypto/siphash.h"
+#include "../../layer1-core/pow/sha256d.h"
+
+namespace net {
+
+namespace {
+
+constexpr char k_magic[4] = {'D', 'R', 'P', 'A'};
+constexpr size_t k_no_slot = static_cast<size_t>(-1);
+// Tables this small are passed on whole by GetAddr().
+constexpr size_t k_getaddr_floor = 50;
+
+void PutU8(std::vector<uint8_t>& out, uint8_t v)
+{
+    out.push_back(v);
+}
+
+template <typename T>
+void PutInt(std::vector<uint8_t>& out, T v)
+{
+    for (size_t i = 0; i < sizeof(T); ++i) out.push_back(static_cast<uint8_t>(static_cast<uint64_t>(v) >> (8 * i)));
+}
+
+void PutString(std::vector<uint8_t>& out, const std::string& s)
+{
+    if (s.size() > 255) throw std::runtime_error("peers file string too long");
+    PutU8(out, static_cast<uint8_t>(s.size()));
+    out.insert(out.end(), s.begin(), s.end());
+}
+
+class Reader {
+public:
+    Reader(const std::vector<uint8_t>& data, size_t end) : m_data(data), m_end(end) {}
+
+    template <typename T>
+    T Int()
+    {
+        Need(sizeof(T));
+        uint64_t v = 0;
+        for (size_t i = 0; i < sizeof(T); ++i) v |= static_cast<uint64_t>(m_data[m_off + i]) << (8 * i);
+        m_off += sizeof(T);
+        return static_cast<T>(v);
+    }
+
+    std::string String()
+    {
+        const size_t len = Int<uint8_t>();
+        Need(len);
+        std::string s(reinterpret_cast<const char*>(m_data.data() + m_off), len);
+        m_off += len;
+        return s;
+    }
+
+    bool Done() const { return m_off == m_end; }
+
+private:
+    void Need(size_t n) const
+    {
+        if (m_end - m_off < n) throw std::runtime_error("truncated peers file");
+    }
+
+    const std::vector<uint8_t>& m_data;
+    size_t m_end;
+    size_t m_off{0};
+};
+
+} // namespace
+
+AddrMan::AddrMan()
+{
+    m_k0 = m_rng();
+    m_k1 = m_rng();
+    Clear();
+}
+
+int64_t AddrMan::Now()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+bool AddrMan::SplitHostPort(const std::string& address, std::string& host, std::string& port)
+{
+    const auto colon = address.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == address.size()) return false;
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+    if (host.front() == '[') {
+        if (host.size() < 3 || host.back() != ']') return false;
+        host = host.substr(1, host.size() - 2);
+    } else if (host.find(':') != std::string::npos) {
+        return false; // IPv6 needs brackets
+    }
+    if (port.size() > 5 || !std::all_of(port.begin(), port.end(), [](char c) { return c >= '0' && c <= '9'; }))
+        return false;
+    const unsigned long n = std::stoul(port);
+    return n > 0 && n <= 65535;
+}
+
+std::string AddrMan::Group(const std::string& address)
+{
+    std::string host;
+    std::string port;
+    if (!SplitHostPort(address, host, port)) host = address;
+    boost::system::error_code ec;
+    auto ip = boost::asio::ip::make_address(host, ec);
+    if (ec) {
+        std::transform(host.begin(), host.end(), host.begin(), [](unsigned char c) { return std::tolower(c); });
+        return host;
+    }
+    if (ip.is_v6() && ip.to_v6().is_v4_mapped())
+        ip = boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, ip.to_v6());
+    if (ip.is_loopback() || ip.is_unspecified()) return address;
+    if (ip.is_v4()) {
+        const auto b = ip.to_v4().to_bytes();
+        const bool local = b[0] == 10 || (b[0] == 172 && (b[1] & 0xf0) == 16) || (b[0] == 192 && b[1] == 168) ||
+                           (b[0] == 169 && b[1] == 254);
+        if (local) return address;
+        return std::to_string(b[0]) + "." + std::to_string(b[1]);
+    }
+    const auto v6 = ip.to_v6();
+    if (v6.is_link_local() || v6.is_site_local() || (v6.to_bytes()[0] & 0xfe) == 0xfc) return address;
+    const auto b = v6.to_bytes();
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "%02x%02x:%02x%02x::", b[0], b[1], b[2], b[3]);
+    return buf;
+}
+
+bool AddrMan::IsTerrible(const AddrInfo& info, int64_t now)
+{
+    if (info.lastTry != 0 && now - info.lastTry < 60) return false; // just tried: give it a chance
+    if (info.addr.time > now + 10 * 60) return true;
+    if (info.addr.time == 0 || now - info.addr.time > 30 * 86400) return true;
+    if (info.lastSuccess == 0 && info.attempts >= 3) return true;
+    if (now - info.lastSuccess > 7 * 86400 && info.attempts >= 10) return true;
+    return false;
+}
+
+uint64_t AddrMan::Hash(const std::string& data) const
+{
+    return SipHash24(m_k0, m_k1, reinterpret_cast<const uint8_t*>(data.data()), data.size());
+}
+
+size_t AddrMan::NewSlot(const std::string& address, const std::string& source) const
+{
+    const std::string sourceGroup = Group(source);
+    const uint64_t spread = Hash("N" + Group(address) + "|" + sourceGroup) % k_new_buckets_per_source;
+    const uint64_t bucket = Hash("B" + sourceGroup + "|" + std::to_string(spread)) % k_new_buckets;
+    const uint64_t pos = Hash("P" + std::to_string(bucket) + "|" + address) % k_bucket_size;
+    return bucket * k_bucket_size + pos;
+}
+
+size_t AddrMan::TriedSlot(const std::string& address) const
+{
+    const uint64_t spread = Hash("T" + address) % k_tried_buckets_per_group;
+    const uint64_t bucket = Hash("G" + Group(address) + "|" + std::to_string(spread)) % k_tried_buckets;
+    const uint64_t pos = Hash("Q" + std::to_string(bucket) + "|" + address) % k_bucket_size;
+    return bucket * k_bucket_size + pos;
+}
+
+bool AddrMan::PlaceNew(int id, int64_t now)
+{
+    Entry& e = m_entries.at(id);
+    const size_t slot = NewSlot(e.info.addr.address, e.info.source);
+    const int occupant = m_new[slot];
+    if (occupant != -1) {
+        if (!IsTerrible(m_entries.at(occupant).info, now)) return false;
+        Delete(occupant);
+    }
+    m_new[slot] = id;
+    e.slot = slot;
+    e.info.tried = false;
+    e.randomPos = m_random[0].size();
+    m_random[0].push_back(id);
+    return true;
+}
+
+void AddrMan::Unplace(int id)
+{
+    Entry& e = m_entries.at(id);
+    if (e.slot == k_no_slot) return;
+    (e.info.tried ? m_tried : m_new)[e.slot] = -1;
+    auto& ids = m_random[e.info.tried ? 1 : 0];
+    const int last = ids.back();
+    ids[e.randomPos] = last;
+    m_entries.at(last).randomPos = e.randomPos;
+    ids.pop_back();
+    e.slot = k_no_slot;
+}
+
+void AddrMan::Delete(int id)
+{
+    Unplace(id);
+    m_ids.erase(m_entries.at(id).info.addr.address);
+    m_entries.erase(id);
+}
+
+void AddrMan::Clear()
+{
+    m_entries.clear();
+    m_ids.clear();
+    m_new.assign(k_new_buckets * k_bucket_size, -1);
+    m_tried.assign(k_tried_buckets * k_bucket_size, -1);
+    m_random[0].clear();
+    m_random[1].clear();
+}
+
+double AddrMan::Chance(const AddrInfo& info, int64_t now) const
+{
+    double chance = 1.0;
+    if (now - info.lastTry < 10 * 60) chance *= 0.01;
+    chance *= std::pow(0.66, std::min<uint32_t>(info.attempts, 8));
+    if (info.latencyMs > 0) chance /= 1.0 + static_cast<double>(info.latencyMs) / 1000.0;
+    return chance;
+}
+
+size_t AddrMan::Add(const std::vector<PeerAddress>& addrs, const std::string& source, int64_t penalty, int64_t now)
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    size_t added = 0;
+    for (const auto& a : addrs) {
+        std::string host;
+        std::string port;
+        if (!SplitHostPort(a.address, host, port)) continue;
+        const int64_t time = std::max<int64_t>(0, a.time - penalty);
+        auto it = m_ids.find(a.address);
+        if (it != m_ids.end()) {
+            auto& info = m_entries.at(it->second).info;
+            info.addr.time = std::max(info.addr.time, time);
+            info.addr.services |= a.services;
+            continue;
+        }
+        const int id = m_nextId++;
+        Entry& e = m_entries[id];
+        e.info.addr = PeerAddress{a.address, a.services, time};
+        e.info.source = source;
+        e.slot = k_no_slot;
+        m_ids[a.address] = id;
+        if (PlaceNew(id, now)) {
+            ++added;
+        } else {
+            m_ids.erase(a.address);
+            m_entries.erase(id);
+        }
+    }
+    return added;
+}
+
+void AddrMan::Attempt(const std::string& address, int64_t now)
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    auto it = m_ids.find(address);
+    if (it == m_ids.end()) return;
+    auto& info = m_entries.at(it->second).info;
+    info.lastTry = now;
+    ++info.attempts;
+}
+
+void AddrMan::Good(const std::string& address, int64_t latencyMs, int64_t now)
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    int id = 0;
+    auto it = m_ids.find(address);
+    if (it != m_ids.end()) {
+        id = it->second;
+    } else {
+        id = m_nextId++;
+        Entry& e = m_entries[id];
+        e.info.addr.address = address;
+        e.info.source = address;
+        e.slot = k_no_slot;
+        m_ids[address] = id;
+    }
+    Entry& e = m_entries.at(id);
+    e.info.addr.time = now;
+    e.info.lastTry = now;
+    e.info.lastSuccess = now;
+    e.info.attempts = 0;
+    ++e.info.successes;
+    e.info.latencyMs = e.info.latencyMs < 0 ? latencyMs : (3 * e.info.latencyMs + latencyMs) / 4;
+    if (e.info.tried) return;
+
+    Unplace(id);
+    const size_t slot = TriedSlot(address);
+    const int occupant = m_tried[slot];
+    if (occupant != -1) {
+        // The one already there goes back to new, if there is room.
+        Unplace(occupant);
+        if (!PlaceNew(occupant, now)) Delete(occupant);
+    }
+    m_tried[slot] = id;
+    e.slot = slot;
+    e.info.tried = true;
+    e.randomPos = m_random[1].size();
+    m_random[1].push_back(id);
+}
+
+void AddrMan::Connected(const std::string& address, int64_t now)
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    auto it = m_ids.find(address);
+    if (it == m_ids.end()) return;
+    auto& info = m_entries.at(it->second).info;
+    if (now - info.addr.time > 20 * 60) info.addr.time = now;
+}
+
+void AddrMan::Remove(const std::string& address)
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    auto it = m_ids.find(address);
+    if (it != m_ids.end()) Delete(it->second);
+}
+
+std::optional<PeerAddress> AddrMan::Select(bool newOnly, int64_t now) const
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    const bool tried = !newOnly && !m_random[1].empty() && (m_random[0].empty() || (m_rng() & 1));
+    const auto& ids = m_random[tried ? 1 : 0];
+    if (ids.empty()) return std::nullopt;
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    // Raising the bar each round makes sure this ends.
+    for (double factor = 1.0;; factor *= 1.2) {
+        const auto& info = m_entries.at(ids[m_rng() % ids.size()]).info;
+        if (unit(m_rng) < factor * Chance(info, now)) return info.addr;
+    }
+}
+
+std::vector<PeerAddress> AddrMan::GetAddr(size_t maxCount, size_t maxPercent, int64_t now) const
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    std::vector<PeerAddress> out;
+    for (const auto& kv : m_entries)
+        if (!IsTerrible(kv.second.info, now)) out.push_back(kv.second.info.addr);
+    std::shuffle(out.begin(), out.end(), m_rng);
+    const size_t count = std::min(maxCount, std::max(out.size() * maxPercent / 100, std::min(out.size(), k_getaddr_floor)));
+    out.resize(std::min(out.size(), count));
+    return out;
+}
+
+std::optional<AddrInfo> AddrMan::Find(const std::string& address) const
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    auto it = m_ids.find(address);
+    if (it == m_ids.end()) return std::nullopt;
+    return m_entries.at(it->second).info;
+}
+
+size_t AddrMan::Size() const
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    return m_entries.size();
+}
+
+size_t AddrMan::TriedSize() const
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    return m_random[1].size();
+}
+
+void AddrMan::Save(const std::string& path) const
+{
+    std::vector<uint8_t> data(k_magic, k_magic + sizeof(k_magic));
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        PutU8(data, k_file_version);
+        PutInt(data, m_k0);
+        PutInt(data, m_k1);
+        PutInt(data, static_cast<uint32_t>(m_entries.size()));
+        for (const auto& kv : m_entries) {
+            const auto& info = kv.second.info;
+            PutString(data, info.addr.address);
+            PutInt(data, info.addr.services);
+            PutInt(data, info.addr.time);
+            PutString(data, info.source);
+            PutInt(data, info.lastTry);
+            PutInt(data, info.lastSuccess);
+            PutInt(data, info.attempts);
+            PutInt(data, info.successes);
+            PutInt(data, info.latencyMs);
+            PutU8(data, info.tried ? 1 : 0);
+        }
+    }
+    uint8_t checksum[32];
+    sha256d(checksum, data.data(), data.size());
+    data.insert(data.end(), checksum, checksum + 4);
+
+    const std::string tmpPath = path + ".new";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("cannot open peers file");
+        out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        out.flush();
+        if (!out) throw std::runtime_error("failed writing peers file");
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec) throw std::runtime_error("cannot finalize peers file: " + ec.message());
+}
+
+void AddrMan::Load(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("cannot open peers file");
+    const std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (data.size() < sizeof(k_magic) + 1 + 4 || std::memcmp(data.data(), k_magic, sizeof(k_magic)) != 0)
+        throw std::runtime_error("not a peers file");
+    const size_t body = data.size() - 4;
+    uint8_t checksum[32];
+    sha256d(checksum, data.data(), body);
+    if (std::memcmp(checksum, data.data() + body, 4) != 0) throw std::runtime_error("peers file checksum mismatch");
+
+    Reader r(data, body);
+    r.Int<uint32_t>(); // magic
+    if (r.Int<uint8_t>() != k_file_version) throw std::runtime_error("unsupported peers file version");
+    const uint64_t k0 = r.Int<uint64_t>();
+    const uint64_t k1 = r.Int<uint64_t>();
+    const uint32_t count = r.Int<uint32_t>();
+    std::vector<AddrInfo> infos;
+    infos.reserve(std::min<uint32_t>(count, static_cast<uint32_t>((k_new_buckets + k_tried_buckets) * k_bucket_size)));
+    for (uint32_t i = 0; i < count; ++i) {
+        AddrInfo info;
+        info.addr.address = r.String();
+        info.addr.services = r.Int<uint64_t>();
+        info.addr.time = r.Int<int64_t>();
+        info.source = r.String();
+        info.lastTry = r.Int<int64_t>();
+        info.lastSuccess = r.Int<int64_t>();
+        info.attempts = r.Int<uint32_t>();
+        info.successes = r.Int<uint32_t>();
+        info.latencyMs = r.Int<int64_t>();
+        info.tried = r.Int<uint8_t>() != 0;
+        infos.push_back(std::move(info));
+    }
+    if (!r.Done()) throw std::runtime_error("trailing data in peers file");
+
+    // Placement depends only on the key, so entries land where they were;
+    // any that no longer fit are dropped.
+    std::lock_guard<std::mutex> l(m_mutex);
+    Clear();
+    m_k0 = k0;
+    m_k1 = k1;
+    const int64_t now = Now();
+    for (auto& info : infos) {
+        if (m_ids.count(info.addr.address)) continue;
+        const int id = m_nextId++;
+        Entry& e = m_entries[id];
+        e.info = std::move(info);
+        e.slot = k_no_slot;
+        m_ids[e.info.addr.address] = id;
+        bool placed = false;
+        if (e.info.tried) {
+            const size_t slot = TriedSlot(e.info.addr.address);
+            if (m_tried[slot] == -1) {
+                m_tried[slot] = id;
+                e.slot = slot;
+                e.randomPos = m_random[1].size();
+                m_random[1].push_back(id);
+                placed = true;
+            }
+        }
+        if (!placed && !PlaceNew(id, now)) {
+            m_ids.erase(e.info.addr.address);
+            m_entries.erase(id);
+        }
+    }
+}
+
+} // namespace net
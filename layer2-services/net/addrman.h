@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace net {
+
+// A peer address as gossiped in "addr": host:port (IPv6 hosts in
+// brackets), when it was last heard to be reachable and the services it
+// announced.
+struct PeerAddress {
+    std::string address;
+    uint64_t services{0};
+    int64_t time{0}; // unix seconds
+};
+
+// What we know about an address.
+struct AddrInfo {
+    PeerAddress addr;
+    std::string source;     // who told us, by network address
+    int64_t lastTry{0};     // unix seconds of the last connection attempt
+    int64_t lastSuccess{0}; // and of the last completed handshake
+    uint32_t attempts{0};   // failed attempts since the last success
+    uint32_t successes{0};
+    int64_t latencyMs{-1};  // average handshake time, -1 if never connected
+    bool tried{false};
+};
+
+// Address manager after Bitcoin Core's: addresses we have only heard of
+// live in the "new" table, bucketed by the network group of the address
+// and of its source, so that one source cannot fill the table; addresses
+// we have completed a handshake with move to the smaller "tried" table,
+// bucketed by their own group. Bucket and slot come from a keyed hash, so
+// the placement cannot be predicted by peers. A full slot keeps its entry
+// unless that one is worthless (see IsTerrible).
+//
+// Select() picks the tried or the new table with equal odds, then entries
+// at random, with the odds lowered for recent or repeated failures and
+// slow handshakes. Save()/Load() keep the tables across restarts. Thread
+// safe.
+class AddrMan {
+public:
+    static constexpr size_t k_new_buckets = 1024;
+    static constexpr size_t k_tried_buckets = 256;
+    static constexpr size_t k_bucket_size = 64;
+    // Buckets one source group, or one address group in tried, maps to.
+    static constexpr size_t k_new_buckets_per_source = 64;
+    static constexpr size_t k_tried_buckets_per_group = 8;
+    static constexpr uint8_t k_file_version = 1;
+
+    AddrMan();
+
+    // Adds or refreshes addresses learned from `source`, taking `penalty`
+    // seconds off their time. Returns how many were new.
+    size_t Add(const std::vector<PeerAddress>& addrs, const std::string& source, int64_t penalty = 0,
+               int64_t now = Now());
+    // A connection attempt is being made.
+    void Attempt(const std::string& address, int64_t now = Now());
+    // A handshake completed after `latencyMs`: the address moves to tried.
+    // Unknown addresses are added first.
+    void Good(const std::string& address, int64_t latencyMs, int64_t now = Now());
+    // A connection to the address has ended; it was reachable until now.
+    void Connected(const std::string& address, int64_t now = Now());
+    void Remove(const std::string& address);
+
+    std::optional<PeerAddress> Select(bool newOnly = false, int64_t now = Now()) const;
+    // A random sample of the addresses worth passing on: at most
+    // `maxCount`, and at most `maxPercent` of them.
+    std::vector<PeerAddress> GetAddr(size_t maxCount, size_t maxPercent, int64_t now = Now()) const;
+    std::optional<AddrInfo> Find(const std::string& address) const;
+
+    size_t Size() const;
+    size_t TriedSize() const;
+
+    // Writes the tables to `path` (replaced atomically) / replaces them
+    // with the ones in `path`. Both throw std::runtime_error.
+    void Save(const std::string& path) const;
+    void Load(const std::string& path);
+
+    static int64_t Now();
+    // Network group: /16 for IPv4, /32 for IPv6, the host name otherwise.
+    // Local and private addresses are each their own group.
+    static std::string Group(const std::string& address);
+    // Splits "host:port" / "[v6host]:port"; false if malformed.
+    static bool SplitHostPort(const std::string& address, std::string& host, std::string& port);
+    // Not worth keeping or passing on: long unseen, from the future, or
+    // failing without ever succeeding.
+    static bool IsTerrible(const AddrInfo& info, int64_t now);
+
+private:
+    struct Entry {
+        AddrInfo info;
+        size_t slot{0};       // in its table
+        size_t randomPos{0};  // in m_random[tried]
+    };
+
+    size_t NewSlot(const std::string& address, const std::string& source) const;
+    size_t TriedSlot(const std::string& address) const;
+    uint64_t Hash(const std::string& data) const;
+    bool PlaceNew(int id, int64_t now);
+    void Unplace(int id);
+    void Delete(int id);
+    double Chance(const AddrInfo& info, int64_t now) const;
+    void Clear();
+
+    mutable std::mutex m_mutex;
+    uint64_t m_k0{0};
+    uint64_t m_k1{0};
+    int m_nextId{0};
+    std::unordered_map<int, Entry> m_entries;
+    std::unordered_map<std::string, int> m_ids;
+    std::vector<int> m_new;      // k_new_buckets * k_bucket_size, -1 when empty
+    std::vector<int> m_tried;    // k_tried_buckets * k_bucket_size
+    std::vector<int> m_random[2]; // ids in new / tried, for uniform picks
+    mutable std::mt19937_64 m_rng{std::random_device{}()};
+};
+
+} // namespace net
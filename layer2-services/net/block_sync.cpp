@@ -0,0 +1,529 @@
+#include "block_sync.h"
+
+#include <algorithm>
+#include <ctime>
+#include <stdexcept>
+
+#include "../../layer1-core/pow/difficulty.h"
+#include "../../layer1-core/validation/validation.h"
+
+namespace net {
+
+namespace {
+
+bool IsNull(const uint256& h)
+{
+    return std::all_of(h.begin(), h.end(), [](uint8_t b) { return b == 0; });
+}
+
+} // namespace
+
+BlockSync::BlockSync(boost::asio::io_context& io, P2PNetwork& p2p, consensus::ForkResolver& headers,
+                     const consensus::Params& params, BlockSink sink, SyncOptions opts)
+    : m_p2p(p2p), m_headers(headers), m_params(params), m_sink(std::move(sink)), m_opts(opts), m_timer(io)
+{
+    if (m_opts.window == 0 || m_opts.maxInFlightPerPeer == 0)
+        throw std::runtime_error("sync window and per-peer limit must be positive");
+}
+
+BlockSync::~BlockSync()
+{
+    Stop();
+}
+
+bool BlockSync::AcceptHeader(const BlockHeader& header)
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    const bool accepted = AcceptHeaderLocked(header).has_value();
+    UpdateChainLocked();
+    return accepted;
+}
+
+void BlockSync::Start(std::optional<uint32_t> connected)
+{
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        if (m_running) throw std::runtime_error("block sync already started");
+        if (connected && *connected >= m_chain.size())
+            throw std::runtime_error("connected tip is not in the header index");
+        m_connected = connected;
+        if (connected) {
+            m_connectedHash = m_chain[*connected];
+            m_delivered[*connected] = Delivered{"", m_connectedHash};
+        }
+        m_running = true;
+    }
+    m_p2p.SetHeadersProvider([this](const std::vector<uint256>& locator, const uint256& stop, size_t max) {
+        return ServeHeaders(locator, stop, max);
+    });
+    m_p2p.SetHeadersHandler([this](const PeerInfo& info, const std::vector<BlockHeader>& headers) { OnHeaders(info, headers); });
+    m_p2p.SetPeerHandlers([this](const PeerInfo& info) { OnPeerConnected(info); },
+                          [this](const PeerInfo& info) { OnPeerDisconnected(info); });
+    m_p2p.RegisterHandler("block", [this](const PeerInfo& info, const Message& msg) {
+        Block block;
+        try {
+            block = DeserializeBlock(msg.payload);
+        } catch (const std::exception&) {
+            m_p2p.Misbehaving(info.id, 50);
+            return;
+        }
+        ProcessBlock(info, block);
+    });
+    for (const auto& info : m_p2p.Peers()) OnPeerConnected(info);
+    ScheduleTick();
+}
+
+void BlockSync::Stop()
+{
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        if (!m_running) return;
+        m_running = false;
+    }
+    m_p2p.SetHeadersProvider({});
+    m_p2p.SetHeadersHandler({});
+    m_p2p.SetPeerHandlers({}, {});
+    m_p2p.RegisterHandler("block", {});
+    boost::system::error_code ec;
+    m_timer.cancel(ec);
+}
+
+void BlockSync::SetBlockFallback(BlockFallback fallback)
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    m_fallback = std::move(fallback);
+}
+
+SyncStatus BlockSync::Status() const
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    SyncStatus status;
+    if (!m_chain.empty()) status.headerHeight = static_cast<uint32_t>(m_chain.size() - 1);
+    status.connectedHeight = m_connected;
+    status.peers = m_peers.size();
+    status.inFlight = m_inFlight.size();
+    status.buffered = m_received.size();
+    status.downloaded = m_downloaded;
+    status.reassigned = m_reassigned;
+    status.rejected = m_rejected;
+    status.forked = !AlignedLocked();
+    status.failedHeight = m_failedHeight;
+    return status;
+}
+
+std::optional<uint256> BlockSync::HashAt(uint32_t height) const
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    if (height >= m_chain.size()) return std::nullopt;
+    return m_chain[height];
+}
+
+std::optional<uint32_t> BlockSync::AcceptHeaderLocked(const BlockHeader& header, bool* invalid)
+{
+    const uint256 hash = BlockHash(header);
+    if (auto known = m_headers.Lookup(hash)) return known->height;
+    bool broken = false;
+    std::optional<uint32_t> height;
+    if (IsNull(header.prevBlockHash)) {
+        broken = !m_chain.empty(); // only the first header may be a root
+        if (!broken) height = 0;
+    } else if (auto parent = m_headers.Lookup(header.prevBlockHash)) {
+        height = parent->height + 1;
+    }
+    if (height && !powalgo::CheckProofOfWork(hash, header.bits, m_params)) {
+        broken = true;
+        height.reset();
+    }
+    if (height) {
+        const auto now = static_cast<uint32_t>(std::time(nullptr));
+        const uint32_t drift = 2 * 60 * 60;
+        m_headers.ConsiderHeader(header, hash, header.prevBlockHash, *height, m_params, now, drift);
+        // Timestamp and checkpoint rules may still have refused it; only a
+        // time too far ahead can be our own clock's fault.
+        if (!m_headers.Lookup(hash)) {
+            broken = static_cast<uint64_t>(header.time) <= static_cast<uint64_t>(now) + drift;
+            height.reset();
+        }
+    }
+    if (invalid) *invalid = broken;
+    return height;
+}
+
+void BlockSync::UpdateChainLocked()
+{
+    const auto* tip = m_headers.Tip();
+    if (!tip || (!m_chain.empty() && m_chain.back() == tip->hash)) return;
+
+    // Walk back from the new tip to where it meets the current chain.
+    std::vector<uint256> branch;
+    consensus::BlockMeta meta = *tip;
+    while (!(meta.height < m_chain.size() && m_chain[meta.height] == meta.hash)) {
+        branch.push_back(meta.hash);
+        if (meta.height == 0) break;
+        auto parent = m_headers.Lookup(meta.parent);
+        if (!parent) break;
+        meta = *parent;
+    }
+    const size_t keep = tip->height + 1 - branch.size();
+    m_chain.resize(keep);
+    m_chain.insert(m_chain.end(), branch.rbegin(), branch.rend());
+
+    // Requests and downloads for blocks that left the best chain are void.
+    std::vector<uint32_t> stale;
+    for (const auto& [height, request] : m_inFlight) {
+        if (height >= m_chain.size() || m_chain[height] != request.hash) stale.push_back(height);
+    }
+    for (uint32_t height : stale) ReleaseLocked(height);
+    for (auto it = m_received.begin(); it != m_received.end();) {
+        if (it->first >= m_chain.size() || m_chain[it->first] != BlockHash(it->second.block.header))
+            it = m_received.erase(it);
+        else
+            ++it;
+    }
+}
+
+bool BlockSync::AlignedLocked() const
+{
+    return !m_connected || (*m_connected < m_chain.size() && m_chain[*m_connected] == m_connectedHash);
+}
+
+uint32_t BlockSync::WindowStartLocked() const
+{
+    return m_connected ? *m_connected + 1 : 0;
+}
+
+std::vector<uint256> BlockSync::LocatorLocked() const
+{
+    // The last ten blocks, then exponentially further back, then genesis.
+    std::vector<uint256> locator;
+    if (m_chain.empty()) return locator;
+    size_t height = m_chain.size() - 1;
+    size_t step = 1;
+    while (locator.size() + 1 < P2PNetwork::k_max_locator) {
+        locator.push_back(m_chain[height]);
+        if (height == 0) return locator;
+        if (locator.size() >= 10) step *= 2;
+        height = height > step ? height - step : 0;
+    }
+    locator.push_back(m_chain.front());
+    return locator;
+}
+
+void BlockSync::RequestHeadersLocked(Peer& peer, Clock::time_point now)
+{
+    peer.headersRequested = now;
+    m_p2p.RequestHeaders(peer.info.id, LocatorLocked());
+}
+
+void BlockSync::ReleaseLocked(uint32_t height)
+{
+    auto it = m_inFlight.find(height);
+    if (it == m_inFlight.end()) return;
+    auto peer = m_peers.find(it->second.peer);
+    if (peer != m_peers.end()) peer->second.inFlight.erase(height);
+    m_inFlight.erase(it);
+}
+
+void BlockSync::ScheduleLocked(Clock::time_point now)
+{
+    if (!m_running || m_failedHeight || !AlignedLocked()) return;
+    const uint32_t start = WindowStartLocked();
+    const uint64_t end = std::min<uint64_t>(m_chain.size(), static_cast<uint64_t>(start) + m_opts.window);
+
+    std::map<std::string, std::vector<uint256>> batches;
+    for (uint64_t h = start; h < end; ++h) {
+        const auto height = static_cast<uint32_t>(h);
+        if (m_inFlight.count(height) || m_received.count(height)) continue;
+        Peer* best = nullptr;
+        bool anyCapacity = false;
+        for (auto& [id, peer] : m_peers) {
+            if (peer.inFlight.size() >= m_opts.maxInFlightPerPeer || peer.stalledUntil > now) continue;
+            anyCapacity = true;
+            if (peer.bestHeight < height) continue;
+            // Pruned peers only keep the most recent blocks.
+            if (!(peer.info.services & P2PNetwork::k_node_network) &&
+                (!(peer.info.services & P2PNetwork::k_node_network_limited) ||
+                 height + P2PNetwork::k_limited_blocks <= peer.bestHeight))
+                continue;
+            if (!best || peer.inFlight.size() < best->inFlight.size()) best = &peer;
+        }
+        if (!anyCapacity) break;
+        if (!best) continue;
+        best->inFlight.insert(height);
+        m_inFlight[height] = Request{best->info.id, m_chain[height], now};
+        batches[best->info.id].push_back(m_chain[height]);
+    }
+    for (const auto& [id, hashes] : batches) m_p2p.RequestBlocks(id, hashes);
+}
+
+void BlockSync::OnPeerConnected(const PeerInfo& info)
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    if (!m_running || m_peers.count(info.id)) return;
+    Peer& peer = m_peers[info.id];
+    peer.info = info;
+    peer.bestHeight = info.startHeight;
+    RequestHeadersLocked(peer, Clock::now());
+}
+
+void BlockSync::OnPeerDisconnected(const PeerInfo& info)
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    auto it = m_peers.find(info.id);
+    if (it == m_peers.end()) return;
+    for (uint32_t height : std::set<uint32_t>(it->second.inFlight)) ReleaseLocked(height);
+    m_peers.erase(it);
+    ScheduleLocked(Clock::now());
+}
+
+void BlockSync::OnHeaders(const PeerInfo& info, const std::vector<BlockHeader>& headers)
+{
+    int penalty = 0;
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        if (!m_running) return;
+        auto it = m_peers.find(info.id);
+        if (it == m_peers.end()) return;
+        Peer& peer = it->second;
+        peer.headersRequested.reset();
+
+        std::optional<uint32_t> last;
+        bool invalid = false;
+        for (size_t i = 0; i < headers.size(); ++i) {
+            // A batch is one chain.
+            if (i > 0 && headers[i].prevBlockHash != BlockHash(headers[i - 1])) {
+                invalid = true;
+                last.reset();
+                break;
+            }
+            last = AcceptHeaderLocked(headers[i], &invalid);
+            if (!last) break;
+            peer.bestHeight = std::max(peer.bestHeight, *last);
+        }
+        UpdateChainLocked();
+        const auto now = Clock::now();
+        if (invalid) {
+            penalty = P2PNetwork::k_ban_threshold + 1;
+        } else if (!headers.empty() && !last) {
+            // We asked from the wrong place, so ask again from our tip, but
+            // only so often: a peer may be feeding us headers of nothing.
+            if (++peer.unconnecting < m_opts.maxUnconnectingHeaders)
+                RequestHeadersLocked(peer, now);
+            else if (peer.unconnecting == m_opts.maxUnconnectingHeaders)
+                penalty = 20;
+        } else {
+            peer.unconnecting = 0;
+            // A full batch means the peer has more.
+            if (last && headers.size() == P2PNetwork::k_max_headers) RequestHeadersLocked(peer, now);
+        }
+        ScheduleLocked(now);
+    }
+    if (penalty) m_p2p.Misbehaving(info.id, penalty);
+}
+
+bool BlockSync::CheckHeader(const BlockHeader& header) const
+{
+    const uint256 hash = BlockHash(header);
+    if (!powalgo::CheckProofOfWork(hash, header.bits, m_params)) return false;
+    std::lock_guard<std::mutex> l(m_mutex);
+    if (m_headers.Lookup(hash)) return false;
+    if (IsNull(header.prevBlockHash)) return m_chain.empty();
+    const auto parent = m_headers.Lookup(header.prevBlockHash);
+    if (!parent) return false;
+    const auto* tip = m_headers.Tip();
+    if (!tip || tip->hash == parent->hash) return true;
+    return parent->chainWork.value + powalgo::CalculateBlockWork(header.bits) > tip->chainWork.value;
+}
+
+void BlockSync::ProcessBlock(const PeerInfo& info, const Block& block)
+{
+    const uint256 hash = BlockHash(block.header);
+    bool wanted = false;
+    bool corrupt = false;
+    BlockFallback fallback;
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        if (!m_running) return;
+        std::optional<uint32_t> height;
+        if (auto meta = m_headers.Lookup(hash)) height = meta->height;
+        if (!height) {
+            // A new block relayed through inv: its header extends the index.
+            height = AcceptHeaderLocked(block.header);
+            UpdateChainLocked();
+            auto peer = m_peers.find(info.id);
+            if (height && peer != m_peers.end()) peer->second.bestHeight = std::max(peer->second.bestHeight, *height);
+        }
+        const uint32_t start = WindowStartLocked();
+        const bool missing = height && *height < m_chain.size() && m_chain[*height] == hash && *height >= start &&
+                             !m_received.count(*height) && !m_failedHeight && AlignedLocked();
+        // Asked of this peer (possibly before the window moved back), or
+        // nobody was asked and it is the new tip.
+        auto req = missing ? m_inFlight.find(*height) : m_inFlight.end();
+        if (req != m_inFlight.end())
+            wanted = req->second.hash == hash && req->second.peer == info.id;
+        else
+            wanted = missing && *height + 1 == m_chain.size() && *height < static_cast<uint64_t>(start) + m_opts.window;
+        // The header is authentic; make sure the transactions are the ones
+        // it commits to before buffering them.
+        if (wanted && !CheckMerkleRoot(block)) {
+            wanted = false;
+            corrupt = true;
+        }
+        if (wanted) {
+            if (req != m_inFlight.end()) ReleaseLocked(*height);
+            m_received.emplace(*height, Download{info.id, block});
+            ++m_downloaded;
+            ScheduleLocked(Clock::now());
+        } else if (!corrupt) {
+            fallback = m_fallback;
+        }
+    }
+    if (corrupt)
+        m_p2p.Misbehaving(info.id, P2PNetwork::k_ban_threshold + 1);
+    else if (wanted)
+        Deliver();
+    else if (fallback)
+        fallback(info, block);
+}
+
+void BlockSync::Deliver()
+{
+    while (true) {
+        uint32_t height = 0;
+        Download download;
+        uint64_t rejected = 0;
+        {
+            std::lock_guard<std::mutex> l(m_mutex);
+            if (m_delivering || m_failedHeight || !AlignedLocked()) return;
+            height = WindowStartLocked();
+            auto it = m_received.find(height);
+            if (it == m_received.end()) return;
+            download = std::move(it->second);
+            m_received.erase(it);
+            m_delivering = true;
+            rejected = m_rejected;
+        }
+        const bool ok = m_sink(height, download.block);
+        std::lock_guard<std::mutex> l(m_mutex);
+        m_delivering = false;
+        // A rejection while the sink ran has already moved the tip back.
+        if (m_rejected != rejected) continue;
+        if (!ok) {
+            m_failedHeight = height;
+            m_received.clear();
+            for (auto& [id, peer] : m_peers) peer.inFlight.clear();
+            m_inFlight.clear();
+            return;
+        }
+        m_connected = height;
+        m_connectedHash = BlockHash(download.block.header);
+        m_delivered[height] = Delivered{std::move(download.peer), m_connectedHash};
+        while (m_delivered.size() > m_opts.window) m_delivered.erase(m_delivered.begin());
+        ScheduleLocked(Clock::now());
+    }
+}
+
+void BlockSync::BlockRejected(uint32_t height, const uint256& hash)
+{
+    std::string sender;
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        ++m_rejected;
+        auto it = m_delivered.find(height);
+        if (it != m_delivered.end() && it->second.hash == hash) sender = it->second.peer;
+        m_delivered.erase(m_delivered.lower_bound(height), m_delivered.end());
+        if (height == 0) {
+            m_connected.reset();
+        } else {
+            m_connected = height - 1;
+            if (!m_delivered.empty() && m_delivered.rbegin()->first == height - 1)
+                m_connectedHash = m_delivered.rbegin()->second.hash;
+            else if (height - 1 < m_chain.size())
+                m_connectedHash = m_chain[height - 1];
+        }
+        const auto now = Clock::now();
+        auto peer = m_peers.find(sender);
+        if (peer != m_peers.end()) {
+            // Until the ban drops it, it gets no more requests.
+            peer->second.stalledUntil = now + m_opts.blockTimeout;
+            for (uint32_t h : std::set<uint32_t>(peer->second.inFlight)) ReleaseLocked(h);
+        }
+        ScheduleLocked(now);
+    }
+    if (!sender.empty()) m_p2p.Misbehaving(sender, P2PNetwork::k_ban_threshold + 1);
+}
+
+std::vector<BlockHeader> BlockSync::ServeHeaders(const std::vector<uint256>& locator, const uint256& stop, size_t max) const
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    size_t start = 0;
+    for (const auto& hash : locator) {
+        auto meta = m_headers.Lookup(hash);
+        if (meta && meta->height < m_chain.size() && m_chain[meta->height] == hash) {
+            start = meta->height + 1;
+            break;
+        }
+    }
+    std::vector<BlockHeader> out;
+    for (size_t h = start; h < m_chain.size() && out.size() < max; ++h) {
+        auto meta = m_headers.Lookup(m_chain[h]);
+        if (!meta) break;
+        out.push_back(meta->header);
+        if (m_chain[h] == stop) break;
+    }
+    return out;
+}
+
+void BlockSync::ScheduleTick()
+{
+    m_timer.expires_after(m_opts.tickInterval);
+    m_timer.async_wait([this](const boost::system::error_code& ec) {
+        if (ec) return;
+        Tick();
+    });
+}
+
+void BlockSync::Tick()
+{
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        if (!m_running) return;
+        const auto now = Clock::now();
+
+        std::vector<uint32_t> expired;
+        for (const auto& [height, request] : m_inFlight) {
+            if (now - request.sent > m_opts.blockTimeout) expired.push_back(height);
+        }
+        for (uint32_t height : expired) ReleaseLocked(height);
+        m_reassigned += expired.size();
+
+        // Everything else in the window is taken and only the lowest block
+        // holds it up: the peer that has it is stalling the download.
+        const uint32_t start = WindowStartLocked();
+        const uint64_t end = std::min<uint64_t>(m_chain.size(), static_cast<uint64_t>(start) + m_opts.window);
+        auto lowest = m_inFlight.find(start);
+        if (lowest != m_inFlight.end() && end > start && now - lowest->second.sent > m_opts.stallTimeout &&
+            m_inFlight.size() + m_received.size() >= end - start) {
+            auto peer = m_peers.find(lowest->second.peer);
+            if (peer != m_peers.end() && m_peers.size() > 1) {
+                peer->second.stalledUntil = now + m_opts.blockTimeout;
+                const auto heights = peer->second.inFlight;
+                for (uint32_t height : heights) ReleaseLocked(height);
+                m_reassigned += heights.size();
+            }
+        }
+
+        // Keep the header chain moving with peers that are ahead of it.
+        const uint64_t headerHeight = m_chain.empty() ? 0 : m_chain.size() - 1;
+        for (auto& [id, peer] : m_peers) {
+            const bool ask = (m_chain.empty() || peer.bestHeight > headerHeight) &&
+                             peer.unconnecting < m_opts.maxUnconnectingHeaders;
+            if (ask && (!peer.headersRequested || now - *peer.headersRequested > m_opts.headersTimeout))
+                RequestHeadersLocked(peer, now);
+        }
+        ScheduleLocked(now);
+    }
+    ScheduleTick();
+}
+
+} // namespace net
@@ -0,0 +1,194 @@
+#pragma once
+
+#include "p2p.h"
+#include "../../layer1-core/consensus/fork_resolution.h"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace net {
+
+struct SyncOptions {
+    // Heights above the connected tip that may be requested or buffered.
+    uint32_t window{1024};
+    // Block requests outstanding to a single peer.
+    size_t maxInFlightPerPeer{16};
+    // A request unanswered for this long is handed to another peer.
+    std::chrono::milliseconds blockTimeout{std::chrono::seconds(30)};
+    // The peer holding the block right above the connected tip stalls the
+    // window when it has not delivered it for this long while the rest of
+    // the window is already taken. Its requests move to other peers and it
+    // gets no new ones for `blockTimeout`.
+    std::chrono::milliseconds stallTimeout{std::chrono::seconds(2)};
+    // Headers are asked for again when a peer that is ahead of us has not
+    // answered for this long.
+    std::chrono::milliseconds headersTimeout{std::chrono::seconds(10)};
+    // A peer whose headers fail to connect this many times in a row is
+    // penalized and no longer asked for headers.
+    uint32_t maxUnconnectingHeaders{8};
+    std::chrono::milliseconds tickInterval{std::chrono::milliseconds(250)};
+};
+
+struct SyncStatus {
+    std::optional<uint32_t> headerHeight;
+    std::optional<uint32_t> connectedHeight;
+    size_t peers{0};
+    size_t inFlight{0};
+    size_t buffered{0};     // downloaded, waiting for a lower block
+    uint64_t downloaded{0};
+    uint64_t reassigned{0}; // requests taken from stalling or timed-out peers
+    uint64_t rejected{0};   // invalid blocks, see BlockSync::BlockRejected()
+    // The best header chain does not extend the connected tip; blocks are
+    // not downloaded until it does (the chainstate cannot reorganize).
+    bool forked{false};
+    std::optional<uint32_t> failedHeight;
+};
+
+// Headers-first block download.
+//
+// Every peer is asked for headers once its version arrives (a locator of
+// our best header chain, "getheaders"/"headers" in P2PNetwork); headers
+// that connect and carry valid proof of work go into the header index
+// (consensus::ForkResolver), which picks the best chain. Blocks of that
+// chain are then fetched in a moving window of `window` heights above the
+// connected tip: each missing height goes to the least loaded peer that has
+// it, at most `maxInFlightPerPeer` per peer, so download speed grows with
+// the number of peers. Blocks arrive in any order, are buffered, and reach
+// the sink strictly in height order.
+//
+// Requests that time out are reassigned. A peer that holds up the lowest
+// missing block while the rest of the window is taken is treated as
+// stalling: all its requests are reassigned and it is skipped for a while.
+//
+// A block is only taken from the peer it was requested from, or, if nobody
+// was asked for it, when it is the tip of the header chain (a new block
+// relayed via inv or compact block). Its transactions must be exactly the
+// ones the header commits to; a peer sending a corrupt copy is banned.
+// Blocks nobody asked for go to the fallback handler.
+class BlockSync {
+public:
+    // Receives best-chain blocks in height order starting right above the
+    // connected tip. Returning false stops the download (e.g. the disk
+    // failed); a block found invalid is reported through BlockRejected().
+    // Called without the sync lock held, on a network thread.
+    using BlockSink = std::function<bool(uint32_t height, const Block& block)>;
+    using BlockFallback = std::function<void(const PeerInfo&, const Block&)>;
+
+    BlockSync(boost::asio::io_context& io, P2PNetwork& p2p, consensus::ForkResolver& headers,
+              const consensus::Params& params, BlockSink sink, SyncOptions opts = {});
+    ~BlockSync();
+
+    BlockSync(const BlockSync&) = delete;
+    BlockSync& operator=(const BlockSync&) = delete;
+
+    // Adds a header whose parent is known (or the first header, as the
+    // root) after checking its proof of work. Used for the headers of the
+    // stored chain at startup. Returns false if it was not accepted.
+    bool AcceptHeader(const BlockHeader& header);
+
+    // Takes over the P2P header and block handlers and starts the timer.
+    // `connected` is the chainstate tip, which must already be in the header
+    // index; nothing connected yet means downloading from genesis.
+    void Start(std::optional<uint32_t> connected);
+    void Stop();
+
+    void SetBlockFallback(BlockFallback fallback);
+
+    // The sink's consumer found the block it took at `height` invalid and
+    // dropped it and everything after it. Its sender is banned and the
+    // download goes on from `height - 1`, asking other peers. Must not be
+    // called from within the sink.
+    void BlockRejected(uint32_t height, const uint256& hash);
+
+    // True if the header is new, has valid proof of work and would become
+    // the best tip, without adding it. Lets relayed blocks be forwarded
+    // before they are fully validated.
+    bool CheckHeader(const BlockHeader& header) const;
+    // A block from `from` obtained other than through a "block" message
+    // (e.g. rebuilt from a compact block); handled like one.
+    void ProcessBlock(const PeerInfo& from, const Block& block);
+
+    SyncStatus Status() const;
+    // Best header chain hash at `height`.
+    std::optional<uint256> HashAt(uint32_t height) const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Peer {
+        PeerInfo info;
+        uint32_t bestHeight{0};  // announced or proven by headers
+        std::set<uint32_t> inFlight;
+        Clock::time_point stalledUntil{};
+        std::optional<Clock::time_point> headersRequested;
+        uint32_t unconnecting{0}; // headers messages in a row that did not connect
+    };
+    struct Request {
+        std::string peer;
+        uint256 hash{};
+        Clock::time_point sent{};
+    };
+    struct Download {
+        std::string peer;
+        Block block;
+    };
+    struct Delivered {
+        std::string peer;
+        uint256 hash{};
+    };
+
+    void OnPeerConnected(const PeerInfo& info);
+    void OnPeerDisconnected(const PeerInfo& info);
+    void OnHeaders(const PeerInfo& info, const std::vector<BlockHeader>& headers);
+    std::vector<BlockHeader> ServeHeaders(const std::vector<uint256>& locator, const uint256& stop, size_t max) const;
+    void ScheduleTick();
+    void Tick();
+    // Hands buffered blocks to the sink while the next height is present.
+    void Deliver();
+
+    // The rest expect m_mutex to be held.
+    // `invalid` is set if the header breaks a rule rather than just not
+    // connecting.
+    std::optional<uint32_t> AcceptHeaderLocked(const BlockHeader& header, bool* invalid = nullptr);
+    void UpdateChainLocked();
+    bool AlignedLocked() const;
+    uint32_t WindowStartLocked() const;
+    std::vector<uint256> LocatorLocked() const;
+    void RequestHeadersLocked(Peer& peer, Clock::time_point now);
+    void ReleaseLocked(uint32_t height);
+    void ScheduleLocked(Clock::time_point now);
+
+    P2PNetwork& m_p2p;
+    consensus::ForkResolver& m_headers;
+    const consensus::Params& m_params;
+    BlockSink m_sink;
+    BlockFallback m_fallback;
+    SyncOptions m_opts;
+    boost::asio::steady_timer m_timer;
+
+    mutable std::mutex m_mutex;
+    bool m_running{false};
+    bool m_delivering{false};
+    std::vector<uint256> m_chain;  // best header chain by height
+    std::optional<uint32_t> m_connected;
+    uint256 m_connectedHash{};
+    std::map<std::string, Peer> m_peers;
+    std::map<uint32_t, Request> m_inFlight;
+    std::map<uint32_t, Download> m_received;
+    // Blocks of the last `window` heights handed to the sink, which may
+    // still be rejected.
+    std::map<uint32_t, Delivered> m_delivered;
+    uint64_t m_downloaded{0};
+    uint64_t m_reassigned{0};
+    uint64_t m_rejected{0};
+    std::optional<uint32_t> m_failedHeight;
+};
+
+} // namespace net
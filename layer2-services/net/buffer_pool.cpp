@@ -0,0 +1,47 @@
+#include "buffer_pool.h"
+#include <algorithm>
+
+namespace net {
+
+std::vector<uint8_t> BufferPool::Acquire(size_t size)
+{
+    size_t index = 0;
+    while (index < k_classes && ClassBytes(index) < size) ++index;
+    std::vector<uint8_t> buffer;
+    if (index < k_classes) {
+        {
+            std::lock_guard<std::mutex> l(m_mutex);
+            if (!m_free[index].empty()) {
+                buffer = std::move(m_free[index].back());
+                m_free[index].pop_back();
+            }
+        }
+        if (buffer.capacity() < ClassBytes(index)) buffer.reserve(ClassBytes(index));
+    }
+    buffer.resize(size);
+    return buffer;
+}
+
+void BufferPool::Release(std::vector<uint8_t>&& buffer)
+{
+    // The largest class the capacity covers.
+    if (buffer.capacity() < k_min_class_bytes) return;
+    size_t index = 0;
+    while (index + 1 < k_classes && ClassBytes(index + 1) <= buffer.capacity()) ++index;
+    // Oversized buffers would pin memory a class does not account for.
+    if (buffer.capacity() > 2 * ClassBytes(index) && index + 1 == k_classes) return;
+    const size_t keep = std::max<size_t>(1, k_class_budget / ClassBytes(index));
+    buffer.clear();
+    std::lock_guard<std::mutex> l(m_mutex);
+    if (m_free[index].size() < keep) m_free[index].push_back(std::move(buffer));
+}
+
+size_t BufferPool::Idle() const
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    size_t n = 0;
+    for (const auto& list : m_free) n += list.size();
+    return n;
+}
+
+} // namespace net
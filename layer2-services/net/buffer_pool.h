@@ -0,0 +1,37 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace net {
+
+// Recycles message payload buffers by size class (256 B, 1 KiB, ... 4 MiB,
+// growing by four) so that a warm receive path does not allocate. Each
+// class keeps at most about k_class_budget bytes of idle buffers, and at
+// least one. Thread safe.
+class BufferPool {
+public:
+    static constexpr size_t k_min_class_bytes = 256;
+    static constexpr size_t k_classes = 8;
+    static constexpr size_t k_class_budget = 1024 * 1024;
+
+    // A buffer of `size` bytes (contents unspecified) with the capacity of
+    // its size class; sizes above the largest class are allocated as is.
+    std::vector<uint8_t> Acquire(size_t size);
+    // Takes a buffer back for reuse. Buffers from elsewhere are fine.
+    void Release(std::vector<uint8_t>&& buffer);
+
+    // Idle buffers held, for tests.
+    size_t Idle() const;
+
+    static size_t ClassBytes(size_t index) { return k_min_class_bytes << (2 * index); }
+
+private:
+    mutable std::mutex m_mutex;
+    std::array<std::vector<std::vector<uint8_t>>, k_classes> m_free;
+};
+
+} // namespace net
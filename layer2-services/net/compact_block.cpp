@@ -0,0 +1,277 @@
+#include "compact_block.h"
+#include "../../layer1-core/crypto/siphash.h"
+#include "../../layer1-core/crypto/tagged_hash.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace net {
+namespace {
+
+// Same bounds as full blocks (see block.cpp).
+constexpr uint32_t kMaxTxSize = 10 * 1024 * 1024;
+constexpr uint32_t kMaxTxCount = 100000;
+
+uint64_t ReadLE64(const uint8_t* p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+}
+
+template <typename T>
+void Put(std::vector<uint8_t>& out, T value)
+{
+    const auto* p = reinterpret_cast<const uint8_t*>(&value);
+    out.insert(out.end(), p, p + sizeof(value));
+}
+
+void PutTransaction(std::vector<uint8_t>& out, const Transaction& tx)
+{
+    const auto raw = Serialize(tx);
+    Put(out, static_cast<uint32_t>(raw.size()));
+    out.insert(out.end(), raw.begin(), raw.end());
+}
+
+class Reader {
+public:
+    explicit Reader(const std::vector<uint8_t>& data) : m_data(data) {}
+
+    template <typename T>
+    T Get()
+    {
+        T value{};
+        Need(sizeof(value));
+        std::memcpy(&value, m_data.data() + m_off, sizeof(value));
+        m_off += sizeof(value);
+        return value;
+    }
+
+    uint256 Hash()
+    {
+        uint256 h{};
+        Need(h.size());
+        std::memcpy(h.data(), m_data.data() + m_off, h.size());
+        m_off += h.size();
+        return h;
+    }
+
+    uint64_t ShortId()
+    {
+        Need(k_short_id_bytes);
+        uint64_t v = 0;
+        for (std::size_t i = k_short_id_bytes; i-- > 0;) v = (v << 8) | m_data[m_off + i];
+        m_off += k_short_id_bytes;
+        return v;
+    }
+
+    Transaction Tx()
+    {
+        const auto len = Get<uint32_t>();
+        if (len == 0 || len > kMaxTxSize) throw std::runtime_error("invalid transaction size");
+        Need(len);
+        auto tx = DeserializeTransaction(std::vector<uint8_t>(m_data.begin() + m_off, m_data.begin() + m_off + len));
+        m_off += len;
+        return tx;
+    }
+
+    uint32_t Count()
+    {
+        const auto count = Get<uint32_t>();
+        if (count > kMaxTxCount) throw std::runtime_error("transaction count exceeds maximum");
+        return count;
+    }
+
+    void End() const
+    {
+        if (m_off != m_data.size()) throw std::runtime_error("trailing data");
+    }
+
+private:
+    void Need(std::size_t n) const
+    {
+        if (n > m_data.size() - m_off) throw std::runtime_error("truncated message");
+    }
+
+    const std::vector<uint8_t>& m_data;
+    std::size_t m_off{0};
+};
+
+} // namespace
+
+ShortIdHasher::ShortIdHasher(const BlockHeader& header, uint64_t nonce)
+{
+    uint8_t buf[sizeof(BlockHeader) + sizeof(nonce)];
+    std::memcpy(buf, &header, sizeof(BlockHeader));
+    std::memcpy(buf + sizeof(BlockHeader), &nonce, sizeof(nonce));
+    const uint256 key = tagged_hash("DRM/cmpct", buf, sizeof(buf));
+    m_k0 = ReadLE64(key.data());
+    m_k1 = ReadLE64(key.data() + 8);
+}
+
+uint64_t ShortIdHasher::operator()(const uint256& txid) const
+{
+    return SipHash24(m_k0, m_k1, txid) & k_short_id_mask;
+}
+
+CompactBlock MakeCompactBlock(const Block& block, uint64_t nonce)
+{
+    CompactBlock cb;
+    cb.header = block.header;
+    cb.nonce = nonce;
+    if (block.transactions.empty()) return cb;
+    cb.prefilled.push_back(PrefilledTransaction{0, block.transactions[0]});
+    const ShortIdHasher hasher(block.header, nonce);
+    cb.shortIds.reserve(block.transactions.size() - 1);
+    for (std::size_t i = 1; i < block.transactions.size(); ++i)
+        cb.shortIds.push_back(hasher(block.transactions[i].GetHash()));
+    return cb;
+}
+
+std::vector<uint8_t> SerializeCompactBlock(const CompactBlock& block)
+{
+    std::vector<uint8_t> out;
+    out.reserve(sizeof(BlockHeader) + 16 + block.shortIds.size() * k_short_id_bytes);
+    const auto* h = reinterpret_cast<const uint8_t*>(&block.header);
+    out.insert(out.end(), h, h + sizeof(BlockHeader));
+    Put(out, block.nonce);
+    Put(out, static_cast<uint32_t>(block.shortIds.size()));
+    for (uint64_t id : block.shortIds)
+        for (std::size_t i = 0; i < k_short_id_bytes; ++i) out.push_back(static_cast<uint8_t>(id >> (8 * i)));
+    Put(out, static_cast<uint32_t>(block.prefilled.size()));
+    for (const auto& p : block.prefilled) {
+        Put(out, p.index);
+        PutTransaction(out, p.tx);
+    }
+    return out;
+}
+
+CompactBlock DeserializeCompactBlock(const std::vector<uint8_t>& data)
+{
+    Reader in(data);
+    CompactBlock block;
+    block.header = in.Get<BlockHeader>();
+    block.nonce = in.Get<uint64_t>();
+    const uint32_t ids = in.Count();
+    block.shortIds.reserve(ids);
+    for (uint32_t i = 0; i < ids; ++i) block.shortIds.push_back(in.ShortId());
+    const uint32_t prefilled = in.Count();
+    for (uint32_t i = 0; i < prefilled; ++i) {
+        const auto index = in.Get<uint32_t>();
+        block.prefilled.push_back(PrefilledTransaction{index, in.Tx()});
+    }
+    in.End();
+    if (block.TransactionCount() > kMaxTxCount) throw std::runtime_error("transaction count exceeds maximum");
+    return block;
+}
+
+std::vector<uint8_t> SerializeBlockTxnRequest(const BlockTxnRequest& req)
+{
+    std::vector<uint8_t> out(req.blockHash.begin(), req.blockHash.end());
+    Put(out, static_cast<uint32_t>(req.indexes.size()));
+    for (uint32_t index : req.indexes) Put(out, index);
+    return out;
+}
+
+BlockTxnRequest DeserializeBlockTxnRequest(const std::vector<uint8_t>& data)
+{
+    Reader in(data);
+    BlockTxnRequest req;
+    req.blockHash = in.Hash();
+    const uint32_t count = in.Count();
+    for (uint32_t i = 0; i < count; ++i) {
+        const auto index = in.Get<uint32_t>();
+        if (!req.indexes.empty() && index <= req.indexes.back()) throw std::runtime_error("indexes not ascending");
+        req.indexes.push_back(index);
+    }
+    in.End();
+    return req;
+}
+
+std::vector<uint8_t> SerializeBlockTxn(const BlockTxn& txn)
+{
+    std::vector<uint8_t> out(txn.blockHash.begin(), txn.blockHash.end());
+    Put(out, static_cast<uint32_t>(txn.transactions.size()));
+    for (const auto& tx : txn.transactions) PutTransaction(out, tx);
+    return out;
+}
+
+BlockTxn DeserializeBlockTxn(const std::vector<uint8_t>& data)
+{
+    Reader in(data);
+    BlockTxn txn;
+    txn.blockHash = in.Hash();
+    const uint32_t count = in.Count();
+    for (uint32_t i = 0; i < count; ++i) txn.transactions.push_back(in.Tx());
+    in.End();
+    return txn;
+}
+
+PartiallyDownloadedBlock::PartiallyDownloadedBlock(const CompactBlock& block)
+    : m_header(block.header), m_hasher(block.header, block.nonce)
+{
+    const std::size_t count = block.TransactionCount();
+    if (count == 0) throw std::runtime_error("empty compact block");
+    m_slots.resize(count);
+    m_collided.assign(count, false);
+    for (const auto& p : block.prefilled) {
+        if (p.index >= count || m_slots[p.index]) throw std::runtime_error("bad prefilled index");
+        m_slots[p.index] = p.tx;
+    }
+    // Short ids fill the remaining slots in order.
+    std::size_t next = 0;
+    m_byShortId.reserve(block.shortIds.size());
+    for (uint64_t id : block.shortIds) {
+        while (m_slots[next]) ++next;
+        if (!m_byShortId.emplace(id, static_cast<uint32_t>(next)).second)
+            throw std::runtime_error("duplicate short id");
+        ++next;
+    }
+}
+
+void PartiallyDownloadedBlock::Offer(const uint256& txid, const Transaction& tx)
+{
+    auto it = m_byShortId.find(m_hasher(txid));
+    if (it == m_byShortId.end()) return;
+    const uint32_t index = it->second;
+    if (m_collided[index]) return;
+    auto& slot = m_slots[index];
+    if (!slot) {
+        slot = tx;
+        m_matchedTxid[index] = txid;
+        ++m_matched;
+    } else if (m_matchedTxid[index] != txid) {
+        // Two candidates share the short id: ask for the real one.
+        slot.reset();
+        m_matchedTxid.erase(index);
+        m_collided[index] = true;
+        --m_matched;
+    }
+}
+
+std::vector<uint32_t> PartiallyDownloadedBlock::Missing() const
+{
+    std::vector<uint32_t> missing;
+    for (uint32_t i = 0; i < m_slots.size(); ++i)
+        if (!m_slots[i]) missing.push_back(i);
+    return missing;
+}
+
+std::optional<Block> PartiallyDownloadedBlock::Fill(const std::vector<Transaction>& missing) const
+{
+    Block block;
+    block.header = m_header;
+    block.transactions.reserve(m_slots.size());
+    std::size_t next = 0;
+    for (const auto& slot : m_slots) {
+        if (slot) {
+            block.transactions.push_back(*slot);
+        } else {
+            if (next == missing.size()) return std::nullopt;
+            block.transactions.push_back(missing[next++]);
+        }
+    }
+    if (next != missing.size()) return std::nullopt;
+    return block;
+}
+
+} // namespace net
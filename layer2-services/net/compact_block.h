@@ -0,0 +1,111 @@
+#pragma once
+
+#include "../../layer1-core/block/block.h"
+#include "../../layer1-core/tx/transaction.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace net {
+
+// Compact block relay (as in BIP152). A compact block carries the header,
+// a random nonce, a 6-byte short id per transaction and a few prefilled
+// transactions (at least the coinbase, which no mempool has). Receivers
+// rebuild the block from their mempool and ask for whatever is left with
+// "getblocktxn".
+//
+// Short ids are SipHash-2-4 of the txid, keyed by the first 16 bytes of
+// tagged_hash("DRM/cmpct", header || nonce), truncated to 48 bits. The
+// per-block key keeps an attacker from precomputing colliding
+// transactions; a collision that still happens shows up as a merkle root
+// mismatch and the full block is fetched instead.
+//
+// Encodings (integers little-endian):
+//   cmpctblock   [header(80)][nonce(8)][count(4)][shortId(6)...]
+//                [prefilledCount(4)]([index(4)][len(4)][tx])...
+//   getblocktxn  [blockHash(32)][count(4)][index(4)...]
+//   blocktxn     [blockHash(32)][count(4)]([len(4)][tx])...
+// Indexes are absolute positions in the block, ascending.
+constexpr std::size_t k_short_id_bytes = 6;
+constexpr uint64_t k_short_id_mask = (uint64_t{1} << (8 * k_short_id_bytes)) - 1;
+
+struct PrefilledTransaction {
+    uint32_t index{0};
+    Transaction tx;
+};
+
+struct CompactBlock {
+    BlockHeader header{};
+    uint64_t nonce{0};
+    std::vector<uint64_t> shortIds;
+    std::vector<PrefilledTransaction> prefilled;
+
+    std::size_t TransactionCount() const { return shortIds.size() + prefilled.size(); }
+};
+
+struct BlockTxnRequest {
+    uint256 blockHash{};
+    std::vector<uint32_t> indexes;
+};
+
+struct BlockTxn {
+    uint256 blockHash{};
+    std::vector<Transaction> transactions;
+};
+
+class ShortIdHasher {
+public:
+    ShortIdHasher(const BlockHeader& header, uint64_t nonce);
+    uint64_t operator()(const uint256& txid) const;
+
+private:
+    uint64_t m_k0{0};
+    uint64_t m_k1{0};
+};
+
+// Prefills only the coinbase.
+CompactBlock MakeCompactBlock(const Block& block, uint64_t nonce);
+
+// The parsers throw std::runtime_error on malformed input.
+std::vector<uint8_t> SerializeCompactBlock(const CompactBlock& block);
+CompactBlock DeserializeCompactBlock(const std::vector<uint8_t>& data);
+std::vector<uint8_t> SerializeBlockTxnRequest(const BlockTxnRequest& req);
+BlockTxnRequest DeserializeBlockTxnRequest(const std::vector<uint8_t>& data);
+std::vector<uint8_t> SerializeBlockTxn(const BlockTxn& txn);
+BlockTxn DeserializeBlockTxn(const std::vector<uint8_t>& data);
+
+// A block being rebuilt from a compact block. Offer() candidate
+// transactions (normally the whole mempool); slots matched by two
+// different transactions are left empty and requested like any other.
+class PartiallyDownloadedBlock {
+public:
+    // Throws std::runtime_error if the compact block is inconsistent
+    // (duplicate short ids, prefilled indexes out of range or repeated).
+    explicit PartiallyDownloadedBlock(const CompactBlock& block);
+
+    void Offer(const uint256& txid, const Transaction& tx);
+
+    // Indexes still missing, ascending.
+    std::vector<uint32_t> Missing() const;
+    // Number of transactions taken from Offer().
+    std::size_t Matched() const { return m_matched; }
+
+    // The block with `missing` filling the gaps in Missing() order; nullopt
+    // if the count does not match. The merkle root is not checked.
+    std::optional<Block> Fill(const std::vector<Transaction>& missing) const;
+
+    const BlockHeader& Header() const { return m_header; }
+
+private:
+    BlockHeader m_header{};
+    ShortIdHasher m_hasher;
+    std::vector<std::optional<Transaction>> m_slots;
+    std::vector<bool> m_collided;
+    std::unordered_map<uint64_t, uint32_t> m_byShortId; // short id -> index
+    std::unordered_map<uint32_t, uint256> m_matchedTxid;
+    std::size_t m_matched{0};
+};
+
+} // namespace net
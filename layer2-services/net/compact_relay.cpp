@@ -0,0 +1,228 @@
+#include "compact_relay.h"
+#include "../../layer1-core/merkle/merkle.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace net {
+
+CompactBlockRelay::CompactBlockRelay(P2PNetwork& p2p, const mempool::Mempool& pool, HeaderCheck checkHeader,
+                                     BlockHandler onBlock)
+    : m_p2p(p2p), m_pool(pool), m_checkHeader(std::move(checkHeader)), m_onBlock(std::move(onBlock)),
+      m_rng(std::random_device{}())
+{
+}
+
+void CompactBlockRelay::Start()
+{
+    m_p2p.SetCompactBlockProvider([this](const uint256& hash) -> std::optional<std::vector<uint8_t>> {
+        std::lock_guard<std::mutex> l(m_mutex);
+        // Only blocks we validated ourselves are served on request.
+        const Recent* recent = FindRecentLocked(hash);
+        if (!recent || !recent->validated) return std::nullopt;
+        return recent->compact;
+    });
+    m_p2p.RegisterHandler("cmpctblock", [this](const PeerInfo& from, const Message& msg) { OnCompactBlock(from, msg); });
+    m_p2p.RegisterHandler("getblocktxn", [this](const PeerInfo& from, const Message& msg) { OnGetBlockTxn(from, msg); });
+    m_p2p.RegisterHandler("blocktxn", [this](const PeerInfo& from, const Message& msg) { OnBlockTxn(from, msg); });
+}
+
+void CompactBlockRelay::Announce(const Block& block)
+{
+    const uint256 hash = BlockHash(block.header);
+    std::vector<uint8_t> compact;
+    std::set<std::string> skip;
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        Recent* recent = FindRecentLocked(hash);
+        if (!recent) recent = &AddRecentLocked(hash, SerializeCompactBlock(MakeCompactBlock(block, m_rng())));
+        if (!recent->block) recent->block = std::make_shared<const Block>(block);
+        recent->validated = true;
+        compact = recent->compact;
+        skip = recent->sentTo;
+        recent->sentTo.clear();
+    }
+    m_p2p.AnnounceBlock(hash, compact, skip);
+}
+
+CompactRelayStats CompactBlockRelay::Stats() const
+{
+    std::lock_guard<std::mutex> l(m_mutex);
+    return m_stats;
+}
+
+void CompactBlockRelay::OnCompactBlock(const PeerInfo& from, const Message& msg)
+{
+    CompactBlock cb;
+    try {
+        cb = DeserializeCompactBlock(msg.payload);
+    } catch (const std::exception&) {
+        m_p2p.Misbehaving(from.id, 50);
+        return;
+    }
+    const uint256 hash = BlockHash(cb.header);
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        if (Recent* recent = FindRecentLocked(hash)) {
+            recent->sentTo.insert(from.id);
+            return;
+        }
+        for (const auto& pending : m_pending)
+            if (pending.hash == hash) return;
+    }
+    if (!m_checkHeader(cb.header)) return;
+
+    std::unique_ptr<PartiallyDownloadedBlock> partial;
+    try {
+        partial = std::make_unique<PartiallyDownloadedBlock>(cb);
+    } catch (const std::exception&) {
+        {
+            std::lock_guard<std::mutex> l(m_mutex);
+            ++m_stats.fullBlocks;
+        }
+        m_p2p.RequestBlocks(from.id, {hash});
+        return;
+    }
+
+    // The header is good: pass it on to high bandwidth peers right away.
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        Recent& recent = AddRecentLocked(hash, msg.payload);
+        recent.sentTo.insert(from.id);
+        ++m_stats.received;
+    }
+    const auto sent = m_p2p.SendCompactBlock(msg.payload, {from.id});
+
+    m_pool.ForEach([&partial](const uint256& txid, const Transaction& tx) { partial->Offer(txid, tx); });
+    auto missing = partial->Missing();
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        if (Recent* recent = FindRecentLocked(hash)) recent->sentTo.insert(sent.begin(), sent.end());
+        m_stats.txFromMempool += partial->Matched();
+        if (missing.empty()) {
+            ++m_stats.reconstructed;
+        } else {
+            ++m_stats.roundTrips;
+            m_stats.txRequested += missing.size();
+        }
+    }
+    if (missing.empty()) {
+        Complete(from, hash, *partial->Fill({}));
+        return;
+    }
+    const auto request = SerializeBlockTxnRequest(BlockTxnRequest{hash, missing});
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        // Requests that were never answered give way to newer ones.
+        if (m_pending.size() >= k_recent_blocks) m_pending.pop_front();
+        m_pending.push_back(Pending{hash, from.id, std::move(partial), std::move(missing)});
+    }
+    m_p2p.SendTo(from.id, Message{"getblocktxn", request});
+}
+
+void CompactBlockRelay::OnGetBlockTxn(const PeerInfo& from, const Message& msg)
+{
+    BlockTxnRequest req;
+    try {
+        req = DeserializeBlockTxnRequest(msg.payload);
+    } catch (const std::exception&) {
+        return;
+    }
+    BlockTxn txn{req.blockHash, {}};
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        const Recent* recent = FindRecentLocked(req.blockHash);
+        if (!recent || !recent->block) return;
+        for (uint32_t index : req.indexes) {
+            if (index >= recent->block->transactions.size()) return;
+            txn.transactions.push_back(recent->block->transactions[index]);
+        }
+    }
+    m_p2p.SendTo(from.id, Message{"blocktxn", SerializeBlockTxn(txn)});
+}
+
+void CompactBlockRelay::OnBlockTxn(const PeerInfo& from, const Message& msg)
+{
+    BlockTxn txn;
+    try {
+        txn = DeserializeBlockTxn(msg.payload);
+    } catch (const std::exception&) {
+        m_p2p.Misbehaving(from.id, 50);
+        return;
+    }
+    Pending pending;
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        auto it = std::find_if(m_pending.begin(), m_pending.end(),
+                               [&](const Pending& p) { return p.hash == txn.blockHash; });
+        if (it == m_pending.end() || it->peer != from.id) return;
+        pending = std::move(*it);
+        m_pending.erase(it);
+    }
+    if (auto block = pending.partial->Fill(txn.transactions)) {
+        Complete(from, txn.blockHash, *block);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        ++m_stats.fullBlocks;
+    }
+    m_p2p.RequestBlocks(from.id, {txn.blockHash});
+}
+
+void CompactBlockRelay::Complete(const PeerInfo& from, const uint256& hash, const Block& block)
+{
+    if (ComputeMerkleRoot(block.transactions) != block.header.merkleRoot) {
+        // A short id collision (or a lying peer): get the real thing.
+        {
+            std::lock_guard<std::mutex> l(m_mutex);
+            ++m_stats.fullBlocks;
+            auto it = std::find_if(m_recent.begin(), m_recent.end(), [&](const Recent& r) { return r.hash == hash; });
+            if (it != m_recent.end()) m_recent.erase(it);
+        }
+        m_p2p.RequestBlocks(from.id, {hash});
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        if (Recent* recent = FindRecentLocked(hash)) recent->block = std::make_shared<const Block>(block);
+    }
+    Promote(from.id);
+    m_onBlock(from, block);
+}
+
+void CompactBlockRelay::Promote(const std::string& peer)
+{
+    std::string demoted;
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        auto it = std::find(m_highBandwidth.begin(), m_highBandwidth.end(), peer);
+        if (it != m_highBandwidth.end()) {
+            m_highBandwidth.erase(it);
+            m_highBandwidth.push_back(peer);
+            return;
+        }
+        m_highBandwidth.push_back(peer);
+        if (m_highBandwidth.size() > k_high_bandwidth_peers) {
+            demoted = m_highBandwidth.front();
+            m_highBandwidth.pop_front();
+        }
+    }
+    m_p2p.SetHighBandwidth(peer, true);
+    if (!demoted.empty()) m_p2p.SetHighBandwidth(demoted, false);
+}
+
+CompactBlockRelay::Recent* CompactBlockRelay::FindRecentLocked(const uint256& hash)
+{
+    for (auto& recent : m_recent)
+        if (recent.hash == hash) return &recent;
+    return nullptr;
+}
+
+CompactBlockRelay::Recent& CompactBlockRelay::AddRecentLocked(const uint256& hash, std::vector<uint8_t> compact)
+{
+    if (m_recent.size() >= k_recent_blocks) m_recent.pop_front();
+    m_recent.push_back(Recent{hash, nullptr, std::move(compact), {}, false});
+    return m_recent.back();
+}
+
+} // namespace net
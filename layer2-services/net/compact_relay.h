@@ -0,0 +1,107 @@
+#pragma once
+
+#include "compact_block.h"
+#include "p2p.h"
+#include "../mempool/mempool.h"
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace net {
+
+struct CompactRelayStats {
+    uint64_t received{0};      // compact blocks for blocks we did not have
+    uint64_t reconstructed{0}; // complete from the mempool alone
+    uint64_t roundTrips{0};    // needed a getblocktxn
+    uint64_t fullBlocks{0};    // fell back to downloading the block
+    uint64_t txFromMempool{0};
+    uint64_t txRequested{0};
+};
+
+// Compact block relay on top of P2PNetwork (formats in compact_block.h).
+//
+// Incoming "cmpctblock" messages are rebuilt from the mempool; missing
+// transactions are fetched with one "getblocktxn"/"blocktxn" round trip
+// from the same peer and the finished block goes to the block handler
+// (normally BlockSync). If the block cannot be rebuilt (short id collision,
+// merkle mismatch, inconsistent message) the full block is requested.
+//
+// High bandwidth mode: the k_high_bandwidth_peers peers that most recently
+// gave us a new block first are asked to push blocks unsolicited, and a
+// compact block whose header checks out is passed on to the peers that
+// asked us for the same before the block itself is validated. Invalid
+// transactions therefore cost the sender a wasted message, not a ban.
+//
+// Our own new blocks are announced through Announce(); the last
+// k_recent_blocks stay available for getdata and getblocktxn.
+class CompactBlockRelay {
+public:
+    // A new header with valid PoW that would become the best tip, checked
+    // without side effects.
+    using HeaderCheck = std::function<bool(const BlockHeader&)>;
+    using BlockHandler = std::function<void(const PeerInfo&, const Block&)>;
+
+    static constexpr size_t k_high_bandwidth_peers = 3;
+    static constexpr size_t k_recent_blocks = 8;
+
+    CompactBlockRelay(P2PNetwork& p2p, const mempool::Mempool& pool, HeaderCheck checkHeader, BlockHandler onBlock);
+
+    CompactBlockRelay(const CompactBlockRelay&) = delete;
+    CompactBlockRelay& operator=(const CompactBlockRelay&) = delete;
+
+    // Registers the message handlers and the compact block provider.
+    void Start();
+
+    // A block that has become our tip: high bandwidth peers get the compact
+    // block (unless they were already sent it), the others an inv.
+    void Announce(const Block& block);
+
+    CompactRelayStats Stats() const;
+
+private:
+    struct Recent {
+        uint256 hash{};
+        std::shared_ptr<const Block> block; // null until rebuilt
+        std::vector<uint8_t> compact;
+        std::set<std::string> sentTo; // peers that have it
+        bool validated{false};        // announced by us
+    };
+    struct Pending {
+        uint256 hash{};
+        std::string peer;
+        std::unique_ptr<PartiallyDownloadedBlock> partial;
+        std::vector<uint32_t> missing;
+    };
+
+    void OnCompactBlock(const PeerInfo& from, const Message& msg);
+    void OnGetBlockTxn(const PeerInfo& from, const Message& msg);
+    void OnBlockTxn(const PeerInfo& from, const Message& msg);
+    // Checks the merkle root and hands the block on, or requests the full
+    // block from `from`.
+    void Complete(const PeerInfo& from, const uint256& hash, const Block& block);
+    void Promote(const std::string& peer);
+
+    // Expect m_mutex to be held.
+    Recent* FindRecentLocked(const uint256& hash);
+    Recent& AddRecentLocked(const uint256& hash, std::vector<uint8_t> compact);
+
+    P2PNetwork& m_p2p;
+    const mempool::Mempool& m_pool;
+    HeaderCheck m_checkHeader;
+    BlockHandler m_onBlock;
+
+    mutable std::mutex m_mutex;
+    std::mt19937_64 m_rng;
+    std::deque<Recent> m_recent;
+    std::deque<Pending> m_pending; // oldest first
+    std::deque<std::string> m_highBandwidth; // oldest first
+    CompactRelayStats m_stats;
+};
+
+} // namespace net
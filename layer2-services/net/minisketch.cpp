@@ -0,0 +1,224 @@
+#include "minisketch.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace net {
+
+namespace {
+
+using Poly = std::vector<uint32_t>; // coefficients, lowest degree first
+
+// GF(2^32) modulo x^32 + x^7 + x^3 + x^2 + 1.
+uint32_t Mul(uint32_t a, uint32_t b)
+{
+    uint64_t r = 0;
+    uint64_t x = a;
+    while (b) {
+        if (b & 1) r ^= x;
+        x <<= 1;
+        b >>= 1;
+    }
+    // Fold the high word back in twice: x^32 = x^7 + x^3 + x^2 + 1.
+    for (int pass = 0; pass < 2; ++pass) {
+        const uint64_t hi = r >> 32;
+        r = (r & 0xffffffffu) ^ (hi << 7) ^ (hi << 3) ^ (hi << 2) ^ hi;
+    }
+    return static_cast<uint32_t>(r);
+}
+
+// a^(2^32 - 2) = a^-1.
+uint32_t Inv(uint32_t a)
+{
+    uint32_t r = a;
+    for (int i = 1; i < 31; ++i) r = Mul(Mul(r, r), a); // a^(2^(i+1) - 1)
+    return Mul(r, r);
+}
+
+void Trim(Poly& p)
+{
+    while (!p.empty() && p.back() == 0) p.pop_back();
+}
+
+void MakeMonic(Poly& p)
+{
+    const uint32_t inv = Inv(p.back());
+    for (auto& c : p) c = Mul(c, inv);
+}
+
+// a becomes a mod m; the quotient goes to `quotient` if given. m is trimmed
+// and nonzero.
+void Reduce(Poly& a, const Poly& m, Poly* quotient = nullptr)
+{
+    Trim(a);
+    if (quotient) quotient->assign(a.size() >= m.size() ? a.size() - m.size() + 1 : 0, 0);
+    const uint32_t inv = Inv(m.back());
+    while (a.size() >= m.size()) {
+        const uint32_t factor = Mul(a.back(), inv);
+        const size_t shift = a.size() - m.size();
+        if (quotient) (*quotient)[shift] = factor;
+        for (size_t i = 0; i < m.size(); ++i) a[shift + i] ^= Mul(factor, m[i]);
+        Trim(a);
+    }
+}
+
+// a^2 mod m; squaring is linear in characteristic 2.
+Poly SquareMod(const Poly& a, const Poly& m)
+{
+    Poly r(a.empty() ? 0 : 2 * a.size() - 1, 0);
+    for (size_t i = 0; i < a.size(); ++i) r[2 * i] = Mul(a[i], a[i]);
+    Reduce(r, m);
+    return r;
+}
+
+Poly Gcd(Poly a, Poly b)
+{
+    Trim(a);
+    Trim(b);
+    while (!b.empty()) {
+        Reduce(a, b);
+        std::swap(a, b);
+    }
+    if (!a.empty()) MakeMonic(a);
+    return a;
+}
+
+// Roots of the monic f, known to be a product of distinct linear factors,
+// by splitting it with gcd(f, Tr(beta * x)) for random beta (Berlekamp's
+// trace algorithm).
+bool FindRoots(const Poly& f, std::vector<uint32_t>& roots, uint32_t& seed)
+{
+    if (f.size() <= 1) return true;
+    if (f.size() == 2) {
+        roots.push_back(f[0]); // x + a
+        return true;
+    }
+    for (int attempt = 0; attempt < 64; ++attempt) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        Poly term{0, seed};
+        Poly trace = term;
+        for (int i = 1; i < 32; ++i) {
+            term = SquareMod(term, f);
+            if (trace.size() < term.size()) trace.resize(term.size(), 0);
+            for (size_t j = 0; j < term.size(); ++j) trace[j] ^= term[j];
+        }
+        const Poly g = Gcd(f, trace);
+        if (g.size() <= 1 || g.size() == f.size()) continue;
+        Poly rest = f;
+        Poly quotient;
+        Reduce(rest, g, &quotient);
+        return FindRoots(g, roots, seed) && FindRoots(quotient, roots, seed);
+    }
+    return false;
+}
+
+} // namespace
+
+Minisketch::Minisketch(size_t capacity) : m_syndromes(capacity, 0) {}
+
+void Minisketch::Add(uint32_t element)
+{
+    if (element == 0) return;
+    const uint32_t square = Mul(element, element);
+    uint32_t power = element;
+    for (auto& s : m_syndromes) {
+        s ^= power;
+        power = Mul(power, square);
+    }
+}
+
+void Minisketch::Merge(const Minisketch& other)
+{
+    if (other.Capacity() != Capacity()) throw std::runtime_error("minisketch: capacity mismatch");
+    for (size_t i = 0; i < m_syndromes.size(); ++i) m_syndromes[i] ^= other.m_syndromes[i];
+}
+
+std::vector<uint8_t> Minisketch::Serialize() const
+{
+    std::vector<uint8_t> out;
+    out.reserve(m_syndromes.size() * k_element_bytes);
+    for (uint32_t s : m_syndromes)
+        for (size_t i = 0; i < k_element_bytes; ++i) out.push_back(static_cast<uint8_t>(s >> (8 * i)));
+    return out;
+}
+
+Minisketch Minisketch::Deserialize(const std::vector<uint8_t>& data)
+{
+    if (data.size() % k_element_bytes != 0) throw std::runtime_error("minisketch: bad size");
+    Minisketch sketch(data.size() / k_element_bytes);
+    for (size_t i = 0; i < sketch.m_syndromes.size(); ++i) {
+        uint32_t s = 0;
+        for (size_t j = 0; j < k_element_bytes; ++j) s |= static_cast<uint32_t>(data[i * k_element_bytes + j]) << (8 * j);
+        sketch.m_syndromes[i] = s;
+    }
+    return sketch;
+}
+
+std::optional<std::vector<uint32_t>> Minisketch::Decode(size_t maxElements) const
+{
+    const size_t capacity = Capacity();
+    if (std::all_of(m_syndromes.begin(), m_syndromes.end(), [](uint32_t s) { return s == 0; }))
+        return std::vector<uint32_t>{};
+
+    // All power sums s_1..s_2c; the even ones are squares of earlier ones.
+    std::vector<uint32_t> sums(2 * capacity + 1, 0);
+    for (size_t i = 0; i < capacity; ++i) sums[2 * i + 1] = m_syndromes[i];
+    for (size_t i = 1; i <= capacity; ++i) sums[2 * i] = Mul(sums[i], sums[i]);
+
+    // Berlekamp-Massey: the shortest C with C(x) = prod(1 - e_i x).
+    Poly c{1};
+    Poly b{1};
+    size_t length = 0;
+    size_t shift = 1;
+    uint32_t lastDiscrepancy = 1;
+    for (size_t n = 0; n < 2 * capacity; ++n) {
+        uint32_t d = sums[n + 1];
+        for (size_t i = 1; i <= length && i < c.size(); ++i) d ^= Mul(c[i], sums[n + 1 - i]);
+        if (d == 0) {
+            ++shift;
+            continue;
+        }
+        const uint32_t factor = Mul(d, Inv(lastDiscrepancy));
+        const Poly previous = c;
+        if (c.size() < b.size() + shift) c.resize(b.size() + shift, 0);
+        for (size_t i = 0; i < b.size(); ++i) c[i + shift] ^= Mul(factor, b[i]);
+        if (2 * length <= n) {
+            length = n + 1 - length;
+            b = previous;
+            lastDiscrepancy = d;
+            shift = 1;
+        } else {
+            ++shift;
+        }
+    }
+    Trim(c);
+    if (length > std::min(maxElements, capacity) || c.size() != length + 1) return std::nullopt;
+
+    // The elements are the roots of the reversed polynomial, which must split
+    // into distinct linear factors: x^(2^32) = x modulo it.
+    Poly locator(c.rbegin(), c.rend());
+    const Poly x = [&] {
+        Poly p{0, 1};
+        Reduce(p, locator);
+        return p;
+    }();
+    Poly power = x;
+    for (int i = 0; i < 32; ++i) power = SquareMod(power, locator);
+    if (power != x) return std::nullopt;
+
+    std::vector<uint32_t> elements;
+    uint32_t seed = 0x9e3779b9u ^ m_syndromes[0];
+    if (seed == 0) seed = 1;
+    if (!FindRoots(locator, elements, seed) || elements.size() != length) return std::nullopt;
+
+    // More differences than the capacity can still yield a consistent-looking
+    // locator; only accept elements that reproduce the sketch.
+    Minisketch check(capacity);
+    for (uint32_t e : elements) check.Add(e);
+    if (check.m_syndromes != m_syndromes) return std::nullopt;
+    std::sort(elements.begin(), elements.end());
+    return elements;
+}
+
+} // namespace net
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace net {
+
+// Set sketch over GF(2^32) (PinSketch, as in minisketch): a sketch of
+// capacity c stores the odd power sums x, x^3, ..., x^(2c-1) of its
+// elements, 4 * c bytes in all. Adding an element twice removes it, so the
+// merge (xor) of the sketches of two sets is the sketch of their symmetric
+// difference, which Decode() recovers whenever it has at most c elements.
+// Elements are nonzero 32-bit values.
+class Minisketch {
+public:
+    static constexpr size_t k_element_bytes = 4;
+
+    explicit Minisketch(size_t capacity);
+
+    size_t Capacity() const { return m_syndromes.size(); }
+
+    void Add(uint32_t element);
+    // Throws std::runtime_error if the capacities differ.
+    void Merge(const Minisketch& other);
+
+    std::vector<uint8_t> Serialize() const;
+    // Capacity follows from the size; throws std::runtime_error if it is
+    // not a multiple of k_element_bytes.
+    static Minisketch Deserialize(const std::vector<uint8_t>& data);
+
+    // The elements of the sketched set, or nullopt if it has more than
+    // `maxElements` (at most Capacity()) of them. A set that fills the whole
+    // capacity cannot be told apart from some larger ones; every element
+    // of slack left makes a wrong answer 2^32 times less likely.
+    std::optional<std::vector<uint32_t>> Decode(size_t maxElements) const;
+    std::optional<std::vector<uint32_t>> Decode() const { return Decode(Capacity()); }
+
+private:
+    std::vector<uint32_t> m_syndromes; // power sums of odd exponent
+};
+
+} // namespace net
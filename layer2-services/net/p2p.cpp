@@ -3,14 +3,19 @@
 #include <algorithm>
 #include <array>
 #include <chrono>
+#include <cstdio>
 #include <cstring>
 #include <deque>
+#include <limits>
 #include <mutex>
 #include <optional>
 #include <random>
 #include <unordered_set>
 
+#include "../../layer1-core/crypto/siphash.h"
 #include "../../layer1-core/pow/sha256d.h"
+#include "minisketch.h"
+#include "v2_transport.h"
 
 namespace net {
 
@@ -24,6 +29,197 @@ static void PadCommand(const std::string& cmd, std::array<char, 12>& out)
 }
 
 static constexpr size_t k_max_payload = 4 * 1024 * 1024; // 4 MiB safety cap
+// Flags and the longest message type of a v2 packet.
+static constexpr size_t k_max_v2_head = 14;
+
+static bool ChecksumMatches(const std::vector<uint8_t>& payload, uint32_t checksum)
+{
+    uint8_t verify[32]{};
+    sha256d(verify, payload.empty() ? nullptr : payload.data(), payload.size());
+    uint32_t calc{0};
+    std::memcpy(&calc, verify, sizeof(calc));
+    return calc == checksum;
+}
+
+static Message AddrMessage(const std::vector<PeerAddress>& addrs)
+{
+    const uint32_t count = static_cast<uint32_t>(addrs.size());
+    std::vector<uint8_t> payload(sizeof(count));
+    std::memcpy(payload.data(), &count, sizeof(count));
+    for (const auto& a : addrs) {
+        const size_t off = payload.size();
+        const size_t len = std::min<size_t>(a.address.size(), 255);
+        payload.resize(off + sizeof(a.time) + sizeof(a.services) + 1 + len);
+        std::memcpy(payload.data() + off, &a.time, sizeof(a.time));
+        std::memcpy(payload.data() + off + 8, &a.services, sizeof(a.services));
+        payload[off + 16] = static_cast<uint8_t>(len);
+        std::memcpy(payload.data() + off + 17, a.address.data(), len);
+    }
+    return Message{"addr", std::move(payload)};
+}
+
+static bool ParseAddrMessage(const std::vector<uint8_t>& payload, std::vector<PeerAddress>& out)
+{
+    uint32_t count{0};
+    if (payload.size() < sizeof(count)) return false;
+    std::memcpy(&count, payload.data(), sizeof(count));
+    if (count > P2PNetwork::k_max_addr) return false;
+    size_t off = sizeof(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        if (payload.size() - off < 17) return false;
+        PeerAddress a;
+        std::memcpy(&a.time, payload.data() + off, sizeof(a.time));
+        std::memcpy(&a.services, payload.data() + off + 8, sizeof(a.services));
+        const size_t len = payload[off + 16];
+        off += 17;
+        if (payload.size() - off < len) return false;
+        a.address.assign(reinterpret_cast<const char*>(payload.data() + off), len);
+        off += len;
+        out.push_back(std::move(a));
+    }
+    return off == payload.size();
+}
+
+// How a peer at `ip` is dialed: IPv4 (also when mapped into IPv6) as is,
+// IPv6 in brackets.
+static std::string DialHost(const std::string& ip)
+{
+    boost::system::error_code ec;
+    const auto addr = boost::asio::ip::make_address(ip, ec);
+    if (ec || addr.is_v4()) return ip;
+    if (addr.to_v6().is_v4_mapped())
+        return boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, addr.to_v6()).to_string();
+    return "[" + ip + "]";
+}
+
+static Message SendCmpctMessage(bool highBandwidth)
+{
+    std::vector<uint8_t> payload{static_cast<uint8_t>(highBandwidth ? 1 : 0)};
+    const uint64_t version = P2PNetwork::k_compact_version;
+    payload.insert(payload.end(), reinterpret_cast<const uint8_t*>(&version),
+                   reinterpret_cast<const uint8_t*>(&version) + sizeof(version));
+    return Message{"sendcmpct", payload};
+}
+
+static Message SendTxRcnclMessage(uint64_t salt)
+{
+    std::vector<uint8_t> payload(sizeof(uint32_t) + sizeof(salt));
+    const uint32_t version = P2PNetwork::k_recon_version;
+    std::memcpy(payload.data(), &version, sizeof(version));
+    std::memcpy(payload.data() + sizeof(version), &salt, sizeof(salt));
+    return Message{"sendtxrcncl", payload};
+}
+
+enum class P2PNetwork::Command : uint8_t {
+    Version, Verack, Ping, Pong, Inv, GetData, Tx, Block, FilterLoad, FilterAdd, FilterClear, GetCFilters,
+    GetCFHeaders, SendCmpct, GetHeaders, Headers, SendTxRcncl, ReqRecon, Sketch, ReconcilDiff, CmpctBlock,
+    GetBlockTxn, BlockTxn, GetAddr, Addr, Unknown
+};
+
+// In Command order.
+static constexpr std::array<std::string_view, 25> k_command_names{
+    "version", "verack", "ping", "pong", "inv", "getdata", "tx", "block", "filterload", "filteradd", "filterclear",
+    "getcfilters", "getcfheaders", "sendcmpct", "getheaders", "headers", "sendtxrcncl", "reqrecon", "sketch",
+    "reconcildiff", "cmpctblock", "getblocktxn", "blocktxn", "getaddr", "addr"};
+
+struct P2PNetwork::HandlerTable {
+    std::array<Handler, k_command_names.size()> known; // by Command
+    std::unordered_map<std::string, Handler> other;
+
+    const Handler* Find(Command cmd, const std::string& command) const
+    {
+        if (cmd != Command::Unknown) {
+            const Handler& h = known[static_cast<size_t>(cmd)];
+            return h ? &h : nullptr;
+        }
+        auto it = other.find(command);
+        return it == other.end() ? nullptr : &it->second;
+    }
+};
+
+struct P2PNetwork::Callbacks {
+    PayloadProvider txProvider;
+    PayloadProvider blockProvider;
+    PayloadProvider compactProvider;
+    FilterProvider filterProvider;
+    HeadersProvider headersProvider;
+    HeadersHandler headersHandler;
+    PeerEvent peerConnected;
+    PeerEvent peerDisconnected;
+};
+
+// Per-peer budget of each command (see "Rate limits" in p2p.h): weight,
+// refill per second and burst, in cost units.
+struct MessageBudget {
+    double weight;
+    double rate;
+    double burst;
+};
+
+// In Command order, then anything else.
+static constexpr std::array<MessageBudget, k_command_names.size() + 1> k_message_budgets{{
+    {1, 0.1, 5},          // version
+    {1, 0.1, 5},          // verack
+    {1, 2, 100},          // ping
+    {1, 2, 100},          // pong
+    {1, 200, 5000},       // inv
+    {2, 200, 5000},       // getdata
+    {10, 500, 10000},     // tx
+    {100, 1, 1000},       // block (unsolicited; see RateLimit)
+    {5, 10, 500},         // filterload
+    {5, 10, 500},         // filteradd
+    {5, 10, 500},         // filterclear
+    {20, 100, 5000},      // getcfilters
+    {20, 100, 5000},      // getcfheaders
+    {1, 0.1, 10},         // sendcmpct
+    {5, 200, 5000},       // getheaders
+    {10, 10000, 100000},  // headers
+    {1, 0.1, 10},         // sendtxrcncl
+    {5, 20, 1000},        // reqrecon
+    {5, 20, 1000},        // sketch
+    {5, 20, 1000},        // reconcildiff
+    {50, 4, 2000},        // cmpctblock (unsolicited)
+    {5, 200, 5000},       // getblocktxn
+    {100, 1, 1000},       // blocktxn (unsolicited)
+    {1, 0.1, 5},          // getaddr
+    {1, 10, 1000},        // addr
+    {1, 1024, 16384},     // other
+}};
+
+// The command in a v1 header.
+static std::string_view HeaderCommand(const WireMessage& wire)
+{
+    const auto* name = reinterpret_cast<const char*>(wire.header.data() + 4);
+    return std::string_view(name, std::find(name, name + 12, '\0') - name);
+}
+
+// Transaction relay, which waits for everything else (see "Upload").
+static bool Deferrable(const WireMessage& wire)
+{
+    if (wire.raw) return false;
+    const std::string_view command = HeaderCommand(wire);
+    if (command == "inv") return !wire.payload.empty() && wire.payload[0] == 0x01;
+    return command == "tx" || command == "addr" || command == "reqrecon" || command == "sketch" ||
+           command == "reconcildiff";
+}
+
+struct P2PNetwork::TrafficMeters {
+    struct Meter {
+        std::atomic<uint64_t> messages{0};
+        std::atomic<uint64_t> bytes{0};
+
+        void Add(size_t size)
+        {
+            messages.fetch_add(1, std::memory_order_relaxed);
+            bytes.fetch_add(size, std::memory_order_relaxed);
+        }
+    };
+
+    std::array<Meter, k_command_names.size() + 1> received; // by Command
+    std::array<Meter, k_command_names.size() + 1> sent;
+    std::atomic<uint64_t> rateLimited{0};
+    std::atomic<uint64_t> uploadWaits{0};
+};
 
 bool BloomFilter::Match(const uint256& h) const
 {
@@ -48,23 +244,85 @@ bool BloomFilter::Match(const uint256& h) const
 }
 
 struct P2PNetwork::PeerState {
+    boost::asio::strand<boost::asio::io_context::executor_type> strand; // the socket's
     tcp::socket socket;
+    boost::asio::strand<boost::asio::any_io_executor> processor;       // message handling
+    boost::asio::steady_timer writeTimer;   // waits for the upload limits
     PeerInfo info;
-    std::deque<Message> outbound;
-    std::mutex outboundMutex;
-    int banScore{0};
-    size_t msgsThisMinute{0};
-    std::chrono::steady_clock::time_point windowStart{std::chrono::steady_clock::now()};
+    // Urgent messages, then deferrable ones (see Deferrable()); the batch
+    // being written is already taken off.
+    std::array<std::deque<SharedWireMessage>, 2> outbound;
+    std::mutex outboundMutex;               // also guards writing, processingBytes, readPaused
+    size_t outboundBytes{0};                // queued or being written
+    bool writing{false};                    // a write is under way
+    bool waiting{false};                    // writeTimer is set
+    bool relayWaiting{false};               // and only relay is held back
+    size_t processingBytes{0};              // received, not yet handled
+    bool readPaused{false};
+    std::atomic<Transport> transport{Transport::V1};
+    std::unique_ptr<V2Transport> v2;        // from the handshake on
+    std::vector<SharedWireMessage> held;    // until the transport is settled
+    bool heard{false};                      // a message has arrived
+    ConnectionType type{ConnectionType::Inbound};
+    std::chrono::steady_clock::time_point dialed{};
+    std::string listenAddress;              // where an inbound peer says it listens
+    bool sentAddr{false};                   // answered its getaddr
+    std::atomic<int> banScore{0};
+    std::atomic<uint32_t> blocksAsked{0};   // block answers we requested, not yet received
+    std::array<TokenBucket, k_message_budgets.size()> budgets; // by Command
+    TokenBucket upload;                     // rate 0 when there is no per-peer limit
     bool gotVersion{false};
     bool sentVerack{false};
+    bool compactBlocks{false};        // sent us sendcmpct
+    bool compactHighBandwidth{false}; // wants new blocks pushed as cmpctblock
+    RollingBloomFilter knownInventory{k_known_inventory, 0.000001};
+    std::set<uint256> txToSend;       // queued for the next trickle
+    std::chrono::steady_clock::time_point nextTrickle{};
+    bool reconciling{false};          // both sides sent sendtxrcncl
+    uint64_t reconK0{0};
+    uint64_t reconK1{0};
+    std::unordered_map<uint32_t, uint256> reconSet;      // short id -> txid, to reconcile
+    std::unordered_map<uint32_t, uint256> reconSnapshot; // what our last sketch covered
+    bool reconRequested{false};       // waiting for the peer's sketch
+    std::chrono::steady_clock::time_point nextRecon{};
     BloomFilter filter{};
+    std::atomic<bool> registered{false}; // in m_peers
+    std::vector<uint8_t> recv;           // bytes [recvStart, recvEnd) are not handled yet
+    size_t recvStart{0};
+    size_t recvEnd{0};
+
+    PeerState(boost::asio::io_context& io, const boost::asio::any_io_executor& processing, PeerInfo p)
+        : strand(boost::asio::make_strand(io)), socket(strand), processor(boost::asio::make_strand(processing)),
+          writeTimer(strand), info(std::move(p))
+    {
+        const auto now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < budgets.size(); ++i)
+            budgets[i] = TokenBucket(k_message_budgets[i].rate, k_message_budgets[i].burst, now);
+    }
+
+    // Caller holds outboundMutex.
+    bool Congested() const { return outboundBytes > k_send_buffer_pause || processingBytes > k_processing_pause; }
+
+    uint32_t ShortTxId(const uint256& txid) const
+    {
+        const auto id = static_cast<uint32_t>(SipHash24(reconK0, reconK1, txid));
+        return id ? id : 1; // sketches cannot hold zero
+    }
 
-    explicit PeerState(boost::asio::io_context& io, PeerInfo p)
-        : socket(io), info(std::move(p)) {}
+    // The peer has `txid`: nothing left to announce.
+    void Forget(const uint256& txid)
+    {
+        txToSend.erase(txid);
+        if (!reconciling) return;
+        auto it = reconSet.find(ShortTxId(txid));
+        if (it != reconSet.end() && it->second == txid) reconSet.erase(it);
+    }
 };
 
 P2PNetwork::P2PNetwork(boost::asio::io_context& io, uint16_t listenPort)
-    : m_io(io), m_acceptor(io), m_timer(io), m_seedTimer(io)
+    : m_io(io), m_processing(io.get_executor()), m_acceptor(io), m_handlerTable(std::make_shared<HandlerTable>()),
+      m_callbacks(std::make_shared<Callbacks>()),       m_meters(std::make_unique<TrafficMeters>()), m_timer(io), m_seedTimer(io),
+      m_trickleTimer(io)
 {
     tcp::endpoint ep(tcp::v6(), listenPort);
     boost::system::error_code ec;
@@ -79,6 +337,9 @@ P2PNetwork::P2PNetwork(boost::asio::io_context& io, uint16_t listenPort)
         m_acceptor.bind({tcp::v4(), listenPort});
     }
     m_acceptor.listen();
+    char nodeId[17];
+    std::snprintf(nodeId, sizeof(nodeId), "%016llx", static_cast<unsigned long long>(m_rng()));
+    m_nodeId = nodeId;
 }
 
 P2PNetwork::~P2PNetwork()
@@ -89,13 +350,27 @@ P2PNetwork::~P2PNetwork()
 void P2PNetwork::RegisterHandler(const std::string& cmd, Handler h)
 {
     std::lock_guard<std::mutex> g(m_mutex);
-    m_handlers[cmd] = std::move(h);
+    auto next = std::make_shared<HandlerTable>(*m_handlerTable);
+    const Command known = ParseCommand(cmd);
+    if (known != Command::Unknown)
+        next->known[static_cast<size_t>(known)] = std::move(h);
+    else
+        next->other[cmd] = std::move(h);
+    std::atomic_store(&m_handlerTable, std::shared_ptr<const HandlerTable>(std::move(next)));
+}
+
+void P2PNetwork::UpdateCallbacks(const std::function<void(Callbacks&)>& edit)
+{
+    std::lock_guard<std::mutex> g(m_mutex);
+    auto next = std::make_shared<Callbacks>(*m_callbacks);
+    edit(*next);
+    std::atomic_store(&m_callbacks, std::shared_ptr<const Callbacks>(std::move(next)));
 }
 
 void P2PNetwork::AddPeerAddress(const std::string& address)
 {
     std::lock_guard<std::mutex> g(m_mutex);
-    m_seedAddrs.insert(address);
+    m_seedAddrs.emplace(address, Redial{});
 }
 
 void P2PNetwork::SetLocalHeight(uint32_t height)
@@ -103,27 +378,138 @@ void P2PNetwork::SetLocalHeight(uint32_t height)
     m_localHeight = height;
 }
 
+void P2PNetwork::SetLocalServices(uint64_t services)
+{
+    if (m_v2Enabled) services |= k_node_p2p_v2;
+    m_localServices = services;
+}
+
 void P2PNetwork::SetTxProvider(PayloadProvider provider)
 {
-    m_txProvider = std::move(provider);
+    UpdateCallbacks([&](Callbacks& c) { c.txProvider = std::move(provider); });
 }
 
 void P2PNetwork::SetBlockProvider(PayloadProvider provider)
 {
-    m_blockProvider = std::move(provider);
+    UpdateCallbacks([&](Callbacks& c) { c.blockProvider = std::move(provider); });
+    std::lock_guard<std::mutex> g(m_servedMutex);
+    m_servedBlocks.clear();
+    m_servedIndex.clear();
+    m_servedBytes = 0;
+}
+
+void P2PNetwork::SetCompactBlockProvider(PayloadProvider provider)
+{
+    UpdateCallbacks([&](Callbacks& c) { c.compactProvider = std::move(provider); });
+}
+
+void P2PNetwork::SetFilterProvider(FilterProvider provider)
+{
+    UpdateCallbacks([&](Callbacks& c) { c.filterProvider = std::move(provider); });
+}
+
+void P2PNetwork::SetHeadersProvider(HeadersProvider provider)
+{
+    UpdateCallbacks([&](Callbacks& c) { c.headersProvider = std::move(provider); });
+}
+
+void P2PNetwork::SetHeadersHandler(HeadersHandler handler)
+{
+    UpdateCallbacks([&](Callbacks& c) { c.headersHandler = std::move(handler); });
+}
+
+void P2PNetwork::SetPeerHandlers(PeerEvent connected, PeerEvent disconnected)
+{
+    UpdateCallbacks([&](Callbacks& c) {
+        c.peerConnected = std::move(connected);
+        c.peerDisconnected = std::move(disconnected);
+    });
+}
+
+void P2PNetwork::SetProcessingExecutor(boost::asio::any_io_executor executor)
+{
+    std::lock_guard<std::mutex> g(m_mutex);
+    m_processing = std::move(executor);
+}
+
+void P2PNetwork::SetMaxOutbound(size_t count, std::chrono::milliseconds feelerInterval)
+{
+    std::lock_guard<std::mutex> g(m_mutex);
+    m_maxOutbound = count;
+    m_feelerInterval = feelerInterval;
+}
+
+void P2PNetwork::SetAddressFile(std::string path)
+{
+    std::lock_guard<std::mutex> g(m_mutex);
+    m_addressFile = std::move(path);
+}
+
+void P2PNetwork::SetUploadLimits(uint64_t peerBytesPerSecond, uint64_t totalBytesPerSecond)
+{
+    {
+        std::lock_guard<std::mutex> g(m_mutex);
+        m_peerUploadLimit = peerBytesPerSecond;
+    }
+    std::lock_guard<std::mutex> ul(m_uploadMutex);
+    // A second's worth of burst.
+    m_upload = TokenBucket(static_cast<double>(totalBytesPerSecond), static_cast<double>(totalBytesPerSecond));
+    m_uploadLimited = totalBytesPerSecond != 0;
+}
+
+TrafficStats P2PNetwork::Traffic() const
+{
+    TrafficStats stats;
+    for (size_t i = 0; i < m_meters->received.size(); ++i) {
+        TrafficCounters c;
+        c.messagesReceived = m_meters->received[i].messages.load(std::memory_order_relaxed);
+        c.bytesReceived = m_meters->received[i].bytes.load(std::memory_order_relaxed);
+        c.messagesSent = m_meters->sent[i].messages.load(std::memory_order_relaxed);
+        c.bytesSent = m_meters->sent[i].bytes.load(std::memory_order_relaxed);
+        if (!c.messagesReceived && !c.messagesSent) continue;
+        stats.total.messagesReceived += c.messagesReceived;
+        stats.total.bytesReceived += c.bytesReceived;
+        stats.total.messagesSent += c.messagesSent;
+        stats.total.bytesSent += c.bytesSent;
+        stats.byCommand[i < k_command_names.size() ? std::string(k_command_names[i]) : "other"] = c;
+    }
+    stats.rateLimited = m_meters->rateLimited;
+    stats.uploadWaits = m_meters->uploadWaits;
+    {
+        std::lock_guard<std::mutex> g(m_mutex);
+        stats.peerUploadLimit = m_peerUploadLimit;
+    }
+    std::lock_guard<std::mutex> ul(m_uploadMutex);
+    stats.totalUploadLimit = m_uploadLimited ? static_cast<uint64_t>(m_upload.Rate()) : 0;
+    return stats;
 }
 
 void P2PNetwork::Start()
 {
+    std::string addressFile;
+    {
+        std::lock_guard<std::mutex> g(m_mutex);
+        addressFile = m_addressFile;
+        m_started = true;
+        m_nextSave = std::chrono::steady_clock::now() + k_address_save_interval;
+    }
+    if (!addressFile.empty()) {
+        try {
+            m_addrman.Load(addressFile);
+        } catch (const std::exception&) {
+            // missing or damaged: start over
+        }
+    }
     LoadDNSSeeds();
     AcceptLoop();
-    ConnectSeeds();
+    MaintainConnections();
     ScheduleHeartbeat();
+    ScheduleTrickle();
 }
 
 void P2PNetwork::connect_to_peers()
 {
-    ConnectSeeds();
+    MaintainConnections();
 }
 
 void P2PNetwork::handle_incoming()
@@ -133,17 +519,23 @@ void P2PNetwork::handle_incoming()
 
 void P2PNetwork::Stop()
 {
+    SaveAddresses();
     m_stopped = true;
     std::lock_guard<std::mutex> g(m_mutex);
     boost::system::error_code ec;
     m_timer.cancel(ec);
     m_seedTimer.cancel(ec);
+    m_trickleTimer.cancel(ec);
     m_acceptor.close(ec);
     for (auto& kv : m_peers) {
         kv.second->socket.close(ec);
+        kv.second->registered = false;
     }
     m_peers.clear();
-    m_seenInventory.clear();
+    {
+        std::lock_guard<std::mutex> inv(m_inventoryMutex);
+        m_recentInventory.Reset();
+    }
     m_io.poll();
 }
 
@@ -156,33 +548,74 @@ uint16_t P2PNetwork::ListenPort() const
 
 void P2PNetwork::Broadcast(const Message& msg)
 {
+    const auto wire = Frame(msg);
     std::lock_guard<std::mutex> g(m_mutex);
-    for (auto& kv : m_peers) QueueMessage(kv.second, msg);
+    for (auto& kv : m_peers) QueueMessage(kv.second, wire);
 }
 
 void P2PNetwork::SendTo(const std::string& peerId, const Message& msg)
 {
     std::lock_guard<std::mutex> g(m_mutex);
     auto it = m_peers.find(peerId);
-    if (it != m_peers.end()) QueueMessage(it->second, msg);
+    if (it == m_peers.end()) return;
+    if (msg.command == "getblocktxn") ExpectBlocks(*it->second, 1);
+    QueueMessage(it->second, msg);
 }
 
 void P2PNetwork::AnnounceInventory(const std::vector<uint256>& txs, const std::vector<uint256>& blocks)
 {
+    for (const auto& h : txs) RelayTransaction(h);
+    if (blocks.empty()) return;
     std::lock_guard<std::mutex> g(m_mutex);
     for (auto& kv : m_peers) {
-        if (!txs.empty()) SendInv(kv.second, txs, /*type=*/0x01);
-        if (!blocks.empty()) SendInv(kv.second, blocks, /*type=*/0x02);
-        if (m_txProvider) {
-            for (const auto& h : txs) {
-                if (auto payload = m_txProvider(h)) {
-                    QueueMessage(kv.second, Message{"tx", *payload});
-                }
-            }
-        }
+        SendInv(kv.second, blocks, /*type=*/0x02);
+        for (const auto& h : blocks) kv.second->knownInventory.Insert(h);
+    }
+}
+
+void P2PNetwork::RelayTransaction(const uint256& txid)
+{
+    MarkSeen(txid);
+    std::lock_guard<std::mutex> g(m_mutex);
+    for (auto& kv : m_peers) {
+        auto& peer = *kv.second;
+        if (!peer.gotVersion || peer.knownInventory.Contains(txid) || !ApplyBloom(peer, txid)) continue;
+        if (peer.reconciling)
+            peer.reconSet.emplace(peer.ShortTxId(txid), txid);
+        else
+            peer.txToSend.insert(txid);
     }
 }
 
+void P2PNetwork::SetTrickleIntervals(std::chrono::milliseconds inbound, std::chrono::milliseconds outbound)
+{
+    std::lock_guard<std::mutex> g(m_mutex);
+    m_inboundTrickle = inbound;
+    m_outboundTrickle = outbound;
+}
+
+void P2PNetwork::EnableTxReconciliation(std::chrono::milliseconds interval)
+{
+    std::lock_guard<std::mutex> g(m_mutex);
+    if (!m_reconEnabled) m_reconSalt = m_rng();
+    m_reconEnabled = true;
+    m_reconInterval = interval;
+}
+
+void P2PNetwork::EnableV2Transport()
+{
+    m_v2Enabled = true;
+    m_localServices |= k_node_p2p_v2;
+}
+
+bool P2PNetwork::MarkSeen(const uint256& hash)
+{
+    std::lock_guard<std::mutex> g(m_inventoryMutex);
+    if (m_recentInventory.Contains(hash)) return false;
+    m_recentInventory.Insert(hash);
+    return true;
+}
+
 std::vector<PeerInfo> P2PNetwork::Peers() const
 {
     std::lock_guard<std::mutex> g(m_mutex);
@@ -194,68 +627,146 @@ std::vector<PeerInfo> P2PNetwork::Peers() const
 void P2PNetwork::AcceptLoop()
 {
     if (m_stopped) return;
-    auto peer = std::make_shared<PeerState>(m_io, PeerInfo{"", "", "", true});
+    auto peer = NewPeer(PeerInfo{"", "", "", true});
     m_acceptor.async_accept(peer->socket, [this, peer](const boost::system::error_code& ec) {
         if (m_stopped) return;
         if (!ec) {
             auto ep = peer->socket.remote_endpoint();
             peer->info.address = ep.address().to_string();
             peer->info.id = peer->info.address + ":" + std::to_string(ep.port());
-            if (IsBanned(peer->info.address)) { DropPeer(peer->info.id); return; }
-            RegisterPeer(peer);
-            SendVersion(peer);
-            ReadLoop(peer);
+            boost::asio::post(peer->strand, [this, peer] { StartPeer(peer); });
         }
         AcceptLoop();
     });
 }
 
-void P2PNetwork::ConnectSeeds()
+void P2PNetwork::MaintainConnections()
 {
     if (m_stopped) return;
-    std::vector<std::string> seeds;
-    std::unordered_set<std::string> connectedAddrs;
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<std::pair<std::string, ConnectionType>> dials;
+    bool save = false;
     {
         std::lock_guard<std::mutex> g(m_mutex);
-        seeds.assign(m_seedAddrs.begin(), m_seedAddrs.end());
         // Build hash set of connected addresses for O(1) lookup
+        std::unordered_set<std::string> connected;
+        std::unordered_set<std::string> outboundGroups;
+        size_t outbound = 0;
         for (const auto& kv : m_peers) {
-            if (kv.second) {
-                const auto& info = kv.second->info;
-                connectedAddrs.insert(info.seed_id.empty() ? info.id : info.seed_id);
+            const auto& peer = *kv.second;
+            connected.insert(peer.info.seed_id.empty() ? peer.info.id : peer.info.seed_id);
+            if (!peer.listenAddress.empty()) connected.insert(peer.listenAddress);
+            if (peer.type == ConnectionType::Outbound) {
+                ++outbound;
+                outboundGroups.insert(AddrMan::Group(peer.info.seed_id));
             }
         }
+        for (const auto& kv : m_pending) {
+            connected.insert(kv.first);
+            if (kv.second == ConnectionType::Outbound) {
+                ++outbound;
+                outboundGroups.insert(AddrMan::Group(kv.first));
+            }
+        }
+        auto usable = [&](const std::string& address) {
+            std::string host;
+            std::string port;
+            return !connected.count(address) && AddrMan::SplitHostPort(address, host, port) && !IsBannedLocked(host);
+        };
+
+        for (auto& kv : m_seedAddrs) {
+            if (connected.count(kv.first) || now < kv.second.next) continue;
+            kv.second.next = now + kv.second.delay;
+            kv.second.delay = std::min<std::chrono::milliseconds>(2 * kv.second.delay, k_max_redial);
+            dials.emplace_back(kv.first, ConnectionType::Manual);
+        }
+        if (m_maxOutbound > 0 && m_addrman.Size() == 0 && !m_dnsSeeds.empty()) {
+            std::vector<PeerAddress> seeds;
+            for (const auto& seed : m_dnsSeeds) seeds.push_back(PeerAddress{seed, k_node_network, AddrMan::Now()});
+            m_addrman.Add(seeds, "dnsseed");
+        }
+        for (int tries = 0; outbound < m_maxOutbound && tries < 100; ++tries) {
+            const auto addr = m_addrman.Select();
+            if (!addr) break;
+            const std::string group = AddrMan::Group(addr->address);
+            if (!usable(addr->address) || outboundGroups.count(group)) continue;
+            connected.insert(addr->address);
+            outboundGroups.insert(group);
+            ++outbound;
+            dials.emplace_back(addr->address, ConnectionType::Outbound);
+        }
+        if (m_maxOutbound > 0 && outbound >= m_maxOutbound && now >= m_nextFeeler) {
+            m_nextFeeler = now + m_feelerInterval;
+            for (int tries = 0; tries < 10; ++tries) {
+                const auto addr = m_addrman.Select(/*newOnly=*/true);
+                if (!addr) break;
+                if (!usable(addr->address)) continue;
+                dials.emplace_back(addr->address, ConnectionType::Feeler);
+                break;
+            }
+        }
+        for (const auto& dial : dials) m_pending[dial.first] = dial.second;
+        if (m_started && now >= m_nextSave) {
+            m_nextSave = now + k_address_save_interval;
+            save = true;
+        }
     }
-    for (const auto& addr : seeds) {
-        // Skip if already connected
-        if (connectedAddrs.count(addr)) continue;
-        
-        auto colon = addr.find(':');
-        if (colon == std::string::npos) continue;
-        auto host = addr.substr(0, colon);
-        auto port = addr.substr(colon + 1);
-        
-        auto peer = std::make_shared<PeerState>(m_io, PeerInfo{"", host, addr, false});
-        auto resolver = std::make_shared<tcp::resolver>(m_io);
-        resolver->async_resolve(host, port, [this, peer, resolver](const boost::system::error_code& ec, tcp::resolver::results_type res) {
-            if (m_stopped || ec) return;
-            boost::asio::async_connect(peer->socket, res, [this, peer, resolver](const boost::system::error_code& ec2, const tcp::endpoint& ep) {
-                if (m_stopped || ec2) return;
-                peer->info.address = ep.address().to_string();
-                peer->info.id = peer->info.address + ":" + std::to_string(ep.port());
-                if (IsBanned(peer->info.address)) { DropPeer(peer->info.id); return; }
-                RegisterPeer(peer);
-                SendVersion(peer);
-                ReadLoop(peer);
-            });
-        });
-    }
+    if (save) SaveAddresses();
+    for (const auto& dial : dials) Dial(dial.first, dial.second);
     m_seedTimer.expires_after(std::chrono::milliseconds(200));
     m_seedTimer.async_wait([this](const boost::system::error_code& ec) {
-        if (!ec && !m_stopped) ConnectSeeds();
+        if (!ec && !m_stopped) MaintainConnections();
+    });
+}
+
+void P2PNetwork::Dial(const std::string& address, ConnectionType type)
+{
+    auto peer = NewPeer(PeerInfo{"", "", address, false});
+    peer->type = type;
+    peer->dialed = std::chrono::steady_clock::now();
+    if (m_v2Enabled) {
+        const auto known = m_addrman.Find(address);
+        std::lock_guard<std::mutex> g(m_mutex);
+        // Manual peers get a v2 attempt first, others if they announce it.
+        const bool v2 = !m_v1Only.count(address) &&
+                        (type == ConnectionType::Manual || (known && (known->addr.services & k_node_p2p_v2)));
+        if (v2) peer->transport = Transport::V2Handshake;
+    }
+    std::string host;
+    std::string port;
+    if (!AddrMan::SplitHostPort(address, host, port)) { DialFailed(peer); return; }
+    peer->info.address = host;
+    m_addrman.Attempt(address);
+
+    auto resolver = std::make_shared<tcp::resolver>(peer->strand);
+    auto timeout = std::make_shared<boost::asio::steady_timer>(peer->strand, k_connect_timeout);
+    timeout->async_wait([peer, resolver](const boost::system::error_code& ec) {
+        if (ec) return; // finished in time
+        resolver->cancel();
+        boost::system::error_code ignored;
+        peer->socket.close(ignored);
+    });
+    resolver->async_resolve(host, port, [this, peer, resolver, timeout](const boost::system::error_code& ec, tcp::resolver::results_type res) {
+        if (m_stopped) return;
+        if (ec) { timeout->cancel(); DialFailed(peer); return; }
+        // Completes on the socket's strand.
+        boost::asio::async_connect(peer->socket, res, [this, peer, timeout](const boost::system::error_code& ec2, const tcp::endpoint& ep) {
+            timeout->cancel();
+            if (m_stopped) return;
+            if (ec2) { DialFailed(peer); return; }
+            peer->info.address = ep.address().to_string();
+            peer->info.id = peer->info.address + ":" + std::to_string(ep.port());
+            StartPeer(peer);
+        });
     });
 }
 
+void P2PNetwork::DialFailed(const std::shared_ptr<PeerState>& peer)
+{
+    std::lock_guard<std::mutex> g(m_mutex);
+    m_pending.erase(peer->info.seed_id);
+}
+
 void P2PNetwork::LoadDNSSeeds()
 {
     // mainnet preferred, fallback to testnet
@@ -264,8 +775,9 @@ void P2PNetwork::LoadDNSSeeds()
             boost::property_tree::ptree pt;
             read_json(path, pt);
             if (auto seeds = pt.get_child_optional("seeds")) {
+                std::lock_guard<std::mutex> g(m_mutex);
                 for (const auto& child : *seeds) {
-                    AddPeerAddress(child.second.get_value<std::string>());
+                    m_dnsSeeds.push_back(child.second.get_value<std::string>());
                 }
             }
             for (const auto& child : pt) {
@@ -273,7 +785,8 @@ void P2PNetwork::LoadDNSSeeds()
                 auto host = child.second.get<std::string>("host", "");
                 auto port = child.second.get<uint16_t>("port", 0);
                 if (!host.empty() && port != 0) {
-                    AddPeerAddress(host + ":" + std::to_string(port));
+                    std::lock_guard<std::mutex> g(m_mutex);
+                    m_dnsSeeds.push_back(host + ":" + std::to_string(port));
                 }
             }
         } catch (...) {
@@ -282,212 +795,813 @@ void P2PNetwork::LoadDNSSeeds()
     }
 }
 
+std::shared_ptr<P2PNetwork::PeerState> P2PNetwork::NewPeer(PeerInfo info)
+{
+    std::lock_guard<std::mutex> g(m_mutex);
+    auto peer = std::make_shared<PeerState>(m_io, m_processing, std::move(info));
+    if (m_peerUploadLimit)
+        peer->upload = TokenBucket(static_cast<double>(m_peerUploadLimit), static_cast<double>(m_peerUploadLimit));
+    return peer;
+}
+
+void P2PNetwork::StartPeer(const std::shared_ptr<PeerState>& peer)
+{
+    if (m_stopped) return;
+    if (IsBanned(peer->info.address)) {
+        if (!peer->info.inbound) DialFailed(peer);
+        return;
+    }
+    RegisterPeer(peer);
+    if (peer->info.inbound && m_v2Enabled) {
+        peer->transport = Transport::Detect;
+    } else if (peer->transport == Transport::V2Handshake) {
+        try {
+            peer->v2 = std::make_unique<V2Transport>(/*initiator=*/true, k_message_magic);
+        } catch (const std::runtime_error&) {
+            DropPeer(peer->info.id);
+            return;
+        }
+        auto key = std::make_shared<WireMessage>();
+        key->raw = true;
+        key->payload.assign(peer->v2->PublicKey().begin(), peer->v2->PublicKey().end());
+        Enqueue(peer, std::move(key));
+    }
+    SendVersion(peer);
+    ReadLoop(peer);
+}
+
 void P2PNetwork::RegisterPeer(const std::shared_ptr<PeerState>& peer)
 {
     std::lock_guard<std::mutex> g(m_mutex);
+    if (!peer->info.inbound) m_pending.erase(peer->info.seed_id);
     if (m_peers.size() >= m_maxPeers) {
         boost::system::error_code ec;
         peer->socket.close(ec);
         return;
     }
     m_peers[peer->info.id] = peer;
+    peer->registered = true;
     WriteLoop(peer);
 }
 
-void P2PNetwork::QueueMessage(const std::shared_ptr<PeerState>& peer, const Message& msg)
+SharedWireMessage P2PNetwork::Frame(Message msg, bool checksum)
 {
-    Message queued = msg;
-    boost::asio::post(m_io, [this, peer, queued = std::move(queued)]() mutable {
-        std::unique_lock<std::mutex> ql(peer->outboundMutex);
-        bool idle = peer->outbound.empty();
-        peer->outbound.push_back(std::move(queued));
-        ql.unlock();
-        if (idle) WriteLoop(peer);
-    });
-}
-
-void P2PNetwork::WriteLoop(const std::shared_ptr<PeerState>& peer)
-{
-    Message msg;
-    {
-        std::lock_guard<std::mutex> ql(peer->outboundMutex);
-        if (peer->outbound.empty()) return;
-        msg = peer->outbound.front();
-    }
-    uint32_t len = static_cast<uint32_t>(msg.payload.size());
-    std::array<uint8_t, 24> header{};
-    std::memcpy(header.data(), &k_message_magic, sizeof(uint32_t));
+    auto wire = std::make_shared<WireMessage>();
+    wire->payload = std::move(msg.payload);
+    const uint32_t len = static_cast<uint32_t>(wire->payload.size());
+    std::memcpy(wire->header.data(), &k_message_magic, sizeof(uint32_t));
     std::array<char, 12> cmdBuf;
     PadCommand(msg.command, cmdBuf);
-    std::memcpy(header.data() + 4, cmdBuf.data(), cmdBuf.size());
-    std::memcpy(header.data() + 16, &len, sizeof(len));
+    std::memcpy(wire->header.data() + 4, cmdBuf.data(), cmdBuf.size());
+    std::memcpy(wire->header.data() + 16, &len, sizeof(len));
+    if (!checksum) return wire;
     uint8_t checksumFull[32]{};
-    sha256d(checksumFull, msg.payload.empty() ? nullptr : msg.payload.data(), msg.payload.size());
-    std::memcpy(header.data() + 20, checksumFull, sizeof(uint32_t));
-    std::array<boost::asio::const_buffer, 2> bufs{
-        boost::asio::buffer(header),
-        boost::asio::buffer(msg.payload)
-    };
-    boost::asio::async_write(peer->socket, bufs, [this, peer](const boost::system::error_code& ec, std::size_t) {
-        if (m_stopped) return;
-        if (ec) { DropPeer(peer->info.id); return; }
-        bool hasMore{false};
-        {
-            std::lock_guard<std::mutex> ql(peer->outboundMutex);
-            if (!peer->outbound.empty()) peer->outbound.pop_front();
-            hasMore = !peer->outbound.empty();
-        }
-        if (hasMore) WriteLoop(peer);
-    });
-}
-
-void P2PNetwork::ReadLoop(const std::shared_ptr<PeerState>& peer)
-{
-    auto header = std::make_shared<std::array<uint8_t, 24>>();
-    boost::asio::async_read(peer->socket, boost::asio::buffer(*header), [this, peer, header](const boost::system::error_code& ec, std::size_t) {
-        if (m_stopped) return;
-        if (ec) { DropPeer(peer->info.id); return; }
-        uint32_t magic{0};
-        std::memcpy(&magic, header->data(), sizeof(magic));
-        if (magic != k_message_magic) { Ban(peer->info.address); DropPeer(peer->info.id); return; }
-        std::string cmd(reinterpret_cast<char*>(header->data() + 4), 12);
-        while (!cmd.empty() && cmd.back() == '\0') cmd.pop_back();
-        uint32_t len{0};
-        std::memcpy(&len, header->data() + 16, sizeof(len));
-        uint32_t checksum{0};
-        std::memcpy(&checksum, header->data() + 20, sizeof(checksum));
-        if (len > k_max_payload) { Ban(peer->info.address); DropPeer(peer->info.id); return; }
-        auto payload = std::make_shared<std::vector<uint8_t>>(len);
-        boost::asio::async_read(peer->socket, boost::asio::buffer(*payload), [this, peer, cmd, payload, checksum](const boost::system::error_code& ec2, std::size_t) {
-            if (m_stopped) return;
-            if (ec2) { DropPeer(peer->info.id); return; }
-            uint8_t verify[32]{};
-            sha256d(verify, payload->empty() ? nullptr : payload->data(), payload->size());
-            uint32_t calc{0};
-            std::memcpy(&calc, verify, sizeof(calc));
-            if (calc != checksum) { Ban(peer->info.address); DropPeer(peer->info.id); return; }
-            Message msg{cmd, std::move(*payload)};
-            if (!RateLimit(*peer)) { DropPeer(peer->info.id); return; }
-            if (msg.command == "ping") {
-                QueueMessage(peer, Message{"pong", msg.payload});
-            } else if (msg.command == "pong") {
-                // heartbeat reply
-            } else {
-                Dispatch(*peer, msg);
-            }
-            ReadLoop(peer);
-        });
-    });
+    sha256d(checksumFull, wire->payload.empty() ? nullptr : wire->payload.data(), wire->payload.size());
+    std::memcpy(wire->header.data() + 20, checksumFull, sizeof(uint32_t));
+    return wire;
 }
 
-void P2PNetwork::Dispatch(const PeerState& peer, const Message& msg)
+SharedWireMessage P2PNetwork::Seal(PeerState& peer, std::string_view command, const std::vector<uint8_t>& payload)
 {
-    std::shared_ptr<PeerState> self;
-    {
-        std::lock_guard<std::mutex> g(m_mutex);
-        auto it = m_peers.find(peer.info.id);
-        if (it != m_peers.end()) self = it->second;
-    }
-    if (self) {
-        HandleBuiltin(self, msg);
-    }
-    Handler h;
-    {
-        std::lock_guard<std::mutex> g(m_mutex);
-        auto it = m_handlers.find(msg.command);
-        if (it != m_handlers.end()) h = it->second;
-    }
-    if (h) h(peer.info, msg);
+    auto wire = std::make_shared<WireMessage>();
+    wire->raw = true;
+    wire->payload = peer.v2->Encrypt(command, payload.data(), payload.size());
+    return wire;
 }
 
-bool P2PNetwork::RateLimit(PeerState& peer)
+void P2PNetwork::QueueMessage(const std::shared_ptr<PeerState>& peer, Message msg)
 {
-    auto now = std::chrono::steady_clock::now();
-    if (now - peer.windowStart > std::chrono::minutes(1)) {
-        peer.windowStart = now;
-        peer.msgsThisMinute = 0;
-    }
-    peer.msgsThisMinute++;
-    if (peer.msgsThisMinute > m_maxMsgsPerMinute) peer.banScore = m_banThreshold + 1;
-    if (peer.banScore > m_banThreshold) {
-        Ban(peer.info.address);
-        return false;
-    }
-    return true;
+    boost::asio::post(peer->strand, [this, peer, msg = std::move(msg)]() mutable {
+        // v2 peers need no checksum.
+        if (peer->transport == Transport::V2)
+            Enqueue(peer, Frame(std::move(msg), /*checksum=*/false));
+        else
+            Transmit(peer, Frame(std::move(msg)));
+    });
 }
 
-void P2PNetwork::SendVersion(const std::shared_ptr<PeerState>& peer)
+void P2PNetwork::QueueMessage(const std::shared_ptr<PeerState>& peer, SharedWireMessage wire)
 {
-    const uint32_t version = 1;
-    std::string nodeId = peer->info.id.empty() ? "" : peer->info.id;
-    std::vector<uint8_t> payload;
-    payload.resize(sizeof(version) + sizeof(m_localHeight) + nodeId.size());
-    std::memcpy(payload.data(), &version, sizeof(version));
-    std::memcpy(payload.data() + sizeof(version), &m_localHeight, sizeof(m_localHeight));
-    std::memcpy(payload.data() + sizeof(version) + sizeof(m_localHeight), nodeId.data(), nodeId.size());
-    QueueMessage(peer, Message{"version", payload});
+    boost::asio::post(peer->strand, [this, peer, wire = std::move(wire)]() mutable { Transmit(peer, std::move(wire)); });
 }
 
-void P2PNetwork::CompleteHandshake(const std::shared_ptr<PeerState>& peer, uint32_t remoteHeight, const std::string& remoteId)
+void P2PNetwork::Transmit(const std::shared_ptr<PeerState>& peer, SharedWireMessage wire)
 {
-    (void)remoteHeight; // reserved for future sync logic
-    peer->gotVersion = true;
-    if (!peer->sentVerack) {
-        QueueMessage(peer, Message{"verack", {}});
-        peer->sentVerack = true;
+    const Transport transport = peer->transport;
+    if (transport == Transport::Detect || transport == Transport::V2Handshake) {
+        peer->held.push_back(std::move(wire));
+        return;
     }
+    Enqueue(peer, std::move(wire));
 }
 
-void P2PNetwork::DropPeer(const std::string& id)
+void P2PNetwork::Enqueue(const std::shared_ptr<PeerState>& peer, SharedWireMessage wire)
 {
-    std::lock_guard<std::mutex> g(m_mutex);
-    auto it = m_peers.find(id);
-    if (it != m_peers.end()) {
+    const size_t queue = Deferrable(*wire) ? 1 : 0;
+    std::unique_lock<std::mutex> ql(peer->outboundMutex);
+    // Urgent messages need not wait for the relay budget.
+    const bool wake = queue == 0 && peer->relayWaiting;
+    if (wake) peer->waiting = peer->relayWaiting = false;
+    const bool idle = !peer->writing && !peer->waiting;
+    peer->outboundBytes += wire->Size();
+    peer->outbound[queue].push_back(std::move(wire));
+    const bool overflow = peer->outboundBytes > k_max_send_buffer;
+    ql.unlock();
+    if (overflow) {
+        DropPeer(peer->info.id);
+        return;
+    }
+    if (wake) {
         boost::system::error_code ec;
-        it->second->socket.close(ec);
-        m_peers.erase(it);
+        peer->writeTimer.cancel(ec);
     }
+    if (idle) WriteLoop(peer);
 }
 
-void P2PNetwork::Ban(const std::string& address)
+void P2PNetwork::SettleTransport(const std::shared_ptr<PeerState>& peer, Transport transport)
 {
-    m_banned[address] = std::chrono::steady_clock::now() + m_banTime;
-    std::vector<std::string> toDrop;
-    for (const auto& kv : m_peers) {
-        if (kv.second && kv.second->info.address == address) {
-            toDrop.push_back(kv.first);
-        }
+    peer->transport = transport;
+    if (transport == Transport::V2) {
+        std::lock_guard<std::mutex> g(m_mutex);
+        peer->info.v2Transport = true;
     }
-    for (const auto& id : toDrop) DropPeer(id);
-}
-
-bool P2PNetwork::IsBanned(const std::string& address) const
-{
-    auto it = m_banned.find(address);
-    if (it == m_banned.end()) return false;
-    if (std::chrono::steady_clock::now() > it->second) return false;
-    return true;
+    auto held = std::move(peer->held);
+    peer->held.clear();
+    for (auto& wire : held) Transmit(peer, std::move(wire));
 }
 
-bool P2PNetwork::ApplyBloom(const PeerState& peer, const uint256& hash) const
+void P2PNetwork::WriteLoop(const std::shared_ptr<PeerState>& peer)
 {
-    if (peer.filter.Empty()) return true;
+    // Bytes the upload limits leave for urgent messages, and for relay; the
+    // last message taken may overdraw them.
+    const auto now = std::chrono::steady_clock::now();
+    double urgentRoom = std::numeric_limits<double>::infinity();
+    double relayRoom = urgentRoom;
+    if (peer->upload.Rate() > 0) urgentRoom = relayRoom = peer->upload.Level(now);
+    if (m_uploadLimited) {
+        std::lock_guard<std::mutex> ul(m_uploadMutex);
+        const double level = m_upload.Level(now);
+        urgentRoom = std::min(urgentRoom, level);
+        relayRoom = std::min(relayRoom, level - m_upload.Burst() / 2);
+    }
+    // The batch keeps the buffers alive until the write completes.
+    std::vector<SharedWireMessage> batch;
+    size_t queued{0};
+    bool urgentHeld{false};
+    {
+        std::lock_guard<std::mutex> ql(peer->outboundMutex);
+        if (peer->writing || peer->waiting) return;
+        auto take = [&](std::deque<SharedWireMessage>& queue, double room) {
+            while (!queue.empty() && batch.size() < k_max_write_batch && room >= static_cast<double>(queued)) {
+                queued += queue.front()->Size();
+                batch.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+        };
+        take(peer->outbound[0], urgentRoom);
+        take(peer->outbound[1], relayRoom);
+        if (batch.empty()) {
+            if (peer->outbound[0].empty() && peer->outbound[1].empty()) return;
+            urgentHeld = !peer->outbound[0].empty();
+            peer->waiting = true;
+            peer->relayWaiting = !urgentHeld;
+        } else {
+            peer->writing = true;
+        }
+    }
+    if (batch.empty()) {
+        auto wait = peer->upload.Rate() > 0 ? peer->upload.TimeUntil(0, now) : std::chrono::steady_clock::duration::zero();
+        if (m_uploadLimited) {
+            std::lock_guard<std::mutex> ul(m_uploadMutex);
+            wait = std::max(wait, m_upload.TimeUntil(urgentHeld ? 0 : m_upload.Burst() / 2, now));
+        }
+        ++m_meters->uploadWaits;
+        peer->writeTimer.expires_after(wait);
+        peer->writeTimer.async_wait([this, peer](const boost::system::error_code& ec) {
+            if (m_stopped || ec) return;
+            {
+                std::lock_guard<std::mutex> ql(peer->outboundMutex);
+                if (!peer->waiting) return; // Enqueue() took over
+                peer->waiting = peer->relayWaiting = false;
+            }
+            WriteLoop(peer);
+        });
+        return;
+    }
+    // v2 packets are sealed here, in the order they go out.
+    const bool v2 = peer->transport == Transport::V2;
+    std::vector<boost::asio::const_buffer> bufs;
+    bufs.reserve(batch.size() * 2);
+    size_t written{0};
+    for (auto& wire : batch) {
+        if (!wire->raw) {
+            const std::string_view command = HeaderCommand(*wire);
+            m_meters->sent[static_cast<size_t>(ParseCommand(command))].Add(wire->payload.size());
+            if (v2) wire = Seal(*peer, command, wire->payload);
+        }
+        if (!wire->raw) bufs.push_back(boost::asio::buffer(wire->header));
+        if (!wire->payload.empty()) bufs.push_back(boost::asio::buffer(wire->payload));
+        written += wire->Size();
+    }
+    if (peer->upload.Rate() > 0) peer->upload.Spend(static_cast<double>(written), now);
+    if (m_uploadLimited) {
+        std::lock_guard<std::mutex> ul(m_uploadMutex);
+        m_upload.Spend(static_cast<double>(written), now);
+    }
+    boost::asio::async_write(peer->socket, bufs, [this, peer, queued, batch = std::move(batch)](const boost::system::error_code& ec, std::size_t) {
+        if (m_stopped) return;
+        if (ec) { DropPeer(peer->info.id); return; }
+        {
+            std::lock_guard<std::mutex> ql(peer->outboundMutex);
+            peer->outboundBytes -= queued;
+            peer->writing = false;
+        }
+        WriteLoop(peer);
+        ResumeReading(peer);
+    });
+}
+
+void P2PNetwork::ReadLoop(const std::shared_ptr<PeerState>& peer)
+{
+    if (m_stopped) return;
+    if (peer->recv.empty()) peer->recv.resize(k_recv_buffer);
+    if (!(peer->transport == Transport::V1 ? ParseV1(peer) : ParseV2(peer))) return;
+    // Keep the partial message at the front so the free space is contiguous.
+    if (peer->recvStart > 0) {
+        std::memmove(peer->recv.data(), peer->recv.data() + peer->recvStart, peer->recvEnd - peer->recvStart);
+        peer->recvEnd -= peer->recvStart;
+        peer->recvStart = 0;
+    }
+    peer->socket.async_read_some(
+        boost::asio::buffer(peer->recv.data() + peer->recvEnd, peer->recv.size() - peer->recvEnd),
+        [this, peer](const boost::system::error_code& ec, std::size_t n) {
+            if (m_stopped) return;
+            if (ec) { DropPeer(peer->info.id); return; }
+            peer->recvEnd += n;
+            ReadLoop(peer);
+        });
+}
+
+bool P2PNetwork::ParseV1(const std::shared_ptr<PeerState>& peer)
+{
+    while (peer->recvEnd - peer->recvStart >= k_header_bytes) {
+        const uint8_t* header = peer->recv.data() + peer->recvStart;
+        uint32_t magic{0};
+        std::memcpy(&magic, header, sizeof(magic));
+        const auto* cmdBytes = reinterpret_cast<const char*>(header + 4);
+        const std::string_view command(cmdBytes, std::find(cmdBytes, cmdBytes + 12, '\0') - cmdBytes);
+        uint32_t len{0};
+        std::memcpy(&len, header + 16, sizeof(len));
+        uint32_t checksum{0};
+        std::memcpy(&checksum, header + 20, sizeof(checksum));
+        if (magic != k_message_magic || len > k_max_payload) {
+            // Opening in another transport (a v2 key) is not misbehaviour.
+            if (peer->heard) Ban(peer->info.address);
+            DropPeer(peer->info.id);
+            return false;
+        }
+        peer->heard = true;
+        if (peer->recvEnd - peer->recvStart - k_header_bytes < len) {
+            if (k_header_bytes + len <= peer->recv.size()) break; // the rest is on its way
+            ReadLargePayload(peer, std::string(command), checksum, len);
+            return false;
+        }
+        auto payload = m_buffers.Acquire(len);
+        if (len) std::memcpy(payload.data(), header + k_header_bytes, len);
+        peer->recvStart += k_header_bytes + len;
+        if (!ChecksumMatches(payload, checksum)) { Ban(peer->info.address); DropPeer(peer->info.id); return false; }
+        if (!ReceiveMessage(peer, command, std::move(payload))) return false;
+    }
+    return true;
+}
+
+bool P2PNetwork::ParseV2(const std::shared_ptr<PeerState>& peer)
+{
+    auto available = [&] { return peer->recvEnd - peer->recvStart; };
+    if (peer->transport == Transport::Detect) {
+        if (available() < sizeof(k_message_magic)) return true;
+        if (std::memcmp(peer->recv.data() + peer->recvStart, &k_message_magic, sizeof(k_message_magic)) == 0) {
+            SettleTransport(peer, Transport::V1);
+            return ParseV1(peer);
+        }
+        try {
+            peer->v2 = std::make_unique<V2Transport>(/*initiator=*/false, k_message_magic);
+        } catch (const std::runtime_error&) {
+            DropPeer(peer->info.id);
+            return false;
+        }
+        auto key = std::make_shared<WireMessage>();
+        key->raw = true;
+        key->payload.assign(peer->v2->PublicKey().begin(), peer->v2->PublicKey().end());
+        Enqueue(peer, std::move(key));
+        peer->transport = Transport::V2Handshake;
+    }
+    if (peer->transport == Transport::V2Handshake) {
+        if (available() < V2Transport::k_key_bytes) return true;
+        const uint8_t* key = peer->recv.data() + peer->recvStart;
+        // A v1 version message means we dialed a v1 node; DropPeer() notes that.
+        bool ok = std::memcmp(key, &k_message_magic, sizeof(k_message_magic)) != 0;
+        try {
+            if (ok) peer->v2->Complete(key);
+        } catch (const std::runtime_error&) {
+            ok = false;
+        }
+        if (!ok) { DropPeer(peer->info.id); return false; }
+        peer->recvStart += V2Transport::k_key_bytes;
+        peer->heard = true;
+        SettleTransport(peer, Transport::V2);
+    }
+    while (available() >= V2Transport::k_length_bytes) {
+        const uint8_t* packet = peer->recv.data() + peer->recvStart;
+        const uint32_t length = peer->v2->DecryptLength(packet);
+        if (length > k_max_v2_head + k_max_payload) { Ban(peer->info.address); DropPeer(peer->info.id); return false; }
+        const size_t size = V2Transport::k_overhead + length;
+        if (available() < size) {
+            if (size <= peer->recv.size()) break; // the rest is on its way
+            ReadLargePacket(peer, length);
+            return false;
+        }
+        peer->recvStart += size;
+        if (!ReceivePacket(peer, packet, length)) return false;
+    }
+    return true;
+}
+
+void P2PNetwork::ReadLargePayload(const std::shared_ptr<PeerState>& peer, std::string command, uint32_t checksum,
+                                  uint32_t length)
+{
+    auto payload = std::make_shared<std::vector<uint8_t>>(m_buffers.Acquire(length));
+    const size_t have = peer->recvEnd - peer->recvStart - k_header_bytes;
+    std::memcpy(payload->data(), peer->recv.data() + peer->recvStart + k_header_bytes, have);
+    peer->recvStart = peer->recvEnd = 0;
+    boost::asio::async_read(peer->socket, boost::asio::buffer(payload->data() + have, length - have),
+                            [this, peer, command = std::move(command), checksum, payload](const boost::system::error_code& ec, std::size_t) {
+        if (m_stopped) return;
+        if (ec) { DropPeer(peer->info.id); return; }
+        if (!ChecksumMatches(*payload, checksum)) { Ban(peer->info.address); DropPeer(peer->info.id); return; }
+        if (ReceiveMessage(peer, command, std::move(*payload))) ReadLoop(peer);
+    });
+}
+
+void P2PNetwork::ReadLargePacket(const std::shared_ptr<PeerState>& peer, uint32_t length)
+{
+    auto packet = std::make_shared<std::vector<uint8_t>>(m_buffers.Acquire(V2Transport::k_overhead + length));
+    const size_t have = peer->recvEnd - peer->recvStart;
+    std::memcpy(packet->data(), peer->recv.data() + peer->recvStart, have);
+    peer->recvStart = peer->recvEnd = 0;
+    boost::asio::async_read(peer->socket, boost::asio::buffer(packet->data() + have, packet->size() - have),
+                            [this, peer, length, packet](const boost::system::error_code& ec, std::size_t) {
+        if (m_stopped) return;
+        if (ec) { DropPeer(peer->info.id); return; }
+        const bool more = ReceivePacket(peer, packet->data(), length);
+        m_buffers.Release(std::move(*packet));
+        if (more) ReadLoop(peer);
+    });
+}
+
+bool P2PNetwork::ReceivePacket(const std::shared_ptr<PeerState>& peer, const uint8_t* packet, uint32_t length)
+{
+    std::string command;
+    auto payload = m_buffers.Acquire(length);
+    bool ignore{false};
+    if (!peer->v2->Decrypt(packet, length, command, payload, ignore)) {
+        Ban(peer->info.address);
+        DropPeer(peer->info.id);
+        return false;
+    }
+    if (ignore) {
+        m_buffers.Release(std::move(payload));
+        return true;
+    }
+    return ReceiveMessage(peer, command, std::move(payload));
+}
+
+bool P2PNetwork::ReceiveMessage(const std::shared_ptr<PeerState>& peer, std::string_view command,
+                                std::vector<uint8_t>&& payload)
+{
+    const Command cmd = ParseCommand(command);
+    m_meters->received[static_cast<size_t>(cmd)].Add(payload.size());
+    if (!RateLimit(*peer, cmd, payload.size())) { DropPeer(peer->info.id); return false; }
+    if (cmd == Command::Ping) {
+        QueueMessage(peer, Message{"pong", std::move(payload)});
+    } else if (cmd == Command::Pong) {
+        m_buffers.Release(std::move(payload)); // heartbeat reply
+    } else {
+        const size_t size = k_header_bytes + payload.size();
+        {
+            std::lock_guard<std::mutex> ql(peer->outboundMutex);
+            peer->processingBytes += size;
+        }
+        boost::asio::post(peer->processor, [this, peer, cmd, size, msg = Message{std::string(command), std::move(payload)}]() mutable {
+            if (m_stopped) return;
+            Dispatch(peer, cmd, msg);
+            m_buffers.Release(std::move(msg.payload));
+            {
+                std::lock_guard<std::mutex> ql(peer->outboundMutex);
+                peer->processingBytes -= size;
+            }
+            ResumeReading(peer);
+        });
+    }
+    // Answers to this peer are still queued, or its messages are: hear more
+    // once they have gone.
+    std::lock_guard<std::mutex> ql(peer->outboundMutex);
+    if (peer->Congested()) {
+        peer->readPaused = true;
+        return false;
+    }
+    return true;
+}
+
+void P2PNetwork::ResumeReading(const std::shared_ptr<PeerState>& peer)
+{
+    {
+        std::lock_guard<std::mutex> ql(peer->outboundMutex);
+        if (!peer->readPaused || peer->Congested()) return;
+        peer->readPaused = false;
+    }
+    boost::asio::dispatch(peer->strand, [this, peer] { ReadLoop(peer); });
+}
+
+P2PNetwork::Command P2PNetwork::ParseCommand(std::string_view command)
+{
+    for (size_t i = 0; i < k_command_names.size(); ++i)
+        if (k_command_names[i] == command) return static_cast<Command>(i);
+    return Command::Unknown;
+}
+
+void P2PNetwork::Dispatch(const std::shared_ptr<PeerState>& peer, Command cmd, const Message& msg)
+{
+    if (peer->registered) HandleBuiltin(peer, cmd, msg);
+    const auto handlers = std::atomic_load(&m_handlerTable);
+    if (const Handler* h = handlers->Find(cmd, msg.command)) (*h)(peer->info, msg);
+}
+
+bool P2PNetwork::RateLimit(PeerState& peer, Command cmd, size_t size)
+{
+    const auto index = static_cast<size_t>(cmd);
+    if (cmd == Command::Block || cmd == Command::CmpctBlock || cmd == Command::BlockTxn) {
+        // The answer to a request of ours was paid for by asking.
+        uint32_t asked = peer.blocksAsked;
+        while (asked > 0 && !peer.blocksAsked.compare_exchange_weak(asked, asked - 1)) {
+        }
+        if (asked > 0) return true;
+    }
+    const double cost = k_message_budgets[index].weight + static_cast<double>(size) / k_cost_unit_bytes;
+    if (!peer.budgets[index].Take(cost, std::chrono::steady_clock::now())) {
+        ++m_meters->rateLimited;
+        peer.banScore = k_ban_threshold + 1;
+    }
+    if (peer.banScore > k_ban_threshold) {
+        Ban(peer.info.address);
+        return false;
+    }
+    return true;
+}
+
+void P2PNetwork::SendVersion(const std::shared_ptr<PeerState>& peer)
+{
+    const uint32_t version = k_protocol_version;
+    const uint32_t height = m_localHeight;
+    const std::string& nodeId = m_nodeId;
+    std::vector<uint8_t> payload;
+    payload.resize(sizeof(version) + sizeof(height) + sizeof(m_localServices) + nodeId.size());
+    std::memcpy(payload.data(), &version, sizeof(version));
+    std::memcpy(payload.data() + sizeof(version), &height, sizeof(height));
+    std::memcpy(payload.data() + sizeof(version) + sizeof(height), &m_localServices, sizeof(m_localServices));
+    std::memcpy(payload.data() + sizeof(version) + sizeof(height) + sizeof(m_localServices), nodeId.data(),
+                nodeId.size());
+    QueueMessage(peer, Message{"version", std::move(payload)});
+}
+
+void P2PNetwork::CompleteHandshake(const std::shared_ptr<PeerState>& peer, uint32_t remoteHeight, const std::string& remoteId)
+{
+    const auto latency =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - peer->dialed).count();
+    // Remember its services, k_node_p2p_v2 among them, for the next dial.
+    if (!peer->info.inbound)
+        m_addrman.Add({PeerAddress{peer->info.seed_id, peer->info.services, AddrMan::Now()}}, peer->info.address);
+    if (peer->type == ConnectionType::Feeler) {
+        // It answered, which is all a feeler asks.
+        m_addrman.Good(peer->info.seed_id, latency);
+        DropPeer(peer->info.id);
+        return;
+    }
+    bool first{false};
+    std::optional<uint64_t> reconSalt;
+    {
+        std::lock_guard<std::mutex> g(m_mutex);
+        first = !peer->gotVersion;
+        peer->info.startHeight = remoteHeight;
+        peer->gotVersion = true;
+        if (m_reconEnabled) reconSalt = m_reconSalt;
+        auto redial = m_seedAddrs.find(peer->info.seed_id);
+        if (redial != m_seedAddrs.end()) redial->second.delay = Redial{}.delay;
+    }
+    if (!peer->sentVerack) {
+        QueueMessage(peer, Message{"verack", {}});
+        peer->sentVerack = true;
+    }
+    const auto callbacks = std::atomic_load(&m_callbacks);
+    if (first && callbacks->compactProvider) QueueMessage(peer, SendCmpctMessage(false));
+    if (first && reconSalt) QueueMessage(peer, SendTxRcnclMessage(*reconSalt));
+    if (first && !peer->info.inbound) {
+        m_addrman.Good(peer->info.seed_id, latency);
+        // Where we listen, for the peer to pass on, then what it knows.
+        QueueMessage(peer, AddrMessage({PeerAddress{":" + std::to_string(ListenPort()), m_localServices, AddrMan::Now()}}));
+        QueueMessage(peer, Message{"getaddr", {}});
+    }
+    if (first && callbacks->peerConnected) callbacks->peerConnected(peer->info);
+}
+
+void P2PNetwork::DropPeer(const std::string& id)
+{
+    std::shared_ptr<PeerState> peer;
+    std::optional<PeerInfo> dropped;
+    {
+        std::lock_guard<std::mutex> g(m_mutex);
+        auto it = m_peers.find(id);
+        if (it != m_peers.end()) {
+            peer = it->second;
+            peer->registered = false;
+            if (peer->gotVersion) dropped = peer->info;
+            // Cut off before the keys were exchanged: the peer may not speak v2.
+            if (!peer->info.inbound && peer->transport == Transport::V2Handshake) m_v1Only.insert(peer->info.seed_id);
+            m_peers.erase(it);
+        }
+    }
+    if (dropped && !peer->info.inbound) m_addrman.Connected(peer->info.seed_id);
+    // The socket is only touched on its strand.
+    if (peer) {
+        boost::asio::dispatch(peer->strand, [peer] {
+            boost::system::error_code ec;
+            peer->writeTimer.cancel(ec);
+            peer->socket.close(ec);
+        });
+    }
+    const auto callbacks = std::atomic_load(&m_callbacks);
+    if (dropped && callbacks->peerDisconnected) callbacks->peerDisconnected(*dropped);
+}
+
+void P2PNetwork::Ban(const std::string& address)
+{
+    std::vector<std::string> toDrop;
+    {
+        std::lock_guard<std::mutex> g(m_mutex);
+        m_banned[address] = std::chrono::steady_clock::now() + m_banTime;
+        for (const auto& kv : m_peers) {
+            if (kv.second && kv.second->info.address == address) {
+                toDrop.push_back(kv.first);
+            }
+        }
+    }
+    for (const auto& id : toDrop) DropPeer(id);
+}
+
+bool P2PNetwork::IsBanned(const std::string& address) const
+{
+    std::lock_guard<std::mutex> g(m_mutex);
+    return IsBannedLocked(address);
+}
+
+bool P2PNetwork::IsBannedLocked(const std::string& address) const
+{
+    auto it = m_banned.find(address);
+    if (it == m_banned.end()) return false;
+    if (std::chrono::steady_clock::now() > it->second) return false;
+    return true;
+}
+
+bool P2PNetwork::ApplyBloom(const PeerState& peer, const uint256& hash) const
+{
+    if (peer.filter.Empty()) return true;
     return peer.filter.Match(hash);
 }
 
-void P2PNetwork::HandleBuiltin(const std::shared_ptr<PeerState>& peer, const Message& msg)
+std::vector<FilterRecord> P2PNetwork::CollectFilters(uint32_t start, const uint256& stopHash, size_t max) const
 {
-    if (msg.command == "version") {
+    std::vector<FilterRecord> out;
+    const auto callbacks = std::atomic_load(&m_callbacks);
+    if (!callbacks->filterProvider) return out;
+    for (uint32_t h = start; out.size() < max; ++h) {
+        auto record = callbacks->filterProvider(h);
+        if (!record) break;
+        const bool last = record->blockHash == stopHash;
+        out.push_back(std::move(*record));
+        if (last) return out;
+        if (h == std::numeric_limits<uint32_t>::max()) break;
+    }
+    return {};
+}
+
+void P2PNetwork::ServeFilters(const std::shared_ptr<PeerState>& peer, const Message& msg)
+{
+    if (msg.payload.size() != 1 + sizeof(uint32_t) + 32) {
+        peer->banScore += 10;
+        return;
+    }
+    const uint8_t type = msg.payload[0];
+    if (type != k_basic_filter) return;
+    uint32_t start{0};
+    std::memcpy(&start, msg.payload.data() + 1, sizeof(start));
+    uint256 stopHash{};
+    std::copy(msg.payload.begin() + 5, msg.payload.end(), stopHash.begin());
+
+    if (msg.command == "getcfilters") {
+        for (const auto& record : CollectFilters(start, stopHash, k_max_cfilters)) {
+            std::vector<uint8_t> payload;
+            payload.reserve(1 + record.blockHash.size() + record.filter.size());
+            payload.push_back(type);
+            payload.insert(payload.end(), record.blockHash.begin(), record.blockHash.end());
+            payload.insert(payload.end(), record.filter.begin(), record.filter.end());
+            SendPayload(peer, "cfilter", payload);
+        }
+        return;
+    }
+
+    const auto records = CollectFilters(start, stopHash, k_max_cfheaders);
+    if (records.empty()) return;
+    uint256 prevHeader{};
+    if (start > 0) {
+        const auto callbacks = std::atomic_load(&m_callbacks);
+        auto prev = callbacks->filterProvider ? callbacks->filterProvider(start - 1) : std::nullopt;
+        if (!prev) return;
+        prevHeader = prev->header;
+    }
+    const uint32_t count = static_cast<uint32_t>(records.size());
+    std::vector<uint8_t> payload;
+    payload.reserve(1 + 64 + sizeof(count) + records.size() * 32);
+    payload.push_back(type);
+    payload.insert(payload.end(), stopHash.begin(), stopHash.end());
+    payload.insert(payload.end(), prevHeader.begin(), prevHeader.end());
+    payload.insert(payload.end(), reinterpret_cast<const uint8_t*>(&count), reinterpret_cast<const uint8_t*>(&count) + sizeof(count));
+    for (const auto& record : records)
+        payload.insert(payload.end(), record.filterHash.begin(), record.filterHash.end());
+    SendPayload(peer, "cfheaders", payload);
+}
+
+void P2PNetwork::ServeHeaders(const std::shared_ptr<PeerState>& peer, const Message& msg)
+{
+    uint32_t count{0};
+    if (msg.payload.size() >= sizeof(count)) std::memcpy(&count, msg.payload.data(), sizeof(count));
+    if (msg.payload.size() < sizeof(count) || count > k_max_locator ||
+        msg.payload.size() != sizeof(count) + (static_cast<size_t>(count) + 1) * 32) {
+        peer->banScore += 10;
+        return;
+    }
+    const auto callbacks = std::atomic_load(&m_callbacks);
+    if (!callbacks->headersProvider) return;
+    std::vector<uint256> locator(count);
+    size_t off = sizeof(count);
+    for (auto& h : locator) {
+        std::copy_n(msg.payload.begin() + off, h.size(), h.begin());
+        off += h.size();
+    }
+    uint256 stop{};
+    std::copy_n(msg.payload.begin() + off, stop.size(), stop.begin());
+
+    const auto headers = callbacks->headersProvider(locator, stop, k_max_headers);
+    const uint32_t n = static_cast<uint32_t>(std::min(headers.size(), k_max_headers));
+    std::vector<uint8_t> payload(sizeof(n) + n * sizeof(BlockHeader));
+    std::memcpy(payload.data(), &n, sizeof(n));
+    for (uint32_t i = 0; i < n; ++i)
+        std::memcpy(payload.data() + sizeof(n) + i * sizeof(BlockHeader), &headers[i], sizeof(BlockHeader));
+    SendPayload(peer, "headers", payload);
+}
+
+void P2PNetwork::ReceiveHeaders(const std::shared_ptr<PeerState>& peer, const Message& msg)
+{
+    uint32_t count{0};
+    if (msg.payload.size() >= sizeof(count)) std::memcpy(&count, msg.payload.data(), sizeof(count));
+    if (msg.payload.size() < sizeof(count) || count > k_max_headers ||
+        msg.payload.size() != sizeof(count) + static_cast<size_t>(count) * sizeof(BlockHeader)) {
+        peer->banScore += 10;
+        return;
+    }
+    const auto callbacks = std::atomic_load(&m_callbacks);
+    if (!callbacks->headersHandler) return;
+    std::vector<BlockHeader> headers(count);
+    for (uint32_t i = 0; i < count; ++i)
+        std::memcpy(&headers[i], msg.payload.data() + sizeof(count) + i * sizeof(BlockHeader), sizeof(BlockHeader));
+    callbacks->headersHandler(peer->info, headers);
+}
+
+void P2PNetwork::ReceiveAddr(const std::shared_ptr<PeerState>& peer, const Message& msg)
+{
+    std::vector<PeerAddress> addrs;
+    if (!ParseAddrMessage(msg.payload, addrs)) {
+        peer->banScore += 20;
+        return;
+    }
+    if (!peer->gotVersion) return;
+    const int64_t now = AddrMan::Now();
+    std::vector<PeerAddress> heard;
+    std::vector<PeerAddress> relay;
+    for (auto& a : addrs) {
+        if (!a.address.empty() && a.address.front() == ':') {
+            // The sender's own listening address, at the host we see it as.
+            a.address = DialHost(peer->info.address) + a.address;
+            a.time = now;
+            {
+                std::lock_guard<std::mutex> g(m_mutex);
+                peer->listenAddress = a.address;
+            }
+            m_addrman.Add({a}, peer->info.address);
+        } else {
+            if (a.time > now + 10 * 60) a.time = now - 5 * 24 * 3600; // clock from the future: not recent
+            heard.push_back(a);
+        }
+        if (addrs.size() <= 10 && a.time > now - 10 * 60) relay.push_back(a);
+    }
+    // Second-hand addresses count as two hours older.
+    m_addrman.Add(heard, peer->info.address, /*penalty=*/2 * 3600);
+    if (relay.empty()) return;
+
+    std::lock_guard<std::mutex> g(m_mutex);
+    std::vector<std::shared_ptr<PeerState>> targets;
+    for (const auto& kv : m_peers) {
+        if (kv.second != peer && kv.second->gotVersion && kv.second->type != ConnectionType::Feeler)
+            targets.push_back(kv.second);
+    }
+    std::shuffle(targets.begin(), targets.end(), m_rng);
+    if (targets.size() > 2) targets.resize(2);
+    auto key = [](const PeerAddress& a) {
+        return tagged_hash("DRM/addr", reinterpret_cast<const uint8_t*>(a.address.data()), a.address.size());
+    };
+    for (const auto& a : relay) peer->knownInventory.Insert(key(a));
+    for (const auto& target : targets) {
+        std::vector<PeerAddress> batch;
+        for (const auto& a : relay) {
+            if (a.address == target->listenAddress || target->knownInventory.Contains(key(a))) continue;
+            target->knownInventory.Insert(key(a));
+            batch.push_back(a);
+        }
+        if (!batch.empty()) QueueMessage(target, AddrMessage(batch));
+    }
+}
+
+void P2PNetwork::ServeAddr(const std::shared_ptr<PeerState>& peer)
+{
+    if (peer->sentAddr) return; // once per connection, so it cannot scrape the table
+    peer->sentAddr = true;
+    auto addrs = m_addrman.GetAddr(k_max_addr, /*maxPercent=*/23);
+    std::string own;
+    {
+        std::lock_guard<std::mutex> g(m_mutex);
+        own = peer->listenAddress;
+    }
+    addrs.erase(std::remove_if(addrs.begin(), addrs.end(),
+                               [&](const PeerAddress& a) { return a.address == own || a.address == peer->info.seed_id; }),
+                addrs.end());
+    QueueMessage(peer, AddrMessage(addrs));
+}
+
+void P2PNetwork::SaveAddresses()
+{
+    std::string path;
+    {
+        std::lock_guard<std::mutex> g(m_mutex);
+        if (!m_started) return; // nothing loaded that could be overwritten
+        path = m_addressFile;
+    }
+    if (path.empty()) return;
+    try {
+        m_addrman.Save(path);
+    } catch (const std::exception&) {
+        // best effort; tried again at the next interval
+    }
+}
+
+void P2PNetwork::HandleBuiltin(const std::shared_ptr<PeerState>& peer, Command cmd, const Message& msg)
+{
+    if (cmd == Command::Version) {
         if (msg.payload.size() >= 8) {
             uint32_t version{0};
             uint32_t height{0};
             std::memcpy(&version, msg.payload.data(), sizeof(version));
             std::memcpy(&height, msg.payload.data() + sizeof(version), sizeof(height));
+            if (version == 0) { Ban(peer->info.address); DropPeer(peer->info.id); return; }
+            size_t idOffset = 8;
+            uint64_t services = k_node_network | k_node_network_limited;
+            if (version >= 2) {
+                if (msg.payload.size() < 16) { Ban(peer->info.address); DropPeer(peer->info.id); return; }
+                std::memcpy(&services, msg.payload.data() + 8, sizeof(services));
+                idOffset = 16;
+            }
+            {
+                std::lock_guard<std::mutex> g(m_mutex);
+                peer->info.services = services;
+            }
             std::string remoteId;
-            if (msg.payload.size() > 8) {
-                remoteId.assign(reinterpret_cast<const char*>(msg.payload.data() + 8), msg.payload.size() - 8);
+            if (msg.payload.size() > idOffset) {
+                remoteId.assign(reinterpret_cast<const char*>(msg.payload.data() + idOffset), msg.payload.size() - idOffset);
+            }
+            if (remoteId == m_nodeId) {
+                // We reached ourselves through an address someone passed on.
+                if (!peer->info.inbound) m_addrman.Remove(peer->info.seed_id);
+                DropPeer(peer->info.id);
+                return;
             }
-            if (version == 0) { Ban(peer->info.address); DropPeer(peer->info.id); return; }
             CompleteHandshake(peer, height, remoteId);
         } else {
             Ban(peer->info.address);
@@ -495,9 +1609,9 @@ void P2PNetwork::HandleBuiltin(const std::shared_ptr<PeerState>& peer, const Mes
             return;
         }
         QueueMessage(peer, Message{"verack", {}});
-    } else if (msg.command == "verack") {
+    } else if (cmd == Command::Verack) {
         peer->sentVerack = true;
-    } else if (msg.command == "filterload") {
+    } else if (cmd == Command::FilterLoad) {
         // payload: [nHashFuncs(4)][tweak(4)][data...]
         if (msg.payload.size() >= 8) {
             BloomFilter bf;
@@ -505,9 +1619,11 @@ void P2PNetwork::HandleBuiltin(const std::shared_ptr<PeerState>& peer, const Mes
             std::memcpy(&bf.tweak, msg.payload.data() + 4, sizeof(bf.tweak));
             bf.bits.assign(msg.payload.begin() + 8, msg.payload.end());
             bf.full = false;
+            std::lock_guard<std::mutex> g(m_mutex);
             peer->filter = std::move(bf);
         }
-    } else if (msg.command == "filteradd") {
+    } else if (cmd == Command::FilterAdd) {
+        std::lock_guard<std::mutex> g(m_mutex);
         if (peer->filter.Empty()) return;
         if (msg.payload.size() >= 32) {
             uint256 h{};
@@ -524,9 +1640,36 @@ void P2PNetwork::HandleBuiltin(const std::shared_ptr<PeerState>& peer, const Mes
                 peer->filter.bits[bit / 8] |= (1u << (bit % 8));
             }
         }
-    } else if (msg.command == "filterclear") {
+    } else if (cmd == Command::FilterClear) {
+        std::lock_guard<std::mutex> g(m_mutex);
         peer->filter = BloomFilter{};
-    } else if (msg.command == "inv") {
+    } else if (cmd == Command::GetCFilters || cmd == Command::GetCFHeaders) {
+        ServeFilters(peer, msg);
+    } else if (cmd == Command::SendCmpct) {
+        uint64_t version = 0;
+        if (msg.payload.size() != 1 + sizeof(version)) { peer->banScore += 10; return; }
+        std::memcpy(&version, msg.payload.data() + 1, sizeof(version));
+        if (version != k_compact_version) return;
+        std::lock_guard<std::mutex> g(m_mutex);
+        peer->compactBlocks = true;
+        peer->compactHighBandwidth = msg.payload[0] != 0;
+    } else if (cmd == Command::SendTxRcncl) {
+        ReceiveSendTxRcncl(peer, msg);
+    } else if (cmd == Command::ReqRecon) {
+        ServeSketch(peer, msg);
+    } else if (cmd == Command::Sketch) {
+        ReceiveSketch(peer, msg);
+    } else if (cmd == Command::ReconcilDiff) {
+        ReceiveReconcilDiff(peer, msg);
+    } else if (cmd == Command::GetAddr) {
+        ServeAddr(peer);
+    } else if (cmd == Command::Addr) {
+        ReceiveAddr(peer, msg);
+    } else if (cmd == Command::GetHeaders) {
+        ServeHeaders(peer, msg);
+    } else if (cmd == Command::Headers) {
+        ReceiveHeaders(peer, msg);
+    } else if (cmd == Command::Inv) {
         std::vector<uint256> invs;
         uint8_t type = 0x01;
         size_t stride = (msg.payload.size() % 33 == 0) ? 33 : 32;
@@ -534,13 +1677,19 @@ void P2PNetwork::HandleBuiltin(const std::shared_ptr<PeerState>& peer, const Mes
             uint256 h{};
             if (stride == 33) type = msg.payload[i];
             std::copy(msg.payload.begin() + i + (stride - 32), msg.payload.begin() + i + stride, h.begin());
+            bool wanted = false;
             {
                 std::lock_guard<std::mutex> g(m_mutex);
-                if (ApplyBloom(*peer, h) && m_seenInventory.insert(h).second) invs.push_back(h);
+                peer->knownInventory.Insert(h);
+                peer->Forget(h);
+                wanted = ApplyBloom(*peer, h);
             }
+            if (wanted && MarkSeen(h)) invs.push_back(h);
         }
+        // Near the tip a block is mostly in our mempool already.
+        if (type == 0x02 && peer->compactBlocks && std::atomic_load(&m_callbacks)->compactProvider) type = k_inv_compact_block;
         if (!invs.empty()) SendGetData(peer, invs, type);
-    } else if (msg.command == "getdata") {
+    } else if (cmd == Command::GetData) {
         std::vector<uint256> requests;
         uint8_t type = 0x01;
         size_t stride = (msg.payload.size() % 33 == 0) ? 33 : 32;
@@ -550,27 +1699,45 @@ void P2PNetwork::HandleBuiltin(const std::shared_ptr<PeerState>& peer, const Mes
             std::copy(msg.payload.begin() + i + (stride - 32), msg.payload.begin() + i + stride, h.begin());
             requests.push_back(h);
         }
+        const auto callbacks = std::atomic_load(&m_callbacks);
         for (const auto& h : requests) {
             std::optional<std::vector<uint8_t>> payload;
-            if (type == 0x02 && m_blockProvider) payload = m_blockProvider(h);
-            if (!payload && m_txProvider) payload = m_txProvider(h);
+            if (type == k_inv_compact_block) {
+                if (callbacks->compactProvider && (payload = callbacks->compactProvider(h))) {
+                    QueueMessage(peer, Message{"cmpctblock", std::move(*payload)});
+                    continue;
+                }
+                type = 0x02;
+            }
+            if (type == 0x02 && callbacks->blockProvider) {
+                if (auto wire = ServedBlock(callbacks->blockProvider, h)) {
+                    {
+                        std::lock_guard<std::mutex> g(m_mutex);
+                        peer->knownInventory.Insert(h);
+                    }
+                    QueueMessage(peer, std::move(wire));
+                    continue;
+                }
+            }
+            if (callbacks->txProvider) payload = callbacks->txProvider(h);
             if (payload) {
-                SendPayload(peer, type == 0x02 ? "block" : "tx", *payload);
+                {
+                    std::lock_guard<std::mutex> g(m_mutex);
+                    peer->knownInventory.Insert(h);
+                }
+                QueueMessage(peer, Message{type == 0x02 ? "block" : "tx", std::move(*payload)});
             }
         }
-    } else if (msg.command == "tx") {
-        uint256 seenHash{};
-        if (msg.payload.size() >= seenHash.size()) {
-            std::copy_n(msg.payload.begin(), seenHash.size(), seenHash.begin());
-        }
+    } else if (cmd == Command::Tx) {
+        // Not passed on here: the "tx" handler validates it and calls
+        // RelayTransaction() if the mempool takes it.
+        const uint256 txid = tagged_hash("TX", msg.payload.data(), msg.payload.size());
         {
             std::lock_guard<std::mutex> g(m_mutex);
-            m_seenInventory.insert(seenHash);
-            for (const auto& kv : m_peers) {
-                if (kv.first == peer->info.id) continue;
-                QueueMessage(kv.second, msg);
-            }
+            peer->knownInventory.Insert(txid);
+            peer->Forget(txid);
         }
+        MarkSeen(txid);
     }
 }
 
@@ -582,7 +1749,91 @@ void P2PNetwork::SendInv(const std::shared_ptr<PeerState>& peer, const std::vect
         payload.push_back(type);
         payload.insert(payload.end(), h.begin(), h.end());
     }
-    QueueMessage(peer, Message{"inv", payload});
+    QueueMessage(peer, Message{"inv", std::move(payload)});
+}
+
+size_t P2PNetwork::RequestBlocks(const std::vector<uint256>& hashes)
+{
+    if (hashes.empty()) return 0;
+    std::lock_guard<std::mutex> g(m_mutex);
+    size_t asked = 0;
+    for (auto& kv : m_peers) {
+        if (!kv.second->gotVersion || !(kv.second->info.services & k_node_network)) continue;
+        SendGetData(kv.second, hashes, /*type=*/0x02);
+        ++asked;
+    }
+    return asked;
+}
+
+bool P2PNetwork::RequestBlocks(const std::string& peerId, const std::vector<uint256>& hashes)
+{
+    std::lock_guard<std::mutex> g(m_mutex);
+    auto it = m_peers.find(peerId);
+    if (it == m_peers.end()) return false;
+    if (!hashes.empty()) SendGetData(it->second, hashes, /*type=*/0x02);
+    return true;
+}
+
+bool P2PNetwork::RequestHeaders(const std::string& peerId, const std::vector<uint256>& locator, const uint256& stop)
+{
+    const uint32_t count = static_cast<uint32_t>(std::min(locator.size(), k_max_locator));
+    std::vector<uint8_t> payload;
+    payload.reserve(sizeof(count) + (count + 1) * 32);
+    payload.insert(payload.end(), reinterpret_cast<const uint8_t*>(&count), reinterpret_cast<const uint8_t*>(&count) + sizeof(count));
+    for (uint32_t i = 0; i < count; ++i) payload.insert(payload.end(), locator[i].begin(), locator[i].end());
+    payload.insert(payload.end(), stop.begin(), stop.end());
+    std::lock_guard<std::mutex> g(m_mutex);
+    auto it = m_peers.find(peerId);
+    if (it == m_peers.end()) return false;
+    QueueMessage(it->second, Message{"getheaders", std::move(payload)});
+    return true;
+}
+
+void P2PNetwork::Misbehaving(const std::string& peerId, int score)
+{
+    std::shared_ptr<PeerState> peer;
+    {
+        std::lock_guard<std::mutex> g(m_mutex);
+        auto it = m_peers.find(peerId);
+        if (it == m_peers.end()) return;
+        peer = it->second;
+    }
+    if ((peer->banScore += score) > k_ban_threshold) Ban(peer->info.address);
+}
+
+bool P2PNetwork::SetHighBandwidth(const std::string& peerId, bool on)
+{
+    std::lock_guard<std::mutex> g(m_mutex);
+    auto it = m_peers.find(peerId);
+    if (it == m_peers.end()) return false;
+    QueueMessage(it->second, SendCmpctMessage(on));
+    return true;
+}
+
+std::vector<std::string> P2PNetwork::SendCompactBlock(const std::vector<uint8_t>& compact, const std::set<std::string>& skip)
+{
+    std::vector<std::string> sent;
+    const auto wire = Frame(Message{"cmpctblock", compact});
+    std::lock_guard<std::mutex> g(m_mutex);
+    for (auto& kv : m_peers) {
+        if (!kv.second->compactHighBandwidth || skip.count(kv.first)) continue;
+        QueueMessage(kv.second, wire);
+        sent.push_back(kv.first);
+    }
+    return sent;
+}
+
+void P2PNetwork::AnnounceBlock(const uint256& hash, const std::vector<uint8_t>& compact, const std::set<std::string>& skip)
+{
+    const auto wire = compact.empty() ? nullptr : Frame(Message{"cmpctblock", compact});
+    std::lock_guard<std::mutex> g(m_mutex);
+    for (auto& kv : m_peers) {
+        if (!kv.second->gotVersion || skip.count(kv.first)) continue;
+        if (kv.second->compactHighBandwidth && wire)
+            QueueMessage(kv.second, wire);
+        else
+            SendInv(kv.second, {hash}, /*type=*/0x02);
+    }
 }
 
 void P2PNetwork::SendGetData(const std::shared_ptr<PeerState>& peer, const std::vector<uint256>& hashes, uint8_t type)
@@ -593,7 +1844,15 @@ void P2PNetwork::SendGetData(const std::shared_ptr<PeerState>& peer, const std::
         payload.push_back(type);
         payload.insert(payload.end(), h.begin(), h.end());
     }
-    QueueMessage(peer, Message{"getdata", payload});
+    if (type != 0x01) ExpectBlocks(*peer, hashes.size());
+    QueueMessage(peer, Message{"getdata", std::move(payload)});
+}
+
+void P2PNetwork::ExpectBlocks(PeerState& peer, size_t count)
+{
+    // Capped, so requests that are never answered do not pile up credit.
+    const auto asked = peer.blocksAsked.fetch_add(static_cast<uint32_t>(std::min(count, k_max_blocks_asked)));
+    if (asked + count > k_max_blocks_asked) peer.blocksAsked = static_cast<uint32_t>(k_max_blocks_asked);
 }
 
 void P2PNetwork::SendPayload(const std::shared_ptr<PeerState>& peer, const std::string& cmd, const std::vector<uint8_t>& payload)
@@ -601,6 +1860,33 @@ void P2PNetwork::SendPayload(const std::shared_ptr<PeerState>& peer, const std::
     QueueMessage(peer, Message{cmd, payload});
 }
 
+SharedWireMessage P2PNetwork::ServedBlock(const PayloadProvider& provider, const uint256& hash)
+{
+    {
+        std::lock_guard<std::mutex> g(m_servedMutex);
+        auto it = m_servedIndex.find(hash);
+        if (it != m_servedIndex.end()) {
+            m_servedBlocks.splice(m_servedBlocks.begin(), m_servedBlocks, it->second);
+            return it->second->second;
+        }
+    }
+    // Read without the lock: other peers' requests need not wait for it.
+    auto payload = provider(hash);
+    if (!payload) return nullptr;
+    auto wire = Frame(Message{"block", std::move(*payload)});
+    std::lock_guard<std::mutex> g(m_servedMutex);
+    if (m_servedIndex.count(hash)) return wire;
+    m_servedBlocks.emplace_front(hash, wire);
+    m_servedIndex[hash] = m_servedBlocks.begin();
+    m_servedBytes += wire->Size();
+    while (m_servedBytes > k_served_block_cache && m_servedBlocks.size() > 1) {
+        m_servedBytes -= m_servedBlocks.back().second->Size();
+        m_servedIndex.erase(m_servedBlocks.back().first);
+        m_servedBlocks.pop_back();
+    }
+    return wire;
+}
+
 void P2PNetwork::ScheduleHeartbeat()
 {
     m_timer.expires_after(std::chrono::seconds(30));
@@ -612,4 +1898,200 @@ void P2PNetwork::ScheduleHeartbeat()
     });
 }
 
+void P2PNetwork::ScheduleTrickle()
+{
+    std::chrono::milliseconds tick{100};
+    {
+        std::lock_guard<std::mutex> g(m_mutex);
+        tick = std::max(std::chrono::milliseconds(1), std::min({tick, m_inboundTrickle / 4, m_outboundTrickle / 4}));
+    }
+    m_trickleTimer.expires_after(tick);
+    m_trickleTimer.async_wait([this](const boost::system::error_code& ec) {
+        if (!ec && !m_stopped) {
+            Trickle();
+            ScheduleTrickle();
+        }
+    });
+}
+
+std::chrono::steady_clock::time_point P2PNetwork::NextTrickle(std::chrono::steady_clock::time_point now, bool inbound)
+{
+    const auto mean = inbound ? m_inboundTrickle : m_outboundTrickle;
+    std::exponential_distribution<double> delay(1.0);
+    return now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(mean * delay(m_rng));
+}
+
+void P2PNetwork::Trickle()
+{
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> g(m_mutex);
+    bool inboundDue = false;
+    if (m_nextInboundTrickle == std::chrono::steady_clock::time_point{}) {
+        m_nextInboundTrickle = NextTrickle(now, true);
+    } else if (now >= m_nextInboundTrickle) {
+        inboundDue = true;
+        m_nextInboundTrickle = NextTrickle(now, true);
+    }
+    for (auto& kv : m_peers) {
+        auto& peer = kv.second;
+        // A request left unanswered for a whole interval is repeated.
+        if (peer->reconciling && !peer->info.inbound && now >= peer->nextRecon &&
+            (!peer->reconRequested || now >= peer->nextRecon + m_reconInterval))
+            RequestReconciliationLocked(peer);
+        if (peer->info.inbound) {
+            if (!inboundDue) continue;
+        } else {
+            if (peer->nextTrickle == std::chrono::steady_clock::time_point{}) peer->nextTrickle = NextTrickle(now, false);
+            if (now < peer->nextTrickle) continue;
+            peer->nextTrickle = NextTrickle(now, false);
+        }
+        std::vector<uint256> batch;
+        for (auto it = peer->txToSend.begin(); it != peer->txToSend.end() && batch.size() < k_max_inv_per_trickle;) {
+            if (!peer->knownInventory.Contains(*it)) {
+                batch.push_back(*it);
+                peer->knownInventory.Insert(*it);
+            }
+            it = peer->txToSend.erase(it);
+        }
+        if (!batch.empty()) SendInv(peer, batch, /*type=*/0x01);
+    }
+}
+
+void P2PNetwork::AnnounceLocked(const std::shared_ptr<PeerState>& peer, const std::vector<uint256>& txids)
+{
+    std::vector<uint256> batch;
+    for (const auto& txid : txids) {
+        if (peer->knownInventory.Contains(txid)) continue;
+        peer->knownInventory.Insert(txid);
+        batch.push_back(txid);
+        if (batch.size() == k_max_inv_per_trickle) {
+            SendInv(peer, batch, /*type=*/0x01);
+            batch.clear();
+        }
+    }
+    if (!batch.empty()) SendInv(peer, batch, /*type=*/0x01);
+}
+
+void P2PNetwork::RequestReconciliationLocked(const std::shared_ptr<PeerState>& peer)
+{
+    const auto size = static_cast<uint32_t>(peer->reconSet.size());
+    std::vector<uint8_t> payload(sizeof(size));
+    std::memcpy(payload.data(), &size, sizeof(size));
+    QueueMessage(peer, Message{"reqrecon", std::move(payload)});
+    peer->reconRequested = true;
+    peer->nextRecon = std::chrono::steady_clock::now() + m_reconInterval;
+}
+
+void P2PNetwork::ReceiveSendTxRcncl(const std::shared_ptr<PeerState>& peer, const Message& msg)
+{
+    uint32_t version = 0;
+    uint64_t salt = 0;
+    if (msg.payload.size() != sizeof(version) + sizeof(salt)) { peer->banScore += 10; return; }
+    std::memcpy(&version, msg.payload.data(), sizeof(version));
+    std::memcpy(&salt, msg.payload.data() + sizeof(version), sizeof(salt));
+    if (version < k_recon_version) return;
+    std::lock_guard<std::mutex> g(m_mutex);
+    if (!m_reconEnabled || peer->reconciling) return;
+    // Both salts, smaller first, key the short ids of this connection.
+    const uint64_t salts[2] = {std::min(salt, m_reconSalt), std::max(salt, m_reconSalt)};
+    const uint256 key = tagged_hash("DRM/recon", reinterpret_cast<const uint8_t*>(salts), sizeof(salts));
+    std::memcpy(&peer->reconK0, key.data(), sizeof(peer->reconK0));
+    std::memcpy(&peer->reconK1, key.data() + sizeof(peer->reconK0), sizeof(peer->reconK1));
+    peer->reconciling = true;
+    peer->nextRecon = std::chrono::steady_clock::now() + m_reconInterval;
+}
+
+void P2PNetwork::ServeSketch(const std::shared_ptr<PeerState>& peer, const Message& msg)
+{
+    uint32_t remoteSize = 0;
+    if (msg.payload.size() != sizeof(remoteSize)) { peer->banScore += 10; return; }
+    std::memcpy(&remoteSize, msg.payload.data(), sizeof(remoteSize));
+    std::lock_guard<std::mutex> g(m_mutex);
+    if (!peer->reconciling || !peer->info.inbound) { peer->banScore += 10; return; }
+    // A snapshot whose round never finished is folded into the new one.
+    peer->reconSnapshot.insert(peer->reconSet.begin(), peer->reconSet.end());
+    peer->reconSet.clear();
+    const size_t localSize = peer->reconSnapshot.size();
+    const size_t small = std::min<size_t>(localSize, remoteSize);
+    const size_t large = std::max<size_t>(localSize, remoteSize);
+    // Expected difference: the size gap plus a quarter of the smaller set,
+    // one more element, and one of slack so a full decode is never trusted.
+    // Nothing on either side needs no sketch at all.
+    size_t capacity = large == 0 ? 0 : (large - small) + small / 4 + 2;
+    capacity = std::min(capacity, k_max_sketch_capacity);
+    Minisketch sketch(capacity);
+    for (const auto& entry : peer->reconSnapshot) sketch.Add(entry.first);
+    QueueMessage(peer, Message{"sketch", sketch.Serialize()});
+}
+
+void P2PNetwork::ReceiveSketch(const std::shared_ptr<PeerState>& peer, const Message& msg)
+{
+    if (msg.payload.size() > k_max_sketch_capacity * Minisketch::k_element_bytes ||
+        msg.payload.size() % Minisketch::k_element_bytes != 0) {
+        peer->banScore += 10;
+        return;
+    }
+    const Minisketch remote = Minisketch::Deserialize(msg.payload);
+    std::unordered_map<uint32_t, uint256> local;
+    {
+        std::lock_guard<std::mutex> g(m_mutex);
+        if (!peer->reconciling || peer->info.inbound) { peer->banScore += 10; return; }
+        if (!peer->reconRequested) return; // a repeated request was answered twice
+        peer->reconRequested = false;
+        local.swap(peer->reconSet);
+    }
+
+    // Decoding is the expensive part; it runs without the lock.
+    std::optional<std::vector<uint32_t>> difference;
+    if (remote.Capacity() == 0) {
+        // The peer had nothing: everything we have is the difference.
+        difference.emplace();
+        for (const auto& entry : local) difference->push_back(entry.first);
+    } else {
+        Minisketch sketch(remote.Capacity());
+        for (const auto& entry : local) sketch.Add(entry.first);
+        sketch.Merge(remote);
+        difference = sketch.Decode(remote.Capacity() - 1);
+    }
+
+    std::vector<uint256> announce;
+    std::vector<uint8_t> reply{static_cast<uint8_t>(difference ? 1 : 0)};
+    if (difference) {
+        for (uint32_t id : *difference) {
+            auto it = local.find(id);
+            if (it != local.end()) {
+                announce.push_back(it->second);
+            } else {
+                reply.insert(reply.end(), reinterpret_cast<const uint8_t*>(&id),
+                             reinterpret_cast<const uint8_t*>(&id) + sizeof(id));
+            }
+        }
+    } else {
+        for (const auto& entry : local) announce.push_back(entry.second);
+    }
+    std::lock_guard<std::mutex> g(m_mutex);
+    QueueMessage(peer, Message{"reconcildiff", std::move(reply)});
+    AnnounceLocked(peer, announce);
+}
+
+void P2PNetwork::ReceiveReconcilDiff(const std::shared_ptr<PeerState>& peer, const Message& msg)
+{
+    if (msg.payload.empty() || (msg.payload.size() - 1) % sizeof(uint32_t) != 0) { peer->banScore += 10; return; }
+    std::vector<uint256> announce;
+    std::lock_guard<std::mutex> g(m_mutex);
+    if (!peer->reconciling || !peer->info.inbound) { peer->banScore += 10; return; }
+    if (msg.payload[0]) {
+        for (size_t i = 1; i < msg.payload.size(); i += sizeof(uint32_t)) {
+            uint32_t id = 0;
+            std::memcpy(&id, msg.payload.data() + i, sizeof(id));
+            auto it = peer->reconSnapshot.find(id);
+            if (it != peer->reconSnapshot.end()) announce.push_back(it->second);
+        }
+    } else {
+        for (const auto& entry : peer->reconSnapshot) announce.push_back(entry.second);
+    }
+    peer->reconSnapshot.clear();
+    AnnounceLocked(peer, announce);
+}
+
 } // namespace net
@@ -3,16 +3,29 @@
 #include <boost/asio.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <functional>
+#include <list>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <random>
+#include <map>
 #include <set>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "../../layer1-core/block/block.h"
 #include "../../layer1-core/crypto/tagged_hash.h"
+#include "addrman.h"
+#include "buffer_pool.h"
+#include "rolling_bloom.h"
+#include "token_bucket.h"
 
 namespace net {
 
@@ -21,12 +34,24 @@ struct Message {
     std::vector<uint8_t> payload;  // raw payload
 };
 
+// Framed once and shared, read-only, by every peer queue it is put on.
+struct WireMessage {
+    std::array<uint8_t, 24> header{};
+    std::vector<uint8_t> payload;
+    bool raw{false}; // payload is sent as is, without the header (v2 packets)
+
+    size_t Size() const { return (raw ? 0 : header.size()) + payload.size(); }
+};
+using SharedWireMessage = std::shared_ptr<const WireMessage>;
+
 struct PeerInfo {
     std::string id;      // address:port (address may be an IP or hostname)
-    std::string id;      // resolved host:port
     std::string address; // ip string
     std::string seed_id; // original seed host:port
     bool inbound{false};
+    uint64_t services{0}; // from the peer's version message
+    uint32_t startHeight{0}; // chain height the peer announced in its version message
+    bool v2Transport{false}; // the connection is encrypted (see V2Transport)
 };
 
 struct BloomFilter {
@@ -39,14 +64,135 @@ struct BloomFilter {
     bool Match(const uint256& h) const;
 };
 
+// Precomputed compact filter of one block, served to light clients.
+struct FilterRecord {
+    uint256 blockHash{};
+    uint256 filterHash{};
+    uint256 header{};
+    std::vector<uint8_t> filter;
+};
+
+// Payload bytes and messages since the node started.
+struct TrafficCounters {
+    uint64_t messagesReceived{0};
+    uint64_t bytesReceived{0};
+    uint64_t messagesSent{0};
+    uint64_t bytesSent{0};
+};
+
+struct TrafficStats {
+    TrafficCounters total;
+    std::map<std::string, TrafficCounters> byCommand; // commands the node does not speak are "other"
+    uint64_t rateLimited{0};      // peers banned for running a budget dry
+    uint64_t uploadWaits{0};      // times a peer's writes waited for the upload limits
+    uint64_t peerUploadLimit{0};  // bytes per second, 0 for none
+    uint64_t totalUploadLimit{0};
+};
+
 class P2PNetwork {
 public:
     using Handler = std::function<void(const PeerInfo&, const Message&)>;
     using PayloadProvider = std::function<std::optional<std::vector<uint8_t>>(const uint256&)>;
+    // Filter of the active-chain block at a height, if indexed.
+    using FilterProvider = std::function<std::optional<FilterRecord>(uint32_t)>;
+    // Headers of the best chain following the first locator hash we know
+    // (from genesis if none), up to `stop` or `max` headers.
+    using HeadersProvider =
+        std::function<std::vector<BlockHeader>(const std::vector<uint256>& locator, const uint256& stop, size_t max)>;
+    using HeadersHandler = std::function<void(const PeerInfo&, const std::vector<BlockHeader>&)>;
+    using PeerEvent = std::function<void(const PeerInfo&)>;
+
+    // Service bits in the version message [version(4)][height(4)]
+    // [services(8)][nodeId...]. A full node serves every block and sets both;
+    // a pruned node only keeps the last k_limited_blocks and sets just
+    // k_node_network_limited. Version 1 peers did not send services and are
+    // full nodes.
+    static constexpr uint32_t k_protocol_version = 2;
+    static constexpr uint64_t k_node_network = 1;
+    static constexpr uint64_t k_node_network_limited = 1 << 1;
+    static constexpr uint64_t k_node_p2p_v2 = 1 << 11; // see EnableV2Transport()
+    static constexpr uint32_t k_limited_blocks = 288;
+
+    // Header sync: "getheaders" [count(4)][locator hash...][stopHash(32)]
+    // is answered with "headers" [count(4)][header(80)...]; a full batch
+    // means the sender has more.
+    static constexpr size_t k_max_headers = 2000;
+    static constexpr size_t k_max_locator = 101;
+
+    // Compact blocks (see compact_block.h): "sendcmpct" [highBandwidth(1)]
+    // [version(8)] is sent once after the handshake by nodes that serve
+    // them. Block invs from such a peer are then fetched as compact blocks
+    // (getdata type k_inv_compact_block, answered with "cmpctblock", or
+    // "block" when it is not recent). A peer that asked for high bandwidth
+    // gets new blocks as "cmpctblock" straight away instead of an inv.
+    static constexpr uint64_t k_compact_version = 1;
+    static constexpr uint8_t k_inv_compact_block = 0x04;
+
+    // Transaction relay: trickled "inv" batches on Poisson timers (one
+    // shared by inbound peers), deduplicated by rolling filters.
+    static constexpr size_t k_max_inv_per_trickle = 1000;
+    static constexpr uint32_t k_known_inventory = 5000;
+    static constexpr uint32_t k_recent_inventory = 50000;
+
+    // Erlay reconciliation: "sendtxrcncl", then "reqrecon" / "sketch" /
+    // "reconcildiff" rounds of short-id sets instead of per-peer invs.
+    static constexpr uint32_t k_recon_version = 1;
+    static constexpr size_t k_max_sketch_capacity = 512;
+
+    // Send queues: batched scatter-gather writes; reads pause past
+    // k_send_buffer_pause and the peer is dropped past k_max_send_buffer.
+    static constexpr size_t k_max_write_batch = 64;
+    static constexpr size_t k_send_buffer_pause = 5 * 1024 * 1024;
+    static constexpr size_t k_max_send_buffer = 20 * 1024 * 1024;
+
+    // Framed blocks served for getdata, shared by peers; LRU by bytes.
+    static constexpr size_t k_served_block_cache = 32 * 1024 * 1024;
+
+    // Threading: socket I/O on a per-peer strand of the io_context, message
+    // handling on a per-peer strand of the processing executor.
+    static constexpr size_t k_processing_pause = 5 * 1024 * 1024;
+
+    // Rate limits: per-command token buckets, charged a weight plus one per
+    // k_cost_unit_bytes; a peer that runs one dry is banned. Block answers
+    // we asked for are free, up to k_max_blocks_asked.
+    static constexpr size_t k_cost_unit_bytes = 1024;
+    static constexpr size_t k_max_blocks_asked = 1024;
+
+    // Ban score past which an address is banned for ten minutes.
+    static constexpr int k_ban_threshold = 100;
+
+    // Address gossip: "getaddr" / "addr" (at most k_max_addr), learned
+    // addresses kept in an AddrMan. AddPeerAddress() peers are redialed
+    // with backoff; outbound slots and feelers are filled from the AddrMan.
+    static constexpr size_t k_max_addr = 1000;
+    static constexpr std::chrono::seconds k_connect_timeout{5};
+    static constexpr std::chrono::seconds k_max_redial{64};
+    static constexpr std::chrono::minutes k_address_save_interval{15};
+
+    // Compact filter requests: [filterType(1)][startHeight(4)][stopHash(32)].
+    // "getcfilters" is answered with one "cfilter" [type][blockHash][filter]
+    // per block, "getcfheaders" with one "cfheaders" [type][stopHash]
+    // [prevHeader][count(4)][filterHash...]. Only type 0 (basic) exists.
+    static constexpr uint8_t k_basic_filter = 0;
+    static constexpr size_t k_max_cfilters = 1000;
+    static constexpr size_t k_max_cfheaders = 2000;
 
     explicit P2PNetwork(boost::asio::io_context& io, uint16_t listenPort);
     ~P2PNetwork();
 
+    // For peers that connect from now on; it must not run our work once
+    // this object is gone.
+    void SetProcessingExecutor(boost::asio::any_io_executor executor);
+    // Outbound peers from the AddrMan besides AddPeerAddress() ones.
+    void SetMaxOutbound(size_t count, std::chrono::milliseconds feelerInterval = std::chrono::minutes(2));
+    // Loaded by Start(), written periodically and by Stop().
+    void SetAddressFile(std::string path);
+    // Bytes per second, 0 for none; urgent messages go before relay.
+    // Call before Start().
+    void SetUploadLimits(uint64_t peerBytesPerSecond, uint64_t totalBytesPerSecond);
+    TrafficStats Traffic() const;
+    AddrMan& Addresses() { return m_addrman; }
+
     void RegisterHandler(const std::string& cmd, Handler h);
     void AddPeerAddress(const std::string& address);
     void Start();
@@ -58,54 +204,214 @@ public:
     void SendTo(const std::string& peerId, const Message& msg);
     std::vector<PeerInfo> Peers() const;
     void SetLocalHeight(uint32_t height);
+    void SetLocalServices(uint64_t services);
+    // The callbacks below may be replaced or cleared at any time; a call
+    // already under way finishes with the old one.
     void SetTxProvider(PayloadProvider provider);
     void SetBlockProvider(PayloadProvider provider);
+    void SetFilterProvider(FilterProvider provider);
+    // Serialized compact block of a recent block, for getdata requests.
+    void SetCompactBlockProvider(PayloadProvider provider);
+    void SetHeadersProvider(HeadersProvider provider);
+    // Receives every well-formed "headers" message.
+    void SetHeadersHandler(HeadersHandler handler);
+    // `connected` runs once a peer's version has been received,
+    // `disconnected` when such a peer is dropped. Both run without the
+    // network lock held.
+    void SetPeerHandlers(PeerEvent connected, PeerEvent disconnected);
+    // Transactions are queued for the next trickle (see above), blocks are
+    // announced right away.
     void AnnounceInventory(const std::vector<uint256>& txs, const std::vector<uint256>& blocks = {});
+    void RelayTransaction(const uint256& txid);
+    // Mean delay between transaction announcements (defaults 5 s inbound,
+    // 2 s outbound).
+    void SetTrickleIntervals(std::chrono::milliseconds inbound, std::chrono::milliseconds outbound);
+    // Offers reconciliation (see above) to peers that connect from now on;
+    // outbound peers are reconciled every `interval`.
+    void EnableTxReconciliation(std::chrono::milliseconds interval = std::chrono::seconds(2));
+    // Speaks the V2Transport encryption instead of v1 checksummed frames with
+    // k_node_p2p_v2 peers that connect from now on; a failed v2 attempt falls
+    // back to v1.
+    void EnableV2Transport();
+    // Asks every connected full node (k_node_network) for the blocks with a
+    // getdata; the answers arrive as "block" messages. Returns the number of
+    // peers asked.
+    size_t RequestBlocks(const std::vector<uint256>& hashes);
+    // Single-peer requests; false if the peer is not connected.
+    bool RequestBlocks(const std::string& peerId, const std::vector<uint256>& hashes);
+    bool RequestHeaders(const std::string& peerId, const std::vector<uint256>& locator, const uint256& stop = {});
+    // Ban score from outside the network layer, e.g. an invalid block.
+    void Misbehaving(const std::string& peerId, int score);
+    // Asks a compact block peer to push new blocks to us (or to stop).
+    bool SetHighBandwidth(const std::string& peerId, bool on);
+    // Sends a "cmpctblock" to every peer that asked for high bandwidth mode,
+    // except those in `skip`; returns the peers it went to.
+    std::vector<std::string> SendCompactBlock(const std::vector<uint8_t>& compact, const std::set<std::string>& skip = {});
+    // Announces a new block: high bandwidth peers get `compact`, the rest
+    // an inv. Peers in `skip` already have it.
+    void AnnounceBlock(const uint256& hash, const std::vector<uint8_t>& compact, const std::set<std::string>& skip = {});
 
 private:
     struct PeerState;
+    struct HandlerTable;
+    struct Callbacks;
+    struct TrafficMeters;
+    enum class Command : uint8_t; // the commands the node itself speaks
 
     static constexpr uint32_t k_message_magic = 0xd1a0c0deU;
+    static constexpr size_t k_header_bytes = 24;
+    // Per-peer receive buffer; longer messages are read into their own.
+    static constexpr size_t k_recv_buffer = 64 * 1024;
+
+    enum class ConnectionType : uint8_t { Inbound, Manual, Outbound, Feeler };
+    // Detect: inbound, first bytes not seen yet. V2Handshake: our key is
+    // sent, the peer's is awaited.
+    enum class Transport : uint8_t { Detect, V1, V2Handshake, V2 };
+    struct Redial {
+        std::chrono::steady_clock::time_point next{};
+        std::chrono::milliseconds delay{1000};
+    };
 
     void AcceptLoop();
-    void ConnectSeeds();
+    // Dials whatever is missing: AddPeerAddress() peers, free outbound
+    // slots, a feeler. Runs every 200 ms.
+    void MaintainConnections();
+    void Dial(const std::string& address, ConnectionType type);
+    void DialFailed(const std::shared_ptr<PeerState>& peer);
     void LoadDNSSeeds();
+    void SaveAddresses();
+    std::shared_ptr<PeerState> NewPeer(PeerInfo info);
     void RegisterPeer(const std::shared_ptr<PeerState>& peer);
-    void QueueMessage(const std::shared_ptr<PeerState>& peer, const Message& msg);
+    // On the peer's strand once it is connected: registers it, sends our
+    // version and starts reading.
+    void StartPeer(const std::shared_ptr<PeerState>& peer);
+    // The checksum is only needed by v1 peers.
+    static SharedWireMessage Frame(Message msg, bool checksum = true);
+    // A v2 packet for the peer; on its strand, in sending order.
+    static SharedWireMessage Seal(PeerState& peer, std::string_view command, const std::vector<uint8_t>& payload);
+    void QueueMessage(const std::shared_ptr<PeerState>& peer, Message msg);
+    void QueueMessage(const std::shared_ptr<PeerState>& peer, SharedWireMessage wire);
+    // On the peer's strand: holds the message until the transport is
+    // settled, then hands it to Enqueue(). WriteLoop() encrypts for v2.
+    void Transmit(const std::shared_ptr<PeerState>& peer, SharedWireMessage wire);
+    // Queues the message by priority and starts writing if idle.
+    void Enqueue(const std::shared_ptr<PeerState>& peer, SharedWireMessage wire);
+    void SettleTransport(const std::shared_ptr<PeerState>& peer, Transport transport);
+    // Writes a batch of the queue, as much as the upload limits allow, or
+    // waits until they allow some. On the peer's strand.
     void WriteLoop(const std::shared_ptr<PeerState>& peer);
+    // Handles the complete messages in the peer's receive buffer, then reads
+    // more.
     void ReadLoop(const std::shared_ptr<PeerState>& peer);
-    void Dispatch(const PeerState& peer, const Message& msg);
-    bool RateLimit(PeerState& peer);
+    // The buffer's messages in either transport; false if reading is to
+    // stop here (dropped, paused, or a long message is read elsewhere).
+    bool ParseV1(const std::shared_ptr<PeerState>& peer);
+    bool ParseV2(const std::shared_ptr<PeerState>& peer);
+    void ReadLargePayload(const std::shared_ptr<PeerState>& peer, std::string command, uint32_t checksum,
+                          uint32_t length);
+    void ReadLargePacket(const std::shared_ptr<PeerState>& peer, uint32_t length);
+    // Opens the v2 packet at `packet` and passes it on as ReceiveMessage()
+    // does.
+    bool ReceivePacket(const std::shared_ptr<PeerState>& peer, const uint8_t* packet, uint32_t length);
+    // Dispatches one message; false if the peer was dropped or is not to be
+    // read from for now.
+    bool ReceiveMessage(const std::shared_ptr<PeerState>& peer, std::string_view command,
+                        std::vector<uint8_t>&& payload);
+    static Command ParseCommand(std::string_view command);
+    void Dispatch(const std::shared_ptr<PeerState>& peer, Command cmd, const Message& msg);
+    // Reads from the peer again if it was paused and no longer needs to be.
+    void ResumeReading(const std::shared_ptr<PeerState>& peer);
+    // Charges the message to the peer's budget; false if it was banned.
+    bool RateLimit(PeerState& peer, Command cmd, size_t size);
     void SendVersion(const std::shared_ptr<PeerState>& peer);
     void CompleteHandshake(const std::shared_ptr<PeerState>& peer, uint32_t remoteHeight, const std::string& remoteId);
     void DropPeer(const std::string& id);
     void Ban(const std::string& address);
     bool IsBanned(const std::string& address) const;
-    void HandleBuiltin(const std::shared_ptr<PeerState>& peer, const Message& msg);
+    bool IsBannedLocked(const std::string& address) const;
+    void HandleBuiltin(const std::shared_ptr<PeerState>& peer, Command cmd, const Message& msg);
     void SendInv(const std::shared_ptr<PeerState>& peer, const std::vector<uint256>& invs, uint8_t type);
     void SendGetData(const std::shared_ptr<PeerState>& peer, const std::vector<uint256>& hashes, uint8_t type);
+    // Credits the peer with `count` block answers it may send unmetered.
+    void ExpectBlocks(PeerState& peer, size_t count);
     void SendPayload(const std::shared_ptr<PeerState>& peer, const std::string& cmd, const std::vector<uint8_t>& payload);
+    // The framed "block" message, from the cache or `provider`; null if the
+    // provider does not have it.
+    SharedWireMessage ServedBlock(const PayloadProvider& provider, const uint256& hash);
     void ScheduleHeartbeat();
+    void ScheduleTrickle();
+    // Sends the queued announcements of every peer whose timer has fired.
+    void Trickle();
+    std::chrono::steady_clock::time_point NextTrickle(std::chrono::steady_clock::time_point now, bool inbound);
+    // Remembers `hash` as recently seen; false if it already was.
+    bool MarkSeen(const uint256& hash);
     bool ApplyBloom(const PeerState& peer, const uint256& hash) const;
+    // Reconciliation rounds; Locked variants expect m_mutex to be held.
+    void AnnounceLocked(const std::shared_ptr<PeerState>& peer, const std::vector<uint256>& txids);
+    void RequestReconciliationLocked(const std::shared_ptr<PeerState>& peer);
+    void ReceiveSendTxRcncl(const std::shared_ptr<PeerState>& peer, const Message& msg);
+    void ServeSketch(const std::shared_ptr<PeerState>& peer, const Message& msg);
+    void ReceiveSketch(const std::shared_ptr<PeerState>& peer, const Message& msg);
+    void ReceiveReconcilDiff(const std::shared_ptr<PeerState>& peer, const Message& msg);
+    // Filters from `start` up to the block `stopHash`; empty if the stop
+    // block is not found within `max` heights.
+    std::vector<FilterRecord> CollectFilters(uint32_t start, const uint256& stopHash, size_t max) const;
+    void ServeFilters(const std::shared_ptr<PeerState>& peer, const Message& msg);
+    void ServeHeaders(const std::shared_ptr<PeerState>& peer, const Message& msg);
+    void ReceiveHeaders(const std::shared_ptr<PeerState>& peer, const Message& msg);
+    void ReceiveAddr(const std::shared_ptr<PeerState>& peer, const Message& msg);
+    void ServeAddr(const std::shared_ptr<PeerState>& peer);
+    void UpdateCallbacks(const std::function<void(Callbacks&)>& edit);
 
     boost::asio::io_context& m_io;
+    boost::asio::any_io_executor m_processing;
     boost::asio::ip::tcp::acceptor m_acceptor;
     mutable std::mutex m_mutex;
     std::unordered_map<std::string, std::shared_ptr<PeerState>> m_peers;
-    std::unordered_map<std::string, Handler> m_handlers;
-    std::set<std::string> m_seedAddrs;
+    // Replaced as a whole on registration, so dispatch reads it unlocked.
+    std::shared_ptr<const HandlerTable> m_handlerTable;
+    std::shared_ptr<const Callbacks> m_callbacks; // the same, for the Set*() callbacks
+    BufferPool m_buffers;
+    std::unique_ptr<TrafficMeters> m_meters;
+    uint64_t m_peerUploadLimit{0};
+    std::atomic<bool> m_uploadLimited{false}; // m_upload is in use
+    mutable std::mutex m_uploadMutex;
+    TokenBucket m_upload;
+    std::map<std::string, Redial> m_seedAddrs;           // AddPeerAddress()
+    std::vector<std::string> m_dnsSeeds;
+    std::unordered_map<std::string, ConnectionType> m_pending; // being dialed
+    AddrMan m_addrman;
+    std::string m_addressFile;
+    std::string m_nodeId; // in our version message, to spot connections to ourselves
+    size_t m_maxOutbound{0};
+    std::chrono::milliseconds m_feelerInterval{std::chrono::minutes(2)};
+    std::chrono::steady_clock::time_point m_nextFeeler{};
+    std::chrono::steady_clock::time_point m_nextSave{};
+    bool m_started{false};
+    std::unordered_set<std::string> m_v1Only; // v2 attempts failed
+    std::atomic<bool> m_v2Enabled{false};
     std::unordered_map<std::string, std::chrono::steady_clock::time_point> m_banned;
-    std::set<uint256> m_seenInventory;
     boost::asio::steady_timer m_timer;
     boost::asio::steady_timer m_seedTimer;
-    PayloadProvider m_txProvider;
-    PayloadProvider m_blockProvider;
-    uint32_t m_localHeight{0};
-    const size_t m_maxMsgsPerMinute{200};
+    boost::asio::steady_timer m_trickleTimer;
+    std::mutex m_inventoryMutex;
+    RollingBloomFilter m_recentInventory{k_recent_inventory, 0.000001};
+    std::chrono::milliseconds m_inboundTrickle{5000};
+    std::chrono::milliseconds m_outboundTrickle{2000};
+    std::chrono::steady_clock::time_point m_nextInboundTrickle{};
+    std::mt19937_64 m_rng{std::random_device{}()};
+    bool m_reconEnabled{false};
+    std::chrono::milliseconds m_reconInterval{2000};
+    uint64_t m_reconSalt{0};
+    std::mutex m_servedMutex;
+    std::list<std::pair<uint256, SharedWireMessage>> m_servedBlocks; // most recently served first
+    std::map<uint256, std::list<std::pair<uint256, SharedWireMessage>>::iterator> m_servedIndex;
+    size_t m_servedBytes{0};
+    std::atomic<uint32_t> m_localHeight{0};
+    uint64_t m_localServices{k_node_network | k_node_network_limited};
     const size_t m_maxPeers{64};
-    const int m_banThreshold{100};
     const std::chrono::minutes m_banTime{10};
-    bool m_stopped{false};
+    std::atomic<bool> m_stopped{false};
 };
 
 using P2PNode = P2PNetwork; // backward compatibility for existing call sites
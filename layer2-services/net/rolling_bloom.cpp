@@ -0,0 +1,78 @@
+#include "rolling_bloom.h"
+#include "../../layer1-core/crypto/siphash.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace net {
+
+RollingBloomFilter::RollingBloomFilter(uint32_t elements, double fpRate)
+{
+    const double logFpRate = std::log(fpRate);
+    // Optimal number of hash functions for the false positive rate.
+    m_hashFuncs = static_cast<uint32_t>(std::max(1, std::min(static_cast<int>(std::round(logFpRate / std::log(0.5))), 50)));
+    m_entriesPerGeneration = (elements + 1) / 2;
+    const uint32_t maxElements = m_entriesPerGeneration * 3;
+    // Bits needed for maxElements at fpRate with m_hashFuncs functions:
+    //   fpRate = (1 - exp(-k * n / m)) ^ k
+    const auto bits = static_cast<uint64_t>(
+        std::ceil(-1.0 * m_hashFuncs * maxElements / std::log(1.0 - std::exp(logFpRate / m_hashFuncs))));
+    m_data.resize(((bits + 63) / 64) << 1);
+    Reset();
+}
+
+uint32_t RollingBloomFilter::Hash(uint32_t n, const uint256& value) const
+{
+    return static_cast<uint32_t>(SipHash24(m_k0, m_k1 + n, value));
+}
+
+void RollingBloomFilter::Insert(const uint256& value)
+{
+    if (m_entriesThisGeneration == m_entriesPerGeneration) {
+        m_entriesThisGeneration = 0;
+        if (++m_generation == 4) m_generation = 1;
+        // Clear every bit pair holding the generation being reused.
+        const uint64_t mask1 = 0 - static_cast<uint64_t>(m_generation & 1);
+        const uint64_t mask2 = 0 - static_cast<uint64_t>(m_generation >> 1);
+        for (std::size_t p = 0; p < m_data.size(); p += 2) {
+            const uint64_t p1 = m_data[p];
+            const uint64_t p2 = m_data[p + 1];
+            const uint64_t keep = (p1 ^ mask1) | (p2 ^ mask2);
+            m_data[p] = p1 & keep;
+            m_data[p + 1] = p2 & keep;
+        }
+    }
+    ++m_entriesThisGeneration;
+    const uint64_t pairs = m_data.size() / 2;
+    for (uint32_t n = 0; n < m_hashFuncs; ++n) {
+        const uint32_t h = Hash(n, value);
+        const int bit = h & 63;
+        const std::size_t pos = static_cast<std::size_t>((static_cast<uint64_t>(h) * pairs) >> 32) * 2;
+        m_data[pos] = (m_data[pos] & ~(uint64_t{1} << bit)) | (static_cast<uint64_t>(m_generation & 1) << bit);
+        m_data[pos + 1] = (m_data[pos + 1] & ~(uint64_t{1} << bit)) | (static_cast<uint64_t>(m_generation >> 1) << bit);
+    }
+}
+
+bool RollingBloomFilter::Contains(const uint256& value) const
+{
+    const uint64_t pairs = m_data.size() / 2;
+    for (uint32_t n = 0; n < m_hashFuncs; ++n) {
+        const uint32_t h = Hash(n, value);
+        const int bit = h & 63;
+        const std::size_t pos = static_cast<std::size_t>((static_cast<uint64_t>(h) * pairs) >> 32) * 2;
+        if (!(((m_data[pos] | m_data[pos + 1]) >> bit) & 1)) return false;
+    }
+    return true;
+}
+
+void RollingBloomFilter::Reset()
+{
+    std::random_device rd;
+    m_k0 = (static_cast<uint64_t>(rd()) << 32) | rd();
+    m_k1 = (static_cast<uint64_t>(rd()) << 32) | rd();
+    m_entriesThisGeneration = 0;
+    m_generation = 1;
+    std::fill(m_data.begin(), m_data.end(), 0);
+}
+
+} // namespace net
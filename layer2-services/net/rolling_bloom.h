@@ -0,0 +1,43 @@
+#pragma once
+
+#include "../../layer1-core/crypto/tagged_hash.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace net {
+
+// Bloom filter that remembers roughly the last `elements` insertions with
+// false positive rate `fpRate`, in constant memory.
+//
+// Entries belong to one of three generations of elements / 2 insertions
+// each; every bit position stores the (2-bit) generation that last set it.
+// Starting a new generation wipes the bits of the oldest one, so between
+// `elements` and 1.5 * `elements` of the most recent entries are always
+// found. Positions come from SipHash with a random key, so peers cannot
+// aim collisions at a node. Not thread safe.
+class RollingBloomFilter {
+public:
+    RollingBloomFilter(uint32_t elements, double fpRate);
+
+    void Insert(const uint256& value);
+    bool Contains(const uint256& value) const;
+    // Forgets everything and draws a new key.
+    void Reset();
+
+    std::size_t MemoryUsage() const { return m_data.size() * sizeof(uint64_t); }
+
+private:
+    uint32_t Hash(uint32_t n, const uint256& value) const;
+
+    uint32_t m_entriesPerGeneration{0};
+    uint32_t m_entriesThisGeneration{0};
+    uint32_t m_generation{1};
+    uint32_t m_hashFuncs{0};
+    uint64_t m_k0{0};
+    uint64_t m_k1{0};
+    // Bit pairs: word 2i holds the low and word 2i+1 the high generation bit.
+    std::vector<uint64_t> m_data;
+};
+
+} // namespace net
@@ -0,0 +1,42 @@
+#include "token_bucket.h"
+#include <algorithm>
+#include <cmath>
+
+namespace net {
+
+TokenBucket::TokenBucket(double rate, double burst, Clock::time_point now)
+    : m_rate(rate), m_burst(burst), m_level(burst), m_updated(now)
+{
+}
+
+double TokenBucket::Level(Clock::time_point now)
+{
+    if (now > m_updated) {
+        const double elapsed = std::chrono::duration<double>(now - m_updated).count();
+        m_level = std::min(m_burst, m_level + elapsed * m_rate);
+        m_updated = now;
+    }
+    return m_level;
+}
+
+bool TokenBucket::Take(double tokens, Clock::time_point now)
+{
+    if (Level(now) < tokens) return false;
+    m_level -= tokens;
+    return true;
+}
+
+void TokenBucket::Spend(double tokens, Clock::time_point now)
+{
+    Level(now);
+    m_level -= tokens;
+}
+
+TokenBucket::Clock::duration TokenBucket::TimeUntil(double level, Clock::time_point now)
+{
+    const double missing = std::min(level, m_burst) - Level(now);
+    if (missing <= 0 || m_rate <= 0) return Clock::duration::zero();
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(std::ceil(missing) / m_rate));
+}
+
+} // namespace net
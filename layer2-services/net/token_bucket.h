@@ -0,0 +1,36 @@
+#pragma once
+
+#include <chrono>
+
+namespace net {
+
+// Token bucket: refills at `rate` tokens per second up to `burst` and
+// starts full. Take() only succeeds while enough is left; Spend() may
+// overdraw it, and the debt is paid back by the refill before the level
+// is positive again. Not thread safe.
+class TokenBucket {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TokenBucket() = default;
+    TokenBucket(double rate, double burst, Clock::time_point now = Clock::now());
+
+    // Tokens at `now`; negative while in debt.
+    double Level(Clock::time_point now);
+    // Removes `tokens` if there are that many; false leaves the bucket as is.
+    bool Take(double tokens, Clock::time_point now);
+    void Spend(double tokens, Clock::time_point now);
+    // How long from `now` until the level reaches `level` (at most burst).
+    Clock::duration TimeUntil(double level, Clock::time_point now);
+
+    double Rate() const { return m_rate; }
+    double Burst() const { return m_burst; }
+
+private:
+    double m_rate{0};
+    double m_burst{0};
+    double m_level{0};
+    Clock::time_point m_updated{};
+};
+
+} // namespace net
@@ -0,0 +1,256 @@
+#include "v2_transport.h"
+
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
+#include <openssl/rand.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "../../layer1-core/crypto/tagged_hash.h"
+
+namespace net {
+
+namespace {
+
+using ec_group_ptr = std::unique_ptr<EC_GROUP, decltype(&EC_GROUP_free)>;
+using ec_point_ptr = std::unique_ptr<EC_POINT, decltype(&EC_POINT_free)>;
+using bn_ptr = std::unique_ptr<BIGNUM, decltype(&BN_clear_free)>;
+using bn_ctx_ptr = std::unique_ptr<BN_CTX, decltype(&BN_CTX_free)>;
+using cipher_ctx_ptr = std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)>;
+
+// Short ids are part of the protocol: append only.
+constexpr std::array<std::string_view, 27> k_short_ids{
+    "version", "verack", "ping", "pong", "inv", "getdata", "tx", "block", "filterload", "filteradd", "filterclear",
+    "getcfilters", "getcfheaders", "sendcmpct", "getheaders", "headers", "sendtxrcncl", "reqrecon", "sketch",
+    "reconcildiff", "cmpctblock", "getblocktxn", "blocktxn", "getaddr", "addr", "cfilter", "cfheaders"};
+
+constexpr size_t k_command_bytes = 12;
+
+ec_group_ptr Secp256k1()
+{
+    ec_group_ptr group(EC_GROUP_new_by_curve_name(NID_secp256k1), &EC_GROUP_free);
+    if (!group) throw std::runtime_error("v2 transport: secp256k1 unavailable");
+    return group;
+}
+
+uint256 DeriveKey(const std::string& label, const std::vector<uint8_t>& material)
+{
+    return tagged_hash("DRM/v2/" + label, material.data(), material.size());
+}
+
+} // namespace
+
+struct V2Transport::Cipher {
+    uint256 lengthKey{};
+    uint256 payloadKey{};
+    uint64_t packet{0};
+    bool encrypt;
+    cipher_ctx_ptr length{EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free};
+    cipher_ctx_ptr aead{EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free};
+
+    Cipher(const uint256& l, const uint256& p, bool enc) : lengthKey(l), payloadKey(p), encrypt(enc)
+    {
+        if (!length || !aead || EVP_CipherInit_ex(length.get(), EVP_chacha20(), nullptr, nullptr, nullptr, 1) != 1 ||
+            EVP_CipherInit_ex(aead.get(), EVP_chacha20_poly1305(), nullptr, nullptr, nullptr, encrypt) != 1)
+            throw std::runtime_error("v2 transport: cipher setup failed");
+    }
+
+    ~Cipher()
+    {
+        OPENSSL_cleanse(lengthKey.data(), lengthKey.size());
+        OPENSSL_cleanse(payloadKey.data(), payloadKey.size());
+    }
+
+    // [packet in epoch(4)][epoch(8)], little endian.
+    std::array<uint8_t, 12> Nonce() const
+    {
+        std::array<uint8_t, 12> nonce{};
+        const uint64_t index = packet % k_rekey_interval;
+        const uint64_t epoch = packet / k_rekey_interval;
+        for (size_t i = 0; i < 4; ++i) nonce[i] = static_cast<uint8_t>(index >> (8 * i));
+        for (size_t i = 0; i < 8; ++i) nonce[4 + i] = static_cast<uint8_t>(epoch >> (8 * i));
+        return nonce;
+    }
+
+    void Length(const uint8_t* in, uint8_t* out)
+    {
+        // OpenSSL's ChaCha20 IV is the block counter followed by the nonce.
+        std::array<uint8_t, 16> iv{};
+        const auto nonce = Nonce();
+        std::memcpy(iv.data() + 4, nonce.data(), nonce.size());
+        int n = 0;
+        if (EVP_CipherInit_ex(length.get(), nullptr, nullptr, lengthKey.data(), iv.data(), 1) != 1 ||
+            EVP_CipherUpdate(length.get(), out, &n, in, static_cast<int>(k_length_bytes)) != 1)
+            throw std::runtime_error("v2 transport: length cipher failed");
+    }
+
+    bool Start(const uint8_t* aad)
+    {
+        const auto nonce = Nonce();
+        int n = 0;
+        return EVP_CipherInit_ex(aead.get(), nullptr, nullptr, payloadKey.data(), nonce.data(), encrypt) == 1 &&
+               EVP_CipherUpdate(aead.get(), nullptr, &n, aad, static_cast<int>(k_length_bytes)) == 1;
+    }
+
+    bool Update(uint8_t* out, const uint8_t* in, size_t size)
+    {
+        int n = 0;
+        return size == 0 || EVP_CipherUpdate(aead.get(), out, &n, in, static_cast<int>(size)) == 1;
+    }
+
+    void Advance()
+    {
+        ++packet;
+        if (packet % k_rekey_interval != 0) return;
+        lengthKey = tagged_hash("DRM/v2/rekey", lengthKey.data(), lengthKey.size());
+        payloadKey = tagged_hash("DRM/v2/rekey", payloadKey.data(), payloadKey.size());
+    }
+};
+
+V2Transport::V2Transport(bool initiator, uint32_t magic) : m_initiator(initiator), m_magic(magic)
+{
+    const auto group = Secp256k1();
+    bn_ctx_ptr ctx(BN_CTX_new(), &BN_CTX_free);
+    bn_ptr order(BN_new(), &BN_clear_free);
+    if (!ctx || !order || EC_GROUP_get_order(group.get(), order.get(), ctx.get()) != 1)
+        throw std::runtime_error("v2 transport: curve order unavailable");
+    bn_ptr secret(BN_new(), &BN_clear_free);
+    do {
+        if (RAND_bytes(m_secretKey.data(), static_cast<int>(m_secretKey.size())) != 1)
+            throw std::runtime_error("v2 transport: no randomness");
+        BN_bin2bn(m_secretKey.data(), static_cast<int>(m_secretKey.size()), secret.get());
+    } while (BN_is_zero(secret.get()) || BN_cmp(secret.get(), order.get()) >= 0);
+
+    ec_point_ptr pub(EC_POINT_new(group.get()), &EC_POINT_free);
+    if (!pub || EC_POINT_mul(group.get(), pub.get(), secret.get(), nullptr, nullptr, ctx.get()) != 1 ||
+        EC_POINT_point2oct(group.get(), pub.get(), POINT_CONVERSION_COMPRESSED, m_publicKey.data(), m_publicKey.size(),
+                           ctx.get()) != m_publicKey.size())
+        throw std::runtime_error("v2 transport: key generation failed");
+}
+
+V2Transport::~V2Transport()
+{
+    OPENSSL_cleanse(m_secretKey.data(), m_secretKey.size());
+}
+
+void V2Transport::Complete(const uint8_t* theirKey)
+{
+    const auto group = Secp256k1();
+    bn_ctx_ptr ctx(BN_CTX_new(), &BN_CTX_free);
+    ec_point_ptr theirs(EC_POINT_new(group.get()), &EC_POINT_free);
+    if (!ctx || !theirs || EC_POINT_oct2point(group.get(), theirs.get(), theirKey, k_key_bytes, ctx.get()) != 1 ||
+        EC_POINT_is_on_curve(group.get(), theirs.get(), ctx.get()) != 1 || EC_POINT_is_at_infinity(group.get(), theirs.get()))
+        throw std::runtime_error("v2 transport: bad public key");
+
+    bn_ptr secret(BN_bin2bn(m_secretKey.data(), static_cast<int>(m_secretKey.size()), nullptr), &BN_clear_free);
+    ec_point_ptr shared(EC_POINT_new(group.get()), &EC_POINT_free);
+    bn_ptr x(BN_new(), &BN_clear_free);
+    std::vector<uint8_t> material(32);
+    if (!secret || !shared || !x ||
+        EC_POINT_mul(group.get(), shared.get(), nullptr, theirs.get(), secret.get(), ctx.get()) != 1 ||
+        EC_POINT_get_affine_coordinates(group.get(), shared.get(), x.get(), nullptr, ctx.get()) != 1 ||
+        BN_bn2binpad(x.get(), material.data(), 32) != 32)
+        throw std::runtime_error("v2 transport: key exchange failed");
+    OPENSSL_cleanse(m_secretKey.data(), m_secretKey.size());
+
+    // Secret, then the initiator's key, the responder's and the network.
+    const uint8_t* initiatorKey = m_initiator ? m_publicKey.data() : theirKey;
+    const uint8_t* responderKey = m_initiator ? theirKey : m_publicKey.data();
+    material.insert(material.end(), initiatorKey, initiatorKey + k_key_bytes);
+    material.insert(material.end(), responderKey, responderKey + k_key_bytes);
+    for (size_t i = 0; i < sizeof(m_magic); ++i) material.push_back(static_cast<uint8_t>(m_magic >> (8 * i)));
+
+    auto initiatorCipher = [&](bool enc) {
+        return std::make_unique<Cipher>(DeriveKey("initiator_L", material), DeriveKey("initiator_P", material), enc);
+    };
+    auto responderCipher = [&](bool enc) {
+        return std::make_unique<Cipher>(DeriveKey("responder_L", material), DeriveKey("responder_P", material), enc);
+    };
+    m_send = m_initiator ? initiatorCipher(true) : responderCipher(true);
+    m_recv = m_initiator ? responderCipher(false) : initiatorCipher(false);
+    m_sessionId = DeriveKey("session_id", material);
+    OPENSSL_cleanse(material.data(), material.size());
+}
+
+uint8_t V2Transport::ShortId(std::string_view command)
+{
+    const auto it = std::find(k_short_ids.begin(), k_short_ids.end(), command);
+    return it == k_short_ids.end() ? 0 : static_cast<uint8_t>(it - k_short_ids.begin() + 1);
+}
+
+std::vector<uint8_t> V2Transport::Encrypt(std::string_view command, const uint8_t* payload, size_t size)
+{
+    if (!m_send) throw std::runtime_error("v2 transport: handshake not complete");
+    // [flags][short id] or [flags][0][command(12)]
+    std::array<uint8_t, 2 + k_command_bytes> head{};
+    head[1] = ShortId(command);
+    size_t headBytes = 2;
+    if (head[1] == 0) {
+        std::memcpy(head.data() + 2, command.data(), std::min(command.size(), k_command_bytes));
+        headBytes += k_command_bytes;
+    }
+    const size_t contents = headBytes + size;
+    if (contents > k_max_contents) throw std::runtime_error("v2 transport: message too large");
+
+    std::vector<uint8_t> out(k_length_bytes + contents + k_tag_bytes);
+    const uint8_t length[k_length_bytes] = {static_cast<uint8_t>(contents), static_cast<uint8_t>(contents >> 8),
+                                            static_cast<uint8_t>(contents >> 16)};
+    m_send->Length(length, out.data());
+    uint8_t* body = out.data() + k_length_bytes;
+    uint8_t rest[16];
+    int n = 0;
+    if (!m_send->Start(out.data()) || !m_send->Update(body, head.data(), headBytes) ||
+        !m_send->Update(body + headBytes, payload, size) || EVP_CipherFinal_ex(m_send->aead.get(), rest, &n) != 1 ||
+        EVP_CIPHER_CTX_ctrl(m_send->aead.get(), EVP_CTRL_AEAD_GET_TAG, static_cast<int>(k_tag_bytes), body + contents) != 1)
+        throw std::runtime_error("v2 transport: encryption failed");
+    m_send->Advance();
+    return out;
+}
+
+uint32_t V2Transport::DecryptLength(const uint8_t* in)
+{
+    if (!m_recv) throw std::runtime_error("v2 transport: handshake not complete");
+    uint8_t length[k_length_bytes];
+    m_recv->Length(in, length);
+    return static_cast<uint32_t>(length[0]) | static_cast<uint32_t>(length[1]) << 8 |
+           static_cast<uint32_t>(length[2]) << 16;
+}
+
+bool V2Transport::Decrypt(const uint8_t* in, uint32_t length, std::string& command, std::vector<uint8_t>& payload,
+                          bool& ignore)
+{
+    if (!m_recv || length < 2) return false;
+    const uint8_t* body = in + k_length_bytes;
+    // Nothing in the plaintext is looked at before the tag checks out.
+    payload.resize(length);
+    uint8_t rest[16];
+    int n = 0;
+    if (!m_recv->Start(in) || !m_recv->Update(payload.data(), body, length) ||
+        EVP_CIPHER_CTX_ctrl(m_recv->aead.get(), EVP_CTRL_AEAD_SET_TAG, static_cast<int>(k_tag_bytes),
+                            const_cast<uint8_t*>(body + length)) != 1 ||
+        EVP_CipherFinal_ex(m_recv->aead.get(), rest, &n) != 1)
+        return false;
+    const uint8_t flags = payload[0];
+    size_t headBytes = 2;
+    if (payload[1] == 0) {
+        if (length < headBytes + k_command_bytes) return false;
+        const auto* name = reinterpret_cast<const char*>(payload.data() + 2);
+        command.assign(name, std::find(name, name + k_command_bytes, '\0'));
+        headBytes += k_command_bytes;
+    } else if (payload[1] <= k_short_ids.size()) {
+        command.assign(k_short_ids[payload[1] - 1]);
+    } else {
+        return false;
+    }
+    payload.erase(payload.begin(), payload.begin() + static_cast<std::ptrdiff_t>(headBytes));
+    ignore = (flags & k_ignore) != 0;
+    m_recv->Advance();
+    return true;
+}
+
+} // namespace net
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace net {
+
+using uint256 = std::array<uint8_t, 32>;
+
+// Encrypted transport after BIP324. Each side sends an ephemeral secp256k1
+// public key (compressed, k_key_bytes) in the clear; the ECDH secret then
+// keys two ChaCha20 streams per direction, one hiding each packet's length
+// and one ChaCha20-Poly1305 AEAD for its contents:
+//
+//   [length(3), encrypted][flags(1) type payload, encrypted][tag(16)]
+//
+// The length counts flags, type and payload and is authenticated as the
+// AEAD's associated data. The type is one byte, an index into a fixed
+// table of commands (short id, counted from 1), or 0 followed by the
+// 12-byte NUL-padded command. Packets with k_ignore set in flags are
+// decoys and carry nothing. The nonce is the packet number; every
+// k_rekey_interval packets both keys of a direction are replaced by a hash
+// of themselves, so a key that leaks later does not open older traffic.
+//
+// Unlike BIP324 the public keys are plain points rather than ElligatorSwift
+// encodings and no garbage is sent, so the handshake itself can be told
+// from random bytes; what follows it cannot. Not thread safe: each
+// direction must be used from one thread at a time.
+class V2Transport {
+public:
+    static constexpr size_t k_key_bytes = 33;
+    static constexpr size_t k_length_bytes = 3;
+    static constexpr size_t k_tag_bytes = 16;
+    static constexpr size_t k_overhead = k_length_bytes + k_tag_bytes;
+    static constexpr uint8_t k_ignore = 0x80;
+    static constexpr uint32_t k_rekey_interval = 224;
+    // Contents cannot describe more than this.
+    static constexpr uint32_t k_max_contents = (1u << 24) - 1;
+
+    // `magic` separates the keys of different networks.
+    V2Transport(bool initiator, uint32_t magic);
+    ~V2Transport();
+    V2Transport(const V2Transport&) = delete;
+    V2Transport& operator=(const V2Transport&) = delete;
+
+    const std::array<uint8_t, k_key_bytes>& PublicKey() const { return m_publicKey; }
+    // Derives the session keys from the peer's public key. Throws
+    // std::runtime_error if it is not a point on the curve.
+    void Complete(const uint8_t* theirKey);
+    bool Ready() const { return m_send != nullptr; }
+    // The same on both ends of a session, for binding it to something else.
+    const uint256& SessionId() const { return m_sessionId; }
+
+    // The packet carrying `command` with `size` bytes of payload.
+    std::vector<uint8_t> Encrypt(std::string_view command, const uint8_t* payload, size_t size);
+    // Contents length of the next incoming packet, from its first
+    // k_length_bytes. Does not consume the packet.
+    uint32_t DecryptLength(const uint8_t* in);
+    // Opens the next incoming packet: `in` points at its length, which
+    // DecryptLength() returned as `length`. Fills command and payload (or
+    // sets `ignore` for a decoy); false if it fails authentication or is
+    // malformed, after which the session is unusable.
+    bool Decrypt(const uint8_t* in, uint32_t length, std::string& command, std::vector<uint8_t>& payload, bool& ignore);
+
+    // Short ids, for tests: 0 if the command has none.
+    static uint8_t ShortId(std::string_view command);
+
+private:
+    struct Cipher;
+
+    bool m_initiator;
+    uint32_t m_magic;
+    std::array<uint8_t, 32> m_secretKey{};
+    std::array<uint8_t, k_key_bytes> m_publicKey{};
+    uint256 m_sessionId{};
+    std::unique_ptr<Cipher> m_send;
+    std::unique_ptr<Cipher> m_recv;
+};
+
+} // namespace net
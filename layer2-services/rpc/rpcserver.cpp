@@ -5,15 +5,17 @@
 #include <algorithm>
 #include <chrono>
 #include <cstdio>
-#include <fstream>
 #include <sstream>
 #include <stdexcept>
 #include <cstring>
+#include <limits>
 #include <unordered_map>
 #include <openssl/sha.h>
 
 #include "rpcserver.h"
+#include "../../layer1-core/chainstate/snapshot.h"
 #include "../../layer1-core/consensus/params.h"
+#include "../../layer1-core/crypto/crc32c.h"
 #include "../../layer1-core/tx/transaction.h"
 #include "../../sidechain/wasm/runtime/types.h"
 
@@ -218,45 +220,14 @@ std::string FormatExecResult(const sidechain::wasm::ExecutionResult& res)
     return ss.str();
 }
 
-static Block DeserializeBlock(const std::vector<uint8_t>& buf)
-{
-    Block block{};
-    if (buf.size() < sizeof(BlockHeader)) return block;
-
-    std::memcpy(&block.header, buf.data(), sizeof(BlockHeader));
-    size_t offset = sizeof(BlockHeader);
-
-    if (offset + sizeof(uint32_t) > buf.size()) return block;
-    uint32_t txCount{0};
-    std::memcpy(&txCount, buf.data() + offset, sizeof(txCount));
-    offset += sizeof(txCount);
-
-    block.transactions.reserve(txCount);
-    for (uint32_t i = 0; i < txCount && offset < buf.size(); ++i) {
-        if (offset + sizeof(uint32_t) > buf.size()) break;
-        uint32_t len{0};
-        std::memcpy(&len, buf.data() + offset, sizeof(len));
-        offset += sizeof(len);
-        if (offset + len > buf.size()) break;
-        std::vector<uint8_t> txBytes(buf.begin() + offset, buf.begin() + offset + len);
-        offset += len;
-        try {
-            block.transactions.push_back(DeserializeTransaction(txBytes));
-        } catch (...) {
-            break;
-        }
-    }
-    return block;
-}
-
 RPCServer::RPCServer(boost::asio::io_context& io, const std::string& user, const std::string& pass, uint16_t port)
     : m_io(io), m_acceptor(io, {boost::asio::ip::tcp::v4(), port}), m_user(user), m_pass(pass)
 {
 }
 
-void RPCServer::SetBlockStorePath(std::string path)
+void RPCServer::SetBlockStore(BlockStore* blocks)
 {
-    m_blockPath = std::move(path);
+    m_blocks = blocks;
 }
 
 void RPCServer::AttachCoreHandlers(mempool::Mempool& pool, wallet::WalletBackend& wallet, txindex::TxIndex& index, net::P2PNode& p2p)
@@ -292,10 +263,8 @@ void RPCServer::AttachCoreHandlers(mempool::Mempool& pool, wallet::WalletBackend
         return false;
     };
 
-    pool.SetOnAccept([&p2p](const Transaction& tx) {
-        auto payload = Serialize(tx);
-        p2p.Broadcast(net::Message{"tx", payload});
-    });
+    // Whatever the mempool accepts (from RPC or peers) is announced.
+    pool.SetOnAccept([&p2p](const Transaction& tx) { p2p.RelayTransaction(tx.GetHash()); });
 
     Register("getbalance", [&wallet, &formatBalances, &parseAssetParam](const std::string& params) {
         auto trimmed = TrimQuotes(params);
@@ -321,18 +290,25 @@ void RPCServer::AttachCoreHandlers(mempool::Mempool& pool, wallet::WalletBackend
 
     Register("getrawtransaction", [&index, this](const std::string& params) {
         auto hash = ParseHash(params);
-        std::stringstream ss;
-        uint32_t height{0};
-        if (!index.Lookup(hash, height)) return std::string("null");
-        auto blk = ReadBlock(height);
-        if (!blk) return std::string("null");
-        for (const auto& tx : blk->transactions) {
-            if (tx.GetHash() == hash) {
-                ss << '"' << HexEncode(Serialize(tx)) << '"';
-                return ss.str();
+        auto loc = index.Locate(hash);
+        if (!loc || !m_blocks) return std::string("null");
+        std::optional<Transaction> found;
+        try {
+            // One small read when the index knows the exact position.
+            if (loc->pos) {
+                auto tx = m_blocks->ReadTransaction(*loc->pos);
+                if (tx.GetHash() == hash) found = std::move(tx);
+            }
+            if (!found && m_blocks->HasBlock(loc->height)) {
+                for (auto& tx : m_blocks->ReadBlock(loc->height).transactions) {
+                    if (tx.GetHash() == hash) { found = std::move(tx); break; }
+                }
             }
+        } catch (const std::exception&) {
+            return std::string("null");
         }
-        return std::string("null");
+        if (!found) return std::string("null");
+        return '"' + HexEncode(Serialize(*found)) + '"';
     });
 
     Register("getutxos", [&wallet, &formatBalances, &parseAssetParam](const std::string& params) {
@@ -352,16 +328,12 @@ void RPCServer::AttachCoreHandlers(mempool::Mempool& pool, wallet::WalletBackend
         return std::to_string(pool.EstimateFeeRate(percentile));
     });
 
-    Register("sendtx", [&pool, &p2p](const std::string& params) {
+    Register("sendtx", [&pool](const std::string& params) {
         auto hex = TrimQuotes(params);
         auto raw = ParseHex(hex);
         Transaction tx = DeserializeTransaction(raw);
         uint64_t fee = 0; // rely on caller to include fee in inputs/outputs difference
         bool ok = pool.Accept(tx, fee);
-        if (ok) {
-            auto payload = Serialize(tx);
-            p2p.Broadcast(net::Message{"tx", payload});
-        }
         return std::string("{\"accepted\":") + (ok ? "true" : "false") + "}";
     });
 
@@ -384,6 +356,29 @@ void RPCServer::AttachCoreHandlers(mempool::Mempool& pool, wallet::WalletBackend
         return ss.str();
     });
 
+    Register("getnettotals", [&p2p](const std::string&) {
+        const auto traffic = p2p.Traffic();
+        auto counters = [](const net::TrafficCounters& c) {
+            std::stringstream ss;
+            ss << "{\"msgs_recv\":" << c.messagesReceived << ",\"bytes_recv\":" << c.bytesReceived
+               << ",\"msgs_sent\":" << c.messagesSent << ",\"bytes_sent\":" << c.bytesSent << "}";
+            return ss.str();
+        };
+        std::stringstream ss;
+        ss << "{\"total\":" << counters(traffic.total) << ",\"by_command\":{";
+        bool first = true;
+        for (const auto& [command, c] : traffic.byCommand) {
+            if (!first) ss << ",";
+            ss << "\"" << command << "\":" << counters(c);
+            first = false;
+        }
+        ss << "},\"rate_limited\":" << traffic.rateLimited
+           << ",\"upload_waits\":" << traffic.uploadWaits
+           << ",\"peer_upload_limit\":" << traffic.peerUploadLimit
+           << ",\"total_upload_limit\":" << traffic.totalUploadLimit << "}";
+        return ss.str();
+    });
+
     Register("getassetpolicy", [&](const std::string& params) {
         auto trimmed = TrimQuotes(params);
         std::stringstream ss;
@@ -411,6 +406,191 @@ void RPCServer::AttachCoreHandlers(mempool::Mempool& pool, wallet::WalletBackend
     });
 }
 
+void RPCServer::AttachChainstateHandlers(Chainstate& chainstate, const consensus::Params& params)
+{
+    auto formatSnapshot = [](const UTXOSnapshotMetadata& meta) {
+        std::stringstream ss;
+        ss << "{\"height\":" << meta.height
+           << ",\"blockhash\":\"" << EncodeHex(std::vector<uint8_t>(meta.blockHash.begin(), meta.blockHash.end())) << "\""
+           << ",\"coins\":" << meta.coinCount
+           << ",\"commitment\":\"" << EncodeHex(std::vector<uint8_t>(meta.commitment.begin(), meta.commitment.end())) << "\"}";
+        return ss.str();
+    };
+
+    // params: "path=<file>"
+    Register("dumptxoutset", [&chainstate, formatSnapshot](const std::string& params) {
+        auto kv = ParseKeyValues(params);
+        if (kv["path"].empty()) throw std::runtime_error("path required");
+        return formatSnapshot(DumpUTXOSnapshot(chainstate, kv["path"]));
+    });
+
+    // params: "path=<file>[;commitment=<hex>][;workers=<n>]". Without an
+    // explicit commitment only heights listed in assumeutxo are accepted.
+    Register("loadtxoutset", [&chainstate, &params, formatSnapshot](const std::string& raw) {
+        auto kv = ParseKeyValues(raw);
+        if (kv["path"].empty()) throw std::runtime_error("path required");
+        std::optional<uint256> commitment;
+        if (!kv["commitment"].empty()) {
+            auto bytes = ParseHex(kv["commitment"]);
+            if (bytes.size() != 32) throw std::runtime_error("commitment must be 32 bytes");
+            uint256 c{};
+            std::copy(bytes.begin(), bytes.end(), c.begin());
+            commitment = c;
+        }
+        size_t workers = kv["workers"].empty() ? 0 : std::stoul(kv["workers"]);
+        return formatSnapshot(LoadUTXOSnapshot(chainstate, kv["path"], params, commitment, workers));
+    });
+
+    // Served from the running totals kept by Chainstate; never scans the DB.
+    Register("gettxoutsetinfo", [&chainstate](const std::string&) {
+        auto stats = chainstate.Stats();
+        auto best = chainstate.BestBlock();
+        std::stringstream ss;
+        ss << "{";
+        if (best) {
+            ss << "\"height\":" << best->height
+               << ",\"bestblock\":\"" << EncodeHex(std::vector<uint8_t>(best->hash.begin(), best->hash.end())) << "\",";
+        }
+        ss << "\"txouts\":" << stats.coins
+           << ",\"serialized_size\":" << stats.serializedSize
+           << ",\"muhash\":\"" << EncodeHex(std::vector<uint8_t>(stats.muhash.begin(), stats.muhash.end())) << "\""
+           << ",\"total_amount\":{";
+        bool first = true;
+        for (const auto& [asset, amount] : stats.totalAmount) {
+            if (!first) ss << ",";
+            first = false;
+            ss << "\"" << consensus::AssetSymbol(asset) << "\":" << amount;
+        }
+        ss << "}}";
+        return ss.str();
+    });
+}
+
+void RPCServer::AttachAddressIndexHandlers(addrindex::AddressIndex& index)
+{
+    // Both calls page with "limit" (default and max 1000) and continue from
+    // the "next" cursor returned by the previous page.
+    constexpr size_t kMaxPage = 1000;
+    auto parseKey = [](std::unordered_map<std::string, std::string>& kv) {
+        auto bytes = ParseHex(kv["key"]);
+        if (bytes.size() != 32) throw std::runtime_error("key must be 32 bytes");
+        addrindex::ScriptKey key{};
+        std::copy(bytes.begin(), bytes.end(), key.begin());
+        return key;
+    };
+    auto parsePage = [](std::unordered_map<std::string, std::string>& kv) {
+        size_t limit = kv["limit"].empty() ? kMaxPage : std::stoul(kv["limit"]);
+        if (limit == 0 || limit > kMaxPage) throw std::runtime_error("limit must be 1-1000");
+        std::optional<std::string> cursor;
+        if (!kv["cursor"].empty()) {
+            auto bytes = ParseHex(kv["cursor"]);
+            cursor = std::string(bytes.begin(), bytes.end());
+        }
+        return std::make_pair(limit, cursor);
+    };
+    auto formatPage = [](const addrindex::AddressPage& page) {
+        std::stringstream ss;
+        ss << "{\"entries\":[";
+        for (size_t i = 0; i < page.entries.size(); ++i) {
+            const auto& e = page.entries[i];
+            if (i) ss << ",";
+            ss << "{\"txid\":\"" << EncodeHex(std::vector<uint8_t>(e.outpoint.hash.begin(), e.outpoint.hash.end())) << "\""
+               << ",\"vout\":" << e.outpoint.index
+               << ",\"height\":" << e.height
+               << ",\"value\":" << e.value
+               << ",\"asset\":" << static_cast<int>(e.assetId);
+            if (e.spentBy) {
+                ss << ",\"spent\":{\"txid\":\"" << EncodeHex(std::vector<uint8_t>(e.spentBy->txid.begin(), e.spentBy->txid.end())) << "\""
+                   << ",\"vin\":" << e.spentBy->vin
+                   << ",\"height\":" << e.spentBy->height << "}";
+            }
+            ss << "}";
+        }
+        ss << "]";
+        if (page.next) ss << ",\"next\":\"" << EncodeHex(std::vector<uint8_t>(page.next->begin(), page.next->end())) << "\"";
+        ss << "}";
+        return ss.str();
+    };
+
+    // params: "key=<hex>[;from=<height>][;to=<height>][;limit=<n>][;cursor=<hex>]"
+    Register("getaddresshistory", [&index, parseKey, parsePage, formatPage](const std::string& raw) {
+        auto kv = ParseKeyValues(raw);
+        auto key = parseKey(kv);
+        uint32_t from = kv["from"].empty() ? 0 : static_cast<uint32_t>(std::stoul(kv["from"]));
+        uint32_t to = kv["to"].empty() ? std::numeric_limits<uint32_t>::max() : static_cast<uint32_t>(std::stoul(kv["to"]));
+        auto [limit, cursor] = parsePage(kv);
+        return formatPage(index.History(key, from, to, limit, cursor));
+    });
+
+    // params: "key=<hex>[;limit=<n>][;cursor=<hex>]"
+    Register("getaddressutxos", [&index, parseKey, parsePage, formatPage](const std::string& raw) {
+        auto kv = ParseKeyValues(raw);
+        auto key = parseKey(kv);
+        auto [limit, cursor] = parsePage(kv);
+        return formatPage(index.Utxos(key, limit, cursor));
+    });
+}
+
+void RPCServer::AttachBlockFilterHandlers(blockfilter::BlockFilterIndex& index)
+{
+    // params: "height=<n>"
+    Register("getblockfilter", [&index](const std::string& raw) {
+        auto kv = ParseKeyValues(raw);
+        if (kv["height"].empty()) throw std::runtime_error("height required");
+        auto entry = index.Entry(static_cast<uint32_t>(std::stoul(kv["height"])));
+        if (!entry) throw std::runtime_error("filter not available");
+        std::stringstream ss;
+        ss << "{\"blockhash\":\"" << EncodeHex(std::vector<uint8_t>(entry->blockHash.begin(), entry->blockHash.end())) << "\""
+           << ",\"filter\":\"" << EncodeHex(entry->filter) << "\""
+           << ",\"header\":\"" << EncodeHex(std::vector<uint8_t>(entry->header.begin(), entry->header.end())) << "\"}";
+        return ss.str();
+    });
+}
+
+void RPCServer::AttachScrubberHandlers(BlockScrubber& scrubber)
+{
+    Register("getscrubinfo", [&scrubber](const std::string&) {
+        const auto status = scrubber.Status();
+        std::stringstream ss;
+        ss << "{\"crc32c\":\"" << (Crc32cAccelerated() ? "hardware" : "software") << "\""
+           << ",\"passes\":" << status.passes
+           << ",\"blocks_verified\":" << status.blocksVerified
+           << ",\"bytes_verified\":" << status.bytesVerified
+           << ",\"repaired\":" << status.repaired;
+        if (status.position) ss << ",\"position\":" << *status.position;
+        ss << ",\"damaged\":[";
+        for (size_t i = 0; i < status.damaged.size(); ++i) {
+            const auto& range = status.damaged[i];
+            if (i) ss << ",";
+            ss << "{\"first\":" << range.first << ",\"last\":" << range.last
+               << ",\"error\":\"" << JsonEscape(range.error) << "\"}";
+        }
+        ss << "]}";
+        return ss.str();
+    });
+}
+
+void RPCServer::AttachSyncHandlers(net::BlockSync& sync)
+{
+    Register("getsyncinfo", [&sync](const std::string&) {
+        const auto status = sync.Status();
+        std::stringstream ss;
+        ss << "{";
+        if (status.headerHeight) ss << "\"headers\":" << *status.headerHeight << ",";
+        if (status.connectedHeight) ss << "\"blocks\":" << *status.connectedHeight << ",";
+        ss << "\"peers\":" << status.peers
+           << ",\"in_flight\":" << status.inFlight
+           << ",\"buffered\":" << status.buffered
+           << ",\"downloaded\":" << status.downloaded
+           << ",\"reassigned\":" << status.reassigned
+           << ",\"rejected\":" << status.rejected
+           << ",\"forked\":" << (status.forked ? "true" : "false");
+        if (status.failedHeight) ss << ",\"failed_height\":" << *status.failedHeight;
+        ss << "}";
+        return ss.str();
+    });
+}
+
 void RPCServer::AttachBridgeHandlers(crosschain::BridgeManager& bridge)
 {
     Register("createbridgelock", [&bridge, this](const std::string& params) {
@@ -709,87 +889,6 @@ std::string RPCServer::HexEncode(const std::vector<uint8_t>& data)
     return EncodeHex(data);
 }
 
-std::optional<Block> RPCServer::ReadBlock(uint32_t height)
-{
-    // Improved block retrieval using indexed access via height->offset mapping.
-    // Block index file (.idx) contains height->file_offset pairs for O(1) lookups
-    // instead of the previous O(n) linear scan through all blocks.
-    
-    // Load block index if not already cached
-    std::ifstream indexFile(m_blockPath + ".idx", std::ios::binary);
-    if (!indexFile.is_open()) {
-        // Fallback: If index doesn't exist, try legacy linear scan for backwards compatibility
-        // This ensures the RPC server can still read old block files without an index.
-        std::ifstream file(m_blockPath, std::ios::binary);
-        if (!file.is_open()) return std::nullopt;
-        
-        while (file.peek() != EOF) {
-            uint32_t h = 0; uint32_t len = 0;
-            file.read(reinterpret_cast<char*>(&h), sizeof(h));
-            file.read(reinterpret_cast<char*>(&len), sizeof(len));
-            if (!file || len > 100*1024*1024) break; // Sanity check: block size < 100MB
-            std::vector<uint8_t> buf(len);
-            file.read(reinterpret_cast<char*>(buf.data()), len);
-            if (h == height) {
-                return DeserializeBlock(buf);
-            }
-        }
-        return std::nullopt;
-    }
-    
-    // Read index to find block offset
-    // Index file format: [count] [height, offset] pairs
-    // Heights are stored in ascending order, allowing binary search
-    uint32_t indexCount = 0;
-    indexFile.read(reinterpret_cast<char*>(&indexCount), sizeof(indexCount));
-    if (!indexFile || indexCount > 10000000) return std::nullopt; // Sanity check
-    
-    // Binary search through index entries for O(log n) lookup
-    // This is more efficient than O(n) linear scan for large blockchains
-    std::optional<uint64_t> blockOffset;
-    uint32_t left = 0, right = indexCount;
-    
-    while (left < right) {
-        uint32_t mid = left + (right - left) / 2;
-        indexFile.seekg(sizeof(uint32_t) + mid * (sizeof(uint32_t) + sizeof(uint64_t)));
-        
-        uint32_t h = 0;
-        uint64_t offset = 0;
-        indexFile.read(reinterpret_cast<char*>(&h), sizeof(h));
-        indexFile.read(reinterpret_cast<char*>(&offset), sizeof(offset));
-        
-        if (!indexFile) break;
-        
-        if (h == height) {
-            blockOffset = offset;
-            break;
-        } else if (h < height) {
-            left = mid + 1;
-        } else {
-            right = mid;
-        }
-    }
-    
-    if (!blockOffset) return std::nullopt;
-    
-    // Seek to block offset and read
-    std::ifstream blockFile(m_blockPath, std::ios::binary);
-    if (!blockFile.is_open()) return std::nullopt;
-    
-    blockFile.seekg(*blockOffset);
-    if (!blockFile.good()) return std::nullopt;
-    
-    uint32_t blockSize = 0;
-    blockFile.read(reinterpret_cast<char*>(&blockSize), sizeof(blockSize));
-    if (!blockFile || blockSize == 0 || blockSize > 100*1024*1024) return std::nullopt;
-    
-    std::vector<uint8_t> buf(blockSize);
-    blockFile.read(reinterpret_cast<char*>(buf.data()), blockSize);
-    if (!blockFile) return std::nullopt;
-    
-    return DeserializeBlock(buf);
-}
-
 std::vector<uint8_t> RPCServer::ParseHex(const std::string& hex)
 {
     // Maximum allowed hex string size: 1MB (512KB binary data)
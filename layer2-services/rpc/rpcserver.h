@@ -9,11 +9,18 @@
 #include <unordered_map>
 #include <vector>
 
+#include "../index/addressindex.h"
+#include "../index/blockfilterindex.h"
 #include "../index/txindex.h"
 #include "../mempool/mempool.h"
 #include "../net/p2p.h"
+#include "../net/block_sync.h"
 #include "../wallet/wallet.h"
 #include "../../layer1-core/block/block.h"
+#include "../../layer1-core/chainstate/coins.h"
+#include "../../layer1-core/consensus/params.h"
+#include "../../layer1-core/storage/blockstore.h"
+#include "../../layer1-core/storage/scrubber.h"
 #include "../../layer1-core/tx/transaction.h"
 #include "../crosschain/bridge/bridge_manager.h"
 #include "../../sidechain/rpc/wasm_rpc.h"
@@ -28,9 +35,15 @@ public:
 
     RPCServer(boost::asio::io_context& io, const std::string& user, const std::string& pass, uint16_t port);
 
-    void SetBlockStorePath(std::string path);
+    // Block files used to serve getrawtransaction. Not owned; may be null.
+    void SetBlockStore(BlockStore* blocks);
 
     void AttachCoreHandlers(mempool::Mempool& pool, wallet::WalletBackend& wallet, txindex::TxIndex& index, net::P2PNode& p2p);
+    void AttachChainstateHandlers(Chainstate& chainstate, const consensus::Params& params);
+    void AttachAddressIndexHandlers(addrindex::AddressIndex& index);
+    void AttachBlockFilterHandlers(blockfilter::BlockFilterIndex& index);
+    void AttachScrubberHandlers(BlockScrubber& scrubber);
+    void AttachSyncHandlers(net::BlockSync& sync);
     void AttachBridgeHandlers(crosschain::BridgeManager& bridge);
     void AttachSidechainHandlers(sidechain::rpc::WasmRpcService& wasm);
 
@@ -48,7 +61,6 @@ private:
     bool RateLimit(const std::string& remote);
     Handler GetHandler(const std::string& name);
     static std::string HexEncode(const std::vector<uint8_t>& data);
-    std::optional<Block> ReadBlock(uint32_t height);
     static std::vector<uint8_t> ParseHex(const std::string& hex);
     static uint256 ParseHash(const std::string& params);
     static std::string TrimQuotes(std::string in);
@@ -60,7 +72,7 @@ private:
     std::string m_pass;
     std::unordered_map<std::string, Handler> m_handlers;
     mutable std::mutex m_mutex;
-    std::string m_blockPath{"mainnet/blocks.dat"};
+    BlockStore* m_blocks{nullptr};
     std::unordered_map<std::string, std::pair<size_t, std::chrono::steady_clock::time_point>> m_rate;
     std::string m_token{"drachma-token"};
 };
@@ -106,6 +106,98 @@ int main()
         assert(cs.GetUTXO(opA).value == 25);
     }
 
+    // Set statistics track every update, undo cleanly on rollback, and the
+    // set hash depends only on the final contents.
+    {
+        std::filesystem::path statsPath = std::filesystem::temp_directory_path() / "drachma_chainstate_stats";
+        std::filesystem::remove_all(statsPath.string() + ".ldb", ec);
+        std::filesystem::remove(statsPath, ec);
+        UTXOSetStats before;
+        UTXOSetStats after;
+        {
+            Chainstate cs(statsPath.string(), 4);
+            auto empty = cs.Stats();
+            assert(empty.coins == 0 && empty.serializedSize == 0 && empty.totalAmount.empty());
+
+            cs.AddUTXO(MakeOutPoint(0x10, 0), MakeOutput(100, 0xA1, 1));
+            cs.AddUTXO(MakeOutPoint(0x11, 0), MakeOutput(7, 0xA2, 2));
+            before = cs.Stats();
+            assert(before.coins == 2);
+            assert(before.totalAmount.at(1) == 100 && before.totalAmount.at(2) == 7);
+            assert(before.serializedSize == 2 * (36 + 9 + 32));
+
+            cs.BeginTransaction();
+            cs.SpendUTXO(MakeOutPoint(0x10, 0));
+            cs.AddUTXO(MakeOutPoint(0x12, 1), MakeOutput(60, 0xA3, 1));
+            cs.AddUTXO(MakeOutPoint(0x11, 0), MakeOutput(9, 0xA2, 2)); // overwrite
+            assert(cs.Stats().totalAmount.at(1) == 60);
+            cs.Rollback();
+            auto rolledBack = cs.Stats();
+            assert(rolledBack.coins == before.coins);
+            assert(rolledBack.totalAmount == before.totalAmount);
+            assert(rolledBack.muhash == before.muhash);
+
+            cs.SpendUTXO(MakeOutPoint(0x10, 0));
+            cs.AddUTXO(MakeOutPoint(0x12, 1), MakeOutput(60, 0xA3, 1));
+            after = cs.Stats();
+            assert(after.muhash != before.muhash);
+            cs.Flush();
+        }
+        {
+            // Same contents built in a different order hash identically.
+            std::filesystem::path otherPath = std::filesystem::temp_directory_path() / "drachma_chainstate_stats_b";
+            std::filesystem::remove_all(otherPath.string() + ".ldb", ec);
+            std::filesystem::remove(otherPath, ec);
+            Chainstate other(otherPath.string(), 4);
+            other.AddUTXO(MakeOutPoint(0x12, 1), MakeOutput(60, 0xA3, 1));
+            other.AddUTXO(MakeOutPoint(0x11, 0), MakeOutput(7, 0xA2, 2));
+            assert(other.Stats().muhash == after.muhash);
+            std::filesystem::remove_all(otherPath.string() + ".ldb", ec);
+            std::filesystem::remove(otherPath, ec);
+        }
+        {
+            Chainstate reloaded(statsPath.string(), 4);
+            auto stats = reloaded.Stats();
+            assert(stats.coins == after.coins);
+            assert(stats.serializedSize == after.serializedSize);
+            assert(stats.totalAmount == after.totalAmount);
+            assert(stats.muhash == after.muhash);
+        }
+        std::filesystem::remove_all(statsPath.string() + ".ldb", ec);
+        std::filesystem::remove(statsPath, ec);
+    }
+
+    // The best-block marker is written with the block's coins: a committed
+    // block survives reopen with its marker, a rolled-back one leaves neither.
+    {
+        std::filesystem::path tipPath = std::filesystem::temp_directory_path() / "drachma_chainstate_tip";
+        std::filesystem::remove_all(tipPath.string() + ".ldb", ec);
+        std::filesystem::remove(tipPath, ec);
+        BestBlockMarker tip;
+        tip.hash.fill(0x42);
+        tip.height = 7;
+        {
+            Chainstate cs(tipPath.string(), 4);
+            cs.BeginTransaction();
+            cs.AddUTXO(MakeOutPoint(0x20, 0), MakeOutput(5, 0xB1));
+            cs.Commit(tip);
+            assert(cs.BestBlock() && cs.BestBlock()->height == 7);
+
+            cs.BeginTransaction();
+            cs.AddUTXO(MakeOutPoint(0x21, 0), MakeOutput(6, 0xB2));
+            cs.Rollback();
+        }
+        {
+            Chainstate cs(tipPath.string(), 4);
+            auto best = cs.BestBlock();
+            assert(best && best->height == 7 && best->hash == tip.hash);
+            assert(cs.HaveUTXO(MakeOutPoint(0x20, 0)));
+            assert(!cs.HaveUTXO(MakeOutPoint(0x21, 0)));
+        }
+        std::filesystem::remove_all(tipPath.string() + ".ldb", ec);
+        std::filesystem::remove(tipPath, ec);
+    }
+
     std::filesystem::remove(temp, ec);
     return 0;
 }
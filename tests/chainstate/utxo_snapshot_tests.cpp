@@ -0,0 +1,152 @@
+#include "../../layer1-core/chainstate/snapshot.h"
+#include <cassert>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <vector>
+
+namespace {
+
+OutPoint MakeOutPoint(uint8_t seed, uint32_t index)
+{
+    OutPoint op{};
+    op.hash.fill(seed);
+    op.index = index;
+    return op;
+}
+
+TxOut MakeOutput(uint64_t value, uint8_t tag, uint8_t asset = 1)
+{
+    TxOut out{};
+    out.value = value;
+    out.scriptPubKey.assign(32, tag);
+    out.assetId = asset;
+    return out;
+}
+
+bool Throws(const std::function<void()>& fn)
+{
+    try {
+        fn();
+    } catch (const std::exception&) {
+        return true;
+    }
+    return false;
+}
+
+} // namespace
+
+int main()
+{
+    const auto dir = std::filesystem::temp_directory_path() / "drachma_utxo_snapshot";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    const auto snapshotPath = (dir / "utxo.snapshot").string();
+
+    BestBlockMarker base;
+    base.hash.fill(0x5A);
+    base.height = 1234;
+
+    // Dump a chainstate spanning several chunks, including multi-output txids.
+    UTXOSnapshotMetadata dumped;
+    UTXOSetStats sourceStats;
+    {
+        Chainstate source((dir / "source").string(), 16);
+        for (uint8_t seed = 1; seed <= 40; ++seed) {
+            for (uint32_t idx = 0; idx < static_cast<uint32_t>(seed % 4) + 1; ++idx)
+                source.AddUTXO(MakeOutPoint(seed, idx * 3), MakeOutput(1000ULL * seed + idx, seed, seed % 3));
+        }
+        bool threw = Throws([&]() { DumpUTXOSnapshot(source, snapshotPath); });
+        assert(threw); // no best block yet
+        source.SetBestBlock(base);
+        dumped = DumpUTXOSnapshot(source, snapshotPath, /*coinsPerChunk=*/7);
+        assert(dumped.height == base.height);
+        assert(dumped.blockHash == base.hash);
+        assert(dumped.coinCount == source.SortedUTXOs().size());
+        sourceStats = source.Stats();
+
+        // Chunking must not influence the commitment.
+        auto rechunked = DumpUTXOSnapshot(source, (dir / "rechunked.snapshot").string(), 1000);
+        assert(rechunked.commitment == dumped.commitment);
+
+        auto header = ReadUTXOSnapshotMetadata(snapshotPath);
+        assert(header.commitment == dumped.commitment);
+        assert(header.coinCount == dumped.coinCount);
+    }
+
+    consensus::Params params = consensus::Testnet();
+
+    // Unknown heights are refused unless the operator supplies the commitment.
+    {
+        Chainstate target((dir / "untrusted").string(), 16);
+        bool threw = Throws([&]() { LoadUTXOSnapshot(target, snapshotPath, params); });
+        assert(threw);
+        assert(target.Empty());
+    }
+
+    // Trusted via assumeutxo: every coin and the base marker round-trip.
+    {
+        params.assumeutxo[base.height] = dumped.commitment;
+        Chainstate target((dir / "target").string(), 16);
+        auto loaded = LoadUTXOSnapshot(target, snapshotPath, params, std::nullopt, /*workers=*/3);
+        assert(loaded.commitment == dumped.commitment);
+        auto best = target.BestBlock();
+        assert(best && best->height == base.height && best->hash == base.hash);
+        assert(target.GetUTXO(MakeOutPoint(7, 6)).value == 7002);
+        assert(target.GetUTXO(MakeOutPoint(40, 0)).assetId == 1);
+        assert(!target.HaveUTXO(MakeOutPoint(41, 0)));
+        assert(target.SortedUTXOs().size() == dumped.coinCount);
+        auto stats = target.Stats();
+        assert(stats.coins == sourceStats.coins);
+        assert(stats.totalAmount == sourceStats.totalAmount);
+        assert(stats.muhash == sourceStats.muhash);
+
+        // Loading on top of a populated chainstate is refused.
+        bool threw = Throws([&]() { LoadUTXOSnapshot(target, snapshotPath, params); });
+        assert(threw);
+    }
+
+    // A flipped payload byte is caught by the commitment and leaves nothing behind.
+    {
+        std::vector<char> bytes;
+        {
+            std::ifstream in(snapshotPath, std::ios::binary);
+            bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        bytes[bytes.size() - 3] ^= 0x01; // inside the last script
+        const auto tampered = (dir / "tampered.snapshot").string();
+        {
+            std::ofstream out(tampered, std::ios::binary);
+            out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        }
+        Chainstate target((dir / "tampered").string(), 16);
+        bool threw = Throws([&]() { LoadUTXOSnapshot(target, tampered, params); });
+        assert(threw);
+        assert(target.Empty());
+        assert(!target.BestBlock());
+    }
+
+    // An explicit commitment overrides assumeutxo and must match the header.
+    {
+        uint256 wrong = dumped.commitment;
+        wrong[0] ^= 0xFF;
+        Chainstate target((dir / "explicit").string(), 16);
+        bool threw = Throws([&]() { LoadUTXOSnapshot(target, snapshotPath, params, wrong); });
+        assert(threw);
+        auto ok = LoadUTXOSnapshot(target, snapshotPath, params, dumped.commitment, 1);
+        assert(ok.coinCount == dumped.coinCount);
+    }
+
+    // Imported coins replace whatever the cache held for them.
+    {
+        Chainstate used((dir / "used").string(), 16);
+        used.AddUTXO(MakeOutPoint(9, 0), MakeOutput(1, 9));
+        assert(used.GetUTXO(MakeOutPoint(9, 0)).value == 1);
+        used.ImportUTXOs({{MakeOutPoint(9, 0), MakeOutput(2, 9)}});
+        assert(used.GetUTXO(MakeOutPoint(9, 0)).value == 2);
+        assert(used.Stats().coins == 1);
+    }
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
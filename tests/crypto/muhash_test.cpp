@@ -0,0 +1,71 @@
+#include "../../layer1-core/crypto/muhash.h"
+#include <cassert>
+#include <string>
+
+namespace {
+
+void Insert(MuHash3072& h, const std::string& s)
+{
+    h.Insert(reinterpret_cast<const uint8_t*>(s.data()), s.size());
+}
+
+void Remove(MuHash3072& h, const std::string& s)
+{
+    h.Remove(reinterpret_cast<const uint8_t*>(s.data()), s.size());
+}
+
+} // namespace
+
+int main()
+{
+    const uint256 empty = MuHash3072().Finalize();
+
+    // Order independence.
+    MuHash3072 a;
+    Insert(a, "alpha");
+    Insert(a, "beta");
+    Insert(a, "gamma");
+    MuHash3072 b;
+    Insert(b, "gamma");
+    Insert(b, "alpha");
+    Insert(b, "beta");
+    assert(a.Finalize() == b.Finalize());
+    assert(a.Finalize() != empty);
+
+    // Removal undoes insertion, even before the element was added.
+    MuHash3072 c;
+    Remove(c, "beta");
+    Insert(c, "alpha");
+    Insert(c, "beta");
+    Insert(c, "beta");
+    Insert(c, "gamma");
+    assert(c.Finalize() == a.Finalize());
+    Remove(c, "alpha");
+    Remove(c, "beta");
+    Remove(c, "gamma");
+    assert(c.Finalize() == empty);
+
+    // Multiset semantics: duplicates count.
+    MuHash3072 d;
+    Insert(d, "alpha");
+    Insert(d, "alpha");
+    MuHash3072 e;
+    Insert(e, "alpha");
+    assert(d.Finalize() != e.Finalize());
+
+    // Set union/difference.
+    MuHash3072 left;
+    Insert(left, "alpha");
+    MuHash3072 right;
+    Insert(right, "beta");
+    Insert(right, "gamma");
+    left *= right;
+    assert(left.Finalize() == a.Finalize());
+    left /= right;
+    assert(left.Finalize() == e.Finalize());
+
+    // Round-trip through the raw accumulator parts.
+    auto restored = MuHash3072::FromParts(a.Numerator(), a.Denominator());
+    assert(restored.Finalize() == a.Finalize());
+    return 0;
+}
@@ -0,0 +1,21 @@
+#include "../../layer1-core/crypto/siphash.h"
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+int main()
+{
+    // Reference vectors from the SipHash paper: key 00..0f, message 00..(n-1).
+    const uint64_t k0 = 0x0706050403020100ULL;
+    const uint64_t k1 = 0x0f0e0d0c0b0a0908ULL;
+    std::vector<uint8_t> msg;
+    assert(SipHash24(k0, k1, msg.data(), msg.size()) == 0x726fdb47dd0e0e31ULL);
+    for (uint8_t i = 0; i < 15; ++i) msg.push_back(i);
+    assert(SipHash24(k0, k1, msg.data(), msg.size()) == 0xa129ca6149be45e5ULL);
+    msg.push_back(15);
+    assert(SipHash24(k0, k1, msg.data(), msg.size()) == 0x3f2acc7f57c29bdbULL);
+
+    // The key matters.
+    assert(SipHash24(k0 + 1, k1, msg.data(), msg.size()) != 0x3f2acc7f57c29bdbULL);
+    return 0;
+}
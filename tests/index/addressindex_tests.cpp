@@ -0,0 +1,176 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <filesystem>
+#include <limits>
+#include <vector>
+
+#include "../../layer1-core/merkle/merkle.h"
+#include "../../layer2-services/index/addressindex.h"
+
+namespace {
+
+using namespace std::chrono_literals;
+
+addrindex::ScriptKey Key(uint8_t tag)
+{
+    addrindex::ScriptKey key{};
+    key.fill(tag);
+    return key;
+}
+
+TxOut Pay(uint8_t tag, uint64_t value)
+{
+    TxOut out;
+    out.value = value;
+    out.scriptPubKey.assign(32, tag);
+    return out;
+}
+
+// Coinbase paying `tag`, plus a transaction spending each of `spends` to
+// `spendTo`.
+Block MakeBlock(const uint256& prev, uint32_t height, uint8_t tag, const std::vector<OutPoint>& spends = {},
+                uint8_t spendTo = 0)
+{
+    Block block{};
+    block.header.version = 1;
+    block.header.time = 1700000000 + height * 60;
+    block.header.prevBlockHash = prev;
+    Transaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.index = std::numeric_limits<uint32_t>::max();
+    coinbase.vin[0].scriptSig = {static_cast<uint8_t>(height), static_cast<uint8_t>(height >> 8), tag};
+    coinbase.vout.push_back(Pay(tag, 50));
+    block.transactions.push_back(coinbase);
+    if (!spends.empty()) {
+        Transaction tx;
+        for (const auto& out : spends) {
+            TxIn in;
+            in.prevout = out;
+            tx.vin.push_back(in);
+        }
+        tx.vout.push_back(Pay(spendTo, 40));
+        block.transactions.push_back(tx);
+    }
+    block.header.merkleRoot = ComputeMerkleRoot(block.transactions);
+    return block;
+}
+
+OutPoint CoinbaseOut(const Block& block)
+{
+    return OutPoint{block.transactions[0].GetHash(), 0};
+}
+
+struct TempPaths {
+    std::filesystem::path blocks;
+    std::filesystem::path index;
+    explicit TempPaths(const std::string& name)
+        : blocks(std::filesystem::temp_directory_path() / (name + "_blocks.dat")),
+          index(std::filesystem::temp_directory_path() / (name + "_index"))
+    {
+        Clean();
+    }
+    ~TempPaths() { Clean(); }
+    void Clean()
+    {
+        std::error_code ec;
+        std::filesystem::remove(blocks, ec);
+        std::filesystem::remove(blocks.string() + ".idx", ec);
+        std::filesystem::remove_all(index, ec);
+    }
+};
+
+// Heights 0..9 pay 0xA1; block 5 spends the outputs of blocks 1 and 2 to 0xB2.
+std::vector<Block> BuildChain()
+{
+    std::vector<Block> chain;
+    for (uint32_t h = 0; h < 10; ++h) {
+        const uint256 prev = chain.empty() ? uint256{} : BlockHash(chain.back().header);
+        if (h == 5)
+            chain.push_back(MakeBlock(prev, h, 0xA1, {CoinbaseOut(chain[1]), CoinbaseOut(chain[2])}, 0xB2));
+        else
+            chain.push_back(MakeBlock(prev, h, 0xA1));
+    }
+    return chain;
+}
+
+} // namespace
+
+TEST(AddressIndex, HistoryAndUtxosArePagedInHeightOrder)
+{
+    TempPaths paths("addrindex_history");
+    auto chain = BuildChain();
+    BlockStore blocks(paths.blocks.string());
+    for (uint32_t h = 0; h < chain.size(); ++h) blocks.WriteBlock(h, chain[h]);
+
+    addrindex::AddressIndex index;
+    index.Open(paths.index.string());
+    index.Start(blocks, 9);
+    ASSERT_TRUE(index.WaitUntilSynced(5s));
+
+    std::vector<addrindex::AddressOutput> history;
+    std::optional<std::string> cursor;
+    do {
+        auto page = index.History(Key(0xA1), 0, 9, 3, cursor);
+        EXPECT_LE(page.entries.size(), 3u);
+        history.insert(history.end(), page.entries.begin(), page.entries.end());
+        cursor = page.next;
+    } while (cursor);
+    ASSERT_EQ(history.size(), 10u);
+    for (uint32_t h = 0; h < 10; ++h) {
+        EXPECT_EQ(history[h].height, h);
+        EXPECT_EQ(history[h].outpoint.hash, chain[h].transactions[0].GetHash());
+        EXPECT_EQ(history[h].value, 50u);
+        EXPECT_EQ(history[h].spentBy.has_value(), h == 1 || h == 2);
+    }
+    ASSERT_TRUE(history[2].spentBy);
+    EXPECT_EQ(history[2].spentBy->txid, chain[5].transactions[1].GetHash());
+    EXPECT_EQ(history[2].spentBy->vin, 1u);
+    EXPECT_EQ(history[2].spentBy->height, 5u);
+
+    auto range = index.History(Key(0xA1), 3, 6, 100);
+    ASSERT_EQ(range.entries.size(), 4u);
+    EXPECT_EQ(range.entries.front().height, 3u);
+    EXPECT_EQ(range.entries.back().height, 6u);
+    EXPECT_FALSE(range.next);
+
+    auto utxos = index.Utxos(Key(0xA1), 100);
+    EXPECT_EQ(utxos.entries.size(), 8u);
+    for (const auto& out : utxos.entries) EXPECT_FALSE(out.spentBy);
+    auto received = index.Utxos(Key(0xB2), 100);
+    ASSERT_EQ(received.entries.size(), 1u);
+    EXPECT_EQ(received.entries[0].height, 5u);
+    EXPECT_EQ(received.entries[0].value, 40u);
+    EXPECT_TRUE(index.Utxos(Key(0xC3), 100).entries.empty());
+}
+
+TEST(AddressIndex, ReorgRestoresSpentOutputs)
+{
+    TempPaths paths("addrindex_reorg");
+    auto chain = BuildChain();
+    BlockStore blocks(paths.blocks.string());
+    for (uint32_t h = 0; h < chain.size(); ++h) blocks.WriteBlock(h, chain[h]);
+
+    addrindex::AddressIndex index;
+    index.Open(paths.index.string());
+    index.Start(blocks, 9);
+    ASSERT_TRUE(index.WaitUntilSynced(5s));
+
+    // Replace heights 4.. with a branch that never spends.
+    std::vector<Block> fork(chain.begin(), chain.begin() + 4);
+    for (uint32_t h = 4; h < 11; ++h) fork.push_back(MakeBlock(BlockHash(fork.back().header), h, 0xC3));
+    for (uint32_t h = 4; h < fork.size(); ++h) blocks.WriteBlock(h, fork[h]);
+    index.ChainTipChanged(10);
+    ASSERT_TRUE(index.WaitUntilSynced(5s));
+
+    auto history = index.History(Key(0xA1), 0, 100, 100);
+    ASSERT_EQ(history.entries.size(), 4u);
+    for (const auto& out : history.entries) EXPECT_FALSE(out.spentBy);
+    EXPECT_EQ(index.Utxos(Key(0xA1), 100).entries.size(), 4u);
+    EXPECT_TRUE(index.Utxos(Key(0xB2), 100).entries.empty());
+    EXPECT_EQ(index.Utxos(Key(0xC3), 100).entries.size(), 7u);
+
+    auto best = index.Checkpoint();
+    ASSERT_TRUE(best);
+    EXPECT_EQ(best->height, 10u);
+    EXPECT_EQ(best->hash, BlockHash(fork.back().header));
+}
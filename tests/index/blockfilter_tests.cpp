@@ -0,0 +1,247 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "../../layer1-core/merkle/merkle.h"
+#include "../../layer2-services/index/blockfilterindex.h"
+#include "../../layer2-services/net/p2p.h"
+
+namespace {
+
+using namespace std::chrono_literals;
+
+blockfilter::Element Script(uint8_t tag, uint8_t n)
+{
+    blockfilter::Element script(32, tag);
+    script[0] = n;
+    return script;
+}
+
+// Coinbase plus one transaction spending the coinbase of the parent block.
+Block MakeBlock(const uint256& prev, uint32_t height, uint8_t tag, const std::optional<OutPoint>& spend = std::nullopt)
+{
+    Block block{};
+    block.header.version = 1;
+    block.header.time = 1700000000 + height * 60;
+    block.header.prevBlockHash = prev;
+    Transaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.index = std::numeric_limits<uint32_t>::max();
+    coinbase.vin[0].scriptSig = {static_cast<uint8_t>(height), static_cast<uint8_t>(height >> 8), tag};
+    TxOut out;
+    out.value = 50;
+    out.scriptPubKey = Script(tag, static_cast<uint8_t>(height));
+    coinbase.vout.push_back(out);
+    block.transactions.push_back(coinbase);
+    if (spend) {
+        Transaction tx;
+        TxIn in;
+        in.prevout = *spend;
+        tx.vin.push_back(in);
+        out.scriptPubKey = Script(tag ^ 0xff, static_cast<uint8_t>(height));
+        tx.vout.push_back(out);
+        block.transactions.push_back(tx);
+    }
+    block.header.merkleRoot = ComputeMerkleRoot(block.transactions);
+    return block;
+}
+
+std::vector<Block> Extend(std::vector<Block> chain, uint32_t toHeight, uint8_t tag)
+{
+    while (chain.size() <= toHeight) {
+        const uint256 prev = chain.empty() ? uint256{} : BlockHash(chain.back().header);
+        std::optional<OutPoint> spend;
+        if (!chain.empty()) spend = OutPoint{chain.back().transactions[0].GetHash(), 0};
+        chain.push_back(MakeBlock(prev, static_cast<uint32_t>(chain.size()), tag, spend));
+    }
+    return chain;
+}
+
+struct TempPaths {
+    std::filesystem::path blocks;
+    std::filesystem::path index;
+    explicit TempPaths(const std::string& name)
+        : blocks(std::filesystem::temp_directory_path() / (name + "_blocks.dat")),
+          index(std::filesystem::temp_directory_path() / (name + "_index"))
+    {
+        Clean();
+    }
+    ~TempPaths() { Clean(); }
+    void Clean()
+    {
+        std::error_code ec;
+        std::filesystem::remove(blocks, ec);
+        std::filesystem::remove(blocks.string() + ".idx", ec);
+        std::filesystem::remove_all(index, ec);
+    }
+};
+
+} // namespace
+
+TEST(GCSFilter, MatchesMembersAndRoundTrips)
+{
+    uint256 blockHash{};
+    blockHash[0] = 0x42;
+    std::vector<blockfilter::Element> members;
+    for (uint8_t i = 0; i < 200; ++i) members.push_back(Script(0x11, i));
+    blockfilter::GCSFilter filter(blockHash, members);
+    EXPECT_EQ(filter.Size(), members.size());
+    // ~P bits per element plus the unary part.
+    EXPECT_LT(filter.Encoded().size(), members.size() * 4);
+
+    blockfilter::GCSFilter decoded(blockHash, filter.Encoded());
+    for (const auto& e : members) {
+        EXPECT_TRUE(filter.Match(e));
+        EXPECT_TRUE(decoded.Match(e));
+    }
+    size_t falsePositives = 0;
+    for (uint8_t i = 0; i < 200; ++i) falsePositives += decoded.Match(Script(0x22, i)) ? 1 : 0;
+    EXPECT_LE(falsePositives, 1u);
+    EXPECT_TRUE(decoded.MatchAny({Script(0x22, 1), members[77]}));
+    EXPECT_FALSE(decoded.MatchAny({}));
+
+    blockfilter::GCSFilter empty(blockHash, std::vector<blockfilter::Element>{});
+    EXPECT_EQ(empty.Encoded(), std::vector<uint8_t>{0});
+    EXPECT_FALSE(empty.Match(members[0]));
+    EXPECT_THROW(blockfilter::GCSFilter(blockHash, std::vector<uint8_t>{}), std::runtime_error);
+}
+
+TEST(BlockFilterIndex, BuildsHeaderChainAndRewinds)
+{
+    TempPaths paths("blockfilter_index");
+    auto chain = Extend({}, 9, 0xA0);
+    BlockStore blocks(paths.blocks.string());
+    for (uint32_t h = 0; h < chain.size(); ++h) blocks.WriteBlock(h, chain[h]);
+
+    blockfilter::BlockFilterIndex index;
+    index.Open(paths.index.string());
+    index.Start(blocks, 9);
+    ASSERT_TRUE(index.WaitUntilSynced(5s));
+
+    uint256 prevHeader{};
+    for (uint32_t h = 0; h < chain.size(); ++h) {
+        auto entry = index.Entry(h);
+        ASSERT_TRUE(entry);
+        EXPECT_EQ(entry->blockHash, BlockHash(chain[h].header));
+        EXPECT_EQ(entry->filterHash, blockfilter::FilterHash(entry->filter));
+        EXPECT_EQ(entry->header, blockfilter::FilterHeader(entry->filterHash, prevHeader));
+        prevHeader = entry->header;
+
+        blockfilter::GCSFilter filter(entry->blockHash, entry->filter);
+        EXPECT_TRUE(filter.Match(chain[h].transactions[0].vout[0].scriptPubKey));
+        if (h > 0) {
+            EXPECT_TRUE(filter.Match(blockfilter::OutPointElement(chain[h].transactions[1].vin[0].prevout)));
+            EXPECT_TRUE(filter.Match(chain[h].transactions[1].vout[0].scriptPubKey));
+        }
+    }
+
+    auto fork = Extend(std::vector<Block>(chain.begin(), chain.begin() + 6), 10, 0xB0);
+    for (uint32_t h = 6; h < fork.size(); ++h) blocks.WriteBlock(h, fork[h]);
+    index.ChainTipChanged(10);
+    ASSERT_TRUE(index.WaitUntilSynced(5s));
+    for (uint32_t h = 5; h <= 10; ++h) {
+        auto entry = index.Entry(h);
+        ASSERT_TRUE(entry);
+        EXPECT_EQ(entry->blockHash, BlockHash(fork[h].header));
+        EXPECT_EQ(entry->header, blockfilter::FilterHeader(entry->filterHash, index.Entry(h - 1)->header));
+    }
+    auto best = index.Checkpoint();
+    ASSERT_TRUE(best);
+    EXPECT_EQ(best->height, 10u);
+}
+
+TEST(BlockFilterIndex, ServedOverP2P)
+{
+    TempPaths paths("blockfilter_p2p");
+    auto chain = Extend({}, 7, 0xC0);
+    BlockStore blocks(paths.blocks.string());
+    for (uint32_t h = 0; h < chain.size(); ++h) blocks.WriteBlock(h, chain[h]);
+    blockfilter::BlockFilterIndex index;
+    index.Open(paths.index.string());
+    index.Start(blocks, 7);
+    ASSERT_TRUE(index.WaitUntilSynced(5s));
+
+    boost::asio::io_context ioServer;
+    boost::asio::io_context ioClient;
+    net::P2PNode server(ioServer, 0);
+    net::P2PNode client(ioClient, 0);
+    server.SetFilterProvider([&index](uint32_t height) -> std::optional<net::FilterRecord> {
+        auto entry = index.Entry(height);
+        if (!entry) return std::nullopt;
+        return net::FilterRecord{entry->blockHash, entry->filterHash, entry->header, entry->filter};
+    });
+
+    std::mutex mu;
+    std::vector<net::Message> filters;
+    std::optional<net::Message> headers;
+    client.RegisterHandler("cfilter", [&](const net::PeerInfo&, const net::Message& msg) {
+        std::lock_guard<std::mutex> g(mu);
+        filters.push_back(msg);
+    });
+    client.RegisterHandler("cfheaders", [&](const net::PeerInfo&, const net::Message& msg) {
+        std::lock_guard<std::mutex> g(mu);
+        headers = msg;
+    });
+    client.AddPeerAddress("127.0.0.1:" + std::to_string(server.ListenPort()));
+
+    std::atomic<bool> stop{false};
+    auto run = [&stop](boost::asio::io_context& io) {
+        while (!stop.load()) {
+            io.run_for(20ms);
+            io.restart();
+        }
+    };
+    std::thread ts(run, std::ref(ioServer));
+    std::thread tc(run, std::ref(ioClient));
+    server.Start();
+    client.Start();
+    for (int i = 0; i < 200 && (client.Peers().empty() || server.Peers().empty()); ++i)
+        std::this_thread::sleep_for(10ms);
+    ASSERT_FALSE(client.Peers().empty());
+
+    // Heights 2..5.
+    std::vector<uint8_t> request{net::P2PNode::k_basic_filter};
+    const uint32_t start = 2;
+    request.insert(request.end(), reinterpret_cast<const uint8_t*>(&start), reinterpret_cast<const uint8_t*>(&start) + 4);
+    const auto stopHash = BlockHash(chain[5].header);
+    request.insert(request.end(), stopHash.begin(), stopHash.end());
+    client.Broadcast(net::Message{"getcfilters", request});
+    client.Broadcast(net::Message{"getcfheaders", request});
+
+    for (int i = 0; i < 300; ++i) {
+        {
+            std::lock_guard<std::mutex> g(mu);
+            if (filters.size() == 4 && headers) break;
+        }
+        std::this_thread::sleep_for(10ms);
+    }
+    stop = true;
+    ts.join();
+    tc.join();
+    client.Stop();
+    server.Stop();
+
+    ASSERT_EQ(filters.size(), 4u);
+    for (uint32_t i = 0; i < 4; ++i) {
+        const auto entry = index.Entry(start + i);
+        ASSERT_TRUE(entry);
+        const auto& payload = filters[i].payload;
+        ASSERT_EQ(payload.size(), 33 + entry->filter.size());
+        EXPECT_TRUE(std::equal(entry->blockHash.begin(), entry->blockHash.end(), payload.begin() + 1));
+        EXPECT_TRUE(std::equal(entry->filter.begin(), entry->filter.end(), payload.begin() + 33));
+    }
+    ASSERT_TRUE(headers);
+    ASSERT_EQ(headers->payload.size(), 1 + 64 + 4 + 4 * 32u);
+    uint256 header = index.Entry(start - 1)->header;
+    EXPECT_TRUE(std::equal(header.begin(), header.end(), headers->payload.begin() + 33));
+    for (uint32_t i = 0; i < 4; ++i) {
+        uint256 filterHash{};
+        std::copy_n(headers->payload.begin() + 69 + i * 32, 32, filterHash.begin());
+        header = blockfilter::FilterHeader(filterHash, header);
+    }
+    EXPECT_EQ(header, index.Entry(5)->header);
+}
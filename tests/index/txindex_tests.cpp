@@ -0,0 +1,140 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <filesystem>
+#include <limits>
+#include <vector>
+
+#include "../../layer1-core/merkle/merkle.h"
+#include "../../layer2-services/index/txindex.h"
+
+namespace {
+
+using namespace std::chrono_literals;
+
+Block MakeBlock(const uint256& prev, uint32_t height, uint8_t tag)
+{
+    Block block{};
+    block.header.version = 1;
+    block.header.time = 1700000000 + height * 60;
+    block.header.prevBlockHash = prev;
+    for (uint8_t i = 0; i < 2; ++i) {
+        Transaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.index = std::numeric_limits<uint32_t>::max();
+        tx.vin[0].scriptSig = {static_cast<uint8_t>(height), static_cast<uint8_t>(height >> 8), tag, i};
+        TxOut out;
+        out.value = 50;
+        out.scriptPubKey.assign(32, tag);
+        tx.vout.push_back(out);
+        block.transactions.push_back(tx);
+    }
+    block.header.merkleRoot = ComputeMerkleRoot(block.transactions);
+    return block;
+}
+
+std::vector<Block> Extend(std::vector<Block> chain, uint32_t toHeight, uint8_t tag)
+{
+    while (chain.size() <= toHeight) {
+        const uint256 prev = chain.empty() ? uint256{} : BlockHash(chain.back().header);
+        chain.push_back(MakeBlock(prev, static_cast<uint32_t>(chain.size()), tag));
+    }
+    return chain;
+}
+
+struct TempPaths {
+    std::filesystem::path blocks;
+    std::filesystem::path index;
+    explicit TempPaths(const std::string& name)
+        : blocks(std::filesystem::temp_directory_path() / (name + "_blocks.dat")),
+          index(std::filesystem::temp_directory_path() / (name + "_index"))
+    {
+        Clean();
+    }
+    ~TempPaths() { Clean(); }
+    void Clean()
+    {
+        std::error_code ec;
+        std::filesystem::remove(blocks, ec);
+        std::filesystem::remove(blocks.string() + ".idx", ec);
+        std::filesystem::remove_all(index, ec);
+    }
+};
+
+} // namespace
+
+TEST(BackgroundIndex, CatchesUpAndResumesFromCheckpoint)
+{
+    TempPaths paths("bgindex_resume");
+    auto chain = Extend({}, 19, 0xA0);
+    BlockStore blocks(paths.blocks.string());
+    for (uint32_t h = 0; h < chain.size(); ++h) blocks.WriteBlock(h, chain[h]);
+
+    {
+        txindex::TxIndex index;
+        index.Open(paths.index.string());
+        index.Start(blocks, 9);
+        ASSERT_TRUE(index.WaitUntilSynced(5s));
+        uint256 hash{};
+        uint32_t height{0};
+        ASSERT_TRUE(index.BestBlock(hash, height));
+        EXPECT_EQ(height, 9u);
+        EXPECT_EQ(hash, BlockHash(chain[9].header));
+        EXPECT_FALSE(index.Lookup(chain[10].transactions[0].GetHash(), height));
+    }
+
+    txindex::TxIndex index;
+    index.Open(paths.index.string());
+    EXPECT_EQ(index.BlockCount(), 10u);
+    index.Start(blocks, 19);
+    ASSERT_TRUE(index.WaitUntilSynced(5s));
+    for (uint32_t h : {0u, 9u, 10u, 19u}) {
+        auto loc = index.Locate(chain[h].transactions[1].GetHash());
+        ASSERT_TRUE(loc.has_value());
+        EXPECT_EQ(loc->height, h);
+        ASSERT_TRUE(loc->pos.has_value());
+        EXPECT_EQ(blocks.ReadTransaction(*loc->pos).GetHash(), chain[h].transactions[1].GetHash());
+    }
+    EXPECT_EQ(index.BlockCount(), 20u);
+}
+
+TEST(BackgroundIndex, RewindsStaleBlocksOnReorg)
+{
+    TempPaths paths("bgindex_reorg");
+    auto chain = Extend({}, 12, 0xB0);
+    BlockStore blocks(paths.blocks.string());
+    for (uint32_t h = 0; h < chain.size(); ++h) blocks.WriteBlock(h, chain[h]);
+
+    txindex::TxIndex index;
+    index.Open(paths.index.string());
+    index.Start(blocks, 12);
+    ASSERT_TRUE(index.WaitUntilSynced(5s));
+
+    // Replace heights 9.. with a longer competing branch.
+    auto fork = Extend(std::vector<Block>(chain.begin(), chain.begin() + 9), 14, 0xC0);
+    for (uint32_t h = 9; h < fork.size(); ++h) blocks.WriteBlock(h, fork[h]);
+    index.ChainTipChanged(14);
+    ASSERT_TRUE(index.WaitUntilSynced(5s));
+
+    uint32_t height{0};
+    for (uint32_t h = 9; h <= 12; ++h) {
+        EXPECT_FALSE(index.Lookup(chain[h].transactions[0].GetHash(), height));
+        uint32_t blockHeight{0};
+        EXPECT_FALSE(index.LookupBlock(BlockHash(chain[h].header), blockHeight));
+    }
+    for (uint32_t h = 9; h <= 14; ++h) {
+        ASSERT_TRUE(index.Lookup(fork[h].transactions[0].GetHash(), height));
+        EXPECT_EQ(height, h);
+    }
+    ASSERT_TRUE(index.Lookup(chain[8].transactions[0].GetHash(), height));
+    uint256 best{};
+    ASSERT_TRUE(index.BestBlock(best, height));
+    EXPECT_EQ(height, 14u);
+    EXPECT_EQ(best, BlockHash(fork.back().header));
+
+    // A shorter active chain rewinds the index to it.
+    index.ChainTipChanged(10);
+    ASSERT_TRUE(index.WaitUntilSynced(5s));
+    ASSERT_TRUE(index.BestBlock(best, height));
+    EXPECT_EQ(height, 10u);
+    EXPECT_FALSE(index.Lookup(fork[11].transactions[0].GetHash(), height));
+}
@@ -19,6 +19,18 @@ int main()
     const uint8_t expected[32] = {0x15,0xe3,0xc0,0x48,0x27,0x0c,0x7e,0x5a,0x3c,0x78,0xb6,0xcc,0xe7,0x5d,0xce,0x6c,
                                   0xa8,0xae,0xe4,0xdb,0xd8,0x07,0x02,0xcf,0xc3,0x96,0x98,0x0f,0x69,0xc0,0x39,0x94};
     assert(std::equal(root.begin(), root.end(), expected));
+
+    // Repeating the last transaction of an odd list keeps the root, which
+    // the mutation flag reports.
+    Transaction c = b;
+    c.vout[0].value = 24;
+    std::vector<Transaction> odd{a, b, c};
+    std::vector<Transaction> padded{a, b, c, c};
+    bool mutated = true;
+    const auto oddRoot = ComputeMerkleRoot(odd, mutated);
+    assert(!mutated);
+    assert(ComputeMerkleRoot(padded, mutated) == oddRoot);
+    assert(mutated);
     std::cout << "Merkle test OK\n";
     return 0;
 }
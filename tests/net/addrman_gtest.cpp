@@ -0,0 +1,248 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <unistd.h>
+#include "../../layer2-services/net/addrman.h"
+#include "../../layer2-services/net/p2p.h"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr int64_t k_now = 1'700'000'000;
+
+// `count` addresses, each in its own /16, from `first`.0.0.1 on. One
+// source's addresses from one group all land in one bucket, so tests that
+// want them all kept spread them out.
+std::vector<net::PeerAddress> Addresses(int first, int count, int64_t time = k_now)
+{
+    std::vector<net::PeerAddress> out;
+    for (int i = 0; i < count; ++i)
+        out.push_back(net::PeerAddress{
+            std::to_string(first + i / 200) + "." + std::to_string(i % 200) + ".0.1:9333", 1, time});
+    return out;
+}
+
+std::string TempPath(const std::string& name)
+{
+    return (std::filesystem::temp_directory_path() / (name + std::to_string(::getpid()))).string();
+}
+
+void RunIo(boost::asio::io_context& io, std::atomic<bool>& stopFlag)
+{
+    while (!stopFlag.load()) {
+        io.run_for(20ms);
+        io.restart();
+    }
+}
+
+bool WaitFor(const std::function<bool()>& cond, std::chrono::milliseconds limit = 10s)
+{
+    const auto deadline = std::chrono::steady_clock::now() + limit;
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (cond()) return true;
+        std::this_thread::sleep_for(20ms);
+    }
+    return cond();
+}
+
+bool HasPeer(net::P2PNode& node, uint16_t port)
+{
+    for (const auto& p : node.Peers())
+        if (p.id.size() > 6 && p.id.substr(p.id.rfind(':') + 1) == std::to_string(port)) return true;
+    return false;
+}
+
+} // namespace
+
+TEST(AddrMan, GroupsByNetwork)
+{
+    EXPECT_EQ(net::AddrMan::Group("203.0.113.5:9333"), "203.0");
+    EXPECT_EQ(net::AddrMan::Group("203.0.200.1:1"), "203.0");
+    EXPECT_EQ(net::AddrMan::Group("[2001:db8:1:2::1]:9333"), "2001:0db8::");
+    EXPECT_EQ(net::AddrMan::Group("Seed.Example.org:9333"), "seed.example.org");
+    // Local addresses are not lumped together.
+    EXPECT_EQ(net::AddrMan::Group("127.0.0.1:9333"), "127.0.0.1:9333");
+    EXPECT_EQ(net::AddrMan::Group("192.168.1.2:9333"), "192.168.1.2:9333");
+
+    std::string host;
+    std::string port;
+    EXPECT_TRUE(net::AddrMan::SplitHostPort("[::1]:80", host, port));
+    EXPECT_EQ(host, "::1");
+    EXPECT_EQ(port, "80");
+    EXPECT_FALSE(net::AddrMan::SplitHostPort("::1:80", host, port));
+    EXPECT_FALSE(net::AddrMan::SplitHostPort("example.org", host, port));
+    EXPECT_FALSE(net::AddrMan::SplitHostPort("example.org:99999", host, port));
+}
+
+TEST(AddrMan, GoodMovesToTried)
+{
+    net::AddrMan addrman;
+    EXPECT_EQ(addrman.Add(Addresses(1, 3), "198.51.100.1", 0, k_now), 3u);
+    EXPECT_EQ(addrman.Add(Addresses(1, 3), "198.51.100.1", 0, k_now), 0u); // known already
+    EXPECT_EQ(addrman.Size(), 3u);
+    EXPECT_EQ(addrman.TriedSize(), 0u);
+
+    addrman.Attempt("1.0.0.1:9333", k_now);
+    EXPECT_EQ(addrman.Find("1.0.0.1:9333")->attempts, 1u);
+    addrman.Good("1.0.0.1:9333", 120, k_now + 1);
+    auto info = addrman.Find("1.0.0.1:9333");
+    ASSERT_TRUE(info);
+    EXPECT_TRUE(info->tried);
+    EXPECT_EQ(info->attempts, 0u);
+    EXPECT_EQ(info->successes, 1u);
+    EXPECT_EQ(info->latencyMs, 120);
+    EXPECT_EQ(addrman.TriedSize(), 1u);
+    EXPECT_EQ(addrman.Size(), 3u);
+
+    // Only the new table has the others.
+    for (int i = 0; i < 50; ++i) {
+        auto pick = addrman.Select(/*newOnly=*/true, k_now + 1);
+        ASSERT_TRUE(pick);
+        EXPECT_NE(pick->address, "1.0.0.1:9333");
+    }
+
+    addrman.Remove("1.1.0.1:9333");
+    EXPECT_FALSE(addrman.Find("1.1.0.1:9333"));
+    EXPECT_EQ(addrman.Size(), 2u);
+}
+
+TEST(AddrMan, SelectPrefersWorkingAddresses)
+{
+    net::AddrMan addrman;
+    addrman.Add(Addresses(1, 2), "198.51.100.1", 0, k_now);
+    // One address keeps failing; the other was never tried.
+    for (int i = 0; i < 6; ++i) addrman.Attempt("1.0.0.1:9333", k_now - 3600);
+    int failing = 0;
+    for (int i = 0; i < 1000; ++i) {
+        auto pick = addrman.Select(false, k_now);
+        ASSERT_TRUE(pick);
+        if (pick->address == "1.0.0.1:9333") ++failing;
+    }
+    EXPECT_LT(failing, 250);
+    EXPECT_GT(failing, 0);
+}
+
+TEST(AddrMan, OneSourceCannotFillTheTable)
+{
+    net::AddrMan addrman;
+    // One source group reaches only k_new_buckets_per_source buckets.
+    const size_t cap = net::AddrMan::k_new_buckets_per_source * net::AddrMan::k_bucket_size;
+    const size_t fromOne = addrman.Add(Addresses(1, 20000), "198.51.100.1", 0, k_now);
+    EXPECT_LE(fromOne, cap);
+    EXPECT_GT(fromOne, cap / 2);
+
+    // Addresses from elsewhere still find room.
+    const size_t other = addrman.Add(Addresses(150, 100), "192.0.2.1", 0, k_now);
+    EXPECT_GT(other, 80u);
+}
+
+TEST(AddrMan, GetAddrSkipsTerribleAndLimits)
+{
+    net::AddrMan addrman;
+    const size_t fresh = addrman.Add(Addresses(1, 200), "198.51.100.1", 0, k_now);
+    addrman.Add(Addresses(150, 20, k_now - 60 * 86400), "198.51.100.2", 0, k_now); // long gone
+
+    auto all = addrman.GetAddr(1000, 100, k_now);
+    EXPECT_EQ(all.size(), fresh);
+    for (const auto& a : all) EXPECT_LT(std::stoi(a.address), 150);
+
+    // Small tables are passed on at 50 entries even where the share is less.
+    EXPECT_EQ(addrman.GetAddr(1000, 10, k_now).size(), 50u);
+    EXPECT_EQ(addrman.GetAddr(10, 100, k_now).size(), 10u);
+}
+
+TEST(AddrMan, SaveAndLoad)
+{
+    const std::string path = TempPath("addrman_roundtrip");
+    net::AddrMan addrman;
+    std::vector<std::string> kept;
+    for (const auto& a : Addresses(1, 40))
+        if (addrman.Add({a}, "198.51.100.1", 0, k_now)) kept.push_back(a.address);
+    ASSERT_GE(kept.size(), 2u);
+    addrman.Good(kept[0], 80, k_now);
+    addrman.Attempt(kept[1], k_now);
+    addrman.Save(path);
+
+    net::AddrMan loaded;
+    loaded.Load(path);
+    EXPECT_EQ(loaded.Size(), addrman.Size());
+    EXPECT_EQ(loaded.TriedSize(), 1u);
+    auto good = loaded.Find(kept[0]);
+    ASSERT_TRUE(good);
+    EXPECT_TRUE(good->tried);
+    EXPECT_EQ(good->latencyMs, 80);
+    auto tried = loaded.Find(kept[1]);
+    ASSERT_TRUE(tried);
+    EXPECT_EQ(tried->attempts, 1u);
+    EXPECT_EQ(tried->source, "198.51.100.1");
+
+    // A damaged file is refused and leaves the tables alone.
+    {
+        std::fstream f(path, std::ios::binary | std::ios::in | std::ios::out);
+        f.seekp(20);
+        f.put('x');
+    }
+    EXPECT_THROW(loaded.Load(path), std::runtime_error);
+    EXPECT_EQ(loaded.Size(), addrman.Size());
+    EXPECT_THROW(loaded.Load(path + ".missing"), std::runtime_error);
+    std::filesystem::remove(path);
+}
+
+TEST(AddrMan, NodesLearnAddressesAndConnect)
+{
+    const std::string path = TempPath("addrman_peers");
+    std::filesystem::remove(path);
+    boost::asio::io_context ioA;
+    boost::asio::io_context ioB;
+    boost::asio::io_context ioC;
+    net::P2PNode nodeA(ioA, 0);
+    net::P2PNode nodeB(ioB, 0);
+    net::P2PNode nodeC(ioC, 0);
+    nodeA.SetMaxOutbound(2);
+    nodeA.SetAddressFile(path);
+
+    // A knows only B; C is connected to B.
+    nodeA.AddPeerAddress("127.0.0.1:" + std::to_string(nodeB.ListenPort()));
+    nodeC.AddPeerAddress("127.0.0.1:" + std::to_string(nodeB.ListenPort()));
+
+    std::atomic<bool> stop{false};
+    std::thread tB(RunIo, std::ref(ioB), std::ref(stop));
+    std::thread tC(RunIo, std::ref(ioC), std::ref(stop));
+    nodeB.Start();
+    nodeC.Start();
+    ASSERT_TRUE(WaitFor([&] { return nodeB.Peers().size() == 1; }));
+
+    std::thread tA(RunIo, std::ref(ioA), std::ref(stop));
+    nodeA.Start();
+    // B passes on where C listens, and A dials it to fill its outbound slots.
+    const std::string addressC = "127.0.0.1:" + std::to_string(nodeC.ListenPort());
+    ASSERT_TRUE(WaitFor([&] { return nodeA.Addresses().Find(addressC).has_value(); }));
+    ASSERT_TRUE(WaitFor([&] { return HasPeer(nodeA, nodeC.ListenPort()); }));
+    EXPECT_TRUE(WaitFor([&] {
+        auto info = nodeA.Addresses().Find(addressC);
+        return info && info->tried;
+    }));
+    // Nobody connects to itself or twice to the same node.
+    std::this_thread::sleep_for(500ms);
+    EXPECT_EQ(nodeA.Peers().size(), 2u);
+    EXPECT_EQ(nodeC.Peers().size(), 2u);
+
+    stop = true;
+    tA.join();
+    tB.join();
+    tC.join();
+    nodeA.Stop();
+    nodeB.Stop();
+    nodeC.Stop();
+
+    // The table outlives the node.
+    net::AddrMan saved;
+    saved.Load(path);
+    EXPECT_TRUE(saved.Find(addressC).has_value());
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,512 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../../layer1-core/merkle/merkle.h"
+#include "../../layer1-core/pow/difficulty.h"
+#include "../../layer2-services/net/block_sync.h"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+void RunIo(boost::asio::io_context& io, std::atomic<bool>& stopFlag)
+{
+    while (!stopFlag.load()) {
+        io.run_for(20ms);
+        io.restart();
+    }
+}
+
+consensus::Params LooseParams()
+{
+    consensus::Params p = consensus::Testnet();
+    p.nGenesisBits = 0x207fffff;
+    p.fPowAllowMinDifficultyBlocks = true;
+    return p;
+}
+
+// Blocks of a coinbase and `extra` transactions nothing checks.
+std::vector<Block> BuildChain(const consensus::Params& params, uint32_t count, uint32_t extra = 0)
+{
+    std::vector<Block> chain;
+    for (uint32_t h = 0; h < count; ++h) {
+        Block block{};
+        block.header.version = 1;
+        block.header.bits = params.nGenesisBits;
+        block.header.time = params.nGenesisTime + (h + 1) * 60;
+        block.header.prevBlockHash = chain.empty() ? uint256{} : BlockHash(chain.back().header);
+        Transaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].prevout.index = std::numeric_limits<uint32_t>::max();
+        coinbase.vin[0].scriptSig = {static_cast<uint8_t>(h), static_cast<uint8_t>(h >> 8)};
+        TxOut out{};
+        out.value = 50;
+        out.scriptPubKey.assign(32, static_cast<uint8_t>(h));
+        coinbase.vout.push_back(out);
+        block.transactions.push_back(coinbase);
+        for (uint32_t i = 0; i < extra; ++i) {
+            Transaction tx = coinbase;
+            tx.vin[0].prevout.index = i;
+            block.transactions.push_back(tx);
+        }
+        block.header.merkleRoot = ComputeMerkleRoot(block.transactions);
+        while (!powalgo::CheckProofOfWork(BlockHash(block.header), block.header.bits, params))
+            ++block.header.nonce;
+        chain.push_back(block);
+    }
+    return chain;
+}
+
+// A node that already has the whole chain and serves it. With `serveBlocks`
+// false it answers headers but ignores block requests (a stalling peer);
+// with `corrupt` it repeats the last transaction of each block it serves,
+// which leaves the merkle root as it is for an odd count.
+struct Server {
+    boost::asio::io_context io;
+    net::P2PNode p2p{io, 0};
+    consensus::ForkResolver headers;
+    net::BlockSync sync;
+    std::atomic<size_t> served{0};
+
+    Server(const consensus::Params& params, const std::vector<Block>& chain, bool serveBlocks, bool corrupt = false)
+        : sync(io, p2p, headers, params, [](uint32_t, const Block&) { return true; })
+    {
+        std::map<uint256, std::vector<uint8_t>> blocks;
+        for (const auto& block : chain) {
+            EXPECT_TRUE(sync.AcceptHeader(block.header));
+            Block served = block;
+            if (corrupt) served.transactions.push_back(served.transactions.back());
+            blocks[BlockHash(block.header)] = SerializeBlock(served);
+        }
+        p2p.SetLocalHeight(static_cast<uint32_t>(chain.size() - 1));
+        p2p.SetBlockProvider([this, blocks, serveBlocks](const uint256& hash) -> std::optional<std::vector<uint8_t>> {
+            auto it = blocks.find(hash);
+            if (!serveBlocks || it == blocks.end()) return std::nullopt;
+            ++served;
+            return it->second;
+        });
+        sync.Start(static_cast<uint32_t>(chain.size() - 1));
+    }
+};
+
+// A fresh node downloading from the given servers.
+struct Client {
+    boost::asio::io_context io;
+    net::P2PNode p2p{io, 0};
+    consensus::ForkResolver headers;
+    net::BlockSync sync;
+    std::mutex mu;
+    std::vector<uint32_t> heights;
+    std::vector<uint256> hashes;
+    std::vector<size_t> sizes; // transactions
+
+    Client(const consensus::Params& params, net::SyncOptions opts)
+        : sync(io, p2p, headers, params, [this](uint32_t height, const Block& block) {
+              std::lock_guard<std::mutex> l(mu);
+              heights.push_back(height);
+              hashes.push_back(BlockHash(block.header));
+              sizes.push_back(block.transactions.size());
+              return true;
+          }, opts)
+    {
+        sync.Start(std::nullopt);
+    }
+};
+
+bool WaitFor(const std::function<bool()>& done, std::chrono::milliseconds timeout)
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (done()) return true;
+        std::this_thread::sleep_for(10ms);
+    }
+    return done();
+}
+
+void ExpectInOrder(Client& client, const std::vector<Block>& chain)
+{
+    std::lock_guard<std::mutex> l(client.mu);
+    ASSERT_EQ(client.heights.size(), chain.size());
+    for (uint32_t h = 0; h < chain.size(); ++h) {
+        EXPECT_EQ(client.heights[h], h);
+        EXPECT_EQ(client.hashes[h], BlockHash(chain[h].header));
+    }
+}
+
+} // namespace
+
+TEST(BlockSync, DownloadsFromAllPeersInOrder)
+{
+    const auto params = LooseParams();
+    const auto chain = BuildChain(params, 80);
+    Server a(params, chain, true);
+    Server b(params, chain, true);
+    net::SyncOptions opts;
+    opts.window = 24;
+    opts.maxInFlightPerPeer = 4;
+    Client client(params, opts);
+    client.p2p.AddPeerAddress("127.0.0.1:" + std::to_string(a.p2p.ListenPort()));
+    client.p2p.AddPeerAddress("127.0.0.1:" + std::to_string(b.p2p.ListenPort()));
+
+    std::atomic<bool> stop{false};
+    std::thread ta(RunIo, std::ref(a.io), std::ref(stop));
+    std::thread tb(RunIo, std::ref(b.io), std::ref(stop));
+    std::thread tc(RunIo, std::ref(client.io), std::ref(stop));
+    a.p2p.Start();
+    b.p2p.Start();
+    client.p2p.Start();
+
+    const bool synced = WaitFor([&] { return client.sync.Status().connectedHeight == chain.size() - 1; }, 20s);
+    const auto status = client.sync.Status();
+
+    stop = true;
+    ta.join();
+    tb.join();
+    tc.join();
+    client.p2p.Stop();
+    a.p2p.Stop();
+    b.p2p.Stop();
+
+    ASSERT_TRUE(synced);
+    EXPECT_EQ(status.headerHeight, chain.size() - 1);
+    EXPECT_EQ(status.peers, 2u);
+    EXPECT_EQ(status.inFlight, 0u);
+    EXPECT_FALSE(status.forked);
+    ExpectInOrder(client, chain);
+    // Both peers did a share of the work.
+    EXPECT_GT(a.served.load(), 0u);
+    EXPECT_GT(b.served.load(), 0u);
+    EXPECT_EQ(client.sync.HashAt(5), BlockHash(chain[5].header));
+}
+
+TEST(BlockSync, ReassignsRequestsOfStallingPeer)
+{
+    const auto params = LooseParams();
+    const auto chain = BuildChain(params, 40);
+    Server good(params, chain, true);
+    Server staller(params, chain, false);
+    net::SyncOptions opts;
+    opts.window = 16;
+    opts.maxInFlightPerPeer = 4;
+    opts.stallTimeout = 100ms;
+    opts.blockTimeout = 2s;
+    opts.tickInterval = 50ms;
+    Client client(params, opts);
+    client.p2p.AddPeerAddress("127.0.0.1:" + std::to_string(good.p2p.ListenPort()));
+    client.p2p.AddPeerAddress("127.0.0.1:" + std::to_string(staller.p2p.ListenPort()));
+
+    std::atomic<bool> stop{false};
+    std::thread t1(RunIo, std::ref(good.io), std::ref(stop));
+    std::thread t2(RunIo, std::ref(staller.io), std::ref(stop));
+    std::thread t3(RunIo, std::ref(client.io), std::ref(stop));
+    good.p2p.Start();
+    staller.p2p.Start();
+    client.p2p.Start();
+
+    const bool synced = WaitFor([&] { return client.sync.Status().connectedHeight == chain.size() - 1; }, 20s);
+    const auto status = client.sync.Status();
+
+    stop = true;
+    t1.join();
+    t2.join();
+    t3.join();
+    client.p2p.Stop();
+    good.p2p.Stop();
+    staller.p2p.Stop();
+
+    ASSERT_TRUE(synced);
+    ExpectInOrder(client, chain);
+    EXPECT_EQ(staller.served.load(), 0u);
+    EXPECT_EQ(good.served.load(), chain.size());
+    EXPECT_GT(status.reassigned, 0u);
+}
+
+TEST(BlockSync, RejectedBlockStopsDownload)
+{
+    const auto params = LooseParams();
+    const auto chain = BuildChain(params, 30);
+    Server server(params, chain, true);
+    boost::asio::io_context io;
+    net::P2PNode p2p(io, 0);
+    consensus::ForkResolver headers;
+    std::atomic<uint32_t> delivered{0};
+    net::BlockSync sync(io, p2p, headers, params, [&](uint32_t height, const Block&) {
+        ++delivered;
+        return height < 10;
+    });
+    sync.Start(std::nullopt);
+    p2p.AddPeerAddress("127.0.0.1:" + std::to_string(server.p2p.ListenPort()));
+
+    std::atomic<bool> stop{false};
+    std::thread t1(RunIo, std::ref(server.io), std::ref(stop));
+    std::thread t2(RunIo, std::ref(io), std::ref(stop));
+    server.p2p.Start();
+    p2p.Start();
+
+    const bool failed = WaitFor([&] { return sync.Status().failedHeight.has_value(); }, 20s);
+    std::this_thread::sleep_for(200ms);
+    const auto status = sync.Status();
+
+    stop = true;
+    t1.join();
+    t2.join();
+    p2p.Stop();
+    server.p2p.Stop();
+
+    ASSERT_TRUE(failed);
+    EXPECT_EQ(status.failedHeight, 10u);
+    EXPECT_EQ(status.connectedHeight, 9u);
+    EXPECT_EQ(delivered.load(), 11u);
+    EXPECT_EQ(status.inFlight, 0u);
+}
+
+TEST(BlockSync, CorruptBlockBansItsSender)
+{
+    const auto params = LooseParams();
+    const auto chain = BuildChain(params, 30, 2);
+    bool mutated = false;
+    ComputeMerkleRoot(chain[5].transactions, mutated);
+    ASSERT_FALSE(mutated);
+    Server bad(params, chain, true, true);
+    Server good(params, chain, true);
+    net::SyncOptions opts;
+    opts.window = 16;
+    opts.maxInFlightPerPeer = 4;
+    opts.tickInterval = 50ms;
+    Client client(params, opts);
+    // Another loopback address, so that banning it leaves `good` alone.
+    client.p2p.AddPeerAddress("127.0.0.2:" + std::to_string(bad.p2p.ListenPort()));
+
+    std::atomic<bool> stop{false};
+    std::thread t1(RunIo, std::ref(bad.io), std::ref(stop));
+    std::thread t2(RunIo, std::ref(good.io), std::ref(stop));
+    std::thread t3(RunIo, std::ref(client.io), std::ref(stop));
+    bad.p2p.Start();
+    good.p2p.Start();
+    client.p2p.Start();
+
+    const bool banned = WaitFor([&] { return bad.served.load() > 0 && client.p2p.Peers().empty(); }, 20s);
+    client.p2p.AddPeerAddress("127.0.0.1:" + std::to_string(good.p2p.ListenPort()));
+    const bool synced = WaitFor([&] { return client.sync.Status().connectedHeight == chain.size() - 1; }, 20s);
+    const auto peers = client.p2p.Peers();
+
+    stop = true;
+    t1.join();
+    t2.join();
+    t3.join();
+    client.p2p.Stop();
+    bad.p2p.Stop();
+    good.p2p.Stop();
+
+    ASSERT_TRUE(banned);
+    ASSERT_TRUE(synced);
+    ExpectInOrder(client, chain);
+    {
+        std::lock_guard<std::mutex> l(client.mu);
+        for (size_t n : client.sizes) EXPECT_EQ(n, 3u);
+    }
+    ASSERT_EQ(peers.size(), 1u);
+    EXPECT_EQ(peers[0].address, "127.0.0.1");
+}
+
+TEST(BlockSync, RejectedBlockIsFetchedAgain)
+{
+    const auto params = LooseParams();
+    const auto chain = BuildChain(params, 40);
+    Server a(params, chain, true);
+    Server b(params, chain, true);
+    net::SyncOptions opts;
+    opts.window = 64; // the sink may reject anything still in it
+    opts.maxInFlightPerPeer = 4;
+    opts.tickInterval = 50ms;
+    Client client(params, opts);
+    client.p2p.AddPeerAddress("127.0.0.1:" + std::to_string(a.p2p.ListenPort()));
+    client.p2p.AddPeerAddress("127.0.0.2:" + std::to_string(b.p2p.ListenPort()));
+
+    std::atomic<bool> stop{false};
+    std::thread t1(RunIo, std::ref(a.io), std::ref(stop));
+    std::thread t2(RunIo, std::ref(b.io), std::ref(stop));
+    std::thread t3(RunIo, std::ref(client.io), std::ref(stop));
+    a.p2p.Start();
+    b.p2p.Start();
+    client.p2p.Start();
+
+    // Whoever sent block 7 is banned once it turns out invalid.
+    const bool delivered = WaitFor([&] {
+        std::lock_guard<std::mutex> l(client.mu);
+        return std::find(client.heights.begin(), client.heights.end(), 7u) != client.heights.end();
+    }, 20s);
+    client.sync.BlockRejected(7, BlockHash(chain[7].header));
+    const bool synced = WaitFor([&] {
+        const auto status = client.sync.Status();
+        return status.connectedHeight == chain.size() - 1 && status.rejected == 1;
+    }, 20s);
+    const auto peers = client.p2p.Peers();
+
+    stop = true;
+    t1.join();
+    t2.join();
+    t3.join();
+    client.p2p.Stop();
+    a.p2p.Stop();
+    b.p2p.Stop();
+
+    ASSERT_TRUE(delivered);
+    ASSERT_TRUE(synced);
+    EXPECT_EQ(peers.size(), 1u);
+    // Everything from the rejected block on came again, in order.
+    std::lock_guard<std::mutex> l(client.mu);
+    EXPECT_EQ(std::count(client.heights.begin(), client.heights.end(), 7u), 2);
+    const auto again = std::find(client.heights.rbegin(), client.heights.rend(), 7u).base() - 1;
+    for (auto it = again; it != client.heights.end(); ++it) {
+        const auto h = static_cast<uint32_t>(7 + (it - again));
+        EXPECT_EQ(*it, h);
+        EXPECT_EQ(client.hashes[it - client.heights.begin()], BlockHash(chain[h].header));
+    }
+    EXPECT_EQ(client.heights.back(), chain.size() - 1);
+}
+
+net::Message HeadersMessage(const std::vector<BlockHeader>& headers)
+{
+    const auto count = static_cast<uint32_t>(headers.size());
+    net::Message msg{"headers", std::vector<uint8_t>(sizeof(count) + headers.size() * sizeof(BlockHeader))};
+    std::memcpy(msg.payload.data(), &count, sizeof(count));
+    for (size_t i = 0; i < headers.size(); ++i)
+        std::memcpy(msg.payload.data() + sizeof(count) + i * sizeof(BlockHeader), &headers[i], sizeof(BlockHeader));
+    return msg;
+}
+
+TEST(BlockSync, HeadersThatDoNotConnectAreAskedForOnlySoOften)
+{
+    const auto params = LooseParams();
+    const auto chain = BuildChain(params, 10);
+    net::SyncOptions opts;
+    opts.tickInterval = 20ms;
+    opts.headersTimeout = 50ms;
+    opts.maxUnconnectingHeaders = 3;
+    Client client(params, opts);
+    boost::asio::io_context io;
+    net::P2PNode peer(io, 0);
+    peer.SetLocalHeight(50); // ahead, so it is asked for headers
+    std::atomic<size_t> asked{0};
+    peer.RegisterHandler("getheaders", [&](const net::PeerInfo&, const net::Message&) { ++asked; });
+    peer.AddPeerAddress("127.0.0.1:" + std::to_string(client.p2p.ListenPort()));
+
+    std::atomic<bool> stop{false};
+    std::thread t1(RunIo, std::ref(io), std::ref(stop));
+    std::thread t2(RunIo, std::ref(client.io), std::ref(stop));
+    client.p2p.Start();
+    peer.Start();
+
+    const bool connected = WaitFor([&] { return asked.load() > 0 && !peer.Peers().empty(); }, 10s);
+    const auto id = connected ? peer.Peers()[0].id : std::string();
+    // Headers whose parent nobody has.
+    for (int i = 0; i < 5; ++i) peer.SendTo(id, HeadersMessage({chain[5].header, chain[6].header}));
+    std::this_thread::sleep_for(300ms);
+    const size_t before = asked.load();
+    std::this_thread::sleep_for(300ms);
+    const size_t after = asked.load();
+    const auto status = client.sync.Status();
+    const auto peers = client.p2p.Peers();
+
+    stop = true;
+    t1.join();
+    t2.join();
+    peer.Stop();
+    client.p2p.Stop();
+
+    ASSERT_TRUE(connected);
+    EXPECT_EQ(before, after);
+    EXPECT_FALSE(status.headerHeight.has_value());
+    // Not reason enough to ban it.
+    EXPECT_EQ(peers.size(), 1u);
+}
+
+TEST(BlockSync, InvalidHeadersBanTheirSender)
+{
+    const auto params = LooseParams();
+    const auto chain = BuildChain(params, 10);
+    Client client(params, net::SyncOptions{});
+    boost::asio::io_context io;
+    net::P2PNode peer(io, 0);
+    peer.AddPeerAddress("127.0.0.1:" + std::to_string(client.p2p.ListenPort()));
+
+    std::atomic<bool> stop{false};
+    std::thread t1(RunIo, std::ref(io), std::ref(stop));
+    std::thread t2(RunIo, std::ref(client.io), std::ref(stop));
+    client.p2p.Start();
+    peer.Start();
+
+    const bool connected = WaitFor([&] { return !client.p2p.Peers().empty() && !peer.Peers().empty(); }, 10s);
+    const auto id = connected ? peer.Peers()[0].id : std::string();
+    BlockHeader weak = chain[1].header;
+    weak.bits = 0x1d00ffff; // the nonce does not meet this target
+    peer.SendTo(id, HeadersMessage({chain[0].header, weak}));
+    const bool dropped = WaitFor([&] { return client.p2p.Peers().empty(); }, 10s);
+    const auto status = client.sync.Status();
+
+    stop = true;
+    t1.join();
+    t2.join();
+    peer.Stop();
+    client.p2p.Stop();
+
+    ASSERT_TRUE(connected);
+    EXPECT_TRUE(dropped);
+    EXPECT_EQ(status.headerHeight, 0u);
+}
+
+TEST(BlockSync, AcceptHeaderNeedsParentAndWork)
+{
+    const auto params = LooseParams();
+    const auto chain = BuildChain(params, 5);
+    boost::asio::io_context io;
+    net::P2PNode p2p(io, 0);
+    consensus::ForkResolver headers;
+    net::BlockSync sync(io, p2p, headers, params, [](uint32_t, const Block&) { return true; });
+
+    EXPECT_FALSE(sync.AcceptHeader(chain[2].header)); // parent unknown
+    EXPECT_TRUE(sync.AcceptHeader(chain[0].header));
+    EXPECT_TRUE(sync.AcceptHeader(chain[1].header));
+    BlockHeader weak = chain[2].header;
+    weak.bits = 0x1d00ffff; // the nonce does not meet this target
+    EXPECT_FALSE(sync.AcceptHeader(weak));
+    EXPECT_TRUE(sync.AcceptHeader(chain[2].header));
+    // A second root is not accepted once the chain exists.
+    auto other = BuildChain(params, 1);
+    other[0].header.time += 1;
+    EXPECT_FALSE(sync.AcceptHeader(other[0].header));
+    EXPECT_EQ(sync.Status().headerHeight, 2u);
+    EXPECT_THROW(sync.Start(3u), std::runtime_error);
+    p2p.Stop();
+}
+
+TEST(BlockSync, CheckHeaderPassesOnlyNewBestHeaders)
+{
+    const auto params = LooseParams();
+    const auto chain = BuildChain(params, 5);
+    boost::asio::io_context io;
+    net::P2PNode p2p(io, 0);
+    consensus::ForkResolver headers;
+    net::BlockSync sync(io, p2p, headers, params, [](uint32_t, const Block&) { return true; });
+    for (uint32_t h = 0; h < 4; ++h) ASSERT_TRUE(sync.AcceptHeader(chain[h].header));
+
+    EXPECT_FALSE(sync.CheckHeader(chain[3].header)); // already known
+    EXPECT_FALSE(sync.CheckHeader(chain[1].header));
+    EXPECT_TRUE(sync.CheckHeader(chain[4].header));
+    // A sibling of a block deep in the chain has less work than the tip.
+    BlockHeader stale = chain[2].header;
+    stale.time += 1;
+    while (!powalgo::CheckProofOfWork(BlockHash(stale), stale.bits, params)) ++stale.nonce;
+    EXPECT_FALSE(sync.CheckHeader(stale));
+    EXPECT_EQ(sync.Status().headerHeight, 3u);
+    p2p.Stop();
+}
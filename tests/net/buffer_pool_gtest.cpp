@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+#include "../../layer2-services/net/buffer_pool.h"
+
+TEST(BufferPool, ReusesBuffersBySizeClass)
+{
+    net::BufferPool pool;
+    auto small = pool.Acquire(100);
+    EXPECT_EQ(small.size(), 100u);
+    EXPECT_GE(small.capacity(), net::BufferPool::ClassBytes(0));
+    const uint8_t* data = small.data();
+    pool.Release(std::move(small));
+    EXPECT_EQ(pool.Idle(), 1u);
+
+    // Anything up to the class size gets the same buffer back.
+    auto again = pool.Acquire(200);
+    EXPECT_EQ(again.data(), data);
+    EXPECT_EQ(again.size(), 200u);
+    EXPECT_EQ(pool.Idle(), 0u);
+
+    // A bigger request does not.
+    auto bigger = pool.Acquire(net::BufferPool::ClassBytes(1) + 1);
+    EXPECT_GE(bigger.capacity(), net::BufferPool::ClassBytes(2));
+    pool.Release(std::move(again));
+    pool.Release(std::move(bigger));
+    EXPECT_EQ(pool.Idle(), 2u);
+}
+
+TEST(BufferPool, KeepsIdleMemoryBounded)
+{
+    net::BufferPool pool;
+    const size_t largest = net::BufferPool::ClassBytes(net::BufferPool::k_classes - 1);
+    for (int i = 0; i < 3; ++i) pool.Release(std::vector<uint8_t>(largest));
+    EXPECT_EQ(pool.Idle(), 1u); // one 4 MiB buffer is over budget already
+
+    for (int i = 0; i < 10000; ++i) pool.Release(std::vector<uint8_t>(net::BufferPool::k_min_class_bytes));
+    EXPECT_EQ(pool.Idle(), 1u + net::BufferPool::k_class_budget / net::BufferPool::k_min_class_bytes);
+
+    // Too small or far too big to be worth keeping.
+    pool.Release(std::vector<uint8_t>(16));
+    pool.Release(std::vector<uint8_t>(4 * largest));
+    EXPECT_EQ(pool.Idle(), 1u + net::BufferPool::k_class_budget / net::BufferPool::k_min_class_bytes);
+}
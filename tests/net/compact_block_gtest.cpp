@@ -0,0 +1,227 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../../layer1-core/merkle/merkle.h"
+#include "../../layer2-services/net/compact_relay.h"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+Transaction MakeTx(uint32_t seed)
+{
+    Transaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    for (size_t i = 0; i < 4; ++i) tx.vin[0].prevout.hash[i] = static_cast<uint8_t>(seed >> (8 * i));
+    tx.vin[0].prevout.index = 1;
+    tx.vin[0].scriptSig.assign(72, static_cast<uint8_t>(seed));
+    tx.vin[0].sequence = 0xffffffff;
+    tx.vout[0].value = 1000 + seed;
+    tx.vout[0].scriptPubKey.assign(32, static_cast<uint8_t>(seed >> 3));
+    return tx;
+}
+
+Block MakeBlock(uint32_t firstSeed, size_t txCount)
+{
+    Block block{};
+    block.header.version = 1;
+    block.header.time = 1700000000 + firstSeed;
+    Transaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.index = std::numeric_limits<uint32_t>::max();
+    coinbase.vin[0].scriptSig = {static_cast<uint8_t>(firstSeed)};
+    TxOut out{};
+    out.value = 50;
+    out.scriptPubKey.assign(32, 7);
+    coinbase.vout.push_back(out);
+    block.transactions.push_back(coinbase);
+    for (size_t i = 1; i < txCount; ++i) block.transactions.push_back(MakeTx(firstSeed + static_cast<uint32_t>(i)));
+    block.header.merkleRoot = ComputeMerkleRoot(block.transactions);
+    return block;
+}
+
+void ExpectSameBlock(const Block& a, const Block& b)
+{
+    EXPECT_EQ(BlockHash(a.header), BlockHash(b.header));
+    ASSERT_EQ(a.transactions.size(), b.transactions.size());
+    for (size_t i = 0; i < a.transactions.size(); ++i)
+        EXPECT_EQ(a.transactions[i].GetHash(), b.transactions[i].GetHash());
+}
+
+void RunIo(boost::asio::io_context& io, std::atomic<bool>& stopFlag)
+{
+    while (!stopFlag.load()) {
+        io.run_for(20ms);
+        io.restart();
+    }
+}
+
+bool WaitFor(const std::function<bool()>& done, std::chrono::milliseconds timeout)
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (done()) return true;
+        std::this_thread::sleep_for(10ms);
+    }
+    return done();
+}
+
+} // namespace
+
+TEST(CompactBlock, RoundTripsAndIsAFractionOfTheBlock)
+{
+    const Block block = MakeBlock(1, 500);
+    const auto compact = net::MakeCompactBlock(block, 42);
+    ASSERT_EQ(compact.prefilled.size(), 1u);
+    EXPECT_EQ(compact.prefilled[0].index, 0u);
+    EXPECT_EQ(compact.shortIds.size(), 499u);
+
+    const auto encoded = net::SerializeCompactBlock(compact);
+    EXPECT_LT(encoded.size() * 10, SerializeBlock(block).size());
+
+    const auto decoded = net::DeserializeCompactBlock(encoded);
+    EXPECT_EQ(BlockHash(decoded.header), BlockHash(block.header));
+    EXPECT_EQ(decoded.nonce, 42u);
+    EXPECT_EQ(decoded.shortIds, compact.shortIds);
+
+    net::PartiallyDownloadedBlock partial(decoded);
+    for (size_t i = block.transactions.size(); i-- > 1;)
+        partial.Offer(block.transactions[i].GetHash(), block.transactions[i]);
+    partial.Offer(MakeTx(9999).GetHash(), MakeTx(9999)); // not in the block
+    EXPECT_TRUE(partial.Missing().empty());
+    EXPECT_EQ(partial.Matched(), 499u);
+    auto rebuilt = partial.Fill({});
+    ASSERT_TRUE(rebuilt.has_value());
+    ExpectSameBlock(*rebuilt, block);
+}
+
+TEST(CompactBlock, ShortIdsDependOnTheNonce)
+{
+    const Block block = MakeBlock(1, 10);
+    EXPECT_NE(net::MakeCompactBlock(block, 1).shortIds, net::MakeCompactBlock(block, 2).shortIds);
+    const net::ShortIdHasher hasher(block.header, 1);
+    EXPECT_LE(hasher(block.transactions[1].GetHash()), net::k_short_id_mask);
+}
+
+TEST(CompactBlock, MissingTransactionsAreFilledInOrder)
+{
+    const Block block = MakeBlock(100, 20);
+    net::PartiallyDownloadedBlock partial(net::MakeCompactBlock(block, 7));
+    for (size_t i = 1; i < block.transactions.size(); ++i)
+        if (i % 5 != 0) partial.Offer(block.transactions[i].GetHash(), block.transactions[i]);
+    const auto missing = partial.Missing();
+    EXPECT_EQ(missing, (std::vector<uint32_t>{5, 10, 15}));
+
+    std::vector<Transaction> txs;
+    for (uint32_t index : missing) txs.push_back(block.transactions[index]);
+    EXPECT_FALSE(partial.Fill({txs[0], txs[1]}).has_value());
+    auto rebuilt = partial.Fill(txs);
+    ASSERT_TRUE(rebuilt.has_value());
+    ExpectSameBlock(*rebuilt, block);
+
+    // The request and answer survive the wire.
+    const auto req = net::DeserializeBlockTxnRequest(net::SerializeBlockTxnRequest({BlockHash(block.header), missing}));
+    EXPECT_EQ(req.indexes, missing);
+    const auto txn = net::DeserializeBlockTxn(net::SerializeBlockTxn({BlockHash(block.header), txs}));
+    ASSERT_EQ(txn.transactions.size(), 3u);
+    EXPECT_EQ(txn.transactions[2].GetHash(), block.transactions[15].GetHash());
+}
+
+TEST(CompactBlock, RejectsMalformedMessages)
+{
+    const Block block = MakeBlock(1, 5);
+    auto compact = net::MakeCompactBlock(block, 1);
+
+    auto duplicate = compact;
+    duplicate.shortIds[1] = duplicate.shortIds[0];
+    EXPECT_THROW(net::PartiallyDownloadedBlock{duplicate}, std::runtime_error);
+
+    auto badIndex = compact;
+    badIndex.prefilled[0].index = 5;
+    EXPECT_THROW(net::PartiallyDownloadedBlock{badIndex}, std::runtime_error);
+
+    auto encoded = net::SerializeCompactBlock(compact);
+    encoded.pop_back();
+    EXPECT_THROW(net::DeserializeCompactBlock(encoded), std::runtime_error);
+
+    auto req = net::SerializeBlockTxnRequest({BlockHash(block.header), {3, 1}});
+    EXPECT_THROW(net::DeserializeBlockTxnRequest(req), std::runtime_error);
+}
+
+TEST(CompactBlockRelay, RebuildsFromMempoolThenSwitchesToHighBandwidth)
+{
+    boost::asio::io_context ioA;
+    boost::asio::io_context ioB;
+    net::P2PNode a(ioA, 0);
+    net::P2PNode b(ioB, 0);
+
+    policy::FeePolicy policy(1, 100000, 5000);
+    mempool::Mempool poolA(policy);
+    mempool::Mempool poolB(policy);
+    net::CompactBlockRelay relayA(a, poolA, [](const BlockHeader&) { return true; }, [](const net::PeerInfo&, const Block&) {});
+
+    std::mutex mu;
+    std::vector<Block> received;
+    net::CompactBlockRelay relayB(b, poolB, [](const BlockHeader&) { return true; },
+                                  [&](const net::PeerInfo&, const Block& block) {
+                                      std::lock_guard<std::mutex> l(mu);
+                                      received.push_back(block);
+                                  });
+    std::atomic<int> invs{0};
+    b.RegisterHandler("inv", [&](const net::PeerInfo&, const net::Message&) { ++invs; });
+    relayA.Start();
+    relayB.Start();
+
+    const Block first = MakeBlock(1, 200);
+    const Block second = MakeBlock(1000, 200);
+    // B saw all but two transactions of the first block and all of the second.
+    for (size_t i = 1; i < first.transactions.size(); ++i)
+        if (i != 50 && i != 150) ASSERT_TRUE(poolB.Accept(first.transactions[i], 100000));
+    for (size_t i = 1; i < second.transactions.size(); ++i) ASSERT_TRUE(poolB.Accept(second.transactions[i], 100000));
+
+    std::atomic<bool> stop{false};
+    std::thread ta(RunIo, std::ref(ioA), std::ref(stop));
+    std::thread tb(RunIo, std::ref(ioB), std::ref(stop));
+    a.Start();
+    b.AddPeerAddress("127.0.0.1:" + std::to_string(a.ListenPort()));
+    b.Start();
+
+    ASSERT_TRUE(WaitFor([&] { return a.Peers().size() == 1 && b.Peers().size() == 1; }, 5s));
+    std::this_thread::sleep_for(200ms); // sendcmpct both ways
+
+    // Not high bandwidth yet: inv, getdata(compact), cmpctblock, then one
+    // getblocktxn round trip for the two missing transactions.
+    relayA.Announce(first);
+    const bool gotFirst = WaitFor([&] { std::lock_guard<std::mutex> l(mu); return received.size() == 1; }, 5s);
+    const auto afterFirst = relayB.Stats();
+    std::this_thread::sleep_for(200ms); // B asks A for high bandwidth mode
+
+    relayA.Announce(second);
+    const bool gotSecond = WaitFor([&] { std::lock_guard<std::mutex> l(mu); return received.size() == 2; }, 5s);
+    const auto afterSecond = relayB.Stats();
+
+    stop = true;
+    ta.join();
+    tb.join();
+    a.Stop();
+    b.Stop();
+
+    ASSERT_TRUE(gotFirst);
+    ASSERT_TRUE(gotSecond);
+    ExpectSameBlock(received[0], first);
+    ExpectSameBlock(received[1], second);
+    EXPECT_EQ(afterFirst.received, 1u);
+    EXPECT_EQ(afterFirst.roundTrips, 1u);
+    EXPECT_EQ(afterFirst.txRequested, 2u);
+    EXPECT_EQ(afterFirst.txFromMempool, 197u);
+    // The second block was pushed without an inv and needed nothing else.
+    EXPECT_EQ(invs.load(), 1);
+    EXPECT_EQ(afterSecond.reconstructed, 1u);
+    EXPECT_EQ(afterSecond.roundTrips, 1u);
+    EXPECT_EQ(afterSecond.fullBlocks, 0u);
+}
@@ -1,8 +1,12 @@
 #include <gtest/gtest.h>
 #include <atomic>
 #include <chrono>
+#include <cstring>
+#include <mutex>
 #include <optional>
 #include <thread>
+#include <vector>
+#include "../../layer1-core/pow/sha256d.h"
 #include "../../layer2-services/net/p2p.h"
 
 using namespace std::chrono_literals;
@@ -17,6 +21,21 @@ void RunIo(boost::asio::io_context& io, std::atomic<bool>& stopFlag)
     }
 }
 
+std::vector<uint8_t> Frame(const std::string& command, const std::vector<uint8_t>& payload)
+{
+    std::vector<uint8_t> out(24, 0);
+    const uint32_t magic = 0xd1a0c0de;
+    std::memcpy(out.data(), &magic, sizeof(magic));
+    std::memcpy(out.data() + 4, command.data(), command.size());
+    const auto len = static_cast<uint32_t>(payload.size());
+    std::memcpy(out.data() + 16, &len, sizeof(len));
+    uint8_t hash[32]{};
+    sha256d(hash, payload.data(), payload.size());
+    std::memcpy(out.data() + 20, hash, 4);
+    out.insert(out.end(), payload.begin(), payload.end());
+    return out;
+}
+
 } // namespace
 
 TEST(P2P, MultinodeBroadcastAndInventory)
@@ -59,9 +78,18 @@ TEST(P2P, MultinodeBroadcastAndInventory)
         if (h[0] == 0xEE) return offeredPayload;
         return std::nullopt;
     });
+    // A stands in for a mempool that accepts the transaction and relays it.
+    nodeA.SetTxProvider([offeredPayload](const uint256& h) -> std::optional<std::vector<uint8_t>> {
+        if (h[0] == 0xEE) return offeredPayload;
+        return std::nullopt;
+    });
+    nodeA.RegisterHandler("tx", [&nodeA, advertised, offeredPayload](const net::PeerInfo&, const net::Message& msg) {
+        if (msg.payload == offeredPayload) nodeA.RelayTransaction(advertised);
+    });
     nodeC.RegisterHandler("tx", [&receivedTx, offeredPayload](const net::PeerInfo&, const net::Message& msg) {
         if (msg.payload == offeredPayload) receivedTx.fetch_add(1, std::memory_order_relaxed);
     });
+    for (auto* node : {&nodeA, &nodeB, &nodeC}) node->SetTrickleIntervals(20ms, 20ms);
 
     nodeA.Start();
     nodeB.Start();
@@ -96,3 +124,360 @@ TEST(P2P, MultinodeBroadcastAndInventory)
     nodeB.Stop();
     nodeC.Stop();
 }
+
+TEST(P2P, VersionAdvertisesServices)
+{
+    boost::asio::io_context ioFull;
+    boost::asio::io_context ioPruned;
+    net::P2PNode full(ioFull, 0);
+    net::P2PNode pruned(ioPruned, 0);
+    pruned.SetLocalServices(net::P2PNode::k_node_network_limited);
+    pruned.AddPeerAddress("127.0.0.1:" + std::to_string(full.ListenPort()));
+
+    std::atomic<bool> stop{false};
+    std::thread tFull(RunIo, std::ref(ioFull), std::ref(stop));
+    std::thread tPruned(RunIo, std::ref(ioPruned), std::ref(stop));
+    full.Start();
+    pruned.Start();
+
+    auto servicesOf = [](net::P2PNode& n) -> uint64_t {
+        for (int i = 0; i < 300; ++i) {
+            auto peers = n.Peers();
+            if (!peers.empty() && peers[0].services != 0) return peers[0].services;
+            std::this_thread::sleep_for(10ms);
+        }
+        return 0;
+    };
+    const uint64_t seenByFull = servicesOf(full);
+    const uint64_t seenByPruned = servicesOf(pruned);
+
+    stop = true;
+    tFull.join();
+    tPruned.join();
+    full.Stop();
+    pruned.Stop();
+
+    EXPECT_EQ(seenByFull, net::P2PNode::k_node_network_limited);
+    EXPECT_EQ(seenByPruned, net::P2PNode::k_node_network | net::P2PNode::k_node_network_limited);
+}
+
+TEST(P2P, RequestBlocksAsksFullNodesOnly)
+{
+    boost::asio::io_context ioFull;
+    boost::asio::io_context ioPruned;
+    net::P2PNode full(ioFull, 0);
+    net::P2PNode pruned(ioPruned, 0);
+    pruned.SetLocalServices(net::P2PNode::k_node_network_limited);
+    pruned.AddPeerAddress("127.0.0.1:" + std::to_string(full.ListenPort()));
+
+    uint256 wanted{};
+    wanted.fill(0x42);
+    const std::vector<uint8_t> body{1, 2, 3, 4};
+    full.SetBlockProvider([&](const uint256& hash) -> std::optional<std::vector<uint8_t>> {
+        if (hash == wanted) return body;
+        return std::nullopt;
+    });
+    std::atomic<bool> received{false};
+    pruned.RegisterHandler("block", [&](const net::PeerInfo&, const net::Message& msg) {
+        if (msg.payload == body) received = true;
+    });
+
+    std::atomic<bool> stop{false};
+    std::thread tFull(RunIo, std::ref(ioFull), std::ref(stop));
+    std::thread tPruned(RunIo, std::ref(ioPruned), std::ref(stop));
+    full.Start();
+    pruned.Start();
+
+    size_t asked = 0;
+    for (int i = 0; i < 300 && asked == 0; ++i) {
+        asked = pruned.RequestBlocks({wanted});
+        if (asked == 0) std::this_thread::sleep_for(10ms);
+    }
+    for (int i = 0; i < 300 && !received; ++i) std::this_thread::sleep_for(10ms);
+    // The pruned peer does not serve old blocks, so it is not asked.
+    const size_t askedByFull = full.RequestBlocks({wanted});
+
+    stop = true;
+    tFull.join();
+    tPruned.join();
+    full.Stop();
+    pruned.Stop();
+
+    EXPECT_EQ(asked, 1u);
+    EXPECT_TRUE(received);
+    EXPECT_EQ(askedByFull, 0u);
+    EXPECT_EQ(pruned.RequestBlocks({}), 0u);
+}
+
+TEST(P2P, ServedBlocksAreSharedBetweenPeers)
+{
+    boost::asio::io_context ioFull;
+    boost::asio::io_context ioB;
+    boost::asio::io_context ioC;
+    net::P2PNode full(ioFull, 0);
+    net::P2PNode nodeB(ioB, 0);
+    net::P2PNode nodeC(ioC, 0);
+    // One encrypted peer and one v1 peer get the same framed block.
+    full.EnableV2Transport();
+    nodeB.EnableV2Transport();
+    nodeB.AddPeerAddress("127.0.0.1:" + std::to_string(full.ListenPort()));
+    nodeC.AddPeerAddress("127.0.0.1:" + std::to_string(full.ListenPort()));
+
+    uint256 wanted{};
+    wanted.fill(0x42);
+    std::vector<uint8_t> body(300 * 1024);
+    for (size_t i = 0; i < body.size(); ++i) body[i] = static_cast<uint8_t>(i * 13);
+    std::atomic<int> reads{0};
+    full.SetBlockProvider([&](const uint256& hash) -> std::optional<std::vector<uint8_t>> {
+        if (hash != wanted) return std::nullopt;
+        ++reads;
+        return body;
+    });
+    std::atomic<int> received{0};
+    auto record = [&](const net::PeerInfo&, const net::Message& msg) {
+        if (msg.payload == body) ++received;
+    };
+    nodeB.RegisterHandler("block", record);
+    nodeC.RegisterHandler("block", record);
+
+    std::atomic<bool> stop{false};
+    std::thread tFull(RunIo, std::ref(ioFull), std::ref(stop));
+    std::thread tB(RunIo, std::ref(ioB), std::ref(stop));
+    std::thread tC(RunIo, std::ref(ioC), std::ref(stop));
+    full.Start();
+    nodeB.Start();
+    nodeC.Start();
+
+    size_t askedB = 0;
+    size_t askedC = 0;
+    for (int i = 0; i < 300 && (askedB == 0 || askedC == 0); ++i) {
+        if (askedB == 0) askedB = nodeB.RequestBlocks({wanted});
+        if (askedC == 0) askedC = nodeC.RequestBlocks({wanted});
+        std::this_thread::sleep_for(10ms);
+    }
+    for (int i = 0; i < 500 && received < 2; ++i) std::this_thread::sleep_for(10ms);
+    const bool encrypted = !nodeB.Peers().empty() && nodeB.Peers()[0].v2Transport;
+
+    stop = true;
+    tFull.join();
+    tB.join();
+    tC.join();
+    full.Stop();
+    nodeB.Stop();
+    nodeC.Stop();
+
+    EXPECT_EQ(received, 2);
+    EXPECT_EQ(reads, 1);
+    EXPECT_TRUE(encrypted);
+}
+
+TEST(P2P, BroadcastDeliversLargeMessagesInOrder)
+{
+    boost::asio::io_context ioA;
+    boost::asio::io_context ioB;
+    boost::asio::io_context ioC;
+    net::P2PNode nodeA(ioA, 0);
+    net::P2PNode nodeB(ioB, 0);
+    net::P2PNode nodeC(ioC, 0);
+    nodeB.AddPeerAddress("127.0.0.1:" + std::to_string(nodeA.ListenPort()));
+    nodeC.AddPeerAddress("127.0.0.1:" + std::to_string(nodeA.ListenPort()));
+
+    std::mutex mu;
+    std::vector<int> seenB;
+    std::vector<int> seenC;
+    auto record = [&mu](std::vector<int>& seen) {
+        return [&mu, &seen](const net::PeerInfo&, const net::Message& msg) {
+            // Every byte of blob i is i; anything else means a corrupt frame.
+            bool intact = msg.payload.size() == 256 * 1024;
+            for (uint8_t b : msg.payload) intact = intact && b == msg.payload[0];
+            std::lock_guard<std::mutex> l(mu);
+            seen.push_back(intact ? msg.payload[0] : -1);
+        };
+    };
+    nodeB.RegisterHandler("blob", record(seenB));
+    nodeC.RegisterHandler("blob", record(seenC));
+
+    std::atomic<bool> stop{false};
+    std::thread tA(RunIo, std::ref(ioA), std::ref(stop));
+    std::thread tB(RunIo, std::ref(ioB), std::ref(stop));
+    std::thread tC(RunIo, std::ref(ioC), std::ref(stop));
+    nodeA.Start();
+    nodeB.Start();
+    nodeC.Start();
+    for (int i = 0; i < 300 && nodeA.Peers().size() < 2; ++i) std::this_thread::sleep_for(10ms);
+
+    // Queued faster than they can be written, so the writer batches them.
+    for (int i = 0; i < 40; ++i)
+        nodeA.Broadcast(net::Message{"blob", std::vector<uint8_t>(256 * 1024, static_cast<uint8_t>(i))});
+    for (int i = 0; i < 500; ++i) {
+        {
+            std::lock_guard<std::mutex> l(mu);
+            if (seenB.size() == 40 && seenC.size() == 40) break;
+        }
+        std::this_thread::sleep_for(10ms);
+    }
+
+    stop = true;
+    tA.join();
+    tB.join();
+    tC.join();
+    nodeA.Stop();
+    nodeB.Stop();
+    nodeC.Stop();
+
+    std::vector<int> expected(40);
+    for (int i = 0; i < 40; ++i) expected[i] = i;
+    EXPECT_EQ(seenB, expected);
+    EXPECT_EQ(seenC, expected);
+}
+
+TEST(P2P, DropsPeersThatStopReading)
+{
+    boost::asio::io_context io;
+    net::P2PNode node(io, 0);
+    std::atomic<bool> stop{false};
+    std::thread t(RunIo, std::ref(io), std::ref(stop));
+    node.Start();
+
+    // Connects but never reads: the kernel buffers fill, then our queue.
+    boost::asio::io_context rawIo;
+    boost::asio::ip::tcp::socket raw(rawIo);
+    raw.connect({boost::asio::ip::make_address("127.0.0.1"), node.ListenPort()});
+    bool connected = false;
+    for (int i = 0; i < 300 && !connected; ++i) {
+        connected = node.Peers().size() == 1;
+        if (!connected) std::this_thread::sleep_for(10ms);
+    }
+
+    bool dropped = false;
+    for (int i = 0; i < 100 && !dropped; ++i) {
+        node.Broadcast(net::Message{"blob", std::vector<uint8_t>(1024 * 1024, 0x5A)});
+        std::this_thread::sleep_for(10ms);
+        dropped = node.Peers().empty();
+    }
+    for (int i = 0; i < 300 && !dropped; ++i) {
+        std::this_thread::sleep_for(10ms);
+        dropped = node.Peers().empty();
+    }
+
+    stop = true;
+    t.join();
+    node.Stop();
+
+    EXPECT_TRUE(connected);
+    EXPECT_TRUE(dropped);
+}
+
+TEST(P2P, ParsesMessagesAcrossReadBoundaries)
+{
+    boost::asio::io_context io;
+    net::P2PNode node(io, 0);
+    std::mutex mu;
+    std::vector<std::vector<uint8_t>> received;
+    node.RegisterHandler("blob", [&](const net::PeerInfo&, const net::Message& msg) {
+        std::lock_guard<std::mutex> l(mu);
+        received.push_back(msg.payload);
+    });
+    std::atomic<bool> stop{false};
+    std::thread t(RunIo, std::ref(io), std::ref(stop));
+    node.Start();
+
+    // Many small messages in one write, a large one behind them, and a final
+    // message split mid-header.
+    std::vector<std::vector<uint8_t>> sent;
+    for (int i = 0; i < 100; ++i) sent.emplace_back(static_cast<size_t>(i), static_cast<uint8_t>(i));
+    sent.emplace_back(300 * 1024, 0x77);
+    sent.emplace_back(std::vector<uint8_t>{1, 2, 3});
+    std::vector<uint8_t> stream;
+    for (const auto& p : sent) {
+        const auto frame = Frame("blob", p);
+        stream.insert(stream.end(), frame.begin(), frame.end());
+    }
+    boost::asio::io_context rawIo;
+    boost::asio::ip::tcp::socket raw(rawIo);
+    raw.connect({boost::asio::ip::make_address("127.0.0.1"), node.ListenPort()});
+    const size_t split = stream.size() - 3 - 10;
+    boost::asio::write(raw, boost::asio::buffer(stream.data(), split));
+    std::this_thread::sleep_for(50ms);
+    boost::asio::write(raw, boost::asio::buffer(stream.data() + split, stream.size() - split));
+
+    bool done = false;
+    for (int i = 0; i < 300 && !done; ++i) {
+        std::this_thread::sleep_for(10ms);
+        std::lock_guard<std::mutex> l(mu);
+        done = received.size() == sent.size();
+    }
+
+    stop = true;
+    t.join();
+    node.Stop();
+
+    std::lock_guard<std::mutex> l(mu);
+    EXPECT_EQ(received, sent);
+}
+
+TEST(P2P, SlowHandlersOnlyHoldUpTheirOwnPeer)
+{
+    boost::asio::io_context io;
+    boost::asio::thread_pool processing(4);
+    net::P2PNode node(io, 0);
+    node.SetProcessingExecutor(processing.get_executor());
+    std::mutex mu;
+    std::vector<uint8_t> slowSeen;
+    std::vector<uint8_t> fastSeen;
+    std::atomic<bool> slowBusy{false};
+    std::atomic<bool> fastDoneWhileSlowBusy{false};
+    node.RegisterHandler("work", [&](const net::PeerInfo&, const net::Message& msg) {
+        if (msg.payload.size() != 2) return;
+        if (msg.payload[0] == 1) {
+            if (msg.payload[1] == 0) {
+                slowBusy = true;
+                std::this_thread::sleep_for(500ms);
+                slowBusy = false;
+            }
+            std::lock_guard<std::mutex> l(mu);
+            slowSeen.push_back(msg.payload[1]);
+        } else {
+            std::lock_guard<std::mutex> l(mu);
+            fastSeen.push_back(msg.payload[1]);
+            if (fastSeen.size() == 50 && slowBusy) fastDoneWhileSlowBusy = true;
+        }
+    });
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) threads.emplace_back(RunIo, std::ref(io), std::ref(stop));
+    node.Start();
+
+    boost::asio::io_context rawIo;
+    boost::asio::ip::tcp::socket slow(rawIo);
+    boost::asio::ip::tcp::socket fast(rawIo);
+    slow.connect({boost::asio::ip::make_address("127.0.0.1"), node.ListenPort()});
+    fast.connect({boost::asio::ip::make_address("127.0.0.1"), node.ListenPort()});
+    std::vector<uint8_t> slowStream;
+    for (uint8_t i = 0; i < 20; ++i) {
+        const auto frame = Frame("work", {1, i});
+        slowStream.insert(slowStream.end(), frame.begin(), frame.end());
+    }
+    boost::asio::write(slow, boost::asio::buffer(slowStream));
+    for (int i = 0; i < 100 && !slowBusy; ++i) std::this_thread::sleep_for(5ms);
+    for (uint8_t i = 0; i < 50; ++i) boost::asio::write(fast, boost::asio::buffer(Frame("work", {2, i})));
+
+    bool done = false;
+    for (int i = 0; i < 300 && !done; ++i) {
+        std::this_thread::sleep_for(10ms);
+        std::lock_guard<std::mutex> l(mu);
+        done = slowSeen.size() == 20 && fastSeen.size() == 50;
+    }
+
+    stop = true;
+    for (auto& t : threads) t.join();
+    node.Stop();
+    processing.join();
+
+    EXPECT_TRUE(fastDoneWhileSlowBusy);
+    std::lock_guard<std::mutex> l(mu);
+    ASSERT_EQ(slowSeen.size(), 20u);
+    ASSERT_EQ(fastSeen.size(), 50u);
+    for (uint8_t i = 0; i < 20; ++i) EXPECT_EQ(slowSeen[i], i);
+    for (uint8_t i = 0; i < 50; ++i) EXPECT_EQ(fastSeen[i], i);
+}
@@ -0,0 +1,172 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "../../layer2-services/net/p2p.h"
+#include "../../layer2-services/net/token_bucket.h"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+void RunIo(boost::asio::io_context& io, std::atomic<bool>& stopFlag)
+{
+    while (!stopFlag.load()) {
+        io.run_for(20ms);
+        io.restart();
+    }
+}
+
+bool WaitFor(const std::function<bool()>& cond, std::chrono::milliseconds limit = 10s)
+{
+    const auto deadline = std::chrono::steady_clock::now() + limit;
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (cond()) return true;
+        std::this_thread::sleep_for(20ms);
+    }
+    return cond();
+}
+
+class TwoNodes : public ::testing::Test {
+protected:
+    void Connect()
+    {
+        a.AddPeerAddress("127.0.0.1:" + std::to_string(b.ListenPort()));
+        ta = std::thread(RunIo, std::ref(ioA), std::ref(stop));
+        tb = std::thread(RunIo, std::ref(ioB), std::ref(stop));
+        a.Start();
+        b.Start();
+        ASSERT_TRUE(WaitFor([&] { return a.Peers().size() == 1 && b.Peers().size() == 1; }));
+    }
+
+    void TearDown() override
+    {
+        stop = true;
+        if (ta.joinable()) ta.join();
+        if (tb.joinable()) tb.join();
+        a.Stop();
+        b.Stop();
+    }
+
+    boost::asio::io_context ioA;
+    boost::asio::io_context ioB;
+    net::P2PNode a{ioA, 0};
+    net::P2PNode b{ioB, 0};
+    std::atomic<bool> stop{false};
+    std::thread ta;
+    std::thread tb;
+};
+
+} // namespace
+
+TEST(TokenBucket, RefillsUpToBurst)
+{
+    const auto t0 = net::TokenBucket::Clock::now();
+    net::TokenBucket bucket(10, 20, t0);
+    EXPECT_DOUBLE_EQ(bucket.Level(t0), 20);
+    EXPECT_TRUE(bucket.Take(15, t0));
+    EXPECT_FALSE(bucket.Take(10, t0));
+    EXPECT_DOUBLE_EQ(bucket.Level(t0), 5);
+    EXPECT_DOUBLE_EQ(bucket.Level(t0 + 1s), 15);
+    EXPECT_DOUBLE_EQ(bucket.Level(t0 + 10s), 20);
+
+    // Spending overdraws; the debt is repaid first.
+    bucket.Spend(40, t0 + 10s);
+    EXPECT_DOUBLE_EQ(bucket.Level(t0 + 10s), -20);
+    EXPECT_EQ(bucket.TimeUntil(0, t0 + 10s), 2s);
+    EXPECT_EQ(bucket.TimeUntil(100, t0 + 10s), 4s); // no more than the burst
+    EXPECT_EQ(bucket.TimeUntil(0, t0 + 13s), net::TokenBucket::Clock::duration::zero());
+}
+
+TEST_F(TwoNodes, BudgetsAreWeightedByCommand)
+{
+    Connect();
+    // Far more than the old 200 messages a minute, but free for blocks
+    // that were asked for.
+    std::vector<uint256> wanted(1000);
+    for (size_t i = 0; i < wanted.size(); ++i) {
+        wanted[i][0] = static_cast<uint8_t>(i);
+        wanted[i][1] = static_cast<uint8_t>(i >> 8);
+    }
+    ASSERT_TRUE(b.RequestBlocks(b.Peers()[0].id, wanted));
+    const std::vector<uint8_t> block(1024, 0x42);
+    for (int i = 0; i < 1000; ++i) a.Broadcast(net::Message{"block", block});
+    ASSERT_TRUE(WaitFor([&] {
+        const auto traffic = b.Traffic();
+        auto it = traffic.byCommand.find("block");
+        return it != traffic.byCommand.end() && it->second.messagesReceived == 1000;
+    }));
+    EXPECT_EQ(b.Peers().size(), 1u);
+    auto traffic = b.Traffic();
+    EXPECT_EQ(traffic.rateLimited, 0u);
+    EXPECT_EQ(traffic.byCommand["block"].bytesReceived, 1000u * block.size());
+    EXPECT_EQ(a.Traffic().byCommand["block"].messagesSent, 1000u);
+
+    // Unsolicited ones are not.
+    for (int i = 0; i < 20; ++i) a.Broadcast(net::Message{"block", block});
+    ASSERT_TRUE(WaitFor([&] { return b.Peers().empty(); }));
+    EXPECT_EQ(b.Traffic().rateLimited, 1u);
+}
+
+TEST_F(TwoNodes, OneOffMessagesHaveSmallBudgets)
+{
+    Connect();
+    // A handful of one-off messages runs a bucket dry.
+    for (int i = 0; i < 10; ++i) a.Broadcast(net::Message{"getaddr", {}});
+    ASSERT_TRUE(WaitFor([&] { return b.Peers().empty(); }));
+    EXPECT_EQ(b.Traffic().rateLimited, 1u);
+}
+
+TEST_F(TwoNodes, UploadLimitsHoldRelayBack)
+{
+    std::mutex mutex;
+    std::vector<std::string> order;
+    auto record = [&](const net::PeerInfo&, const net::Message& msg) {
+        std::lock_guard<std::mutex> l(mutex);
+        order.push_back(msg.command);
+    };
+    a.RegisterHandler("tx", record);
+    a.RegisterHandler("hello", record);
+    b.SetUploadLimits(0, 32 * 1024);
+    Connect();
+
+    // The first transaction uses up the budget; the rest wait for half of
+    // it to come back, the urgent message only for what it needs.
+    const auto start = std::chrono::steady_clock::now();
+    const std::vector<uint8_t> payload(32 * 1024, 0x17);
+    for (int i = 0; i < 4; ++i) {
+        auto tx = payload;
+        tx[0] = static_cast<uint8_t>(i);
+        b.Broadcast(net::Message{"tx", tx});
+    }
+    b.Broadcast(net::Message{"hello", payload});
+    ASSERT_TRUE(WaitFor([&] {
+        std::lock_guard<std::mutex> l(mutex);
+        return order.size() == 5;
+    }));
+    EXPECT_GE(std::chrono::steady_clock::now() - start, 3s);
+    std::lock_guard<std::mutex> l(mutex);
+    EXPECT_EQ(order[0], "tx");
+    EXPECT_EQ(order[1], "hello");
+
+    const auto traffic = b.Traffic();
+    EXPECT_EQ(traffic.totalUploadLimit, 32u * 1024);
+    EXPECT_GT(traffic.uploadWaits, 0u);
+}
+
+TEST_F(TwoNodes, PeerUploadLimit)
+{
+    std::atomic<size_t> received{0};
+    a.RegisterHandler("hello", [&](const net::PeerInfo&, const net::Message&) { ++received; });
+    b.SetUploadLimits(64 * 1024, 0);
+    Connect();
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 6; ++i) b.Broadcast(net::Message{"hello", std::vector<uint8_t>(32 * 1024)});
+    ASSERT_TRUE(WaitFor([&] { return received == 6; }));
+    // A second's worth goes at once, the rest at the limit.
+    EXPECT_GE(std::chrono::steady_clock::now() - start, 1s);
+    EXPECT_EQ(b.Traffic().peerUploadLimit, 64u * 1024);
+}
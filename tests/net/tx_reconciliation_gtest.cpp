@@ -0,0 +1,183 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+#include "../../layer2-services/net/minisketch.h"
+#include "../../layer2-services/net/p2p.h"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+uint256 MakeHash(uint32_t n)
+{
+    uint256 h{};
+    for (size_t i = 0; i < 4; ++i) h[i] = static_cast<uint8_t>(n >> (8 * i));
+    h[31] = 0xA5;
+    return h;
+}
+
+void RunIo(boost::asio::io_context& io, std::atomic<bool>& stopFlag)
+{
+    while (!stopFlag.load()) {
+        io.run_for(20ms);
+        io.restart();
+    }
+}
+
+bool WaitFor(const std::function<bool()>& done, std::chrono::milliseconds timeout)
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (done()) return true;
+        std::this_thread::sleep_for(10ms);
+    }
+    return done();
+}
+
+// Collects the hashes announced to a node, counting repeats.
+struct InvLog {
+    std::mutex mu;
+    std::multiset<uint256> hashes;
+
+    void Attach(net::P2PNode& node)
+    {
+        node.RegisterHandler("inv", [this](const net::PeerInfo&, const net::Message& msg) {
+            std::lock_guard<std::mutex> l(mu);
+            for (size_t i = 0; i + 33 <= msg.payload.size(); i += 33) {
+                uint256 h{};
+                std::copy(msg.payload.begin() + i + 1, msg.payload.begin() + i + 33, h.begin());
+                hashes.insert(h);
+            }
+        });
+    }
+    size_t Size()
+    {
+        std::lock_guard<std::mutex> l(mu);
+        return hashes.size();
+    }
+};
+
+// Two reconciling nodes; `b` connects to `a` and so initiates.
+struct Pair {
+    boost::asio::io_context ioA;
+    boost::asio::io_context ioB;
+    net::P2PNode a{ioA, 0};
+    net::P2PNode b{ioB, 0};
+    InvLog atA;
+    InvLog atB;
+    std::atomic<bool> stop{false};
+    std::thread ta;
+    std::thread tb;
+
+    bool Connect()
+    {
+        for (auto* node : {&a, &b}) {
+            node->SetTrickleIntervals(20ms, 20ms);
+            node->EnableTxReconciliation(500ms);
+        }
+        atA.Attach(a);
+        atB.Attach(b);
+        ta = std::thread(RunIo, std::ref(ioA), std::ref(stop));
+        tb = std::thread(RunIo, std::ref(ioB), std::ref(stop));
+        a.Start();
+        b.AddPeerAddress("127.0.0.1:" + std::to_string(a.ListenPort()));
+        b.Start();
+        const bool connected = WaitFor([&] { return a.Peers().size() == 1 && b.Peers().size() == 1; }, 5s);
+        std::this_thread::sleep_for(100ms); // sendtxrcncl both ways
+        return connected;
+    }
+    ~Pair()
+    {
+        stop = true;
+        if (ta.joinable()) ta.join();
+        if (tb.joinable()) tb.join();
+        a.Stop();
+        b.Stop();
+    }
+};
+
+} // namespace
+
+TEST(Minisketch, DecodesTheSymmetricDifference)
+{
+    std::mt19937 rng(7);
+    net::Minisketch a(20);
+    net::Minisketch b(20);
+    for (int i = 0; i < 500; ++i) {
+        const uint32_t common = rng() | 1;
+        a.Add(common);
+        b.Add(common);
+    }
+    std::set<uint32_t> expected;
+    for (int i = 0; i < 15; ++i) {
+        const uint32_t only = rng() | 1;
+        (i % 3 ? a : b).Add(only);
+        expected.insert(only);
+    }
+    auto merged = net::Minisketch::Deserialize(a.Serialize());
+    EXPECT_EQ(merged.Capacity(), 20u);
+    merged.Merge(b);
+    const auto difference = merged.Decode();
+    ASSERT_TRUE(difference.has_value());
+    EXPECT_EQ(std::set<uint32_t>(difference->begin(), difference->end()), expected);
+
+    // Adding an element twice removes it.
+    net::Minisketch empty(4);
+    empty.Add(12345);
+    empty.Add(12345);
+    EXPECT_TRUE(empty.Decode()->empty());
+
+    EXPECT_THROW(merged.Merge(net::Minisketch(3)), std::runtime_error);
+    EXPECT_THROW(net::Minisketch::Deserialize({1, 2, 3}), std::runtime_error);
+}
+
+TEST(Minisketch, RefusesSetsBeyondItsCapacity)
+{
+    std::mt19937 rng(11);
+    for (size_t capacity = 2; capacity < 40; ++capacity) {
+        net::Minisketch sketch(capacity);
+        for (size_t i = 0; i < capacity + 5; ++i) sketch.Add(rng() | 1);
+        EXPECT_FALSE(sketch.Decode(capacity - 1).has_value()) << capacity;
+    }
+}
+
+TEST(TxReconciliation, AnnouncesOnlyTheDifference)
+{
+    Pair pair;
+    ASSERT_TRUE(pair.Connect());
+    for (uint32_t i = 0; i < 200; ++i) {
+        pair.a.RelayTransaction(MakeHash(i));
+        pair.b.RelayTransaction(MakeHash(i));
+    }
+    for (uint32_t i = 1000; i < 1010; ++i) pair.a.RelayTransaction(MakeHash(i));
+    for (uint32_t i = 2000; i < 2005; ++i) pair.b.RelayTransaction(MakeHash(i));
+
+    EXPECT_TRUE(WaitFor([&] { return pair.atA.Size() == 5 && pair.atB.Size() == 10; }, 5s));
+    std::this_thread::sleep_for(600ms); // one more round has nothing to add
+    std::lock_guard<std::mutex> la(pair.atA.mu);
+    std::lock_guard<std::mutex> lb(pair.atB.mu);
+    EXPECT_EQ(pair.atA.hashes.size(), 5u);
+    EXPECT_EQ(pair.atB.hashes.size(), 10u);
+    for (uint32_t i = 2000; i < 2005; ++i) EXPECT_EQ(pair.atA.hashes.count(MakeHash(i)), 1u);
+    for (uint32_t i = 1000; i < 1010; ++i) EXPECT_EQ(pair.atB.hashes.count(MakeHash(i)), 1u);
+}
+
+TEST(TxReconciliation, FallsBackToAnnouncingEverything)
+{
+    Pair pair;
+    ASSERT_TRUE(pair.Connect());
+    // Equal sizes but nothing in common: far more difference than expected.
+    for (uint32_t i = 0; i < 100; ++i) {
+        pair.a.RelayTransaction(MakeHash(i));
+        pair.b.RelayTransaction(MakeHash(5000 + i));
+    }
+    EXPECT_TRUE(WaitFor([&] { return pair.atA.Size() == 100 && pair.atB.Size() == 100; }, 5s));
+    std::lock_guard<std::mutex> la(pair.atA.mu);
+    EXPECT_EQ(pair.atA.hashes.count(MakeHash(5000)), 1u);
+    EXPECT_EQ(pair.atA.hashes.count(MakeHash(0)), 0u);
+}
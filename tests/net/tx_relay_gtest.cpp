@@ -0,0 +1,288 @@
+#include <gtest/gtest.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include "../../layer1-core/crypto/schnorr.h"
+#include "../../layer2-services/mempool/mempool.h"
+#include "../../layer2-services/net/p2p.h"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+uint256 MakeHash(uint32_t n)
+{
+    uint256 h{};
+    for (size_t i = 0; i < 4; ++i) h[i] = static_cast<uint8_t>(n >> (8 * i));
+    h[31] = 0x5A;
+    return h;
+}
+
+void RunIo(boost::asio::io_context& io, std::atomic<bool>& stopFlag)
+{
+    while (!stopFlag.load()) {
+        io.run_for(20ms);
+        io.restart();
+    }
+}
+
+bool WaitFor(const std::function<bool()>& done, std::chrono::milliseconds timeout)
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (done()) return true;
+        std::this_thread::sleep_for(10ms);
+    }
+    return done();
+}
+
+// Counts "inv" messages and the distinct hashes they carry.
+struct InvCounter {
+    std::mutex mu;
+    size_t messages{0};
+    size_t entries{0};
+    std::set<uint256> hashes;
+
+    void Attach(net::P2PNode& node)
+    {
+        node.RegisterHandler("inv", [this](const net::PeerInfo&, const net::Message& msg) {
+            std::lock_guard<std::mutex> l(mu);
+            ++messages;
+            const size_t stride = (msg.payload.size() % 33 == 0) ? 33 : 32;
+            for (size_t i = 0; i + stride <= msg.payload.size(); i += stride) {
+                uint256 h{};
+                std::copy(msg.payload.begin() + i + (stride - 32), msg.payload.begin() + i + stride, h.begin());
+                hashes.insert(h);
+                ++entries;
+            }
+        });
+    }
+    size_t Distinct()
+    {
+        std::lock_guard<std::mutex> l(mu);
+        return hashes.size();
+    }
+};
+
+// BIP-340 test vector 1 key pair.
+const std::array<uint8_t, 32> kSeckey = {
+    0xB7,0xE1,0x51,0x62,0x8A,0xED,0x2A,0x6A,0xBF,0x71,0x58,0x80,0x9C,0xF4,0xF3,0xC7,
+    0x62,0xE7,0x16,0x0F,0x38,0xB4,0xDA,0x56,0xA7,0x84,0xD9,0x04,0x51,0x90,0xCF,0xEF};
+const std::array<uint8_t, 32> kPubkey = {
+    0xDF,0xF1,0xD7,0x7F,0x2A,0x67,0x1C,0x5F,0x36,0x18,0x37,0x26,0xDB,0x23,0x41,0xBE,
+    0x58,0xFE,0xAE,0x1D,0xA2,0xDE,0xCE,0xD8,0x43,0x24,0x0F,0x7B,0x50,0x2B,0xA6,0x59};
+
+TxOut PayToKey(uint64_t value)
+{
+    TxOut out{};
+    out.value = value;
+    out.assetId = static_cast<uint8_t>(AssetId::TALANTON);
+    out.scriptPubKey.assign(kPubkey.begin(), kPubkey.end());
+    return out;
+}
+
+} // namespace
+
+TEST(RollingBloomFilter, RemembersRecentEntriesAndForgetsOldOnes)
+{
+    net::RollingBloomFilter filter(1000, 0.0001);
+    for (uint32_t i = 0; i < 1000; ++i) filter.Insert(MakeHash(i));
+    for (uint32_t i = 0; i < 1000; ++i) EXPECT_TRUE(filter.Contains(MakeHash(i)));
+
+    // Two more generations push the first one out.
+    for (uint32_t i = 1000; i < 2500; ++i) filter.Insert(MakeHash(i));
+    for (uint32_t i = 1500; i < 2500; ++i) EXPECT_TRUE(filter.Contains(MakeHash(i)));
+    size_t remembered = 0;
+    for (uint32_t i = 0; i < 500; ++i) remembered += filter.Contains(MakeHash(i));
+    EXPECT_LT(remembered, 5u);
+
+    size_t falsePositives = 0;
+    for (uint32_t i = 100000; i < 200000; ++i) falsePositives += filter.Contains(MakeHash(i));
+    EXPECT_LT(falsePositives, 50u);
+
+    filter.Reset();
+    EXPECT_FALSE(filter.Contains(MakeHash(2499)));
+}
+
+TEST(TxRelay, AnnouncesInBatchesOncePerPeerWithoutEcho)
+{
+    boost::asio::io_context ioA;
+    boost::asio::io_context ioB;
+    net::P2PNode a(ioA, 0);
+    net::P2PNode b(ioB, 0);
+    a.SetTrickleIntervals(200ms, 200ms);
+    b.SetTrickleIntervals(50ms, 50ms);
+    InvCounter atA;
+    InvCounter atB;
+    atA.Attach(a);
+    atB.Attach(b);
+
+    std::atomic<bool> stop{false};
+    std::thread ta(RunIo, std::ref(ioA), std::ref(stop));
+    std::thread tb(RunIo, std::ref(ioB), std::ref(stop));
+    a.Start();
+    b.AddPeerAddress("127.0.0.1:" + std::to_string(a.ListenPort()));
+    b.Start();
+    ASSERT_TRUE(WaitFor([&] { return a.Peers().size() == 1 && b.Peers().size() == 1; }, 5s));
+    std::this_thread::sleep_for(100ms);
+
+    for (uint32_t i = 0; i < 300; ++i) a.RelayTransaction(MakeHash(i));
+    for (uint32_t i = 0; i < 300; ++i) a.RelayTransaction(MakeHash(i)); // already queued
+    const bool delivered = WaitFor([&] { return atB.Distinct() == 300; }, 5s);
+    // B accepts them and relays in turn: A announced them, so nothing goes back.
+    for (uint32_t i = 0; i < 300; ++i) b.RelayTransaction(MakeHash(i));
+    std::this_thread::sleep_for(400ms);
+    a.RelayTransaction(MakeHash(0));
+    std::this_thread::sleep_for(500ms);
+
+    stop = true;
+    ta.join();
+    tb.join();
+    a.Stop();
+    b.Stop();
+
+    ASSERT_TRUE(delivered);
+    std::lock_guard<std::mutex> l(atB.mu);
+    EXPECT_LE(atB.messages, 3u);
+    EXPECT_EQ(atB.entries, 300u);
+    std::lock_guard<std::mutex> la(atA.mu);
+    EXPECT_EQ(atA.entries, 0u);
+}
+
+TEST(TxRelay, UnvalidatedTransactionsAreNotForwarded)
+{
+    boost::asio::io_context ioA;
+    boost::asio::io_context ioB;
+    boost::asio::io_context ioC;
+    net::P2PNode a(ioA, 0);
+    net::P2PNode b(ioB, 0);
+    net::P2PNode c(ioC, 0);
+    for (auto* node : {&a, &b, &c}) node->SetTrickleIntervals(20ms, 20ms);
+
+    const std::vector<uint8_t> payload{0x01, 0x02, 0x03};
+    const uint256 txid = tagged_hash("TX", payload.data(), payload.size());
+    a.SetTxProvider([&](const uint256& h) -> std::optional<std::vector<uint8_t>> {
+        if (h == txid) return payload;
+        return std::nullopt;
+    });
+    std::atomic<int> atB{0};
+    b.RegisterHandler("tx", [&](const net::PeerInfo&, const net::Message& msg) {
+        if (msg.payload == payload) ++atB; // never handed to RelayTransaction
+    });
+    InvCounter atC;
+    atC.Attach(c);
+
+    std::atomic<bool> stop{false};
+    std::thread ta(RunIo, std::ref(ioA), std::ref(stop));
+    std::thread tb(RunIo, std::ref(ioB), std::ref(stop));
+    std::thread tc(RunIo, std::ref(ioC), std::ref(stop));
+    b.Start();
+    a.AddPeerAddress("127.0.0.1:" + std::to_string(b.ListenPort()));
+    c.AddPeerAddress("127.0.0.1:" + std::to_string(b.ListenPort()));
+    a.Start();
+    c.Start();
+    ASSERT_TRUE(WaitFor([&] { return b.Peers().size() == 2; }, 5s));
+    std::this_thread::sleep_for(100ms);
+
+    a.RelayTransaction(txid);
+    const bool fetched = WaitFor([&] { return atB.load() == 1; }, 5s);
+    std::this_thread::sleep_for(300ms);
+
+    stop = true;
+    ta.join();
+    tb.join();
+    tc.join();
+    a.Stop();
+    b.Stop();
+    c.Stop();
+
+    EXPECT_TRUE(fetched);
+    EXPECT_EQ(atC.Distinct(), 0u);
+}
+
+TEST(TxRelay, PeerTransactionsAreValidatedAcceptedAndAnnounced)
+{
+    boost::asio::io_context ioA;
+    boost::asio::io_context ioB;
+    boost::asio::io_context ioC;
+    net::P2PNode a(ioA, 0);
+    net::P2PNode b(ioB, 0);
+    net::P2PNode c(ioC, 0);
+    for (auto* node : {&a, &b, &c}) node->SetTrickleIntervals(20ms, 20ms);
+
+    // B's mempool checks spends against one confirmed coin, as drachmad wires it.
+    OutPoint prev{};
+    prev.hash.fill(0x42);
+    prev.index = 0;
+    const TxOut coin = PayToKey(50000);
+    policy::FeePolicy policy;
+    mempool::Mempool pool(policy);
+    pool.SetValidationContext(consensus::Testnet(), 10, [&](const OutPoint& out) -> std::optional<TxOut> {
+        if (out.hash == prev.hash && out.index == prev.index) return coin;
+        return std::nullopt;
+    });
+    pool.SetOnAccept([&b](const Transaction& tx) { b.RelayTransaction(tx.GetHash()); });
+    b.RegisterHandler("tx", [&pool](const net::PeerInfo&, const net::Message& msg) {
+        const Transaction tx = DeserializeTransaction(msg.payload);
+        uint64_t out = 0;
+        for (const auto& o : tx.vout) out += o.value;
+        pool.Accept(tx, 50000 - out);
+    });
+
+    Transaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = prev;
+    spend.vin[0].assetId = coin.assetId;
+    spend.vout.push_back(PayToKey(40000));
+    const auto digest = ComputeInputDigest(spend, 0);
+    std::array<uint8_t, 64> sig{};
+    ASSERT_TRUE(schnorr_sign_with_aux(kSeckey.data(), digest.data(), nullptr, sig.data()));
+    spend.vin[0].scriptSig.assign(sig.begin(), sig.end());
+    Transaction forged = spend;
+    forged.vin[0].scriptSig[0] ^= 0x01;
+    forged.vout[0].value -= 1; // a different txid, with a signature that fails
+
+    a.SetTxProvider([&](const uint256& h) -> std::optional<std::vector<uint8_t>> {
+        if (h == spend.GetHash()) return Serialize(spend);
+        if (h == forged.GetHash()) return Serialize(forged);
+        return std::nullopt;
+    });
+    InvCounter atC;
+    atC.Attach(c);
+
+    std::atomic<bool> stop{false};
+    std::thread ta(RunIo, std::ref(ioA), std::ref(stop));
+    std::thread tb(RunIo, std::ref(ioB), std::ref(stop));
+    std::thread tc(RunIo, std::ref(ioC), std::ref(stop));
+    b.Start();
+    a.AddPeerAddress("127.0.0.1:" + std::to_string(b.ListenPort()));
+    c.AddPeerAddress("127.0.0.1:" + std::to_string(b.ListenPort()));
+    a.Start();
+    c.Start();
+    ASSERT_TRUE(WaitFor([&] { return b.Peers().size() == 2; }, 5s));
+    std::this_thread::sleep_for(100ms);
+
+    a.RelayTransaction(forged.GetHash());
+    a.RelayTransaction(spend.GetHash());
+    const bool announced = WaitFor([&] { return atC.Distinct() == 1; }, 5s);
+    std::this_thread::sleep_for(300ms);
+
+    stop = true;
+    ta.join();
+    tb.join();
+    tc.join();
+    a.Stop();
+    b.Stop();
+    c.Stop();
+
+    EXPECT_TRUE(announced);
+    EXPECT_TRUE(pool.Exists(spend.GetHash()));
+    EXPECT_FALSE(pool.Exists(forged.GetHash()));
+    std::lock_guard<std::mutex> l(atC.mu);
+    EXPECT_EQ(atC.hashes.size(), 1u);
+    EXPECT_EQ(atC.hashes.count(spend.GetHash()), 1u);
+}
@@ -0,0 +1,223 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "../../layer2-services/net/p2p.h"
+#include "../../layer2-services/net/v2_transport.h"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr uint32_t k_magic = 0xd1a0c0deU;
+
+// An initiator and a responder that have exchanged keys.
+struct Session {
+    net::V2Transport initiator{true, k_magic};
+    net::V2Transport responder{false, k_magic};
+
+    Session()
+    {
+        initiator.Complete(responder.PublicKey().data());
+        responder.Complete(initiator.PublicKey().data());
+    }
+};
+
+bool Open(net::V2Transport& receiver, const std::vector<uint8_t>& packet, std::string& command,
+          std::vector<uint8_t>& payload)
+{
+    const uint32_t length = receiver.DecryptLength(packet.data());
+    if (packet.size() != net::V2Transport::k_overhead + length) return false;
+    bool ignore{false};
+    return receiver.Decrypt(packet.data(), length, command, payload, ignore) && !ignore;
+}
+
+void RunIo(boost::asio::io_context& io, std::atomic<bool>& stopFlag)
+{
+    while (!stopFlag.load()) {
+        io.run_for(20ms);
+        io.restart();
+    }
+}
+
+bool WaitFor(const std::function<bool()>& cond, std::chrono::milliseconds limit = 10s)
+{
+    const auto deadline = std::chrono::steady_clock::now() + limit;
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (cond()) return true;
+        std::this_thread::sleep_for(20ms);
+    }
+    return cond();
+}
+
+bool AllV2(net::P2PNode& node, bool v2)
+{
+    const auto peers = node.Peers();
+    if (peers.empty()) return false;
+    for (const auto& p : peers)
+        if (p.v2Transport != v2 || p.startHeight != 7) return false;
+    return true;
+}
+
+} // namespace
+
+TEST(V2Transport, RoundTrip)
+{
+    Session s;
+    EXPECT_EQ(s.initiator.SessionId(), s.responder.SessionId());
+
+    const std::vector<uint8_t> payload{1, 2, 3, 4, 5};
+    const auto packet = s.initiator.Encrypt("inv", payload.data(), payload.size());
+    // One byte of message type for known commands.
+    EXPECT_EQ(packet.size(), net::V2Transport::k_overhead + 2 + payload.size());
+    std::string command;
+    std::vector<uint8_t> got;
+    ASSERT_TRUE(Open(s.responder, packet, command, got));
+    EXPECT_EQ(command, "inv");
+    EXPECT_EQ(got, payload);
+
+    // Other commands are spelled out; empty payloads work both ways.
+    const auto custom = s.responder.Encrypt("hello", nullptr, 0);
+    EXPECT_EQ(custom.size(), net::V2Transport::k_overhead + 2 + 12);
+    ASSERT_TRUE(Open(s.initiator, custom, command, got));
+    EXPECT_EQ(command, "hello");
+    EXPECT_TRUE(got.empty());
+
+    EXPECT_EQ(net::V2Transport::ShortId("version"), 1);
+    EXPECT_EQ(net::V2Transport::ShortId("hello"), 0);
+}
+
+TEST(V2Transport, SurvivesRekeying)
+{
+    Session s;
+    std::vector<uint8_t> previous;
+    for (uint32_t i = 0; i < 3 * net::V2Transport::k_rekey_interval + 5; ++i) {
+        const std::vector<uint8_t> payload(4, static_cast<uint8_t>(i));
+        const auto packet = s.initiator.Encrypt("ping", payload.data(), payload.size());
+        EXPECT_NE(packet, previous);
+        previous = packet;
+        std::string command;
+        std::vector<uint8_t> got;
+        ASSERT_TRUE(Open(s.responder, packet, command, got)) << i;
+        EXPECT_EQ(got, payload);
+    }
+}
+
+TEST(V2Transport, RejectsForgeries)
+{
+    const std::vector<uint8_t> payload(100, 0x42);
+    for (size_t flip : {size_t{0}, size_t{3}, size_t{50}, net::V2Transport::k_overhead + 2 + 99}) {
+        Session s;
+        auto packet = s.initiator.Encrypt("tx", payload.data(), payload.size());
+        packet[flip] ^= 0x01;
+        std::string command;
+        std::vector<uint8_t> got;
+        EXPECT_FALSE(Open(s.responder, packet, command, got)) << flip;
+    }
+
+    // Replaying or reordering breaks the nonce sequence.
+    Session s;
+    s.initiator.Encrypt("tx", payload.data(), payload.size()); // lost
+    const auto second = s.initiator.Encrypt("tx", payload.data(), payload.size());
+    std::string command;
+    std::vector<uint8_t> got;
+    EXPECT_FALSE(Open(s.responder, second, command, got));
+
+    // Another network derives other keys.
+    net::V2Transport initiator(true, k_magic);
+    net::V2Transport responder(false, k_magic + 1);
+    initiator.Complete(responder.PublicKey().data());
+    responder.Complete(initiator.PublicKey().data());
+    const auto packet = initiator.Encrypt("tx", payload.data(), payload.size());
+    EXPECT_FALSE(Open(responder, packet, command, got));
+}
+
+TEST(V2Transport, RejectsBadKeys)
+{
+    net::V2Transport transport(true, k_magic);
+    std::array<uint8_t, net::V2Transport::k_key_bytes> key{};
+    EXPECT_THROW(transport.Complete(key.data()), std::runtime_error);
+    key[0] = 0x02;
+    key[32] = 0x05; // x = 5 is not on secp256k1
+    EXPECT_THROW(transport.Complete(key.data()), std::runtime_error);
+    EXPECT_FALSE(transport.Ready());
+    EXPECT_THROW(transport.Encrypt("ping", nullptr, 0), std::runtime_error);
+}
+
+class V2Network : public ::testing::Test {
+protected:
+    void Connect(bool aV2, bool bV2)
+    {
+        a.SetLocalHeight(7);
+        b.SetLocalHeight(7);
+        if (aV2) a.EnableV2Transport();
+        if (bV2) b.EnableV2Transport();
+        a.AddPeerAddress("127.0.0.1:" + std::to_string(b.ListenPort()));
+        ta = std::thread(RunIo, std::ref(ioA), std::ref(stop));
+        tb = std::thread(RunIo, std::ref(ioB), std::ref(stop));
+        a.Start();
+        b.Start();
+    }
+
+    void TearDown() override
+    {
+        stop = true;
+        if (ta.joinable()) ta.join();
+        if (tb.joinable()) tb.join();
+        a.Stop();
+        b.Stop();
+    }
+
+    boost::asio::io_context ioA;
+    boost::asio::io_context ioB;
+    net::P2PNode a{ioA, 0};
+    net::P2PNode b{ioB, 0};
+    std::atomic<bool> stop{false};
+    std::thread ta;
+    std::thread tb;
+};
+
+TEST_F(V2Network, EncryptedWhenBothSupportIt)
+{
+    std::mutex mutex;
+    std::vector<std::vector<uint8_t>> received;
+    b.RegisterHandler("hello", [&](const net::PeerInfo& from, const net::Message& msg) {
+        EXPECT_TRUE(from.v2Transport);
+        std::lock_guard<std::mutex> l(mutex);
+        received.push_back(msg.payload);
+    });
+    Connect(true, true);
+    ASSERT_TRUE(WaitFor([&] { return AllV2(a, true) && AllV2(b, true); }));
+    EXPECT_TRUE(b.Peers()[0].services & net::P2PNode::k_node_p2p_v2);
+
+    // Short, and longer than the receive buffer.
+    std::vector<uint8_t> big(300 * 1024);
+    for (size_t i = 0; i < big.size(); ++i) big[i] = static_cast<uint8_t>(i * 7);
+    a.Broadcast(net::Message{"hello", {1, 2, 3}});
+    a.Broadcast(net::Message{"hello", big});
+    a.Broadcast(net::Message{"hello", {4}});
+    ASSERT_TRUE(WaitFor([&] {
+        std::lock_guard<std::mutex> l(mutex);
+        return received.size() == 3;
+    }));
+    std::lock_guard<std::mutex> l(mutex);
+    EXPECT_EQ(received[0], (std::vector<uint8_t>{1, 2, 3}));
+    EXPECT_EQ(received[1], big);
+    EXPECT_EQ(received[2], (std::vector<uint8_t>{4}));
+}
+
+TEST_F(V2Network, FallsBackToV1)
+{
+    // b only speaks v1: a's v2 attempt is dropped and a redials with v1.
+    Connect(true, false);
+    ASSERT_TRUE(WaitFor([&] { return AllV2(a, false) && AllV2(b, false); }));
+    EXPECT_EQ(b.Peers().size(), 1u);
+}
+
+TEST_F(V2Network, AnswersV1Dialers)
+{
+    Connect(false, true);
+    ASSERT_TRUE(WaitFor([&] { return AllV2(a, false) && AllV2(b, false); }));
+}
@@ -233,6 +233,110 @@ TEST(TxIndex, ReopensEmptyAndTracksNewBlocks)
     EXPECT_EQ(out, 3u);
 }
 
+static Block MakeIndexedBlock()
+{
+    Block block{};
+    block.header.version = 1;
+    block.header.time = 1700000000;
+    for (uint8_t i = 0; i < 3; ++i) {
+        Transaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.hash.fill(static_cast<uint8_t>(0x30 + i));
+        tx.vin[0].scriptSig.assign(8, i);
+        TxOut out;
+        out.value = 1000 + i;
+        out.scriptPubKey.assign(32, static_cast<uint8_t>(0x40 + i));
+        tx.vout.push_back(out);
+        block.transactions.push_back(tx);
+    }
+    return block;
+}
+
+TEST(TxIndex, BlockBatchStoresDirectPositions)
+{
+    std::filesystem::path tmp = std::filesystem::temp_directory_path() / "txindex_best";
+    std::filesystem::path blocksPath = std::filesystem::temp_directory_path() / "txindex_best_blocks.dat";
+    std::filesystem::remove_all(tmp);
+    std::filesystem::remove(blocksPath);
+    std::filesystem::remove(blocksPath.string() + ".idx");
+
+    const Block block = MakeIndexedBlock();
+    const uint256 blockHash = BlockHash(block.header);
+    std::vector<uint256> txids;
+    for (const auto& tx : block.transactions) txids.push_back(tx.GetHash());
+
+    BlockStore blocks(blocksPath.string());
+    {
+        txindex::TxIndex disk;
+        disk.Open(tmp.string());
+        uint256 hash{};
+        uint32_t height{0};
+        EXPECT_FALSE(disk.BestBlock(hash, height));
+        disk.AddBlockTransactions(blockHash, 12, txids, blocks.WriteBlock(12, block));
+        disk.Flush();
+    }
+
+    txindex::TxIndex reopened;
+    reopened.Open(tmp.string());
+    uint256 hash{};
+    uint32_t height{0};
+    ASSERT_TRUE(reopened.BestBlock(hash, height));
+    EXPECT_EQ(hash, blockHash);
+    EXPECT_EQ(height, 12u);
+    EXPECT_EQ(reopened.BlockCount(), 1u);
+    for (const auto& txid : txids) {
+        auto loc = reopened.Locate(txid);
+        ASSERT_TRUE(loc.has_value());
+        EXPECT_EQ(loc->height, 12u);
+        ASSERT_TRUE(loc->pos.has_value());
+        EXPECT_EQ(blocks.ReadTransaction(*loc->pos).GetHash(), txid);
+    }
+
+    // Positions computed from an existing record match the ones returned on write.
+    auto positions = blocks.TransactionPositions(12);
+    ASSERT_EQ(positions.size(), txids.size());
+    for (size_t i = 0; i < positions.size(); ++i)
+        EXPECT_EQ(blocks.ReadTransaction(positions[i]).GetHash(), txids[i]);
+
+    std::filesystem::remove_all(tmp);
+    std::filesystem::remove(blocksPath);
+    std::filesystem::remove(blocksPath.string() + ".idx");
+}
+
+TEST(RPC, GetRawTransactionReadsFromBlockStore)
+{
+    std::filesystem::path blocksPath = std::filesystem::temp_directory_path() / "rpc_rawtx_blocks.dat";
+    std::filesystem::remove(blocksPath);
+    std::filesystem::remove(blocksPath.string() + ".idx");
+    const Block block = MakeIndexedBlock();
+    BlockStore blocks(blocksPath.string());
+    std::vector<uint256> txids;
+    for (const auto& tx : block.transactions) txids.push_back(tx.GetHash());
+
+    std::filesystem::path indexPath = std::filesystem::temp_directory_path() / "rpc_rawtx_index";
+    std::filesystem::remove_all(indexPath);
+    RpcTestHarness env(19670);
+    env.index.Open(indexPath.string());
+    env.index.AddBlockTransactions(BlockHash(block.header), 3, txids, blocks.WriteBlock(3, block));
+    env.Start(true, false);
+    env.server->SetBlockStore(&blocks);
+
+    std::string hashHex = Hex(std::vector<uint8_t>(txids[1].begin(), txids[1].end()));
+    auto raw = RpcCall(env.io, env.rpc_port, "{\"method\":\"getrawtransaction\",\"params\":\"" + hashHex + "\"}");
+    EXPECT_NE(raw.find(Hex(Serialize(block.transactions[1]))), std::string::npos);
+
+    uint256 unknown{};
+    unknown.fill(0xee);
+    auto missing = RpcCall(env.io, env.rpc_port, "{\"method\":\"getrawtransaction\",\"params\":\"" +
+                                                     Hex(std::vector<uint8_t>(unknown.begin(), unknown.end())) + "\"}");
+    EXPECT_NE(missing.find("null"), std::string::npos);
+
+    env.Stop();
+    std::filesystem::remove_all(indexPath);
+    std::filesystem::remove(blocksPath);
+    std::filesystem::remove(blocksPath.string() + ".idx");
+}
+
 TEST(RPC, EndpointsRespond)
 {
     RpcTestHarness env(19600);
@@ -257,6 +361,10 @@ TEST(RPC, EndpointsRespond)
     EXPECT_EQ(staking.find("\"posAllowed\":true"), std::string::npos);
     EXPECT_NE(staking.find("\"posAllowed\":false"), std::string::npos);
 
+    std::string totals = RpcCall(env.io, env.rpc_port, "{\"method\":\"getnettotals\",\"params\":null}");
+    EXPECT_NE(totals.find("\"total\":{\"msgs_recv\":0"), std::string::npos);
+    EXPECT_NE(totals.find("\"total_upload_limit\":0"), std::string::npos);
+
     std::string numericParams = RpcCall(env.io, env.rpc_port, "{\"method\":\"getbalance\",\"params\":123}");
     EXPECT_EQ(numericParams, "{\"result\":null}");
 
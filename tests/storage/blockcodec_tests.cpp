@@ -0,0 +1,77 @@
+#include "../../layer1-core/storage/blockcodec.h"
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+int main()
+{
+    // Amount packing round-trips and shrinks round numbers.
+    for (uint64_t v : std::vector<uint64_t>{0, 1, 9, 10, 123456789, 5000000000ull, 2100000000000000ull,
+                                            blockcodec::kMaxPackedAmount}) {
+        assert(blockcodec::DecompressAmount(blockcodec::CompressAmount(v)) == v);
+    }
+    assert(blockcodec::CompressAmount(5000000000ull) < 100);
+
+    // Transactions decode to the same wire bytes.
+    Transaction tx;
+    tx.version = 1;
+    TxIn in{};
+    in.prevout.hash.fill(0xab);
+    in.prevout.index = 1;
+    in.scriptSig.assign(64, 0x01);
+    tx.vin.push_back(in);
+    in.scriptSig.assign(65, 0x02);
+    in.sequence = 0;
+    in.assetId = 200;
+    tx.vin.push_back(in);
+    TxOut out{};
+    out.value = 123000;
+    out.scriptPubKey.assign(32, 0x03);
+    tx.vout.push_back(out);
+    out.value = std::numeric_limits<uint64_t>::max();
+    out.assetId = 3;
+    out.scriptPubKey.assign(31, 0x04);
+    tx.vout.push_back(out);
+    tx.lockTime = std::numeric_limits<uint32_t>::max();
+    std::vector<uint8_t> enc;
+    blockcodec::EncodeTransaction(tx, enc);
+    const auto dec = blockcodec::DecodeTransaction(enc.data(), enc.size());
+    assert(Serialize(dec) == Serialize(tx));
+    assert(enc.size() < Serialize(tx).size());
+
+    bool threw = false;
+    try {
+        blockcodec::DecodeTransaction(enc.data(), enc.size() - 1);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    // Compression round-trips repetitive, random and empty input.
+    std::vector<uint8_t> repetitive;
+    for (int i = 0; i < 200; ++i) repetitive.insert(repetitive.end(), enc.begin(), enc.end());
+    auto packed = blockcodec::Compress(repetitive.data(), repetitive.size());
+    assert(packed.size() < repetitive.size() / 10);
+    assert(blockcodec::Decompress(packed.data(), packed.size(), repetitive.size()) == repetitive);
+
+    std::mt19937 rng(7);
+    std::vector<uint8_t> noise(5000);
+    for (auto& b : noise) b = static_cast<uint8_t>(rng());
+    packed = blockcodec::Compress(noise.data(), noise.size());
+    assert(blockcodec::Decompress(packed.data(), packed.size(), noise.size()) == noise);
+
+    packed = blockcodec::Compress(nullptr, 0);
+    assert(blockcodec::Decompress(packed.data(), packed.size(), 0).empty());
+
+    threw = false;
+    try {
+        blockcodec::Decompress(packed.data(), packed.size(), 10);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+    return 0;
+}
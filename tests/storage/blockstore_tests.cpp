@@ -0,0 +1,421 @@
+#include "../../layer1-core/storage/blockstore.h"
+#include "../../layer1-core/pow/sha256d.h"
+#include <cassert>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::vector<Block> BuildChain(uint32_t count)
+{
+    std::vector<Block> chain;
+    for (uint32_t h = 0; h < count; ++h) {
+        Block block{};
+        block.header.version = 1;
+        block.header.time = 1700000000 + h * 60;
+        block.header.prevBlockHash = chain.empty() ? uint256{} : BlockHash(chain.back().header);
+        Transaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].prevout.index = std::numeric_limits<uint32_t>::max();
+        coinbase.vin[0].scriptSig = {static_cast<uint8_t>(h), static_cast<uint8_t>(h >> 8)};
+        TxOut out{};
+        out.value = 50 + h;
+        out.scriptPubKey.assign(32, static_cast<uint8_t>(h));
+        coinbase.vout.push_back(out);
+        block.transactions.push_back(coinbase);
+        chain.push_back(block);
+    }
+    return chain;
+}
+
+// A block with the shapes the compact codec special-cases and the ones it
+// has to spell out.
+Block MixedBlock(const uint256& prev, uint32_t outputs)
+{
+    Block block{};
+    block.header.version = 2;
+    block.header.prevBlockHash = prev;
+    block.header.time = 1700000000;
+    block.header.bits = 0x1d00ffff;
+    block.header.nonce = 12345;
+    Transaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.index = std::numeric_limits<uint32_t>::max();
+    coinbase.vin[0].scriptSig = {1, 2, 3};
+    TxOut reward{};
+    reward.value = 5000000000ull;
+    reward.scriptPubKey.assign(32, 0x11);
+    coinbase.vout.push_back(reward);
+    block.transactions.push_back(coinbase);
+
+    Transaction spend;
+    spend.version = 3;
+    spend.lockTime = 500000;
+    TxIn in{};
+    in.prevout.hash.fill(0x22);
+    in.prevout.index = 7;
+    in.scriptSig.assign(64, 0x33);
+    spend.vin.push_back(in);
+    in.prevout.index = 300;
+    in.sequence = 5;
+    in.assetId = 9; // not a valid asset, but storage must not care
+    in.scriptSig.clear();
+    spend.vin.push_back(in);
+    for (uint32_t i = 0; i < outputs; ++i) {
+        TxOut out{};
+        out.value = 1000 + i;
+        out.assetId = static_cast<uint8_t>(i % 3);
+        out.scriptPubKey.assign(32, 0x44);
+        spend.vout.push_back(out);
+    }
+    TxOut odd{};
+    odd.value = std::numeric_limits<uint64_t>::max();
+    odd.scriptPubKey = {0x51};
+    spend.vout.push_back(odd);
+    TxOut empty{};
+    empty.value = 0;
+    spend.vout.push_back(empty);
+    block.transactions.push_back(spend);
+    return block;
+}
+
+bool SameBlock(const Block& a, const Block& b)
+{
+    if (BlockHash(a.header) != BlockHash(b.header) || a.transactions.size() != b.transactions.size()) return false;
+    for (size_t i = 0; i < a.transactions.size(); ++i)
+        if (Serialize(a.transactions[i]) != Serialize(b.transactions[i])) return false;
+    return true;
+}
+
+// Appends a record in the format used before the compact codec.
+void AppendLegacyRecord(const std::string& path, const Block& block)
+{
+    std::vector<uint8_t> payload(reinterpret_cast<const uint8_t*>(&block.header),
+                                 reinterpret_cast<const uint8_t*>(&block.header) + sizeof(BlockHeader));
+    const uint32_t count = static_cast<uint32_t>(block.transactions.size());
+    payload.insert(payload.end(), reinterpret_cast<const uint8_t*>(&count), reinterpret_cast<const uint8_t*>(&count) + 4);
+    for (const auto& tx : block.transactions) {
+        const auto ser = Serialize(tx);
+        const uint32_t len = static_cast<uint32_t>(ser.size());
+        payload.insert(payload.end(), reinterpret_cast<const uint8_t*>(&len), reinterpret_cast<const uint8_t*>(&len) + 4);
+        payload.insert(payload.end(), ser.begin(), ser.end());
+    }
+    const uint32_t size = static_cast<uint32_t>(payload.size());
+    const auto checksum = SHA256(payload.data(), payload.size());
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    out.write(reinterpret_cast<const char*>(checksum.data()), checksum.size());
+    out.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+}
+
+void Remove(const std::string& path)
+{
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    std::filesystem::remove(path + ".idx", ec);
+    std::filesystem::remove(path + ".idx.tmp", ec);
+    std::filesystem::remove(path + ".hdr", ec);
+}
+
+// Copies the files as they are on disk right now, i.e. what survives a crash.
+void Snapshot(const std::string& from, const std::string& to)
+{
+    Remove(to);
+    const auto opts = std::filesystem::copy_options::overwrite_existing;
+    std::filesystem::copy_file(from, to, opts);
+    if (std::filesystem::exists(from + ".idx"))
+        std::filesystem::copy_file(from + ".idx", to + ".idx", opts);
+}
+
+} // namespace
+
+int main()
+{
+    const auto dir = std::filesystem::temp_directory_path();
+    const auto live = (dir / "drachma_blockstore_live.dat").string();
+    const auto crashed = (dir / "drachma_blockstore_crashed.dat").string();
+    Remove(live);
+
+    const uint32_t kBlocks = 105; // the index is flushed after 100 writes
+    auto chain = BuildChain(kBlocks);
+
+    BlockStore store(live);
+    for (uint32_t h = 0; h < kBlocks; ++h) store.WriteBlock(h, chain[h]);
+    assert(store.TipHeight() && *store.TipHeight() == kBlocks - 1);
+
+    // Blocks appended after the last index flush are found again on open.
+    Snapshot(live, crashed);
+    {
+        BlockStore reopened(crashed);
+        assert(reopened.RecoveredOnOpen() == kBlocks - 100);
+        assert(reopened.TipHeight() && *reopened.TipHeight() == kBlocks - 1);
+        auto last = reopened.ReadBlock(kBlocks - 1);
+        assert(BlockHash(last.header) == BlockHash(chain.back().header));
+        assert(last.transactions.size() == 1 && last.transactions[0].vout[0].value == 50 + kBlocks - 1);
+    }
+    {
+        // Recovery was persisted: nothing left to recover.
+        BlockStore again(crashed);
+        assert(again.RecoveredOnOpen() == 0);
+        assert(again.TipHeight() && *again.TipHeight() == kBlocks - 1);
+    }
+
+    // A torn append is cut off and later writes land where it began.
+    Snapshot(live, crashed);
+    const auto intactSize = std::filesystem::file_size(crashed);
+    {
+        std::ofstream out(crashed, std::ios::binary | std::ios::app);
+        const uint32_t size = 4096;
+        out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        out.write("partial", 7);
+    }
+    {
+        BlockStore reopened(crashed);
+        assert(std::filesystem::file_size(crashed) == intactSize);
+        assert(reopened.TipHeight() && *reopened.TipHeight() == kBlocks - 1);
+        auto extra = BuildChain(kBlocks + 1).back();
+        reopened.WriteBlock(kBlocks, extra);
+        assert(BlockHash(reopened.ReadBlock(kBlocks).header) == BlockHash(extra.header));
+    }
+
+    // With the index gone entirely, heights are rebuilt from the genesis record.
+    Snapshot(live, crashed);
+    std::filesystem::remove(crashed + ".idx");
+    {
+        BlockStore reopened(crashed);
+        assert(reopened.RecoveredOnOpen() == kBlocks);
+        for (uint32_t h : {0u, 50u, kBlocks - 1})
+            assert(BlockHash(reopened.ReadBlock(h).header) == BlockHash(chain[h].header));
+    }
+
+    // Sync() makes the index current without waiting for the flush threshold.
+    store.Sync();
+    Snapshot(live, crashed);
+    {
+        BlockStore reopened(crashed);
+        assert(reopened.RecoveredOnOpen() == 0);
+        assert(reopened.TipHeight() && *reopened.TipHeight() == kBlocks - 1);
+    }
+
+    // Small segments: writes roll over to new files and every block and
+    // transaction stays addressable, including after losing the index.
+    const auto segmented = (dir / "drachma_blockstore_seg.dat").string();
+    Remove(segmented);
+    for (uint32_t i = 1; i < 64; ++i) {
+        std::error_code ec;
+        std::filesystem::remove(segmented + "." + std::to_string(i), ec);
+    }
+    uint32_t segments = 0;
+    {
+        BlockStore seg(segmented, 1024);
+        std::vector<DiskTxPos> lastTx;
+        for (uint32_t h = 0; h < 40; ++h) lastTx = seg.WriteBlock(h, chain[h]);
+        while (std::filesystem::exists(seg.SegmentPath(segments))) ++segments;
+        assert(segments > 1);
+        assert(lastTx.size() == 1 && lastTx[0].segment == segments - 1);
+        assert(seg.ReadTransaction(lastTx[0]).GetHash() == chain[39].transactions[0].GetHash());
+    }
+    std::filesystem::remove(segmented + ".idx");
+    {
+        BlockStore seg(segmented, 1024);
+        assert(seg.RecoveredOnOpen() == 40);
+        for (uint32_t h : {0u, 17u, 39u})
+            assert(BlockHash(seg.ReadBlock(h).header) == BlockHash(chain[h].header));
+        auto positions = seg.TransactionPositions(39);
+        assert(positions.size() == 1 && positions[0].segment == segments - 1);
+        seg.WriteBlock(40, chain[40]);
+        assert(!std::filesystem::exists(seg.SegmentPath(segments + 1)));
+    }
+
+    // Pruning deletes whole segments from the front, never one holding a
+    // block above the limit or the one being written, and survives a reopen.
+    uint32_t pruned = 0;
+    {
+        BlockStore seg(segmented, 1024);
+        const uint64_t before = seg.DiskUsage();
+        assert(!seg.PrunedHeight());
+        assert(seg.Prune(0, 0) == 0);
+        assert(seg.Prune(before, 40) == 0);
+
+        const size_t removed = seg.Prune(0, 20);
+        assert(removed > 0 && seg.PrunedHeight());
+        pruned = *seg.PrunedHeight();
+        assert(pruned + 1 == removed && pruned <= 20);
+        assert(!std::filesystem::exists(seg.SegmentPath(0)));
+        assert(seg.DiskUsage() < before);
+        assert(!seg.HasBlock(pruned) && seg.HasBlock(pruned + 1));
+        try {
+            seg.ReadBlock(0);
+            assert(false);
+        } catch (const std::runtime_error& e) {
+            assert(std::string(e.what()) == "block pruned");
+        }
+        assert(BlockHash(seg.ReadBlock(pruned + 1).header) == BlockHash(chain[pruned + 1].header));
+        // Headers of pruned blocks stay readable.
+        for (uint32_t h = 0; h <= pruned + 1; ++h) assert(BlockHash(seg.ReadHeader(h)) == BlockHash(chain[h].header));
+
+        seg.Prune(0, 1000);
+        assert(seg.HasBlock(40) && seg.DiskUsage() > 0);
+        pruned = *seg.PrunedHeight();
+    }
+    {
+        BlockStore seg(segmented, 1024);
+        assert(seg.RecoveredOnOpen() == 0);
+        assert(seg.PrunedHeight() == pruned);
+        for (uint32_t h = 0; h <= pruned; ++h) assert(BlockHash(seg.ReadHeader(h)) == BlockHash(chain[h].header));
+        seg.WriteBlock(41, chain[41]);
+        assert(BlockHash(seg.ReadBlock(41).header) == BlockHash(chain[41].header));
+    }
+
+    // Version 1 index files (single segment, no header) still load.
+    Remove(crashed);
+    {
+        BlockStore fresh(crashed);
+        for (uint32_t h = 0; h < 3; ++h) fresh.WriteBlock(h, chain[h]);
+    }
+    {
+        std::ofstream idx(crashed + ".idx", std::ios::binary | std::ios::trunc);
+        const uint32_t count = 3;
+        idx.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        uint64_t offset = 0;
+        for (uint32_t h = 0; h < 3; ++h) {
+            idx.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            idx.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+            uint32_t size = 0;
+            std::ifstream data(crashed, std::ios::binary);
+            data.seekg(static_cast<std::streamoff>(offset));
+            data.read(reinterpret_cast<char*>(&size), sizeof(size));
+            offset += sizeof(size) + 32 + (size & 0x1fffffff);
+        }
+    }
+    {
+        BlockStore legacy(crashed);
+        assert(legacy.RecoveredOnOpen() == 0);
+        assert(BlockHash(legacy.ReadBlock(2).header) == BlockHash(chain[2].header));
+    }
+
+    // Compact records round-trip exactly and are smaller than the wire form.
+    const auto compact = (dir / "drachma_blockstore_compact.dat").string();
+    Remove(compact);
+    const Block mixed = MixedBlock(uint256{}, 50);
+    {
+        BlockStore store(compact);
+        auto positions = store.WriteBlock(0, mixed);
+        assert(positions.size() == 2);
+        assert(SameBlock(store.ReadBlock(0), mixed));
+        assert(BlockHash(store.ReadHeader(0)) == BlockHash(mixed.header));
+        for (size_t i = 0; i < positions.size(); ++i)
+            assert(store.ReadTransaction(positions[i]).GetHash() == mixed.transactions[i].GetHash());
+        size_t wire = sizeof(BlockHeader) + 4;
+        for (const auto& tx : mixed.transactions) wire += 4 + Serialize(tx).size();
+        assert(std::filesystem::file_size(compact) < wire * 85 / 100);
+    }
+    Remove(compact);
+
+    // Compression: smaller still, readable after losing the index, but no
+    // per-transaction positions.
+    {
+        BlockStore store(compact, BlockStoreOptions{BlockStore::kDefaultSegmentSize, true});
+        const Block big = MixedBlock(uint256{}, 400);
+        assert(store.WriteBlock(0, big).empty());
+        assert(store.TransactionPositions(0).empty());
+        assert(SameBlock(store.ReadBlock(0), big));
+        assert(BlockHash(store.ReadHeader(0)) == BlockHash(big.header));
+        size_t uncompressed = 0;
+        {
+            const auto plain = (dir / "drachma_blockstore_plain.dat").string();
+            Remove(plain);
+            BlockStore p(plain);
+            p.WriteBlock(0, big);
+            uncompressed = std::filesystem::file_size(plain);
+            Remove(plain);
+        }
+        assert(std::filesystem::file_size(compact) < uncompressed / 2);
+        store.WriteBlock(1, BuildChain(1)[0]);
+    }
+    std::filesystem::remove(compact + ".idx");
+    {
+        BlockStore store(compact, BlockStoreOptions{BlockStore::kDefaultSegmentSize, true});
+        assert(store.RecoveredOnOpen() == 1);
+        assert(SameBlock(store.ReadBlock(0), MixedBlock(uint256{}, 400)));
+    }
+    Remove(compact);
+
+    // Files written before the compact codec still read; new blocks go to a
+    // fresh segment so positions stay decodable per segment.
+    for (uint32_t h = 0; h < 3; ++h) AppendLegacyRecord(compact, chain[h]);
+    {
+        BlockStore store(compact);
+        assert(store.RecoveredOnOpen() == 3);
+        assert(SameBlock(store.ReadBlock(2), chain[2]));
+        assert(BlockHash(store.ReadHeader(2)) == BlockHash(chain[2].header));
+        auto legacyPos = store.TransactionPositions(1);
+        assert(legacyPos.size() == 1 && legacyPos[0].segment == 0);
+        assert(store.ReadTransaction(legacyPos[0]).GetHash() == chain[1].transactions[0].GetHash());
+
+        auto newPos = store.WriteBlock(3, chain[3]);
+        assert(newPos.size() == 1 && newPos[0].segment == 1);
+        assert(store.ReadTransaction(newPos[0]).GetHash() == chain[3].transactions[0].GetHash());
+        assert(SameBlock(store.ReadBlock(3), chain[3]));
+    }
+    std::filesystem::remove(compact + ".idx");
+    {
+        BlockStore store(compact);
+        assert(store.RecoveredOnOpen() == 4);
+        assert(SameBlock(store.ReadBlock(3), chain[3]));
+    }
+    Remove(compact);
+    std::filesystem::remove(compact + ".1");
+
+    // Wire records are the block's serialization byte for byte and keep
+    // per-transaction positions; the other formats are re-encoded to match.
+    {
+        BlockStore store(compact, BlockStoreOptions{BlockStore::kDefaultSegmentSize, false, true});
+        auto positions = store.WriteBlock(0, mixed);
+        assert(positions.size() == 2);
+        assert(store.ReadSerializedBlock(0) == SerializeBlock(mixed));
+        assert(SameBlock(store.ReadBlock(0), mixed));
+        assert(BlockHash(store.ReadHeader(0)) == BlockHash(mixed.header));
+        for (size_t i = 0; i < positions.size(); ++i)
+            assert(store.ReadTransaction(positions[i]).GetHash() == mixed.transactions[i].GetHash());
+        std::ifstream in(compact, std::ios::binary);
+        std::vector<uint8_t> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        const auto wire = SerializeBlock(mixed);
+        assert(std::equal(wire.begin(), wire.end(), file.begin() + 36));
+    }
+    std::filesystem::remove(compact + ".idx");
+    {
+        // Recovered without the index; compact records go to a new segment.
+        BlockStore store(compact);
+        assert(store.RecoveredOnOpen() == 1);
+        assert(store.WriteBlock(1, chain[1]).at(0).segment == 1);
+        assert(store.ReadSerializedBlock(1) == SerializeBlock(chain[1]));
+        assert(store.ReadSerializedBlock(0) == SerializeBlock(mixed));
+    }
+    {
+        BlockStore store(compact, BlockStoreOptions{BlockStore::kDefaultSegmentSize, false, true});
+        assert(store.WriteBlock(2, chain[2]).at(0).segment == 2);
+        assert(store.ReadSerializedBlock(2) == SerializeBlock(chain[2]));
+    }
+    bool rejected = false;
+    try {
+        BlockStore store(compact, BlockStoreOptions{BlockStore::kDefaultSegmentSize, true, true});
+    } catch (const std::runtime_error&) {
+        rejected = true;
+    }
+    assert(rejected);
+    Remove(compact);
+    std::filesystem::remove(compact + ".1");
+    std::filesystem::remove(compact + ".2");
+
+    Remove(segmented);
+    for (uint32_t i = 1; i <= segments + 1; ++i) std::filesystem::remove(segmented + "." + std::to_string(i));
+    Remove(live);
+    Remove(crashed);
+    return 0;
+}
@@ -0,0 +1,193 @@
+#include "../../layer1-core/storage/scrubber.h"
+#include "../../layer1-core/merkle/merkle.h"
+#include <cassert>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::vector<Block> BuildChain(uint32_t count)
+{
+    std::vector<Block> chain;
+    for (uint32_t h = 0; h < count; ++h) {
+        Block block{};
+        block.header.version = 1;
+        block.header.time = 1700000000 + h * 60;
+        block.header.prevBlockHash = chain.empty() ? uint256{} : BlockHash(chain.back().header);
+        Transaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].prevout.index = std::numeric_limits<uint32_t>::max();
+        coinbase.vin[0].scriptSig = {static_cast<uint8_t>(h), static_cast<uint8_t>(h >> 8)};
+        TxOut out{};
+        out.value = 50 + h;
+        out.scriptPubKey.assign(32, static_cast<uint8_t>(h));
+        coinbase.vout.push_back(out);
+        block.transactions.push_back(coinbase);
+        // An odd number of transactions, so the block has a mutated twin.
+        if (h == 12) {
+            for (uint8_t i = 1; i <= 2; ++i) {
+                Transaction tx = coinbase;
+                tx.vin[0].prevout.index = i;
+                block.transactions.push_back(tx);
+            }
+        }
+        block.header.merkleRoot = ComputeMerkleRoot(block.transactions);
+        chain.push_back(block);
+    }
+    return chain;
+}
+
+void Remove(const std::string& path)
+{
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    std::filesystem::remove(path + ".idx", ec);
+    for (uint32_t i = 1; i < 32; ++i) std::filesystem::remove(path + "." + std::to_string(i), ec);
+}
+
+// Overwrites one byte of a stored record; `at` counts from the start of the
+// record ([size(4)][checksum(32)][payload]).
+void Corrupt(const BlockStore& store, const StoredBlock& record, uint64_t at)
+{
+    std::fstream f(store.SegmentPath(record.segment), std::ios::binary | std::ios::in | std::ios::out);
+    f.seekg(static_cast<std::streamoff>(record.offset + at));
+    char c = 0;
+    f.get(c);
+    f.seekp(static_cast<std::streamoff>(record.offset + at));
+    f.put(static_cast<char>(c ^ 0x5a));
+    if (!f) throw std::runtime_error("cannot corrupt record");
+}
+
+bool Throws(const std::function<void()>& fn)
+{
+    try {
+        fn();
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+} // namespace
+
+int main()
+{
+    const auto path = (std::filesystem::temp_directory_path() / "drachma_scrubber_blocks.dat").string();
+    Remove(path);
+    const uint32_t kBlocks = 20;
+    const auto chain = BuildChain(kBlocks);
+
+    BlockStore store(path, 1024);
+    for (uint32_t h = 0; h < kBlocks; ++h) store.WriteBlock(h, chain[h]);
+    store.Sync();
+    std::vector<StoredBlock> records;
+    for (uint32_t segment : store.Segments()) {
+        for (const auto& record : store.ScanSegment(segment)) records.push_back(record);
+    }
+    assert(records.size() == kBlocks);
+
+    ScrubOptions options;
+    options.bytesPerSecond = 0;
+    std::map<uint32_t, uint256> requested;
+    BlockScrubber scrubber(store, options, [&](uint32_t height, const uint256& hash) {
+        requested[height] = hash;
+        return std::string("peer");
+    });
+
+    // A clean store.
+    assert(scrubber.RunPass() == 0);
+    auto status = scrubber.Status();
+    assert(status.passes == 1 && status.blocksVerified == kBlocks);
+    assert(status.bytesVerified > 0 && status.damaged.empty() && !status.position);
+
+    // Payload damage is caught by the CRC on every read; damage to the
+    // SHA-256 part of the checksum only by the full check; a block whose
+    // transactions do not match its header only by the merkle check.
+    Corrupt(store, records[5], 36 + 90);
+    Corrupt(store, records[6], 36 + 90);
+    Corrupt(store, records[12], 4 + 10);
+    Block forged = chain[15];
+    forged.transactions[0].vout[0].value += 1;
+    store.WriteBlock(15, forged);
+    Corrupt(store, records[kBlocks - 1], 36 + 90);
+
+    assert(Throws([&] { store.ReadBlock(5); }));
+    assert(BlockHash(store.ReadBlock(12).header) == BlockHash(chain[12].header));
+    assert(!store.VerifyBlock(5).ok && !store.VerifyBlock(5).error.empty());
+    assert(!store.VerifyBlock(12).ok);
+    assert(store.VerifyBlock(15).error == "merkle root mismatch");
+    assert(store.VerifyBlock(4).ok && store.VerifyBlock(4).bytes > 0);
+    assert(Throws([&] { store.VerifyBlock(kBlocks); }));
+
+    assert(scrubber.RunPass() == 5);
+    status = scrubber.Status();
+    assert(status.damaged.size() == 4);
+    assert(status.damaged[0].first == 5 && status.damaged[0].last == 6);
+    assert(status.damaged[1].first == 12 && status.damaged[1].last == 12);
+    assert(status.damaged[2].first == 15 && status.damaged[3].first == kBlocks - 1);
+
+    // Hashes come from the intact block above; the run 5-6 is named from
+    // its top and the damaged tip cannot be named at all.
+    assert(requested.size() == 3);
+    assert(requested.at(6) == BlockHash(chain[6].header));
+    assert(requested.at(12) == BlockHash(chain[12].header));
+    assert(requested.at(15) == BlockHash(chain[15].header));
+
+    // Only the requested block from the peer asked, with matching
+    // transactions, is accepted.
+    Block mutated = chain[12];
+    mutated.transactions.push_back(mutated.transactions.back());
+    assert(BlockHash(mutated.header) == BlockHash(chain[12].header));
+    assert(!scrubber.Repair(chain[7], "peer"));
+    assert(!scrubber.Repair(forged, "peer"));
+    assert(!scrubber.Repair(mutated, "peer"));
+    assert(!scrubber.Repair(chain[6], "other"));
+    assert(!scrubber.Repair(chain[6], ""));
+    assert(scrubber.Repair(chain[6], "peer"));
+    assert(requested.at(5) == BlockHash(chain[5].header));
+    assert(scrubber.Repair(chain[5], "peer"));
+    assert(scrubber.Repair(chain[12], "peer"));
+    assert(scrubber.Repair(chain[15], "peer"));
+    assert(!scrubber.Repair(chain[15], "peer"));
+    for (uint32_t h = 0; h + 1 < kBlocks; ++h) assert(store.VerifyBlock(h).ok);
+
+    assert(scrubber.RunPass() == 1);
+    status = scrubber.Status();
+    assert(status.repaired == 4);
+    assert(status.damaged.size() == 1 && status.damaged[0].first == kBlocks - 1);
+
+    // Repairs survive reopening the store.
+    {
+        scrubber.Stop();
+        store.Sync();
+        BlockStore reopened(path, 1024);
+        for (uint32_t h = 0; h + 1 < kBlocks; ++h) assert(reopened.VerifyBlock(h).ok);
+    }
+
+    // The background thread runs a pass straight away and stops promptly
+    // even when throttled.
+    {
+        ScrubOptions slow;
+        slow.bytesPerSecond = 1;
+        BlockScrubber background(store, slow);
+        background.Start();
+        assert(Throws([&] { background.Start(); }));
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        const auto started = std::chrono::steady_clock::now();
+        background.Stop();
+        assert(std::chrono::steady_clock::now() - started < std::chrono::seconds(5));
+        assert(background.Status().passes == 0);
+        assert(background.Status().blocksVerified >= 1);
+    }
+
+    Remove(path);
+    return 0;
+}
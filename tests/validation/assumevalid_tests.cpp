@@ -0,0 +1,176 @@
+#include "../../layer1-core/validation/assumevalid.h"
+#include "../../layer1-core/validation/validation.h"
+#include "../../layer1-core/merkle/merkle.h"
+#include "../../layer1-core/pow/difficulty.h"
+#include <cassert>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+consensus::Params LooseParams()
+{
+    consensus::Params p = consensus::Testnet();
+    p.nGenesisBits = 0x207fffff;
+    p.fPowAllowMinDifficultyBlocks = true;
+    return p;
+}
+
+BlockHeader MakeHeader(const uint256& prev, uint32_t time, uint32_t bits)
+{
+    BlockHeader h{};
+    h.version = 1;
+    h.prevBlockHash = prev;
+    h.time = time;
+    h.bits = bits;
+    return h;
+}
+
+Transaction MakeCoinbase(uint64_t value)
+{
+    Transaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    tx.vin[0].prevout.hash.fill(0);
+    tx.vin[0].prevout.index = std::numeric_limits<uint32_t>::max();
+    tx.vin[0].scriptSig = {0x01, 0x02};
+    tx.vin[0].assetId = static_cast<uint8_t>(AssetId::TALANTON);
+    tx.vout[0].value = value;
+    tx.vout[0].scriptPubKey.assign(32, 0x01);
+    tx.vout[0].assetId = static_cast<uint8_t>(AssetId::TALANTON);
+    return tx;
+}
+
+bool Throws(const std::string& arg)
+{
+    try {
+        (void)ParseAssumeValid(arg);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+} // namespace
+
+int main()
+{
+    const auto params = LooseParams();
+    const uint8_t drm = static_cast<uint8_t>(AssetId::DRACHMA);
+
+    // A spend carrying a garbage signature is rejected by full validation but
+    // accepted when script checks are skipped; other rules still apply.
+    {
+        TxOut prevOut{};
+        prevOut.value = 5000;
+        prevOut.assetId = drm;
+        prevOut.scriptPubKey.assign(32, 0x07);
+        OutPoint prev{};
+        prev.hash.fill(0x42);
+        prev.index = 0;
+        auto lookup = [prev, prevOut](const OutPoint& op) -> std::optional<TxOut> {
+            if (op.hash == prev.hash && op.index == prev.index) return prevOut;
+            return std::nullopt;
+        };
+
+        Transaction spend;
+        spend.vin.resize(1);
+        spend.vin[0].prevout = prev;
+        spend.vin[0].scriptSig.assign(64, 0x5A); // not a valid signature
+        spend.vin[0].assetId = drm;
+        TxOut out{};
+        out.value = 4000;
+        out.assetId = drm;
+        out.scriptPubKey.assign(32, 0x08);
+        spend.vout.push_back(out);
+
+        const int height = 5;
+        Block block{};
+        block.header.bits = params.nGenesisBits;
+        block.header.time = 3000;
+        block.header.version = 1;
+        block.transactions = {MakeCoinbase(consensus::GetBlockSubsidy(height, params, static_cast<uint8_t>(AssetId::TALANTON))), spend};
+        block.header.merkleRoot = ComputeMerkleRoot(block.transactions);
+        while (!powalgo::CheckProofOfWork(BlockHash(block.header), block.header.bits, params))
+            ++block.header.nonce;
+
+        BlockValidationOptions opts;
+        opts.medianTimePast = block.header.time - 1;
+        opts.now = block.header.time;
+        assert(!ValidateBlock(block, params, height, lookup, opts));
+        opts.skipScriptChecks = true;
+        assert(ValidateBlock(block, params, height, lookup, opts));
+
+        // Overspending is still caught.
+        Block overspend = block;
+        overspend.transactions[1].vout[0].value = 6000;
+        overspend.header.merkleRoot = ComputeMerkleRoot(overspend.transactions);
+        assert(!ValidateBlock(overspend, params, height, lookup, opts));
+
+        // Missing prevouts are still caught.
+        Block missing = block;
+        missing.transactions[1].vin[0].prevout.index = 1;
+        missing.header.merkleRoot = ComputeMerkleRoot(missing.transactions);
+        assert(!ValidateBlock(missing, params, height, lookup, opts));
+
+        // So is a merkle mismatch.
+        Block badMerkle = block;
+        badMerkle.header.merkleRoot[0] ^= 0x01;
+        assert(!ValidateBlock(badMerkle, params, height, lookup, opts));
+    }
+
+    // Ancestry against the best header chain gates the shortcut.
+    {
+        consensus::ForkResolver headers(/*finalizationDepth=*/100, /*reorgWorkMarginBps=*/500);
+        uint256 nullHash{};
+        std::vector<uint256> chain;
+        uint256 prev = nullHash;
+        for (uint32_t h = 0; h < 6; ++h) {
+            auto header = MakeHeader(prev, params.nGenesisTime + h, params.nGenesisBits);
+            auto hash = BlockHash(header);
+            headers.ConsiderHeader(header, hash, prev, h, params);
+            chain.push_back(hash);
+            prev = hash;
+        }
+        // A short side branch off height 2.
+        auto side = MakeHeader(chain[2], params.nGenesisTime + 100, params.nGenesisBits);
+        auto sideHash = BlockHash(side);
+        headers.ConsiderHeader(side, sideHash, chain[2], 3, params);
+        assert(headers.Tip() && headers.Tip()->hash == chain[5]);
+
+        const std::optional<uint256> av = chain[3];
+        assert(CanSkipScriptChecks(headers, av, chain[0]));
+        assert(CanSkipScriptChecks(headers, av, chain[3]));
+        assert(!CanSkipScriptChecks(headers, av, chain[4])); // above the anchor
+        assert(!CanSkipScriptChecks(headers, av, sideHash)); // not an ancestor
+        assert(!CanSkipScriptChecks(headers, std::nullopt, chain[0]));
+
+        // An anchor that is not on the best header chain disables the shortcut.
+        assert(!CanSkipScriptChecks(headers, sideHash, chain[0]));
+        uint256 unknown{};
+        unknown.fill(0xEE);
+        assert(!CanSkipScriptChecks(headers, unknown, chain[0]));
+    }
+
+    // Defaults and argument parsing.
+    {
+        consensus::Params p = params;
+        p.checkpoints.clear();
+        assert(!DefaultAssumeValid(p));
+        uint256 low{};
+        low.fill(0x01);
+        uint256 high{};
+        high.fill(0x02);
+        p.checkpoints[10] = low;
+        p.checkpoints[20] = high;
+        assert(DefaultAssumeValid(p) == high);
+
+        assert(!ParseAssumeValid("0"));
+        auto parsed = ParseAssumeValid(std::string(62, '0') + "aB");
+        assert(parsed && (*parsed)[31] == 0xAB && (*parsed)[0] == 0x00);
+        assert(Throws("1234"));
+        assert(Throws(std::string(64, 'g')));
+    }
+
+    return 0;
+}
@@ -0,0 +1,357 @@
+#include "../../layer1-core/validation/pipeline.h"
+#include "../../layer1-core/validation/replay.h"
+#include "../../layer1-core/crypto/schnorr.h"
+#include "../../layer1-core/merkle/merkle.h"
+#include "../../layer1-core/pow/difficulty.h"
+#include <cassert>
+#include <condition_variable>
+#include <filesystem>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// BIP-340 test vector 1 key pair.
+const std::array<uint8_t, 32> kSeckey = {
+    0xB7,0xE1,0x51,0x62,0x8A,0xED,0x2A,0x6A,0xBF,0x71,0x58,0x80,0x9C,0xF4,0xF3,0xC7,
+    0x62,0xE7,0x16,0x0F,0x38,0xB4,0xDA,0x56,0xA7,0x84,0xD9,0x04,0x51,0x90,0xCF,0xEF};
+const std::array<uint8_t, 32> kPubkey = {
+    0xDF,0xF1,0xD7,0x7F,0x2A,0x67,0x1C,0x5F,0x36,0x18,0x37,0x26,0xDB,0x23,0x41,0xBE,
+    0x58,0xFE,0xAE,0x1D,0xA2,0xDE,0xCE,0xD8,0x43,0x24,0x0F,0x7B,0x50,0x2B,0xA6,0x59};
+
+const uint8_t kTln = static_cast<uint8_t>(AssetId::TALANTON);
+
+consensus::Params LooseParams()
+{
+    consensus::Params p = consensus::Testnet();
+    p.nGenesisBits = 0x207fffff;
+    p.fPowAllowMinDifficultyBlocks = true;
+    return p;
+}
+
+TxOut PayToKey(uint64_t value)
+{
+    TxOut out{};
+    out.value = value;
+    out.assetId = kTln;
+    out.scriptPubKey.assign(kPubkey.begin(), kPubkey.end());
+    return out;
+}
+
+Transaction MakeCoinbase(uint32_t height, uint64_t value)
+{
+    Transaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash.fill(0);
+    tx.vin[0].prevout.index = std::numeric_limits<uint32_t>::max();
+    tx.vin[0].scriptSig = {static_cast<uint8_t>(height), static_cast<uint8_t>(height >> 8)};
+    tx.vin[0].assetId = kTln;
+    tx.vout.push_back(PayToKey(value));
+    return tx;
+}
+
+Transaction MakeSpend(const OutPoint& prev, uint64_t value)
+{
+    Transaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = prev;
+    tx.vin[0].assetId = kTln;
+    tx.vout.push_back(PayToKey(value));
+    auto digest = ComputeInputDigest(tx, 0);
+    std::array<uint8_t, 64> sig{};
+    if (!schnorr_sign_with_aux(kSeckey.data(), digest.data(), nullptr, sig.data()))
+        throw std::runtime_error("sign failed");
+    tx.vin[0].scriptSig.assign(sig.begin(), sig.end());
+    return tx;
+}
+
+void Seal(Block& block, const consensus::Params& params)
+{
+    block.header.merkleRoot = ComputeMerkleRoot(block.transactions);
+    block.header.nonce = 0;
+    while (!powalgo::CheckProofOfWork(BlockHash(block.header), block.header.bits, params))
+        ++block.header.nonce;
+}
+
+// Each block spends the previous block's coinbase (a coin still in flight
+// when the pipeline checks it) and then spends that output again inside the
+// same block. Block 1 spends a coin seeded into the chainstate.
+std::vector<Block> BuildChain(const consensus::Params& params, const OutPoint& seed, uint32_t count)
+{
+    std::vector<Block> chain;
+    OutPoint prevCoinbase = seed;
+    uint64_t prevValue = 50000;
+    for (uint32_t h = 1; h <= count; ++h) {
+        Block block{};
+        block.header.version = 1;
+        block.header.bits = params.nGenesisBits;
+        block.header.time = params.nGenesisTime + h * 60;
+        block.header.prevBlockHash = chain.empty() ? uint256{} : BlockHash(chain.back().header);
+        const uint64_t subsidy = consensus::GetBlockSubsidy(static_cast<int>(h), params, kTln);
+        block.transactions.push_back(MakeCoinbase(h, subsidy));
+        auto first = MakeSpend(prevCoinbase, prevValue - 1000);
+        auto second = MakeSpend(OutPoint{first.GetHash(), 0}, prevValue - 2000);
+        block.transactions.push_back(first);
+        block.transactions.push_back(second);
+        Seal(block, params);
+        prevCoinbase = OutPoint{block.transactions[0].GetHash(), 0};
+        prevValue = subsidy;
+        chain.push_back(std::move(block));
+    }
+    return chain;
+}
+
+struct Run {
+    bool ok{false};
+    std::optional<uint32_t> failed;
+    std::string error;
+    std::optional<uint32_t> connected;
+    std::vector<uint32_t> written;
+    std::vector<uint32_t> indexed;
+    std::optional<BestBlockMarker> best;
+};
+
+Run RunPipeline(const std::string& path, const std::vector<Block>& chain, const consensus::Params& params,
+                const OutPoint& seed, std::function<bool(uint32_t, const uint256&)> skip = {})
+{
+    std::error_code ec;
+    std::filesystem::remove_all(path + ".ldb", ec);
+    std::filesystem::remove(path, ec);
+    Run run;
+    {
+        Chainstate cs(path, 64);
+        cs.AddUTXO(seed, PayToKey(50000));
+
+        std::mutex mu;
+        PipelineOptions opts;
+        opts.workers = 3;
+        opts.lookahead = 4;
+        opts.previousTimes = {params.nGenesisTime};
+        opts.skipScripts = std::move(skip);
+        opts.onConnected = [&](uint32_t height, const uint256& hash, const Block& block) {
+            assert(hash == BlockHash(block.header));
+            run.indexed.push_back(height);
+        };
+        BlockPipeline pipeline(cs, params, [&](uint32_t height, const Block&) {
+            std::lock_guard<std::mutex> l(mu);
+            run.written.push_back(height);
+        }, opts);
+        for (uint32_t h = 1; h <= chain.size(); ++h) {
+            if (!pipeline.Submit(h, chain[h - 1]))
+                break;
+        }
+        run.ok = pipeline.Finish();
+        run.failed = pipeline.FailedHeight();
+        run.error = pipeline.Error();
+        run.connected = pipeline.ConnectedHeight();
+        run.best = cs.BestBlock();
+    }
+    std::filesystem::remove_all(path + ".ldb", ec);
+    std::filesystem::remove(path, ec);
+    return run;
+}
+
+} // namespace
+
+int main()
+{
+    const auto params = LooseParams();
+    const auto path = (std::filesystem::temp_directory_path() / "drachma_pipeline_cs").string();
+    OutPoint seed{};
+    seed.hash.fill(0x5E);
+    seed.index = 0;
+
+    const uint32_t kBlocks = 12;
+    auto chain = BuildChain(params, seed, kBlocks);
+
+    // Every block is connected and written exactly once, in order.
+    {
+        auto run = RunPipeline(path, chain, params, seed);
+        assert(run.ok);
+        assert(!run.failed);
+        assert(run.connected && *run.connected == kBlocks);
+        assert(run.written.size() == kBlocks);
+        for (uint32_t i = 0; i < kBlocks; ++i) assert(run.written[i] == i + 1);
+        assert(run.indexed == run.written);
+        assert(run.best && run.best->height == kBlocks);
+        assert(run.best->hash == BlockHash(chain.back().header));
+    }
+
+    // A bad signature stops the pipeline at that block; everything before it
+    // is connected and written, nothing after it is.
+    auto broken = chain;
+    broken[6].transactions[2].vin[0].scriptSig[10] ^= 0x01; // nothing spends this tx
+    Seal(broken[6], params);
+    for (size_t i = 7; i < broken.size(); ++i) {
+        broken[i].header.prevBlockHash = BlockHash(broken[i - 1].header);
+        Seal(broken[i], params);
+    }
+    {
+        auto run = RunPipeline(path, broken, params, seed);
+        assert(!run.ok);
+        assert(run.failed && *run.failed == 7);
+        assert(run.error == "bad-signature");
+        assert(run.connected && *run.connected == 6);
+        assert(run.written.size() == 6 && run.written.back() == 6);
+        assert(run.best && run.best->height == 6);
+    }
+
+    // Under assumevalid the same chain connects, since only signatures are wrong.
+    {
+        auto run = RunPipeline(path, broken, params, seed, [](uint32_t height, const uint256&) { return height <= 8; });
+        assert(run.ok);
+        assert(run.connected && *run.connected == kBlocks);
+    }
+
+    // Amount rules are never skipped.
+    {
+        auto overspend = chain;
+        overspend[3].transactions[2] = MakeSpend(OutPoint{overspend[3].transactions[1].GetHash(), 0}, 10'000'000'000ULL);
+        Seal(overspend[3], params);
+        auto run = RunPipeline(path, overspend, params, seed, [](uint32_t, const uint256&) { return true; });
+        assert(!run.ok);
+        assert(run.failed && *run.failed == 4);
+        assert(run.error == "bad-txns");
+        // Nothing is stored before it has passed every check.
+        assert(run.connected && *run.connected == 3);
+        assert(run.written.size() == 3);
+        assert(run.best && run.best->height == 3);
+    }
+
+    // A copy padded with its last transaction has the same header and root
+    // but is not the block.
+    {
+        auto padded = chain;
+        padded[2].transactions.push_back(padded[2].transactions.back());
+        auto run = RunPipeline(path, padded, params, seed);
+        assert(run.failed && *run.failed == 3);
+        assert(run.error == "bad-txnmrklroot");
+    }
+
+    // An output can only be spent by a later transaction of the block.
+    {
+        auto reordered = chain;
+        std::swap(reordered[4].transactions[1], reordered[4].transactions[2]);
+        Seal(reordered[4], params);
+        auto run = RunPipeline(path, reordered, params, seed);
+        assert(!run.ok);
+        assert(run.failed && *run.failed == 5);
+        assert(run.error == "bad-txns");
+        assert(run.connected && *run.connected == 4);
+    }
+
+    // With onRejected the pipeline skips a bad block: it goes back to the
+    // connected tip and takes the right block for that height.
+    {
+        std::error_code ec;
+        std::filesystem::remove_all(path + ".ldb", ec);
+        std::filesystem::remove(path, ec);
+        Chainstate cs(path, 64);
+        cs.AddUTXO(seed, PayToKey(50000));
+        std::mutex mu;
+        std::condition_variable cv;
+        std::optional<uint32_t> rejected;
+        std::vector<uint32_t> written;
+        PipelineOptions opts;
+        opts.workers = 3;
+        opts.lookahead = 4;
+        opts.previousTimes = {params.nGenesisTime};
+        opts.onRejected = [&](uint32_t height, const uint256& hash, const std::string& error) {
+            assert(hash == BlockHash(broken[height - 1].header));
+            assert(error == "bad-signature");
+            std::lock_guard<std::mutex> l(mu);
+            rejected = height;
+            cv.notify_all();
+        };
+        BlockPipeline pipeline(cs, params, [&](uint32_t height, const Block&) {
+            std::lock_guard<std::mutex> l(mu);
+            written.push_back(height);
+        }, opts);
+        for (uint32_t h = 1; h <= kBlocks; ++h) {
+            if (!pipeline.Submit(h, broken[h - 1]))
+                break;
+        }
+        {
+            std::unique_lock<std::mutex> l(mu);
+            cv.wait(l, [&] { return rejected.has_value(); });
+        }
+        assert(*rejected == 7);
+        assert(!pipeline.Submit(8, chain[7]));
+        for (uint32_t h = 7; h <= kBlocks; ++h) assert(pipeline.Submit(h, chain[h - 1]));
+        assert(pipeline.Finish());
+        assert(!pipeline.FailedHeight());
+        assert(pipeline.ConnectedHeight() && *pipeline.ConnectedHeight() == kBlocks);
+        assert(written.size() == kBlocks);
+        for (uint32_t i = 0; i < kBlocks; ++i) assert(written[i] == i + 1);
+        assert(cs.BestBlock()->hash == BlockHash(chain.back().header));
+    }
+
+    // Crash between storing and connecting: only the gap is replayed.
+    {
+        const auto storePath = (std::filesystem::temp_directory_path() / "drachma_pipeline_blocks.dat").string();
+        std::error_code ec;
+        std::filesystem::remove_all(path + ".ldb", ec);
+        std::filesystem::remove(path, ec);
+        std::filesystem::remove(storePath, ec);
+        std::filesystem::remove(storePath + ".idx", ec);
+        {
+            Chainstate cs(path, 64);
+            cs.AddUTXO(seed, PayToKey(50000));
+            BlockStore store(storePath);
+            PipelineOptions opts;
+            opts.previousTimes = {params.nGenesisTime};
+            BlockPipeline pipeline(cs, params, [&](uint32_t height, const Block& block) { store.WriteBlock(height, block); }, opts);
+            for (uint32_t h = 1; h <= 8; ++h) assert(pipeline.Submit(h, chain[h - 1]));
+            assert(pipeline.Finish());
+            for (uint32_t h = 9; h <= kBlocks; ++h) store.WriteBlock(h, chain[h - 1]);
+        }
+        {
+            Chainstate cs(path, 64);
+            BlockStore store(storePath);
+            assert(cs.BestBlock() && cs.BestBlock()->height == 8);
+            auto result = ReplayBlocks(cs, store, params);
+            assert(result.replayed == kBlocks - 8);
+            assert(!result.failedHeight);
+            assert(result.tip && *result.tip == kBlocks);
+            assert(cs.BestBlock()->hash == BlockHash(chain.back().header));
+            assert(ReplayBlocks(cs, store, params).replayed == 0);
+        }
+        {
+            // A store that lost the chainstate's tip cannot be replayed.
+            Chainstate cs(path, 64);
+            std::filesystem::remove(storePath, ec);
+            std::filesystem::remove(storePath + ".idx", ec);
+            BlockStore empty(storePath);
+            bool threw = false;
+            try {
+                ReplayBlocks(cs, empty, params);
+            } catch (const std::runtime_error&) {
+                threw = true;
+            }
+            assert(threw);
+        }
+        std::filesystem::remove(storePath, ec);
+        std::filesystem::remove(storePath + ".idx", ec);
+    }
+
+    // Heights must be consecutive.
+    {
+        Chainstate cs(path, 16);
+        BlockPipeline pipeline(cs, params, {}, PipelineOptions{});
+        bool threw = false;
+        try {
+            pipeline.Submit(1, chain[0]);
+            pipeline.Submit(3, chain[2]);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+        pipeline.Finish();
+    }
+    std::error_code ec;
+    std::filesystem::remove_all(path + ".ldb", ec);
+    std::filesystem::remove(path, ec);
+    return 0;
+}
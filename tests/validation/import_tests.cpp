@@ -0,0 +1,264 @@
+#include "../../layer1-core/validation/import.h"
+#include "../../layer1-core/crypto/schnorr.h"
+#include "../../layer1-core/merkle/merkle.h"
+#include "../../layer1-core/pow/difficulty.h"
+#include <array>
+#include <cassert>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+// BIP-340 test vector 1 key pair.
+const std::array<uint8_t, 32> kSeckey = {
+    0xB7,0xE1,0x51,0x62,0x8A,0xED,0x2A,0x6A,0xBF,0x71,0x58,0x80,0x9C,0xF4,0xF3,0xC7,
+    0x62,0xE7,0x16,0x0F,0x38,0xB4,0xDA,0x56,0xA7,0x84,0xD9,0x04,0x51,0x90,0xCF,0xEF};
+const std::array<uint8_t, 32> kPubkey = {
+    0xDF,0xF1,0xD7,0x7F,0x2A,0x67,0x1C,0x5F,0x36,0x18,0x37,0x26,0xDB,0x23,0x41,0xBE,
+    0x58,0xFE,0xAE,0x1D,0xA2,0xDE,0xCE,0xD8,0x43,0x24,0x0F,0x7B,0x50,0x2B,0xA6,0x59};
+
+const uint8_t kTln = static_cast<uint8_t>(AssetId::TALANTON);
+
+consensus::Params LooseParams()
+{
+    consensus::Params p = consensus::Testnet();
+    p.nGenesisBits = 0x207fffff;
+    p.fPowAllowMinDifficultyBlocks = true;
+    return p;
+}
+
+TxOut PayToKey(uint64_t value)
+{
+    TxOut out{};
+    out.value = value;
+    out.assetId = kTln;
+    out.scriptPubKey.assign(kPubkey.begin(), kPubkey.end());
+    return out;
+}
+
+Transaction MakeCoinbase(uint32_t height, uint64_t value, uint8_t tag)
+{
+    Transaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash.fill(0);
+    tx.vin[0].prevout.index = std::numeric_limits<uint32_t>::max();
+    tx.vin[0].scriptSig = {static_cast<uint8_t>(height), static_cast<uint8_t>(height >> 8), tag};
+    tx.vin[0].assetId = kTln;
+    tx.vout.push_back(PayToKey(value));
+    return tx;
+}
+
+Transaction MakeSpend(const OutPoint& prev, uint64_t value)
+{
+    Transaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = prev;
+    tx.vin[0].assetId = kTln;
+    tx.vout.push_back(PayToKey(value));
+    auto digest = ComputeInputDigest(tx, 0);
+    std::array<uint8_t, 64> sig{};
+    if (!schnorr_sign_with_aux(kSeckey.data(), digest.data(), nullptr, sig.data()))
+        throw std::runtime_error("sign failed");
+    tx.vin[0].scriptSig.assign(sig.begin(), sig.end());
+    return tx;
+}
+
+// Chain from a root block at height 0; every later block spends the
+// previous coinbase. `tag` makes otherwise identical chains differ.
+std::vector<Block> BuildChain(const consensus::Params& params, uint32_t count, uint8_t tag,
+                              std::vector<Block> chain = {})
+{
+    while (chain.size() < count) {
+        const auto h = static_cast<uint32_t>(chain.size());
+        Block block{};
+        block.header.version = 1;
+        block.header.bits = params.nGenesisBits;
+        block.header.time = params.nGenesisTime + (h + 1) * 60;
+        block.header.prevBlockHash = chain.empty() ? uint256{} : BlockHash(chain.back().header);
+        const uint64_t subsidy = consensus::GetBlockSubsidy(static_cast<int>(h), params, kTln);
+        block.transactions.push_back(MakeCoinbase(h, subsidy, tag));
+        if (!chain.empty()) {
+            const auto& prev = chain.back().transactions[0];
+            block.transactions.push_back(MakeSpend(OutPoint{prev.GetHash(), 0}, prev.vout[0].value - 1000));
+        }
+        block.header.merkleRoot = ComputeMerkleRoot(block.transactions);
+        while (!powalgo::CheckProofOfWork(BlockHash(block.header), block.header.bits, params))
+            ++block.header.nonce;
+        chain.push_back(std::move(block));
+    }
+    return chain;
+}
+
+void RemoveStore(const std::string& path)
+{
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    std::filesystem::remove(path + ".idx", ec);
+    for (uint32_t i = 1; i < 64; ++i) std::filesystem::remove(path + "." + std::to_string(i), ec);
+}
+
+void RemoveChainstate(const std::string& path)
+{
+    std::error_code ec;
+    std::filesystem::remove_all(path + ".ldb", ec);
+    std::filesystem::remove(path, ec);
+}
+
+bool Throws(const std::function<void()>& fn)
+{
+    try {
+        fn();
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+} // namespace
+
+int main()
+{
+    const auto params = LooseParams();
+    const auto dir = std::filesystem::temp_directory_path();
+    const auto storePath = (dir / "drachma_import_blocks.dat").string();
+    const auto csPath = (dir / "drachma_import_cs").string();
+    const std::vector<std::string> scenarios{"_reindex", "_bootstrap", "_resume", "_bad", "_pruned"};
+    const auto bootstrap = (dir / "drachma_import_bootstrap.dat").string();
+    RemoveStore(storePath);
+    for (const auto& name : scenarios) RemoveChainstate(csPath + name);
+
+    const uint32_t kBlocks = 30;
+    const auto chain = BuildChain(params, kBlocks, 0x01);
+    // A shorter fork from height 8 that was once the tip.
+    const auto fork = BuildChain(params, 12, 0x02, std::vector<Block>(chain.begin(), chain.begin() + 8));
+
+    // Records in the block files out of height order, plus the stale fork:
+    // rebuilding the index puts the best chain back at the right heights.
+    {
+        BlockStore store(storePath, 2048);
+        for (uint32_t h = 8; h < fork.size(); ++h) store.WriteBlock(h, fork[h]);
+        for (uint32_t h = 1; h < kBlocks; h += 2) store.WriteBlock(h, chain[h]);
+        for (uint32_t h = 0; h < kBlocks; h += 2) store.WriteBlock(h, chain[h]);
+        assert(store.Segments().size() > 2);
+    }
+    std::filesystem::remove(storePath + ".idx");
+    {
+        BlockStore store(storePath, 2048);
+        assert(RebuildBlockIndex(store, params, 3) == kBlocks);
+        assert(store.TipHeight() == kBlocks - 1);
+        for (uint32_t h = 0; h < kBlocks; ++h) assert(BlockHash(store.ReadBlock(h).header) == BlockHash(chain[h].header));
+    }
+
+    // Reindex: the chainstate is wiped and rebuilt from the stored blocks.
+    {
+        BlockStore store(storePath, 2048);
+        Chainstate cs(csPath + "_reindex", 64);
+        OutPoint junk{};
+        junk.hash.fill(0x77);
+        junk.index = 0;
+        cs.AddUTXO(junk, PayToKey(5));
+
+        ImportOptions opts;
+        opts.readers = 3;
+        opts.readAhead = 4;
+        opts.progressInterval = 10;
+        std::vector<ImportStats> reports;
+        opts.progress = [&](const ImportStats& s) { reports.push_back(s); };
+        auto result = ReindexChainstate(cs, store, params, opts);
+        assert(!result.failedHeight);
+        assert(result.connected == kBlocks);
+        assert(result.tip == kBlocks - 1);
+        assert(cs.BestBlock()->hash == BlockHash(chain.back().header));
+        assert(!cs.HaveUTXO(junk));
+        assert(cs.HaveUTXO(OutPoint{chain.back().transactions[0].GetHash(), 0}));
+        assert(reports.size() == 4); // every 10 blocks, then the final report
+        assert(reports.back().blocks == kBlocks && reports.back().height == kBlocks - 1);
+        assert(reports.back().readSeconds > 0);
+    }
+
+    // Bootstrap file with blocks out of order, a duplicate and the fork.
+    {
+        std::ofstream out(bootstrap, std::ios::binary | std::ios::trunc);
+        for (uint32_t h = 8; h < fork.size(); ++h) AppendBootstrapBlock(out, fork[h]);
+        for (uint32_t h = kBlocks; h-- > 15;) AppendBootstrapBlock(out, chain[h]);
+        for (uint32_t h = 0; h < 15; ++h) AppendBootstrapBlock(out, chain[h]);
+        AppendBootstrapBlock(out, chain[3]);
+    }
+    RemoveStore(storePath);
+    {
+        BlockStore store(storePath);
+        Chainstate cs(csPath + "_bootstrap", 64);
+        ImportOptions opts;
+        opts.readers = 2;
+        auto result = ImportBootstrap(bootstrap, cs, store, params, opts);
+        assert(!result.failedHeight);
+        assert(result.connected == kBlocks);
+        assert(result.stats.blocks == kBlocks);
+        assert(cs.BestBlock()->hash == BlockHash(chain.back().header));
+        for (uint32_t h = 0; h < kBlocks; ++h) assert(BlockHash(store.ReadBlock(h).header) == BlockHash(chain[h].header));
+
+        // Nothing left to do the second time.
+        result = ImportBootstrap(bootstrap, cs, store, params, opts);
+        assert(result.connected == 0 && result.tip == kBlocks - 1);
+    }
+
+    // Resuming above an existing tip only connects the missing blocks.
+    RemoveStore(storePath);
+    {
+        std::ofstream out(bootstrap, std::ios::binary | std::ios::trunc);
+        for (uint32_t h = 0; h < 20; ++h) AppendBootstrapBlock(out, chain[h]);
+    }
+    {
+        BlockStore store(storePath);
+        Chainstate cs(csPath + "_resume", 64);
+        assert(ImportBootstrap(bootstrap, cs, store, params).connected == 20);
+        {
+            std::ofstream out(bootstrap, std::ios::binary | std::ios::app);
+            for (uint32_t h = 20; h < kBlocks; ++h) AppendBootstrapBlock(out, chain[h]);
+            // A torn final record is ignored.
+            out.write("\xde\xc0\xa0\xd1\xff\xff\x00\x00", 8);
+        }
+        auto result = ImportBootstrap(bootstrap, cs, store, params);
+        assert(result.connected == kBlocks - 20);
+        assert(cs.BestBlock()->hash == BlockHash(chain.back().header));
+
+        // A file for some other chain does not contain our tip.
+        const auto other = BuildChain(params, 5, 0x03);
+        {
+            std::ofstream out(bootstrap, std::ios::binary | std::ios::trunc);
+            for (const auto& block : other) AppendBootstrapBlock(out, block);
+        }
+        assert(Throws([&] { ImportBootstrap(bootstrap, cs, store, params); }));
+    }
+
+    // Garbage is rejected; a pruned store cannot be reindexed.
+    {
+        std::ofstream out(bootstrap, std::ios::binary | std::ios::trunc);
+        out << std::string(200, 'x');
+    }
+    {
+        BlockStore store(storePath);
+        Chainstate cs(csPath + "_bad", 64);
+        assert(Throws([&] { ImportBootstrap(bootstrap, cs, store, params); }));
+        assert(Throws([&] { ImportBootstrap(bootstrap + ".missing", cs, store, params); }));
+    }
+    RemoveStore(storePath);
+    {
+        BlockStore store(storePath, 2048);
+        for (uint32_t h = 0; h < kBlocks; ++h) store.WriteBlock(h, chain[h]);
+        assert(store.Prune(0, 10) > 0);
+        Chainstate cs(csPath + "_pruned", 64);
+        assert(Throws([&] { RebuildBlockIndex(store, params); }));
+        assert(Throws([&] { ReindexChainstate(cs, store, params); }));
+    }
+
+    for (const auto& name : scenarios) RemoveChainstate(csPath + name);
+    RemoveStore(storePath);
+    std::filesystem::remove(bootstrap);
+    return 0;
+}